@@ -0,0 +1,84 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <string>
+#include <vector>
+#include "platform.hpp"
+
+namespace nxgallery::core
+{
+    // Everything the album wrapper needs from the system: listing and reading album files, and the
+    // bits of system information shown along with them. On the Switch, that's capsa, ns and setsys
+    // (see CLibnxAlbumBackend). Having it behind this interface lets the album wrapper and web server
+    // run anywhere else, on top of an album directory (see CDirectoryAlbumBackend)
+    // The calls mirror the capsa calls they replace, and are called from the network thread and the
+    // read-ahead threads at the same time
+    class IAlbumBackend
+    {
+    public:
+        virtual ~IAlbumBackend() {}
+
+        // Called once before any other call, and once after the last one
+        virtual void Init() = 0;
+        virtual void Shutdown() = 0;
+
+        // Lists all album files of the given storage, oldest first
+        virtual Result GetAlbumFileList(CapsAlbumStorage storage, std::vector<CapsAlbumEntry>& outEntries) = 0;
+
+        // Returns how many album files the given storage holds, which is a lot cheaper than listing them
+        virtual Result GetAlbumFileCount(CapsAlbumStorage storage, u64* outCount) = 0;
+
+        // Returns the size of an album file
+        virtual Result GetAlbumFileSize(const CapsAlbumFileId& fileId, u64* outSize) = 0;
+
+        // Loads a whole album file (only screenshots) or its thumbnail (JPEG) into the buffer
+        virtual Result LoadAlbumFile(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize) = 0;
+        virtual Result LoadAlbumFileThumbnail(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize) = 0;
+
+        // Movie streams, through which videos are read bit by bit
+        virtual Result OpenMovieStream(const CapsAlbumFileId& fileId, u64* outStreamHandle) = 0;
+        virtual void CloseMovieStream(u64 streamHandle) = 0;
+        virtual Result GetMovieStreamSize(u64 streamHandle, u64* outSize) = 0;
+        virtual Result ReadMovieStream(u64 streamHandle, u64 offset, void* outBuffer, u64 bufferSize, u64* outSize) = 0;
+
+        // Returns the name of the application with the given title ID, if it's installed
+        virtual Result GetApplicationName(u64 titleId, std::string& outName) = 0;
+
+        // Returns whether the console uses the dark theme
+        virtual Result GetIsDarkTheme(bool* outIsDarkTheme) = 0;
+
+        // Returns the directory the album files of the given storage are stored in, so they can be read
+        // from the filesystem directly
+        virtual const char* GetAlbumDir(CapsAlbumStorage storage) = 0;
+
+        // Returns a directory (ending with a slash) where NXGallery may keep files across launches,
+        // or an empty string if nothing should be kept
+        virtual const char* GetCacheDir() = 0;
+    };
+}
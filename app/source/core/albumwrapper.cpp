@@ -26,18 +26,150 @@
 */
 
 #include "albumwrapper.hpp"
-#include "json.hpp"
+#include "videostreampool.hpp"
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <queue>
+#include <charconv>
+#include <ctype.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <filesystem>
-#include <regex>
+#include <system_error>
 using namespace nxgallery::core;
-using json = nlohmann::json;
 
 // Needed for compiler
 CAlbumWrapper* CAlbumWrapper::singleton = NULL;
+CReadAheadWorker* CReadAheadWorker::singleton = NULL;
+
+// Returns when an album entry was taken as a YYYYMMDDhhmmssII decimal number, which sorts like the time
+static u64 GetCaptureTime(const CapsAlbumFileDateTime& datetime)
+{
+    u64 captureTime = datetime.year;
+    captureTime = captureTime * 100 + datetime.month;
+    captureTime = captureTime * 100 + datetime.day;
+    captureTime = captureTime * 100 + datetime.hour;
+    captureTime = captureTime * 100 + datetime.minute;
+    captureTime = captureTime * 100 + datetime.second;
+    captureTime = captureTime * 100 + datetime.id;
+    return captureTime;
+}
+
+// Returns whether album entry a comes before b in the gallery, which shows the newest entries first
+// Entries taken at the same time are ordered by the rest of their key (title, storage, content), also
+// descending, so the order is the same as comparing capture time and key
+static bool IsShownBefore(const CapsAlbumEntry& a, const CapsAlbumEntry& b)
+{
+    u64 captureTimeA = GetCaptureTime(a.file_id.datetime);
+    u64 captureTimeB = GetCaptureTime(b.file_id.datetime);
+    if (captureTimeA != captureTimeB)
+        return captureTimeA > captureTimeB;
+    if (a.file_id.application_id != b.file_id.application_id)
+        return a.file_id.application_id > b.file_id.application_id;
+    if (a.file_id.storage != b.file_id.storage)
+        return a.file_id.storage > b.file_id.storage;
+    return a.file_id.content > b.file_id.content;
+}
+
+// Writes the key of an album entry. The key is made up of everything that identifies a file in the album:
+// the title it was taken in, when it was taken, where it is stored and what kind of content it is
+#define ALBUM_ENTRY_KEY_SIZE 48
+static void FormatAlbumEntryKey(const CapsAlbumFileId& fileId, char (&outKey)[ALBUM_ENTRY_KEY_SIZE])
+{
+    snprintf(outKey, sizeof(outKey), "%016lX%04u%02u%02u%02u%02u%02u%02u%u%u",
+        fileId.application_id,
+        fileId.datetime.year,
+        fileId.datetime.month,
+        fileId.datetime.day,
+        fileId.datetime.hour,
+        fileId.datetime.minute,
+        fileId.datetime.second,
+        fileId.datetime.id,
+        fileId.storage,
+        fileId.content);
+}
+
+// The names of the orders gallery pages can be sorted in, by EGallerySort
+static const char* const gallerySortNames[] = { "newest", "oldest", "largest", "smallest", "game" };
+static_assert(sizeof(gallerySortNames) / sizeof(gallerySortNames[0]) == (int)EGallerySort::Count, "Every sort order needs a name");
+
+// Brings an album list into gallery order. capsa lists the oldest entries first (just like the album
+// directories are laid out), so reversing the list is all it usually takes. Anything else is sorted
+static void SortAlbumList(std::vector<CapsAlbumEntry>& list)
+{
+    if (std::is_sorted(list.begin(), list.end(), IsShownBefore))
+        return;
+
+    std::reverse(list.begin(), list.end());
+    if (!std::is_sorted(list.begin(), list.end(), IsShownBefore))
+        std::sort(list.begin(), list.end(), IsShownBefore);
+}
+
+// Merges album lists which are in gallery order into one list in gallery order, in O(n log k) for k lists
+// Each step takes whichever of the lists' first entries is shown first
+static void MergeAlbumLists(const std::vector<const std::vector<CapsAlbumEntry>*>& lists, std::vector<CapsAlbumEntry>& outMerged)
+{
+    // Where each list which still has entries is at, as (list, position), with the one shown first on top
+    typedef std::pair<size_t, size_t> SListHead;
+    auto isShownAfter = [&lists](const SListHead& a, const SListHead& b)
+    {
+        return IsShownBefore((*lists[b.first])[b.second], (*lists[a.first])[a.second]);
+    };
+    std::priority_queue<SListHead, std::vector<SListHead>, decltype(isShownAfter)> heads(isShownAfter);
+
+    size_t entryCount = 0;
+    for (size_t i = 0; i < lists.size(); i++)
+    {
+        if (!lists[i]->empty())
+            heads.push({ i, 0 });
+        entryCount += lists[i]->size();
+    }
+
+    outMerged.clear();
+    outMerged.reserve(entryCount);
+    while (!heads.empty())
+    {
+        SListHead head = heads.top();
+        heads.pop();
+        outMerged.push_back((*lists[head.first])[head.second]);
+
+        if (++head.second < lists[head.first]->size())
+            heads.push(head);
+    }
+}
+
+// Appends a title name to a filename, with every run of whitespace and characters which aren't allowed
+// in filenames (or would need escaping in headers) replaced by a single underscore, and dropped at either
+// end. Anything else, such as non-ASCII letters, is kept as it is
+static void AppendSanitizedName(std::string_view name, std::string& outFilename)
+{
+    size_t start = outFilename.size();
+    bool isReplacing = false;
+    for (unsigned char c : name)
+    {
+        bool isUnsafe = c < 0x20 || c == 0x7F || c == ' ' || strchr("/\\:*?\"<>|", c) != NULL;
+        if (isUnsafe)
+        {
+            // Nothing to separate at the start
+            if (!isReplacing && outFilename.size() > start)
+                outFilename += '_';
+        }
+        else
+        {
+            outFilename += c;
+        }
+        isReplacing = isUnsafe;
+    }
+
+    // Nor at the end, the filename goes on with an underscore anyway
+    if (isReplacing && outFilename.size() > start)
+        outFilename.pop_back();
+}
 
 // Overwritten == operator to compare CapsAlbumEntry's
 inline bool operator==(CapsAlbumEntry lhs, const CapsAlbumEntry rhs)
@@ -52,348 +184,1299 @@ inline bool operator==(CapsAlbumEntry lhs, const CapsAlbumEntry rhs)
         && lhs.file_id.datetime.id == rhs.file_id.datetime.id;
 }
 
+CReadAheadWorker* CReadAheadWorker::Get()
+{
+    // If no singleton is existing, create a new instance
+    if (!singleton)
+    {
+        singleton = new CReadAheadWorker();
+    }
+
+    // Return the instance
+    return singleton;
+}
+
+void CReadAheadWorker::Start()
+{
+    if (!threads.empty())
+        return;
+
+    shouldStop = false;
+    for (int i = 0; i < READ_AHEAD_THREAD_COUNT; i++)
+    {
+        // Threads are scarce on the Switch. Make do with the ones which could be started
+        try
+        {
+            threads.emplace_back(&CReadAheadWorker::ThreadMain, this);
+        }
+        catch (const std::system_error& error)
+        {
+            printf("Failed to start read-ahead thread %d: %s\n", i, error.what());
+            break;
+        }
+    }
+}
+
+void CReadAheadWorker::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shouldStop = true;
+    }
+    queueCondition.notify_all();
+
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+
+    // Nobody reads for the queued readers anymore, they read on their own from now on
+    std::lock_guard<std::mutex> lock(mutex);
+    for (CReadAheadReader* reader : queue)
+        reader->isQueued = false;
+    queue.clear();
+}
+
+void CReadAheadWorker::Schedule(CReadAheadReader* reader, std::unique_lock<std::mutex>& lock)
+{
+    // A thread reading for the reader already queues it again once it's done, if there's more to read
+    s64 index;
+    if (!reader->isStarted || reader->isQueued || reader->isReading || !reader->FindNextBlock(index))
+        return;
+
+    // Without threads, the blocks are read right here
+    if (threads.empty())
+    {
+        while (reader->FindNextBlock(index))
+            ReadNext(reader, lock);
+        return;
+    }
+
+    queue.push_back(reader);
+    reader->isQueued = true;
+    queueCondition.notify_one();
+}
+
+void CReadAheadWorker::Cancel(CReadAheadReader* reader)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    reader->isStarted = false;
+    if (reader->isQueued)
+    {
+        queue.erase(std::find(queue.begin(), queue.end(), reader));
+        reader->isQueued = false;
+    }
+
+    readCondition.wait(lock, [reader] { return !reader->isReading; });
+}
+
+void CReadAheadWorker::ReadNext(CReadAheadReader* reader, std::unique_lock<std::mutex>& lock)
+{
+    reader->isReading = true;
+
+    // Open whatever is read from first, which might take as long as reading
+    if (!reader->isOpened)
+    {
+        lock.unlock();
+        bool isOpen = reader->OpenBlocks();
+        lock.lock();
+
+        reader->isOpened = true;
+        reader->hasOpenFailed = !isOpen;
+    }
+
+    s64 index;
+    CReadAheadReader::SBlock* block = reader->FindNextBlock(index);
+    if (block)
+    {
+        // Claim the block, so its old content can't be borrowed anymore while it's overwritten
+        block->index = index;
+        block->isReady = false;
+        block->hasFailed = false;
+
+        // Read without holding the lock, so other readers and the other blocks can be used in the meantime
+        bool hasOpenFailed = reader->hasOpenFailed;
+        lock.unlock();
+        u64 actualSize = 0;
+        bool hasRead = !hasOpenFailed && reader->ReadBlock(index * reader->blockSize, block->data, reader->blockCapacity, &actualSize);
+        lock.lock();
+
+        // Let whoever waits for this block know it's there
+        block->size = actualSize;
+        block->isReady = hasRead;
+        block->hasFailed = !hasRead;
+        if (reader->isBorrowPending)
+        {
+            reader->isBorrowPending = false;
+            CContentWakeup::Get()->Signal();
+        }
+    }
+
+    reader->isReading = false;
+    readCondition.notify_all();
+}
+
+void CReadAheadWorker::ThreadMain()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!shouldStop)
+    {
+        if (queue.empty())
+        {
+            queueCondition.wait(lock);
+            continue;
+        }
+
+        CReadAheadReader* reader = queue.front();
+        queue.pop_front();
+        reader->isQueued = false;
+
+        // One block at a time, then the other readers get their turn
+        ReadNext(reader, lock);
+
+        s64 index;
+        if (reader->isStarted && reader->FindNextBlock(index))
+        {
+            queue.push_back(reader);
+            reader->isQueued = true;
+        }
+    }
+}
+
+CReadAheadReader::CReadAheadReader(u64 inBlockSize)
+    : blockSize(inBlockSize)
+{
+}
+
+CReadAheadReader::~CReadAheadReader()
+{
+    // Subclasses stop reading ahead already, this is just in case
+    StopReadAhead();
+
+    // Free the blocks
+    for (SBlock& block : blocks)
+        free(block.data);
+}
+
+void CReadAheadReader::StartReadAhead(u64 inSize)
+{
+    size = inSize;
+    if (size == 0)
+        return;
+
+    // Something which fits into one block is read in one go, into a block of its size
+    blockCapacity = std::min(blockSize, (size + READ_AHEAD_BLOCK_ALIGNMENT - 1) / READ_AHEAD_BLOCK_ALIGNMENT * READ_AHEAD_BLOCK_ALIGNMENT);
+    blockCount = size <= blockSize ? 1 : READ_AHEAD_BLOCK_COUNT;
+
+    // Initialize the blocks, aligned to pages as that's what capsa and the storage copy into best
+    for (u32 i = 0; i < blockCount; i++)
+        blocks[i].data = (unsigned char*)aligned_alloc(READ_AHEAD_BLOCK_ALIGNMENT, blockCapacity);
+
+    // Start reading ahead right away, the first block will most likely be needed soon
+    CReadAheadWorker* worker = CReadAheadWorker::Get();
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    isStarted = true;
+    worker->Schedule(this, lock);
+}
+
+void CReadAheadReader::StopReadAhead()
+{
+    // Stop reading ahead before the blocks or what they're read from go away
+    if (blockCount > 0)
+        CReadAheadWorker::Get()->Cancel(this);
+}
+
+u64 CReadAheadReader::Borrow(u64 offset, u64 maxBytes, const char** outData)
+{
+    // If no data is remaining, exit
+    if (offset >= size)
+        return 0;
+
+    CReadAheadWorker* worker = CReadAheadWorker::Get();
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    if (!isStarted)
+        return 0;
+
+    // Move the read-ahead along, so the following blocks are read while this one is sent
+    s64 index = offset / blockSize;
+    currentIndex = index;
+    worker->Schedule(this, lock);
+
+    // Usually the block was read already while the previous one was sent. If it wasn't, the network
+    // thread goes on with the other connections and is woken up once the block is read
+    SBlock& block = blocks[index % blockCount];
+    if (block.index != index || !(block.isReady || block.hasFailed))
+    {
+        isBorrowPending = true;
+        return HTTP_BORROW_PENDING;
+    }
+
+    // Reading the block failed. This borrow fails, but the block is cleared so it's read again for the
+    // next one, instead of failing every request for this part of the file from now on
+    if (block.hasFailed)
+    {
+        block.index = -1;
+        block.hasFailed = false;
+        hasFailed = true;
+        return 0;
+    }
+
+    // Hand out what's in the block from the offset on
+    u64 offsetInBlock = offset - index * blockSize;
+    if (offsetInBlock >= block.size)
+        return 0;
+
+    *outData = (const char*)block.data + offsetInBlock;
+    return std::min(maxBytes, block.size - offsetInBlock);
+}
+
+void CReadAheadReader::Seek(u64 offset)
+{
+    // The read-ahead picks up from the block containing that offset
+    CReadAheadWorker* worker = CReadAheadWorker::Get();
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    if (size == 0)
+        return;
+
+    currentIndex = std::min(offset, size - 1) / blockSize;
+    worker->Schedule(this, lock);
+}
+
+bool CReadAheadReader::HasFailed()
+{
+    std::lock_guard<std::mutex> lock(CReadAheadWorker::Get()->mutex);
+    return hasFailed || hasOpenFailed;
+}
+
+CReadAheadReader::SBlock* CReadAheadReader::FindNextBlock(s64& outIndex)
+{
+    s64 numBlocks = (size + blockSize - 1) / blockSize;
+    for (s64 index = currentIndex; index < currentIndex + blockCount && index < numBlocks; index++)
+    {
+        SBlock& block = blocks[index % blockCount];
+        if (block.index != index)
+        {
+            outIndex = index;
+            return &block;
+        }
+    }
+
+    return NULL;
+}
+
 CVideoStreamReader::CVideoStreamReader(const CapsAlbumEntry& inAlbumEntry)
-    : albumEntry(inAlbumEntry)
+    : CReadAheadReader(VIDEO_STREAM_BLOCK_SIZE), albumEntry(inAlbumEntry)
 {
+    IAlbumBackend* albumBackend = CAlbumWrapper::Get()->GetBackend();
+
     // Open video stream
-    if (R_FAILED(capsaOpenAlbumMovieStream(&streamHandle, &albumEntry.file_id)))
+    if (R_FAILED(albumBackend->OpenMovieStream(albumEntry.file_id, &streamHandle)))
     {
         printf("Failed to open video stream!\n");
         return;
     }
+    isOpen = true;
 
-    // Initialize the buffer
-    workBuffer = (unsigned char*)calloc(workBufferSize, sizeof(unsigned char));
-
-    // Get the size the stream will be
-    capsaGetAlbumMovieStreamSize(streamHandle, &streamSize);
+    // Get the size the stream will be, and start reading it
+    albumBackend->GetMovieStreamSize(streamHandle, &streamSize);
+    StartReadAhead(streamSize);
 }
 
 CVideoStreamReader::~CVideoStreamReader()
 {
-    // Free the read buffer
-    free(workBuffer);
+    // The read-ahead threads use the stream
+    StopReadAhead();
+
+    // Close the stream
+    if (isOpen)
+        CAlbumWrapper::Get()->GetBackend()->CloseMovieStream(streamHandle);
+}
+
+bool CVideoStreamReader::IsOpen()
+{
+    return isOpen;
+}
+
+const CapsAlbumFileId& CVideoStreamReader::GetFileId()
+{
+    return albumEntry.file_id;
+}
+
+u64 CVideoStreamReader::GetStreamSize()
+{
+    // If the stream size is bigger than INT_MAX, it's probably invalid and we'll return 0
+    if (streamSize > 0x80000000) return 0;
+
+    return streamSize;
+}
+
+bool CVideoStreamReader::ReadBlock(u64 offset, unsigned char* data, u64 maxBytes, u64* outSize)
+{
+    auto readStartTime = std::chrono::steady_clock::now();
+    Result readResult = CAlbumWrapper::Get()->GetBackend()->ReadMovieStream(streamHandle, offset, data, maxBytes, outSize);
+    CAlbumWrapper::Get()->RecordContentRead(EContentBackend::Capsa, *outSize, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - readStartTime).count());
+
+    if (R_FAILED(readResult))
+    {
+        printf("Error reading movie stream!\n");
+        return false;
+    }
+
+    return true;
+}
+
+CGallerySource::CGallerySource(std::vector<int>&& inIds, int inTotal, int inPageSize, std::string&& inNextCursor)
+    : ids(std::move(inIds)), total(inTotal), pageSize(inPageSize), nextCursor(std::move(inNextCursor)),
+      generation(CAlbumWrapper::Get()->GetAlbumGeneration())
+{
+}
+
+u64 CGallerySource::GetSize()
+{
+    return size;
+}
+
+u64 CGallerySource::Borrow(u64 offset, u64 maxBytes, const char** outData)
+{
+    // Generate until the buffer holds the requested offset. What's before the buffer is gone
+    while (offset >= bufferOffset + buffer.size())
+    {
+        if (size != HTTP_SIZE_UNKNOWN || generation != CAlbumWrapper::Get()->GetAlbumGeneration())
+            return 0;
+
+        GenerateNext();
+    }
+
+    if (offset < bufferOffset)
+        return 0;
+
+    *outData = buffer.data() + (offset - bufferOffset);
+    return std::min(maxBytes, bufferOffset + buffer.size() - offset);
+}
+
+void CGallerySource::GenerateNext()
+{
+    CAlbumWrapper* albumWrapper = CAlbumWrapper::Get();
+
+    // Start over with the buffer, keeping its memory
+    bufferOffset += buffer.size();
+    buffer.clear();
+
+    if (!hasStarted)
+    {
+        startTime = std::chrono::steady_clock::now();
+        albumWrapper->BeginGalleryContent(writer, total, pageSize);
+        hasStarted = true;
+    }
+
+    // Write entries until the buffer is full
+    while (nextIndex < ids.size() && buffer.size() < GALLERY_STREAM_CHUNK_SIZE)
+    {
+        albumWrapper->WriteGalleryEntry(writer, ids[nextIndex++]);
+    }
+
+    // Once all entries are written, the end follows and the size is known
+    if (nextIndex == ids.size())
+    {
+        double indexTime = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - startTime).count();
+        albumWrapper->EndGalleryContent(writer, nextCursor, indexTime);
+        size = bufferOffset + buffer.size();
+    }
+}
+
+CVideoStreamSource::CVideoStreamSource(const CapsAlbumEntry& albumEntry)
+    : reader(CVideoStreamPool::Get()->Acquire(albumEntry))
+{
+}
+
+CVideoStreamSource::~CVideoStreamSource()
+{
+    // Give the reader back, so the next request for this video can use it
+    if (reader)
+        CVideoStreamPool::Get()->Release(std::move(reader));
+}
+
+u64 CVideoStreamSource::GetSize()
+{
+    return reader ? reader->GetStreamSize() : 0;
+}
+
+u64 CVideoStreamSource::Borrow(u64 offset, u64 maxBytes, const char** outData)
+{
+    // The data is sent right out of the reader's blocks
+    return reader ? reader->Borrow(offset, maxBytes, outData) : 0;
+}
+
+CAlbumFileSource::CAlbumFileSource(const CapsAlbumEntry& inAlbumEntry)
+    : CReadAheadReader(ALBUM_FILE_BLOCK_SIZE), albumEntry(inAlbumEntry)
+{
+    // The album listing tells the size, the file is opened once the first block is read
+    StartReadAhead(albumEntry.size);
+}
+
+CAlbumFileSource::~CAlbumFileSource()
+{
+    // The read-ahead threads use the file
+    StopReadAhead();
+
+    // We own the file descriptor or stream, so close it
+    if (fileDescriptor >= 0)
+        close(fileDescriptor);
+    if (isStreamOpen)
+        CAlbumWrapper::Get()->GetBackend()->CloseMovieStream(streamHandle);
+}
+
+u64 CAlbumFileSource::GetSize()
+{
+    return albumEntry.size;
+}
+
+u64 CAlbumFileSource::Borrow(u64 offset, u64 maxBytes, const char** outData)
+{
+    // The data is sent right out of the blocks read ahead
+    return CReadAheadReader::Borrow(offset, maxBytes, outData);
+}
+
+bool CAlbumFileSource::OpenBlocks()
+{
+    CAlbumWrapper* albumWrapper = CAlbumWrapper::Get();
+    std::string path = albumWrapper->FindAlbumFilePath(albumEntry.file_id);
+    if (!path.empty())
+        fileDescriptor = open(path.c_str(), O_RDONLY);
+
+    if (fileDescriptor >= 0)
+    {
+        albumWrapper->RecordContentOpened(EContentBackend::Filesystem);
+        return true;
+    }
+
+    // Not there, capsa has to do it. Videos are streamed, screenshots can only be loaded as a whole
+    albumWrapper->RecordContentFallback();
+    albumWrapper->RecordContentOpened(EContentBackend::Capsa);
+
+    IAlbumBackend* albumBackend = albumWrapper->GetBackend();
+    if (albumEntry.file_id.content == CapsAlbumFileContents_Movie)
+    {
+        isStreamOpen = R_SUCCEEDED(albumBackend->OpenMovieStream(albumEntry.file_id, &streamHandle));
+        return isStreamOpen;
+    }
+
+    u64 loadedSize = 0;
+    auto readStartTime = std::chrono::steady_clock::now();
+    loadedContent.resize(albumEntry.size);
+    if (R_FAILED(albumBackend->LoadAlbumFile(albumEntry.file_id, &loadedContent[0], loadedContent.size(), &loadedSize)))
+        return false;
+
+    loadedContent.resize(loadedSize);
+    albumWrapper->RecordContentRead(EContentBackend::Capsa, loadedSize, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - readStartTime).count());
+    return true;
+}
+
+bool CAlbumFileSource::ReadBlock(u64 offset, unsigned char* data, u64 maxBytes, u64* outSize)
+{
+    // A screenshot loaded through capsa is there already
+    if (fileDescriptor < 0 && !isStreamOpen)
+    {
+        if (offset >= loadedContent.size())
+            return false;
+
+        *outSize = std::min(maxBytes, loadedContent.size() - offset);
+        memcpy(data, loadedContent.data() + offset, *outSize);
+        return true;
+    }
+
+    auto readStartTime = std::chrono::steady_clock::now();
+    if (isStreamOpen)
+    {
+        if (R_FAILED(CAlbumWrapper::Get()->GetBackend()->ReadMovieStream(streamHandle, offset, data, maxBytes, outSize)) || *outSize == 0)
+            return false;
+
+        CAlbumWrapper::Get()->RecordContentRead(EContentBackend::Capsa, *outSize, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - readStartTime).count());
+        return true;
+    }
+
+    // Only the last block of the file may come up short
+    ssize_t bytesRead = pread(fileDescriptor, data, maxBytes, offset);
+    if (bytesRead <= 0)
+        return false;
+
+    *outSize = bytesRead;
+    CAlbumWrapper::Get()->RecordContentRead(EContentBackend::Filesystem, bytesRead, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - readStartTime).count());
+    return true;
+}
+
+CAlbumWrapper* CAlbumWrapper::Get()
+{
+    // If no singleton is existing, create a new instance
+    if (!singleton)
+    {
+        singleton = new CAlbumWrapper();
+    }
+
+    // Return the instance
+    return singleton;
+}
+
+void CAlbumWrapper::Init(std::unique_ptr<IAlbumBackend> inBackend)
+{
+    // Bring up the backend, everything else goes through it
+    albumBackend = std::move(inBackend);
+    albumBackend->Init();
+
+    // Load the title names stored by earlier launches
+    std::string cacheDir = albumBackend->GetCacheDir();
+    titleCache.Load(cacheDir.empty() ? "" : cacheDir + TITLE_CACHE_FILE_NAME);
+
+    // Files are read ahead on these threads
+    CReadAheadWorker::Get()->Start();
+
+    // Cache the gallery content
+    CacheGalleryContent();
+
+    // Then keep an eye on it, so screenshots taken while the app runs show up
+    shouldStopAlbumThread = false;
+    try
+    {
+        albumThread = std::thread(&CAlbumWrapper::AlbumThreadMain, this);
+    }
+    catch (const std::system_error& error)
+    {
+        printf("Failed to start the album thread, changes to the album won't show up: %s\n", error.what());
+    }
+}
+
+void CAlbumWrapper::Shutdown()
+{
+    // Stop checking the album, which goes through the backend
+    if (albumThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(albumThreadMutex);
+            shouldStopAlbumThread = true;
+        }
+        albumThreadCondition.notify_all();
+        albumThread.join();
+    }
+
+    // Close the movie streams which were kept open for reuse
+    CVideoStreamPool::Get()->Clear();
+    CReadAheadWorker::Get()->Stop();
+
+    // Shut down the backend
+    albumBackend->Shutdown();
+}
+
+IAlbumBackend* CAlbumWrapper::GetBackend()
+{
+    return albumBackend.get();
+}
+
+bool CAlbumWrapper::SelectGalleryEntries(std::string_view game, std::string_view type, std::string_view storage, std::string_view sort, SGallerySelection& outSelection)
+{
+    outSelection = SGallerySelection();
+
+    // Every filter narrows down what the ones before left
+    CEntryBitmap entries;
+    bool isFiltered = false;
+    auto narrow = [&entries, &isFiltered](const CEntryBitmap& filterEntries)
+    {
+        entries = isFiltered ? CEntryBitmap::Intersect(entries, filterEntries) : filterEntries;
+        isFiltered = true;
+    };
+
+    if (!game.empty())
+    {
+        u64 titleId = 0;
+        auto [end, error] = std::from_chars(game.data(), game.data() + game.size(), titleId, 16);
+        if (error != std::errc() || end != game.data() + game.size())
+            return false;
+
+        // A game which isn't in the album is no error, there just aren't any entries of it
+        auto title = albumCache->index.titleIndices.find(titleId);
+        narrow(title != albumCache->index.titleIndices.end() ? albumCache->index.titleEntries[title->second] : CEntryBitmap());
+
+        char gameFilter[32];
+        snprintf(gameFilter, sizeof(gameFilter), "game=%016lX&", titleId);
+        outSelection.filter += gameFilter;
+    }
+
+    if (!type.empty())
+    {
+        // The types are the same as in the gallery's JSON, extra content (such as clips saved by the
+        // game itself) counts as screenshot or video as well
+        const CEntryBitmap* contentEntries = albumCache->index.contentEntries;
+        if (type == "screenshot")
+            narrow(CEntryBitmap::Unite(contentEntries[CapsAlbumFileContents_ScreenShot], contentEntries[CapsAlbumFileContents_ExtraScreenShot]));
+        else if (type == "video")
+            narrow(CEntryBitmap::Unite(contentEntries[CapsAlbumFileContents_Movie], contentEntries[CapsAlbumFileContents_ExtraMovie]));
+        else if (type == "extra")
+            narrow(CEntryBitmap::Unite(contentEntries[CapsAlbumFileContents_ExtraScreenShot], contentEntries[CapsAlbumFileContents_ExtraMovie]));
+        else
+            return false;
+
+        outSelection.filter += "type=" + std::string(type) + "&";
+    }
+
+    if (!storage.empty())
+    {
+        if (storage == "sd")
+            narrow(albumCache->index.storageEntries[CapsAlbumStorage_Sd]);
+        else if (storage == "nand")
+            narrow(albumCache->index.storageEntries[CapsAlbumStorage_Nand]);
+        else
+            return false;
+
+        outSelection.filter += "storage=" + std::string(storage) + "&";
+    }
+
+    if (!sort.empty())
+    {
+        auto sortName = std::find(std::begin(gallerySortNames), std::end(gallerySortNames), sort);
+        if (sortName == std::end(gallerySortNames))
+            return false;
+
+        outSelection.sort = (EGallerySort)(sortName - std::begin(gallerySortNames));
+        if (outSelection.sort != EGallerySort::Newest)
+            outSelection.filter += "sort=" + std::string(sort) + "&";
+    }
+
+    if (isFiltered)
+        outSelection.entries = std::make_shared<const CEntryBitmap>(std::move(entries));
+
+    // The album is only sorted once per album generation, and the entries of a filter are only picked
+    // out of that order once, so paging through a selection never goes through the whole album
+    if (outSelection.sort != EGallerySort::Newest)
+        outSelection.order = isFiltered ? GetFilteredSortOrder(outSelection.filter, *outSelection.entries, outSelection.sort) : GetSortOrder(outSelection.sort);
+
+    return true;
+}
+
+int CAlbumWrapper::GetSelectionSize(const SGallerySelection& selection)
+{
+    return selection.entries ? selection.entries->GetCount() : albumCache->entries.size();
+}
+
+void CAlbumWrapper::GetSelectionIds(const SGallerySelection& selection, int first, int end, std::vector<int>& outIds)
+{
+    outIds.reserve(outIds.size() + (end - first));
+    if (selection.order)
+    {
+        outIds.insert(outIds.end(), selection.order->begin() + first, selection.order->begin() + end);
+    }
+    else if (selection.entries)
+    {
+        selection.entries->GetIds(first, end - first, outIds);
+    }
+    else
+    {
+        for (int id = first; id < end; id++)
+        {
+            outIds.push_back(id);
+        }
+    }
+}
+
+int CAlbumWrapper::GetSelectionPosition(const SGallerySelection& selection, int id)
+{
+    return selection.entries ? selection.entries->Rank(id) : id;
+}
+
+std::shared_ptr<SCachedResponse> CAlbumWrapper::GetGalleryPage(const SGallerySelection& selection, int first, int pageSize)
+{
+    // Going back to a page or reloading it is served from the cache
+    SGalleryPageKey key { first, pageSize, selection.filter };
+    std::shared_ptr<SCachedResponse> cached = galleryPageCache.Find(key, albumGeneration);
+    if (cached)
+        return cached;
+
+    // Big pages would take too much memory to keep around
+    int total = GetSelectionSize(selection);
+    int end = std::clamp((s64)first + pageSize, (s64)first, (s64)total);
+    if (end - first > GALLERY_STREAM_MIN_ENTRIES)
+        return nullptr;
+
+    std::vector<int> ids;
+    GetSelectionIds(selection, first, end, ids);
+    std::string nextCursor = end < total && !ids.empty() ? GetGalleryCursor(selection, ids.back()) : "";
+    return galleryPageCache.Insert(key, albumGeneration, WriteGalleryPage(ids, total, pageSize, nextCursor));
+}
+
+std::shared_ptr<IContentSource> CAlbumWrapper::GetGalleryContent(const SGallerySelection& selection, int first, int pageSize)
+{
+    int total = GetSelectionSize(selection);
+    int end = std::clamp((s64)first + pageSize, (s64)first, (s64)total);
+
+    std::vector<int> ids;
+    GetSelectionIds(selection, first, end, ids);
+    std::string nextCursor = end < total && !ids.empty() ? GetGalleryCursor(selection, ids.back()) : "";
+
+    // Big pages are written while they're sent, so they never need to be in memory as a whole
+    if (end - first > GALLERY_STREAM_MIN_ENTRIES)
+        return std::make_shared<CGallerySource>(std::move(ids), total, pageSize, std::move(nextCursor));
+
+    return std::make_shared<CMemorySource>(WriteGalleryPage(ids, total, pageSize, nextCursor));
+}
+
+int CAlbumWrapper::GetGalleryPageStart(const SGallerySelection& selection, int page, int pageSize)
+{
+    // Calculate where the page starts, and make sure to stay in bounds
+    return std::clamp(((s64)page - 1) * pageSize, (s64)0, (s64)GetSelectionSize(selection));
+}
+
+std::string CAlbumWrapper::GetGalleryCursor(const SGallerySelection& selection, int id)
+{
+    // Looks like 2023031512000100-0100000000010000202303151200010010, with "-<file size>" after it if
+    // sorted by size
+    char cursor[96];
+    std::string_view key = GetAlbumEntryKey(id);
+    int length = snprintf(cursor, sizeof(cursor), "%lu-%.*s", albumCache->index.captureTimes[id], (int)key.size(), key.data());
+    if (selection.sort == EGallerySort::Largest || selection.sort == EGallerySort::Smallest)
+        snprintf(cursor + length, sizeof(cursor) - length, "-%lu", albumCache->index.fileSizes[id]);
+
+    return cursor;
+}
+
+// Parses a whole string as a decimal number
+static bool ParseCursorNumber(std::string_view str, u64& outNumber)
+{
+    auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), outNumber);
+    return !str.empty() && error == std::errc() && end == str.data() + str.size();
+}
+
+int CAlbumWrapper::FindGalleryCursor(const SGallerySelection& selection, std::string_view cursor)
+{
+    // Split the cursor into capture time, key and file size (which is only there if sorted by size)
+    bool isSortedBySize = selection.sort == EGallerySort::Largest || selection.sort == EGallerySort::Smallest;
+    size_t dash = cursor.find('-');
+    if (dash == std::string_view::npos)
+        return -1;
+
+    SSortValues anchor = { 0, 0, nullptr, cursor.substr(dash + 1) };
+    if (!ParseCursorNumber(cursor.substr(0, dash), anchor.captureTime))
+        return -1;
+
+    size_t sizeDash = anchor.key.find('-');
+    if (isSortedBySize != (sizeDash != std::string_view::npos))
+        return -1;
+    if (isSortedBySize)
+    {
+        if (!ParseCursorNumber(anchor.key.substr(sizeDash + 1), anchor.fileSize))
+            return -1;
+        anchor.key = anchor.key.substr(0, sizeDash);
+    }
+
+    // Keys are made of digits and uppercase hex digits only, and start with the title ID
+    if (anchor.key.size() < 16 || !std::all_of(anchor.key.begin(), anchor.key.end(), [](char c) { return isdigit(c) || (c >= 'A' && c <= 'F'); }))
+        return -1;
+
+    // Sorted by game, the cursor's game needs to be one of the album. Its name is in the album index then,
+    // and clients can't make us look up names of whatever title they like
+    if (selection.sort == EGallerySort::Game)
+    {
+        u64 titleId = 0;
+        std::from_chars(anchor.key.data(), anchor.key.data() + 16, titleId, 16);
+        auto title = albumCache->index.titleIndices.find(titleId);
+        if (title == albumCache->index.titleIndices.end())
+            return -1;
+
+        anchor.titleName = albumCache->index.titleNames[title->second];
+    }
+
+    // Find the first entry of the order which comes after the one the cursor points at, which doesn't
+    // need to exist anymore. Sorted orders only have the selected entries, newest first has all of them
+    int low = 0;
+    int high = selection.order ? selection.order->size() : albumCache->entries.size();
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        int midId = selection.order ? (*selection.order)[mid] : mid;
+        if (!IsSortedBefore(selection.sort, anchor, GetSortValues(midId)))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return selection.order ? low : GetSelectionPosition(selection, low);
+}
+
+std::string CAlbumWrapper::WriteGalleryPage(const std::vector<int>& ids, int total, int pageSize, const std::string& nextCursor)
+{
+    // Take the time we need so we can display a cool stat
+    auto startTime = std::chrono::steady_clock::now();
+
+    // Write the page in one go, into a string which is big enough right away
+    std::string outJSON;
+    outJSON.reserve(GALLERY_JSON_BASE_SIZE + ids.size() * GALLERY_JSON_ENTRY_SIZE);
+    CJsonWriter writer(outJSON);
+
+    BeginGalleryContent(writer, total, pageSize);
+    for (int id : ids)
+    {
+        WriteGalleryEntry(writer, id);
+    }
+
+    // Stop the time!
+    auto endTime = std::chrono::steady_clock::now();
+    EndGalleryContent(writer, nextCursor, std::chrono::duration_cast<std::chrono::duration<double>>(endTime - startTime).count());
+
+    return outJSON;
+}
+
+int CAlbumWrapper::FindGalleryDate(const SGallerySelection& selection, std::string_view date)
+{
+    // Dates only make sense for the orders by time
+    if (selection.sort != EGallerySort::Newest && selection.sort != EGallerySort::Oldest)
+        return -1;
+
+    // Read the date into the start of a capture time, such as 202303 for 2023-03. The year has four
+    // digits, month and day two, each one after a dash
+    u64 datePrefix = 0;
+    int numParts = 0;
+    while (numParts < 3)
+    {
+        size_t length = numParts == 0 ? 4 : 2;
+        std::string_view part = date.substr(0, length);
+        u32 value = 0;
+        auto [end, error] = std::from_chars(part.data(), part.data() + part.size(), value);
+        if (part.size() != length || error != std::errc() || end != part.data() + part.size() || !isdigit(part[0]))
+            return -1;
+
+        // Months and days need to exist
+        if ((numParts == 1 && (value < 1 || value > 12)) || (numParts == 2 && (value < 1 || value > 31)))
+            return -1;
+
+        datePrefix = datePrefix * 100 + value;
+        numParts++;
+        date.remove_prefix(length);
+
+        if (date.empty())
+            break;
+        if (date[0] != '-')
+            return -1;
+        date.remove_prefix(1);
+    }
+
+    // Something after the day
+    if (!date.empty())
+        return -1;
+
+    // Entries taken in that period have capture times from its start (such as 2023030000000000 for 2023-03)
+    // up to the start of the period after it (2023040000000000). Overflowing into month 13 or day 32 is
+    // fine for that
+    u64 startCaptureTime = datePrefix;
+    u64 endCaptureTime = datePrefix + 1;
+    for (int i = numParts; i < 7; i++)
+    {
+        startCaptureTime *= 100;
+        endCaptureTime *= 100;
+    }
+
+    // Newest first, the period starts with the first entry taken before its end. The capture times are
+    // sorted descending, like the IDs
+    const std::vector<u64>& captureTimes = albumCache->index.captureTimes;
+    if (selection.sort == EGallerySort::Newest)
+    {
+        auto newest = std::partition_point(captureTimes.begin(), captureTimes.end(),
+            [endCaptureTime](u64 captureTime) { return captureTime >= endCaptureTime; });
+        return GetSelectionPosition(selection, newest - captureTimes.begin());
+    }
 
-    // Close the stream
-    capsaCloseAlbumMovieStream(streamHandle);
+    // Oldest first, with the first entry of the selection's order taken since its start
+    const std::vector<int>& order = *selection.order;
+    auto oldest = std::partition_point(order.begin(), order.end(),
+        [&captureTimes, startCaptureTime](int id) { return captureTimes[id] < startCaptureTime; });
+    return oldest - order.begin();
 }
 
-u64 CVideoStreamReader::GetStreamSize()
+CAlbumWrapper::SSortValues CAlbumWrapper::GetSortValues(int id)
 {
-    // If the stream size is bigger than INT_MAX, it's probably invalid and we'll return 0
-    if (streamSize > 0x80000000) return 0;
-
-    return streamSize;
+    return { albumCache->index.captureTimes[id], albumCache->index.fileSizes[id], albumCache->index.titleNames[albumCache->index.titles[id]], GetAlbumEntryKey(id) };
 }
 
-u64 CVideoStreamReader::Read(char* outBuffer, u64 numBytes)
+bool CAlbumWrapper::IsSortedBefore(EGallerySort sort, const SSortValues& a, const SSortValues& b)
 {
-    // Calculate a few statistics
-    u64 remaining = streamSize - bytesRead;
-    u64 bufferIndex = bytesRead / workBufferSize;
-    u64 currentOffset = bytesRead % workBufferSize;
-    u64 readSize = std::min(std::min(numBytes, workBufferSize - currentOffset), remaining);
-    
-    // Could debug the video stream read progress here
-    //float percentage = ((float)bytesRead / (float)streamSize) * 100;
-    //printf("Progress: %f\n", percentage);
+    switch (sort)
+    {
+    case EGallerySort::Oldest:
+        return a.captureTime != b.captureTime ? a.captureTime < b.captureTime : a.key < b.key;
 
-    // If no data is remaining, exit
-    if (remaining <= 0) return 0;
+    case EGallerySort::Largest:
+    case EGallerySort::Smallest:
+        if (a.fileSize != b.fileSize)
+            return sort == EGallerySort::Largest ? a.fileSize > b.fileSize : a.fileSize < b.fileSize;
+        break;
 
-    // Read the next buffer
-    Result readResult = 0;
-    if (bufferIndex != lastBufferIndex)
+    case EGallerySort::Game:
     {
-        u64 actualSize = 0;
-        readResult = capsaReadMovieDataFromAlbumMovieReadStream(streamHandle, bufferIndex * workBufferSize, workBuffer, workBufferSize, &actualSize);
-        lastBufferIndex = bufferIndex;
+        int nameOrder = strcasecmp(a.titleName->c_str(), b.titleName->c_str());
+        if (nameOrder != 0)
+            return nameOrder < 0;
+        break;
     }
 
-    // Copy from the work buffer to the the output buffer
-    unsigned char* startOutBuffer = workBuffer + currentOffset;
-    memcpy(outBuffer, startOutBuffer, readSize);
-
-    // Keep track of progress
-    bytesRead += readSize;
-
-    // If it worked, return the number of bytes we just read, otherwise return 0
-    if (R_SUCCEEDED(readResult))
-        return readSize;
-    else 
-    {
-        printf("Error reading movie stream!");
-        return 0;
+    default:
+        break;
     }
+
+    // Newest first, just like the IDs
+    return a.captureTime != b.captureTime ? a.captureTime > b.captureTime : a.key > b.key;
 }
 
-CAlbumWrapper* CAlbumWrapper::Get()
+std::shared_ptr<const std::vector<int>> CAlbumWrapper::GetSortOrder(EGallerySort sort)
 {
-    // If no singleton is existing, create a new instance
-    if (!singleton)
+    // The IDs are newest first already
+    if (sort == EGallerySort::Newest)
+        return nullptr;
+
+    int sortIndex = (int)sort;
+    if (sortOrders[sortIndex] && sortOrderGenerations[sortIndex] == albumGeneration)
+        return sortOrders[sortIndex];
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<int> order(albumCache->entries.size());
+    if (sort == EGallerySort::Oldest)
     {
-        singleton = new CAlbumWrapper();
+        // Oldest first is just the other way round
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = order.size() - 1 - i;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [this, sort](int a, int b) { return IsSortedBefore(sort, GetSortValues(a), GetSortValues(b)); });
     }
 
-    // Return the instance
-    return singleton;
+#ifdef __DEBUG__
+    auto sortTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+    printf("CAlbumWrapper::GetSortOrder: sorted %zu entries by %s in %lldus\n", order.size(), gallerySortNames[sortIndex], (long long)sortTime.count());
+#else
+    (void)startTime;
+#endif
+
+    sortOrders[sortIndex] = std::make_shared<const std::vector<int>>(std::move(order));
+    sortOrderGenerations[sortIndex] = albumGeneration;
+    return sortOrders[sortIndex];
 }
 
-void CAlbumWrapper::Init()
+std::shared_ptr<const std::vector<int>> CAlbumWrapper::GetFilteredSortOrder(const std::string& filter, const CEntryBitmap& entries, EGallerySort sort)
 {
-    // SD card storage will already be mounted thanks to romfsInitialize()
-
-    // Mount the USER partition of the NAND storage by first opening the BIS USER parition
-    Result r = fsOpenBisFileSystem(&nandFileSystem, FsBisPartitionId_User, "");
-    if (R_FAILED(r))
+    // Orders of older album generations have entries which might not exist anymore
+    if (filteredSortOrderGeneration != albumGeneration)
     {
-        printf("Error opening BIS USER partition: %d\n", R_DESCRIPTION(r));
-        return;
+        filteredSortOrders.clear();
+        filteredSortOrderGeneration = albumGeneration;
     }
 
-    // Now mount the opened partition to "nand:/"
-    int rc = fsdevMountDevice("nand", nandFileSystem);
-    if (rc < 0)
+    // Paging through a selection asks for the same filter again and again, so the filters asked for
+    // last are kept, the one asked for right now at the end
+    auto cached = std::find_if(filteredSortOrders.begin(), filteredSortOrders.end(),
+        [&filter](const auto& filteredSortOrder) { return filteredSortOrder.first == filter; });
+    if (cached != filteredSortOrders.end())
     {
-        printf("Error mounting NAND storage!\n");
+        std::shared_ptr<const std::vector<int>> order = cached->second;
+        filteredSortOrders.erase(cached);
+        filteredSortOrders.emplace_back(filter, order);
+        return order;
     }
-    
-    // Cache the gallery content
-    CacheGalleryContent();
-}
 
-void CAlbumWrapper::Shutdown()
-{
-    // Unmount the NAND storage
-    int r = fsdevUnmountDevice("nand");
-    if (r < 0)
+    // Pick the selected entries out of the order of the whole album, which keeps them in that order
+    std::shared_ptr<const std::vector<int>> albumOrder = GetSortOrder(sort);
+    std::vector<int> order;
+    order.reserve(entries.GetCount());
+    for (int id : *albumOrder)
     {
-        printf("Error unmounting NAND storage!\n");
+        if (entries.Contains(id))
+            order.push_back(id);
     }
+
+    if (filteredSortOrders.size() >= GALLERY_FILTERED_ORDER_CACHE_SIZE)
+        filteredSortOrders.pop_front();
+
+    filteredSortOrders.emplace_back(filter, std::make_shared<const std::vector<int>>(std::move(order)));
+    return filteredSortOrders.back().second;
 }
 
-std::string CAlbumWrapper::GetGalleryContent(int page)
+std::shared_ptr<SCachedResponse> CAlbumWrapper::GetTimeline()
 {
-    // Will hold the stringified JSON data
+    if (cachedTimeline && cachedTimelineGeneration == albumGeneration)
+        return cachedTimeline;
+
+    /*
+        The timeline looks like this, newest first:
+        {
+            "months": [ { "month": "2023-03", "count": 12, "firstId": 0 }, ... ],
+            "days": [ { "day": "2023-03-15", "count": 3, "firstId": 0 }, ... ]
+        }
+        firstId is the ID of the newest entry, which is where the gallery shows that day or month
+    */
     std::string outJSON;
+    outJSON.reserve(GALLERY_JSON_BASE_SIZE + (albumCache->index.timelineDays.size() + albumCache->index.timelineMonths.size()) * 64);
+    CJsonWriter writer(outJSON);
+    writer.BeginObject();
+
+    char dateStr[16];
+    writer.Key("months");
+    writer.BeginArray();
+    for (const STimelineBucket& month : albumCache->index.timelineMonths)
+    {
+        snprintf(dateStr, sizeof(dateStr), "%04u-%02u", month.date / 100, month.date % 100);
+        writer.BeginObject();
+        writer.Key("month");
+        writer.String(dateStr);
+        writer.Key("count");
+        writer.UInt(month.count);
+        writer.Key("firstId");
+        writer.Int(month.firstId);
+        writer.EndObject();
+    }
+    writer.EndArray();
 
-    // Holds the stat object we pass along
-    json statObject;
+    writer.Key("days");
+    writer.BeginArray();
+    for (const STimelineBucket& day : albumCache->index.timelineDays)
+    {
+        snprintf(dateStr, sizeof(dateStr), "%04u-%02u-%02u", day.date / 10000, day.date / 100 % 100, day.date % 100);
+        writer.BeginObject();
+        writer.Key("day");
+        writer.String(dateStr);
+        writer.Key("count");
+        writer.UInt(day.count);
+        writer.Key("firstId");
+        writer.Int(day.firstId);
+        writer.EndObject();
+    }
+    writer.EndArray();
 
-    // Take the time we need so we can display a cool stat
-    auto startTime = std::chrono::steady_clock::now();
+    writer.EndObject();
 
+    cachedTimeline = std::make_shared<SCachedResponse>(std::move(outJSON));
+    cachedTimelineGeneration = albumGeneration;
+    return cachedTimeline;
+}
+
+void CAlbumWrapper::BeginGalleryContent(CJsonWriter& writer, int total, int pageSize)
+{
     /*
-        A "gallery content" object should look like this:
+        A gallery page looks like this:
         {
-            "path": "/2020/05/04/2020050410190700-02CB906EA538A35643C1E1484C4B947D.jpg",
-            "takenAt": "1589444763",
-            "game": "0100000000010000" OR "Super Mario Odyssey",
-            "storedAt": "nand" / "sd",
-            "type": "screenshot" / "movie"
+            "pages": 3,
+            "total": 63,
+            "theme": "dark" / "light",
+            "gallery": [
+                {
+                    "id": 0,
+                    "key": "0100000000010000202005041019070010",
+                    "storedAt": "nand" / "sd",
+                    "game": "Super Mario Odyssey",
+                    "fileSize": 300000,
+                    "takenAt": 1589444763,
+                    "type": "screenshot" / "video",
+                    "fileName": "Super_Mario_Odyssey_20200504_101907_00.jpg"
+                },
+                ...
+            ],
+            "nextCursor": "2020050410190700-0100000000010000202005041019070010" / null,
+            "stats": { "indexTime": 0.001, "numScreenshots": 50, "numVideos": 13 }
         }
     */
-
-    // New json object which will hold the total response
-    json finalObject;
+    writer.BeginObject();
 
     // Fill in some data for the frontend
-    // Calculate the max amount of pages we will have
-    finalObject["pages"] = (int)ceil((double)cachedAlbumContent.size() / (double)CONTENT_PER_PAGE);
+    // Calculate the max amount of pages we will have, and how many entries there are in total
+    writer.Key("pages");
+    writer.Int((total + pageSize - 1) / pageSize);
+    writer.Key("total");
+    writer.Int(total);
 
     // Get the console's color theme so the frontend can fit
-    ColorSetId colorTheme;
-    Result r = setsysGetColorSetId(&colorTheme);
+    bool isDarkTheme;
+    Result r = albumBackend->GetIsDarkTheme(&isDarkTheme);
     if (R_SUCCEEDED(r))
     {
-        finalObject["theme"] = colorTheme == ColorSetId_Dark ? "dark" : "light";
+        writer.Key("theme");
+        writer.String(isDarkTheme ? "dark" : "light");
     }
-    
-    // Will hold the album contents
-    json jsonArray = json::array();
 
-    // Calculate the page range
-    int pageMin = (page - 1) * CONTENT_PER_PAGE;
-    int pageMax = page * CONTENT_PER_PAGE;
+    // The album contents follow
+    writer.Key("gallery");
+    writer.BeginArray();
+}
 
-    // Make sure to stay in bounds
-    if (pageMax >= cachedAlbumContent.size())
-        pageMax = cachedAlbumContent.size();
+void CAlbumWrapper::WriteGalleryEntry(CJsonWriter& writer, int id)
+{
+    // Everything about the entry is in the index already
+    writer.BeginObject();
+    writer.Key("id");
+    writer.Int(id);
+    writer.Key("key");
+    writer.String(GetAlbumEntryKey(id));
+    writer.Key("storedAt");
+    writer.String(albumCache->index.storages[id] == CapsAlbumStorage_Sd ? "sd" : "nand");
+    writer.Key("game");
+    writer.String(*albumCache->index.titleNames[albumCache->index.titles[id]]);
+    writer.Key("fileSize");
+    writer.UInt(albumCache->index.fileSizes[id]);
+    writer.Key("takenAt");
+    writer.Int(albumCache->index.timestamps[id]);
+
+    // Determine the type by looking at the content
+    bool isVideo = albumCache->index.contents[id] == CapsAlbumFileContents_Movie || albumCache->index.contents[id] == CapsAlbumFileContents_ExtraMovie;
+    writer.Key("type");
+    writer.String(isVideo ? "video" : "screenshot");
+
+    // Add the filename for downloading
+    writer.Key("fileName");
+    writer.String(GetAlbumEntryFilename(id));
+    writer.EndObject();
+}
 
-    // Iterate over the current range for the page
-    for (int i = pageMin; i < pageMax; i++)
-    {
-        // Get the entry off the album content cache
-        CapsAlbumEntry albumEntry = cachedAlbumContent[i];
+void CAlbumWrapper::EndGalleryContent(CJsonWriter& writer, const std::string& nextCursor, double indexTime)
+{
+    writer.EndArray();
 
-        // Figure out if this album entry is stored on the NAND of SD by looking at the
-        // vector this element is in
-        bool isStoredInNand = albumEntry.file_id.storage != CapsAlbumStorage_Sd;
+    // Where the next page continues, if there is one
+    writer.Key("nextCursor");
+    if (!nextCursor.empty())
+        writer.String(nextCursor);
+    else
+        writer.Null();
 
-        // The JSON object for this entry of the album
-        json jsonObj;
-        jsonObj["id"] = i;
-        jsonObj["storedAt"] = isStoredInNand ? "nand" : "sd";
+    // Attach the stats
+    writer.Key("stats");
+    writer.BeginObject();
+    writer.Key("indexTime");
+    writer.Double(indexTime);
+    writer.Key("numScreenshots");
+    writer.Int(albumCache->screenshotCount);
+    writer.Key("numVideos");
+    writer.Int(albumCache->videoCount);
+    writer.EndObject();
+
+    writer.EndObject();
+}
 
-        // Retrieve the title's name
-        jsonObj["game"] = GetTitleName(albumEntry.file_id.application_id);
+const std::string& CAlbumWrapper::GetTitleName(u64 titleId)
+{
+    return titleCache.GetTitleName(titleId, albumBackend.get());
+}
 
-        // Retrieve the file size of the file
-        u64 fileSize;
-        Result getFileSizeResult = capsaGetAlbumFileSize(&albumEntry.file_id, &fileSize);
-        if (R_SUCCEEDED(getFileSizeResult))
-        {
-            jsonObj["fileSize"] = fileSize;
-        }
+u32 CAlbumWrapper::GetAlbumGeneration()
+{
+    return albumGeneration;
+}
 
-        // Create a UNIX-timestamp from the datetime we get from capsa
-        struct tm createdAt;
-        createdAt.tm_year = albumEntry.file_id.datetime.year - 1900;
-        createdAt.tm_mon = albumEntry.file_id.datetime.month - 1;
-        createdAt.tm_mday = albumEntry.file_id.datetime.day;
-        createdAt.tm_hour = albumEntry.file_id.datetime.hour;
-        createdAt.tm_min = albumEntry.file_id.datetime.minute;
-        createdAt.tm_sec = albumEntry.file_id.datetime.second;
-        time_t timestamp = mktime(&createdAt);
-        jsonObj["takenAt"] = timestamp;
-
-        // Determine the type by looking at the file extension
-        if (albumEntry.file_id.content == CapsAlbumFileContents_Movie || albumEntry.file_id.content == CapsAlbumFileContents_ExtraMovie)
-        {
-            jsonObj["type"] = "video";
-        }
-        else
-        {
-            jsonObj["type"] = "screenshot";
-        }
+bool CAlbumWrapper::RefreshGalleryContent()
+{
+    if (!albumBackend)
+        return false;
 
-        // Add the filename for downloading
-        jsonObj["fileName"] = nxgallery::core::CAlbumWrapper::Get()->GetAlbumEntryFilename(i);
-        
-        // Push this json object to the array
-        jsonArray.push_back(jsonObj);
+    std::lock_guard<std::mutex> refreshLock(refreshMutex);
+
+    // Counting the files is cheap compared to listing them, so the album is only listed again if it changed
+    bool hasChanged = false;
+    for (CapsAlbumStorage storage : { CapsAlbumStorage_Nand, CapsAlbumStorage_Sd })
+    {
+        u64 fileCount = 0;
+        if (R_SUCCEEDED(albumBackend->GetAlbumFileCount(storage, &fileCount)) && fileCount != listedFileCounts[storage])
+            hasChanged = true;
     }
 
-    finalObject["gallery"] = jsonArray;
+    if (!hasChanged)
+        return false;
 
-    // Stop the time!
-    auto endTime = std::chrono::steady_clock::now();
-    double indexTime = std::chrono::duration_cast<std::chrono::duration<double>>(endTime - startTime).count();
+#ifdef __DEBUG__
+    printf("Album changed, caching it again\n");
+#endif
 
-    // Attach the stats
-    statObject["indexTime"] = indexTime;
-    statObject["numScreenshots"] = screenshotCount;
-    statObject["numVideos"] = videoCount;
-    finalObject["stats"] = statObject;
+    // Build the new cache while the network thread goes on with the current one
+    std::unique_ptr<SAlbumCache> cache = std::make_unique<SAlbumCache>();
+    BuildAlbumCache(*cache);
+    listedFileCounts[CapsAlbumStorage_Nand] = cache->fileCounts[CapsAlbumStorage_Nand];
+    listedFileCounts[CapsAlbumStorage_Sd] = cache->fileCounts[CapsAlbumStorage_Sd];
 
-    // Stringify the JSON array
-    outJSON = finalObject.dump();
+    {
+        std::lock_guard<std::mutex> lock(albumCacheMutex);
+        pendingAlbumCache = std::move(cache);
+        hasPendingAlbumCache = true;
+    }
 
-    return outJSON;
+    // Let the network thread know, it might be waiting for clients
+    CContentWakeup::Get()->Signal();
+    return true;
 }
 
-std::string CAlbumWrapper::GetTitleName(u64 titleId)
+bool CAlbumWrapper::ApplyGalleryContent()
 {
-    // Retrieve the control.nacp data for the game where the current album entry was taken
-    NsApplicationControlData nacpData;
-    u64 nacpDataSize;
-    Result getNACPResult = nsGetApplicationControlData(NsApplicationControlSource_Storage, titleId, &nacpData, sizeof(nacpData), &nacpDataSize);
-    if (R_SUCCEEDED(getNACPResult))
-    {
-        // Retrieve the language string for the Switch'es desired language
-        NacpLanguageEntry* nacpLangEntry;
-        Result getLangEntryResult = nsGetApplicationDesiredLanguage(&nacpData.nacp, &nacpLangEntry);
+    if (!hasPendingAlbumCache)
+        return false;
 
-        // If it worked, we can grab the nacpLangEntry->name which will hold the name of the title
-        if (R_SUCCEEDED(getLangEntryResult))
-        {
-            return nacpLangEntry->name;
-        }
+    std::unique_ptr<SAlbumCache> cache;
+    {
+        std::lock_guard<std::mutex> lock(albumCacheMutex);
+        cache = std::move(pendingAlbumCache);
+        hasPendingAlbumCache = false;
     }
 
-    // If the above didn't work, it's probably not a game where this album entry was created
-    // A list of all system applets mapped to their title ID
-    // https://switchbrew.org/wiki/Title_list#System_Applets
-    std::map<u64, const char*> systemTitles;
-    systemTitles[0x0100000000001000] = "Home Menu"; // qlaunch
-    systemTitles[0x0100000000001001] = "Auth"; // auth
-    systemTitles[0x0100000000001002] = "Cabinet"; // cabinet
-    systemTitles[0x0100000000001003] = "Controller"; // controller
-    systemTitles[0x0100000000001004] = "DataErase"; // dataErase
-    systemTitles[0x0100000000001005] = "Error"; // error
-    systemTitles[0x0100000000001006] = "Net Connect"; // netConnect
-    systemTitles[0x0100000000001007] = "Player Select"; // playerSelect
-    systemTitles[0x0100000000001008] = "Keyboard"; // swkbd
-    systemTitles[0x0100000000001009] = "Mii Editor"; // miiEdit
-    systemTitles[0x010000000000100A] = "Web Browser"; // web
-    systemTitles[0x010000000000100B] = "eShop"; // shop
-    systemTitles[0x010000000000100C] = "Overlay"; // overlayDisp
-    systemTitles[0x010000000000100D] = "Album"; // photoViewer
-    systemTitles[0x010000000000100F] = "Offline Web Browser"; // offlineWeb
-    systemTitles[0x0100000000001010] = "Share"; // loginShare
-    systemTitles[0x0100000000001011] = "WiFi Web Auth"; // wifiWebAuth
-    systemTitles[0x0100000000001012] = "Starter"; // starter
-    systemTitles[0x0100000000001013] = "My Page"; // myPage
-
-    // If it's one of the above, lookup the name from the map, otherwise it's Unknown
-    if (systemTitles.count(titleId))
-    {
-        return systemTitles[titleId];
-    }
-    else
+    if (!cache)
+        return false;
+
+    SwapAlbumCache(std::move(cache));
+    return true;
+}
+
+void CAlbumWrapper::AlbumThreadMain()
+{
+    std::unique_lock<std::mutex> lock(albumThreadMutex);
+    while (!albumThreadCondition.wait_for(lock, std::chrono::milliseconds(ALBUM_CHECK_INTERVAL_MS), [this] { return shouldStopAlbumThread; }))
     {
-        return "Unknown";
+        lock.unlock();
+        RefreshGalleryContent();
+        lock.lock();
     }
 }
 
-CapsAlbumFileContents CAlbumWrapper::GetAlbumEntryType(int id)
+std::string_view CAlbumWrapper::GetAlbumEntryKey(int id)
 {
-    return (CapsAlbumFileContents)cachedAlbumContent[id].file_id.content;
+    return albumCache->index.GetKey(id);
 }
 
-std::string CAlbumWrapper::GetAlbumEntryFilename(int id)
+int CAlbumWrapper::FindAlbumEntryByKey(std::string_view key)
 {
-    // Get the entry from cache
-    CapsAlbumEntry albumEntry = cachedAlbumContent[id];
-
-    // Get the file and check if it's a video
-    CapsAlbumFileContents fileType = GetAlbumEntryType(id);
-    bool isVideo = (fileType == CapsAlbumFileContents_Movie || fileType == CapsAlbumFileContents_ExtraMovie);
-    std::string extension = isVideo ? ".mp4" : ".jpg";
-
-    // Get the title name
-    std::string titleName = GetTitleName(albumEntry.file_id.application_id);
-
-    // Do some regex to replace whitespaces
-    titleName = std::regex_replace(titleName, std::regex("\\s+"), "_");
+    auto it = albumCache->keys.find(key);
+    return it != albumCache->keys.end() ? it->second : -1;
+}
 
-    // Get the date and form a string
-    char dateStr[32];
-    sprintf(dateStr, "%04u%02u%02u_%02u%02u%02u_%02u",
-        albumEntry.file_id.datetime.year,
-        albumEntry.file_id.datetime.month,
-        albumEntry.file_id.datetime.day,
-        albumEntry.file_id.datetime.hour,
-        albumEntry.file_id.datetime.minute,
-        albumEntry.file_id.datetime.second,
-        albumEntry.file_id.datetime.id);
+int CAlbumWrapper::GetAlbumEntryCount()
+{
+    return albumCache->entries.size();
+}
 
-    std::string finalName = titleName + "_" + dateStr + extension;
+CapsAlbumFileContents CAlbumWrapper::GetAlbumEntryType(int id)
+{
+    return (CapsAlbumFileContents)albumCache->entries[id].file_id.content;
+}
 
-    return finalName;
+std::string_view CAlbumWrapper::GetAlbumEntryFilename(int id)
+{
+    return albumCache->index.GetFileName(id);
 }
 
 bool CAlbumWrapper::GetFileThumbnail(int id, void* outBuffer, u64 bufferSize, u64* outActualImageSize)
 {
     // Make sure that ID exists
-    if (id < 0 || id > cachedAlbumContent.size())
+    if (id < 0 || id >= albumCache->entries.size())
         return false;
 
     // Get the content with that ID
-    CapsAlbumEntry entry = cachedAlbumContent[id];
+    CapsAlbumEntry entry = albumCache->entries[id];
 
     // Load the thumbnail
-    Result result = capsaLoadAlbumFileThumbnail(&entry.file_id, outActualImageSize, outBuffer, bufferSize);
+    Result result = albumBackend->LoadAlbumFileThumbnail(entry.file_id, outBuffer, bufferSize, outActualImageSize);
     if (R_SUCCEEDED(result))
     {
         return true;
@@ -405,104 +1488,594 @@ bool CAlbumWrapper::GetFileThumbnail(int id, void* outBuffer, u64 bufferSize, u6
     }
 }
 
-bool CAlbumWrapper::GetFileContent(int id, void* outBuffer, u64 bufferSize, u64* outActualFileSize)
+std::shared_ptr<IContentSource> CAlbumWrapper::GetFileContent(int id)
 {
     // Make sure that ID exists
-    if (id < 0 || id > cachedAlbumContent.size())
-        return false;
+    if (id < 0 || id >= albumCache->entries.size())
+        return nullptr;
 
     // Get the content with that ID
-    CapsAlbumEntry entry = cachedAlbumContent[id];
+    CapsAlbumEntry entry = albumCache->entries[id];
+
+    // Reading the file straight from the filesystem saves all the copying through capsa. Only regular
+    // screenshots and videos are sorted into directories by date, extra content is left to capsa
+    if (contentBackend == EContentBackend::Filesystem)
+    {
+        if (entry.file_id.content == CapsAlbumFileContents_ScreenShot || entry.file_id.content == CapsAlbumFileContents_Movie)
+            return std::make_shared<CAlbumFileSource>(entry);
+
+        RecordContentFallback();
+    }
+
+    RecordContentOpened(EContentBackend::Capsa);
+
+    // Videos can be way bigger than what we'd like to hold in memory, so they're read from their movie
+    // stream bit by bit while they're sent. A stream which failed to open has no size
+    if (entry.file_id.content == CapsAlbumFileContents_Movie || entry.file_id.content == CapsAlbumFileContents_ExtraMovie)
+    {
+        std::shared_ptr<IContentSource> source = std::make_shared<CVideoStreamSource>(entry);
+        if (source->GetSize() == 0)
+            return nullptr;
+
+        return source;
+    }
+
+    // Screenshots are small, so they're loaded as a whole into a buffer of exactly their size
+    u64 fileSize = 0;
+    Result result = albumBackend->GetAlbumFileSize(entry.file_id, &fileSize);
+    if (R_FAILED(result))
+    {
+        printf("Failed to get file size for file %d: %d-%d\n", id, R_MODULE(result), R_DESCRIPTION(result));
+        return nullptr;
+    }
+
+    std::string fileBuffer;
+    fileBuffer.resize(fileSize);
+
+    // Load the file content
+    u64 actualFileSize = 0;
+    auto readStartTime = std::chrono::steady_clock::now();
+    result = albumBackend->LoadAlbumFile(entry.file_id, &fileBuffer[0], fileBuffer.size(), &actualFileSize);
+    if (R_FAILED(result))
+    {
+        printf("Failed to get file content for file %d: %d-%d\n", id, R_MODULE(result), R_DESCRIPTION(result));
+        return nullptr;
+    }
+    RecordContentRead(EContentBackend::Capsa, actualFileSize, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - readStartTime).count());
+
+    fileBuffer.resize(actualFileSize);
+    return std::make_shared<CMemorySource>(std::move(fileBuffer));
+}
+
+std::vector<const char*> CAlbumWrapper::GetAlbumContentPaths()
+{
+    return { GetAlbumDir(CapsAlbumStorage_Nand), GetAlbumDir(CapsAlbumStorage_Sd) };
+}
+
+void CAlbumWrapper::SetContentBackend(EContentBackend backend)
+{
+    contentBackend = backend;
+}
+
+EContentBackend CAlbumWrapper::GetContentBackend()
+{
+    return contentBackend;
+}
+
+SContentBackendStats CAlbumWrapper::GetContentBackendStats(EContentBackend backend)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return backend == EContentBackend::Capsa ? capsaStats : filesystemStats;
+}
+
+void CAlbumWrapper::RecordContentRead(EContentBackend backend, u64 bytesRead, u64 readTimeNs)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    SContentBackendStats& stats = backend == EContentBackend::Capsa ? capsaStats : filesystemStats;
+    stats.bytesRead += bytesRead;
+    stats.readTimeNs += readTimeNs;
+}
+
+void CAlbumWrapper::RecordContentOpened(EContentBackend backend)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    (backend == EContentBackend::Capsa ? capsaStats : filesystemStats).filesOpened++;
+}
+
+void CAlbumWrapper::RecordContentFallback()
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    filesystemStats.fallbacks++;
+}
+
+const char* CAlbumWrapper::GetAlbumDir(CapsAlbumStorage storage)
+{
+    return albumBackend->GetAlbumDir(storage);
+}
+
+std::string CAlbumWrapper::FindAlbumFilePath(const CapsAlbumFileId& fileId)
+{
+    // We might have looked for it already
+    char key[ALBUM_ENTRY_KEY_SIZE];
+    FormatAlbumEntryKey(fileId, key);
+    {
+        std::lock_guard<std::mutex> lock(filePathMutex);
+        auto cachedPath = cachedFilePaths.find(key);
+        if (cachedPath != cachedFilePaths.end())
+            return cachedPath->second;
+    }
+
+    std::string path;
 
-    // If it's a screenshot, we can use capsaLoadAlbumFile to retrieve it
-    if (entry.file_id.content == CapsAlbumFileContents_ScreenShot || entry.file_id.content == CapsAlbumFileContents_ExtraScreenShot)
+    // Only regular screenshots and videos are sorted into directories by date, extra content isn't
+    if (fileId.content == CapsAlbumFileContents_ScreenShot || fileId.content == CapsAlbumFileContents_Movie)
     {
-        // Load the file content
-        Result result = capsaLoadAlbumFile(&entry.file_id, outActualFileSize, outBuffer, bufferSize);
-        if (R_SUCCEEDED(result))
+        // Files are stored as YYYY/MM/DD/YYYYMMDDHHMMSSII-<encrypted application ID>.jpg/.mp4. We can't
+        // encrypt the application ID, but the date and ID before it are enough to find the file
+        char directory[64];
+        snprintf(directory, sizeof(directory), "%s%04u/%02u/%02u/", GetAlbumDir((CapsAlbumStorage)fileId.storage),
+            fileId.datetime.year, fileId.datetime.month, fileId.datetime.day);
+
+        char prefix[32];
+        int prefixLength = snprintf(prefix, sizeof(prefix), "%04u%02u%02u%02u%02u%02u%02u-",
+            fileId.datetime.year, fileId.datetime.month, fileId.datetime.day,
+            fileId.datetime.hour, fileId.datetime.minute, fileId.datetime.second, fileId.datetime.id);
+
+        const char* extension = fileId.content == CapsAlbumFileContents_Movie ? ".mp4" : ".jpg";
+
+        // Look through the day's directory for the file
+        DIR* dir = opendir(directory);
+        if (dir)
         {
-            return true;
+            struct dirent* dirEntry;
+            while ((dirEntry = readdir(dir)) != NULL)
+            {
+                size_t nameLength = strlen(dirEntry->d_name);
+                if (nameLength > prefixLength + 4 && strncmp(dirEntry->d_name, prefix, prefixLength) == 0 && strcmp(dirEntry->d_name + nameLength - 4, extension) == 0)
+                {
+                    path = std::string(directory) + dirEntry->d_name;
+                    break;
+                }
+            }
+
+            closedir(dir);
         }
-        else
+    }
+
+    // Remember the path, or that there's none
+    std::lock_guard<std::mutex> lock(filePathMutex);
+    cachedFilePaths[key] = path;
+    return path;
+}
+
+void CAlbumWrapper::CacheGalleryContent()
+{
+    std::unique_ptr<SAlbumCache> cache = std::make_unique<SAlbumCache>();
+    {
+        std::lock_guard<std::mutex> lock(refreshMutex);
+        BuildAlbumCache(*cache);
+        listedFileCounts[CapsAlbumStorage_Nand] = cache->fileCounts[CapsAlbumStorage_Nand];
+        listedFileCounts[CapsAlbumStorage_Sd] = cache->fileCounts[CapsAlbumStorage_Sd];
+    }
+
+    SwapAlbumCache(std::move(cache));
+}
+
+void CAlbumWrapper::BuildAlbumCache(SAlbumCache& outCache)
+{
+    // Cache NAND album
+    std::vector<CapsAlbumEntry> nandAlbum;
+    CacheAlbum(CapsAlbumStorage_Nand, outCache, nandAlbum);
+
+    // Cache SD album
+    std::vector<CapsAlbumEntry> sdAlbum;
+    CacheAlbum(CapsAlbumStorage_Sd, outCache, sdAlbum);
+
+    // Merge both into one timeline with the newest entries first. Cursors and date seeks rely on this order
+    MergeAlbumLists({ &nandAlbum, &sdAlbum }, outCache.entries);
+
+    // Work out everything the gallery shows about the entries. This also looks up the names of all
+    // titles in the album, so requests never have to wait for that. Store the ones which were new
+    BuildAlbumIndex(outCache);
+    titleCache.Save();
+
+    // The games only change along with the album, so their JSON is written right away
+    BuildGamesContent(outCache);
+}
+
+void CAlbumWrapper::SwapAlbumCache(std::unique_ptr<SAlbumCache> cache)
+{
+    // The old cache is freed along with the pointer. The keys point into its index, so they go with it
+    albumCache = std::move(cache);
+
+    // The search index only ever grows, titles which were searchable before are skipped
+    for (size_t i = 0; i < albumCache->index.titleIds.size(); i++)
+        titleSearch.AddTitle(albumCache->index.titleIds[i], *albumCache->index.titleNames[i]);
+
+    // Files might have moved
+    {
+        std::lock_guard<std::mutex> lock(filePathMutex);
+        cachedFilePaths.clear();
+    }
+
+    // Everything derived from the previous cache is outdated now
+    albumGeneration++;
+}
+
+void CAlbumWrapper::BuildAlbumIndex(SAlbumCache& cache)
+{
+    SAlbumIndex index;
+    size_t entryCount = cache.entries.size();
+    index.timestamps.reserve(entryCount);
+    index.captureTimes.reserve(entryCount);
+    index.fileSizes.reserve(entryCount);
+    index.contents.reserve(entryCount);
+    index.storages.reserve(entryCount);
+    index.titles.reserve(entryCount);
+    index.keyOffsets.reserve(entryCount + 1);
+    index.fileNameOffsets.reserve(entryCount);
+
+    // The name of each title as used in filenames
+    std::vector<std::string> titleFileNames;
+
+    for (const CapsAlbumEntry& entry : cache.entries)
+    {
+        const CapsAlbumFileId& fileId = entry.file_id;
+
+        // Create a UNIX-timestamp from the datetime we get from capsa
+        struct tm createdAt = {};
+        createdAt.tm_year = fileId.datetime.year - 1900;
+        createdAt.tm_mon = fileId.datetime.month - 1;
+        createdAt.tm_mday = fileId.datetime.day;
+        createdAt.tm_hour = fileId.datetime.hour;
+        createdAt.tm_min = fileId.datetime.minute;
+        createdAt.tm_sec = fileId.datetime.second;
+        index.timestamps.push_back(mktime(&createdAt));
+        index.captureTimes.push_back(GetCaptureTime(fileId.datetime));
+
+        // The entries are sorted, so every day and month of the timeline is one run of entries
+        u32 day = index.captureTimes.back() / 100000000;
+        if (index.timelineDays.empty() || index.timelineDays.back().date != day)
+            index.timelineDays.push_back({ day, 0, (int)index.captureTimes.size() - 1 });
+        index.timelineDays.back().count++;
+
+        u32 month = day / 100;
+        if (index.timelineMonths.empty() || index.timelineMonths.back().date != month)
+            index.timelineMonths.push_back({ month, 0, (int)index.captureTimes.size() - 1 });
+        index.timelineMonths.back().count++;
+
+        // The file list already tells the size, no need to ask for it
+        index.fileSizes.push_back(entry.size);
+        index.contents.push_back(fileId.content);
+        index.storages.push_back(fileId.storage);
+
+        // The entries are added in order of their IDs, just like the bitmaps need them
+        u32 id = index.captureTimes.size() - 1;
+        if (fileId.content < 4)
+            index.contentEntries[fileId.content].Add(id);
+        if (fileId.storage < 2)
+            index.storageEntries[fileId.storage].Add(id);
+
+        // Every title is only stored once, entries refer to it by index
+        auto titleIndex = index.titleIndices.find(fileId.application_id);
+        if (titleIndex == index.titleIndices.end())
         {
-            printf("Failed to get file content for file %d: %d-%d\n", id, R_MODULE(result), R_DESCRIPTION(result));
-            return false; 
+            titleIndex = index.titleIndices.emplace(fileId.application_id, index.titleIds.size()).first;
+            index.titleIds.push_back(fileId.application_id);
+            index.titleNames.push_back(&GetTitleName(fileId.application_id));
+            index.titleEntries.emplace_back();
+            index.titleStats.emplace_back();
+
+            std::string titleFileName;
+            AppendSanitizedName(*index.titleNames.back(), titleFileName);
+            titleFileNames.push_back(std::move(titleFileName));
         }
+        index.titles.push_back(titleIndex->second);
+        index.titleEntries[titleIndex->second].Add(id);
+
+        // Add the entry to what the album has of the title. The entries are sorted, so the first one
+        // of a title is its newest and the last one its oldest
+        STitleStats& titleStats = index.titleStats[titleIndex->second];
+        if (fileId.content == CapsAlbumFileContents_Movie || fileId.content == CapsAlbumFileContents_ExtraMovie)
+            titleStats.videoCount++;
+        else
+            titleStats.screenshotCount++;
+        titleStats.totalBytes += entry.size;
+        if (titleStats.newestId < 0)
+            titleStats.newestId = id;
+        titleStats.oldestId = id;
+
+        char key[ALBUM_ENTRY_KEY_SIZE];
+        FormatAlbumEntryKey(fileId, key);
+
+        index.keyOffsets.push_back(index.strings.size());
+        index.strings += key;
+        // The filename is the title's name followed by the date, such as Super_Mario_Odyssey_20200504_101907_00.jpg
+        bool isVideo = (fileId.content == CapsAlbumFileContents_Movie || fileId.content == CapsAlbumFileContents_ExtraMovie);
+        char dateStr[32];
+        snprintf(dateStr, sizeof(dateStr), "_%04u%02u%02u_%02u%02u%02u_%02u%s",
+            fileId.datetime.year,
+            fileId.datetime.month,
+            fileId.datetime.day,
+            fileId.datetime.hour,
+            fileId.datetime.minute,
+            fileId.datetime.second,
+            fileId.datetime.id,
+            isVideo ? ".mp4" : ".jpg");
+
+        index.fileNameOffsets.push_back(index.strings.size());
+        index.strings += titleFileNames[titleIndex->second];
+        index.strings += dateStr;
     }
-    else
+    index.keyOffsets.push_back(index.strings.size());
+    index.strings.shrink_to_fit();
+
+    // The keys point into the index's strings, so the cache is only ever swapped as a whole
+    cache.index = std::move(index);
+    cache.keys.reserve(entryCount);
+    for (int i = 0; i < entryCount; i++)
     {
-        // It's a video, use our movie stream reader
-        CVideoStreamReader* videoStreamReader = new CVideoStreamReader(entry);
+        cache.keys[cache.index.GetKey(i)] = i;
+    }
 
-        // Get the stream size. Using that we also know how much bytes we need to read in total
-        *outActualFileSize = videoStreamReader->GetStreamSize();
-        u64 readLeft = videoStreamReader->GetStreamSize();
+#ifdef __DEBUG__
+    u64 indexBytes = cache.index.GetMemoryUsage();
+    u64 entryBytes = cache.entries.capacity() * sizeof(CapsAlbumEntry);
+    printf("Indexed %zu album entries from %zu titles: %lu bytes of index, %lu bytes of entries (%lu bytes per entry)\n",
+        entryCount, cache.index.titleIds.size(), indexBytes, entryBytes, entryCount > 0 ? (indexBytes + entryBytes) / entryCount : 0);
+#endif
+}
 
-        // Read until no bytes are left to read
-        size_t bytesRead = 0;
-        while (readLeft > 0)
+void CAlbumWrapper::BuildGamesContent(SAlbumCache& cache)
+{
+    /*
+        The games look like this, most recently played first:
         {
-            // Offset the buffer's pointer accordingly
-            char* ptr = ((char*)outBuffer) + bytesRead;
-            u64 readResult = videoStreamReader->Read(ptr, videoStreamReader->GetStreamSize());
+            "games": [
+                {
+                    "titleId": "0100000000010000",
+                    "name": "Super Mario Odyssey",
+                    "screenshots": 50,
+                    "videos": 13,
+                    "totalBytes": 123456789,
+                    "newestId": 0,
+                    "newestKey": "0100000000010000202005041019070010",
+                    "newestAt": 1589444763,
+                    "oldestAt": 1588584000
+                },
+                ...
+            ]
+        }
+        The newest entry is meant as the cover of the game, its thumbnail is at /thumbnail?key=<newestKey>
+    */
+    std::vector<u16> titleOrder(cache.index.titleIds.size());
+    for (size_t i = 0; i < titleOrder.size(); i++)
+    {
+        titleOrder[i] = i;
+    }
+    std::sort(titleOrder.begin(), titleOrder.end(), [&cache](u16 a, u16 b) { return cache.index.titleStats[a].newestId < cache.index.titleStats[b].newestId; });
+
+    std::string outJSON;
+    outJSON.reserve(GALLERY_JSON_BASE_SIZE + titleOrder.size() * GALLERY_JSON_ENTRY_SIZE);
+    CJsonWriter writer(outJSON);
+    writer.BeginObject();
+    writer.Key("games");
+    writer.BeginArray();
+
+    char titleIdStr[24];
+    for (u16 title : titleOrder)
+    {
+        const STitleStats& stats = cache.index.titleStats[title];
+        snprintf(titleIdStr, sizeof(titleIdStr), "%016lX", cache.index.titleIds[title]);
+
+        writer.BeginObject();
+        writer.Key("titleId");
+        writer.String(titleIdStr);
+        writer.Key("name");
+        writer.String(*cache.index.titleNames[title]);
+        writer.Key("screenshots");
+        writer.UInt(stats.screenshotCount);
+        writer.Key("videos");
+        writer.UInt(stats.videoCount);
+        writer.Key("totalBytes");
+        writer.UInt(stats.totalBytes);
+        writer.Key("newestId");
+        writer.Int(stats.newestId);
+        writer.Key("newestKey");
+        writer.String(cache.index.GetKey(stats.newestId));
+        writer.Key("newestAt");
+        writer.Int(cache.index.timestamps[stats.newestId]);
+        writer.Key("oldestAt");
+        writer.Int(cache.index.timestamps[stats.oldestId]);
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+
+    cache.gamesContent = std::make_shared<SCachedResponse>(std::move(outJSON));
+}
+
+std::shared_ptr<SCachedResponse> CAlbumWrapper::GetGames()
+{
+    return albumCache->gamesContent;
+}
 
-            bytesRead += readResult;
-            readLeft -= readResult;
+std::string CAlbumWrapper::GetSearchContent(std::string_view query)
+{
+    /*
+        The results look like this:
+        {
+            "query": "mario",
+            "games": [
+                {
+                    "titleId": "0100000000010000",
+                    "name": "Super Mario Odyssey",
+                    "screenshots": 50,
+                    "videos": 13,
+                    "firstId": 0,
+                    "firstKey": "0100000000010000202005041019070010",
+                    "lastId": 812
+                },
+                ...
+            ],
+            "searchTime": 0.000012
         }
+        firstId and lastId are the IDs of the game's newest and oldest entries in the whole gallery. They are
+        not a range of the game, as the entries of other games are mixed in between. /gallery?game=<titleId>
+        lists just the entries of the game
+    */
+    auto startTime = std::chrono::steady_clock::now();
+
+    // The search index also knows titles which aren't in the album anymore, leave them out
+    std::vector<u64> titleIds;
+    titleSearch.Search(query, titleIds);
+
+    std::vector<u16> titles;
+    titles.reserve(titleIds.size());
+    for (u64 titleId : titleIds)
+    {
+        auto title = albumCache->index.titleIndices.find(titleId);
+        if (title != albumCache->index.titleIndices.end())
+            titles.push_back(title->second);
+    }
+
+    // Games starting with the query are most likely the ones looked for
+    auto startsWithQuery = [this, query](u16 title)
+    {
+        const std::string& name = *albumCache->index.titleNames[title];
+        return name.size() >= query.size() && strncasecmp(name.c_str(), query.data(), query.size()) == 0;
+    };
+    std::sort(titles.begin(), titles.end(), [this, &startsWithQuery](u16 a, u16 b)
+    {
+        bool aStarts = startsWithQuery(a);
+        bool bStarts = startsWithQuery(b);
+        if (aStarts != bStarts)
+            return aStarts;
 
-        // Finished, delete the stream reader
-        delete videoStreamReader;
+        return albumCache->index.titleStats[a].newestId < albumCache->index.titleStats[b].newestId;
+    });
 
-        // If no bytes are left to read, everything worked fine
-        return readLeft <= 0;
+    std::string outJSON;
+    outJSON.reserve(GALLERY_JSON_BASE_SIZE + titles.size() * GALLERY_JSON_ENTRY_SIZE);
+    CJsonWriter writer(outJSON);
+    writer.BeginObject();
+    writer.Key("query");
+    writer.String(query);
+    writer.Key("games");
+    writer.BeginArray();
+
+    char titleIdStr[24];
+    for (u16 title : titles)
+    {
+        const STitleStats& stats = albumCache->index.titleStats[title];
+        snprintf(titleIdStr, sizeof(titleIdStr), "%016lX", albumCache->index.titleIds[title]);
+
+        writer.BeginObject();
+        writer.Key("titleId");
+        writer.String(titleIdStr);
+        writer.Key("name");
+        writer.String(*albumCache->index.titleNames[title]);
+        writer.Key("screenshots");
+        writer.UInt(stats.screenshotCount);
+        writer.Key("videos");
+        writer.UInt(stats.videoCount);
+        writer.Key("firstId");
+        writer.Int(stats.newestId);
+        writer.Key("firstKey");
+        writer.String(GetAlbumEntryKey(stats.newestId));
+        writer.Key("lastId");
+        writer.Int(stats.oldestId);
+        writer.EndObject();
     }
+
+    writer.EndArray();
+
+    // Stop the time!
+    writer.Key("searchTime");
+    writer.Double(std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - startTime).count());
+    writer.EndObject();
+
+    return outJSON;
 }
 
-void CAlbumWrapper::CacheGalleryContent()
-{  
-    // Cache NAND album
-    CacheAlbum(CapsAlbumStorage_Nand, cachedAlbumContent);
+std::string_view SAlbumIndex::GetKey(int id) const
+{
+    return std::string_view(strings).substr(keyOffsets[id], fileNameOffsets[id] - keyOffsets[id]);
+}
 
-    // Cache SD album
-    CacheAlbum(CapsAlbumStorage_Sd, cachedAlbumContent);
+std::string_view SAlbumIndex::GetFileName(int id) const
+{
+    return std::string_view(strings).substr(fileNameOffsets[id], keyOffsets[id + 1] - fileNameOffsets[id]);
+}
+
+u64 SAlbumIndex::GetMemoryUsage() const
+{
+    u64 bitmapUsage = 0;
+    for (const CEntryBitmap& entries : titleEntries)
+    {
+        bitmapUsage += entries.GetMemoryUsage();
+    }
+    for (const CEntryBitmap& entries : contentEntries)
+    {
+        bitmapUsage += entries.GetMemoryUsage();
+    }
+    for (const CEntryBitmap& entries : storageEntries)
+    {
+        bitmapUsage += entries.GetMemoryUsage();
+    }
 
-    // Reverse the album entries so newest are first
-    std::reverse(cachedAlbumContent.begin(), cachedAlbumContent.end());
+    return bitmapUsage
+        + timestamps.capacity() * sizeof(s64)
+        + captureTimes.capacity() * sizeof(u64)
+        + fileSizes.capacity() * sizeof(u64)
+        + contents.capacity() + storages.capacity()
+        + titles.capacity() * sizeof(u16)
+        + keyOffsets.capacity() * sizeof(u32)
+        + fileNameOffsets.capacity() * sizeof(u32)
+        + strings.capacity()
+        + titleIds.capacity() * sizeof(u64)
+        + titleNames.capacity() * sizeof(const std::string*)
+        + titleStats.capacity() * sizeof(STitleStats)
+        + titleIndices.size() * (sizeof(u64) + sizeof(u16) + sizeof(void*)) + titleIndices.bucket_count() * sizeof(void*)
+        + (timelineDays.capacity() + timelineMonths.capacity()) * sizeof(STimelineBucket);
 }
 
-void CAlbumWrapper::CacheAlbum(CapsAlbumStorage location, std::vector<CapsAlbumEntry>& outCache)
+void CAlbumWrapper::CacheAlbum(CapsAlbumStorage location, SAlbumCache& cache, std::vector<CapsAlbumEntry>& outEntries)
 {    
-    // This uses capsa (Capture Service), which is the libnx service to data from the Switch album
+    // This goes through the backend, which is capsa (Capture Service) on the Switch
 
-    // Get the total amount of files in the album
-    u64 totalAlbumFileCount;
-    capsaGetAlbumFileCount(location, &totalAlbumFileCount);
+    // Remember how many files there are first, so a file added while listing is found by the next refresh
+    if (R_FAILED(albumBackend->GetAlbumFileCount(location, &cache.fileCounts[location])))
+        cache.fileCounts[location] = 0;
 
     // Get all album files from the album
-    u64 albumFileCount;
-    CapsAlbumEntry albumFiles[totalAlbumFileCount];
-    Result r = capsaGetAlbumFileList(location, &albumFileCount, albumFiles, totalAlbumFileCount);
-    
+    std::vector<CapsAlbumEntry> albumFiles;
+    Result r = albumBackend->GetAlbumFileList(location, albumFiles);
+
     if (R_FAILED(r))
     {
         printf("Failed to get album file list for storage %s: %d-%d\n", location == CapsAlbumStorage_Sd ? "SD" : "NAND", R_MODULE(r), R_DESCRIPTION(r));
         return;
     }
 
-    // Add the files from the raw array to the std::vector
-    for (CapsAlbumEntry entry : albumFiles)
+    // Newest first, so the storages can be merged
+    SortAlbumList(albumFiles);
+
+    // Add the files to the cache
+    for (const CapsAlbumEntry& entry : albumFiles)
     {
         // Count
         if (entry.file_id.content == CapsAlbumFileContents_Movie || entry.file_id.content == CapsAlbumFileContents_ExtraMovie)
-            videoCount++;
+            cache.videoCount++;
         else
-            screenshotCount++;
+            cache.screenshotCount++;
 
         // Add to the cache
-        outCache.push_back(entry);
+        outEntries.push_back(entry);
     }
 
 #ifdef __DEBUG__
-    printf("Cached %ld album files for %s storage\n", totalAlbumFileCount, location == CapsAlbumStorage_Sd ? "SD" : "NAND");
+    printf("Cached %zu album files for %s storage\n", albumFiles.size(), location == CapsAlbumStorage_Sd ? "SD" : "NAND");
 #endif
 }
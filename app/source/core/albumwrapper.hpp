@@ -29,52 +29,514 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <switch.h>
-
-// Defines how many items should be returned per page
+#include <unordered_map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "platform.hpp"
+#include "http.hpp"
+#include "albumbackend.hpp"
+#include "titlecache.hpp"
+#include "jsonwriter.hpp"
+#include "gallerycache.hpp"
+#include "entrybitmap.hpp"
+#include "titlesearch.hpp"
+
+// Defines how many items should be returned per page, unless a limit is asked for
 #define CONTENT_PER_PAGE 21
 
+// The most items a client may ask for per page
+#define GALLERY_MAX_PAGE_SIZE 5000
+
+// Gallery pages with more entries than this are written while they're sent, in chunks
+#define GALLERY_STREAM_MIN_ENTRIES 256
+
+// How much JSON of a gallery page sent in chunks is written at once
+#define GALLERY_STREAM_CHUNK_SIZE (32 * 1024)
+
+// How many orders of filtered selections are kept at most. Each one takes an int per selected entry
+#define GALLERY_FILTERED_ORDER_CACHE_SIZE 8
+
+// How often (in milliseconds) the album thread checks whether files were added to or removed from the album
+#define ALBUM_CHECK_INTERVAL_MS 2000
+
+// Roughly how much JSON a gallery page takes, without and per entry. Used to size the output up front
+#define GALLERY_JSON_BASE_SIZE 256
+#define GALLERY_JSON_ENTRY_SIZE 256
+
+// Videos are read in blocks of this size
+#define VIDEO_STREAM_BLOCK_SIZE 0x40000
+
+// Album files read straight from the filesystem are read in blocks of this size, aligned to it
+#define ALBUM_FILE_BLOCK_SIZE 0x40000
+
+// The alignment of read-ahead blocks in memory
+#define READ_AHEAD_BLOCK_ALIGNMENT 0x1000
+
+// How many blocks of a file are kept in memory. While one of them is sent, the others are
+// read ahead. Two is enough to keep the storage and the network busy at the same time
+#define READ_AHEAD_BLOCK_COUNT 2
+
+// How many threads read ahead for all readers together. Every connection reading a file shares them,
+// so a few are enough to keep the storage busy, and there are only so many threads on the Switch
+#define READ_AHEAD_THREAD_COUNT 4
+
 namespace nxgallery::core
 {
+    class CReadAheadReader;
+
+    // The threads reading ahead for every CReadAheadReader. Readers which need a block are queued, and
+    // each thread takes the first reader of the queue, reads one block for it and queues it at the end
+    // again if it needs more, so connections take turns. If no thread could be started, the blocks are
+    // read on the thread borrowing them instead, which is slower but still works
+    class CReadAheadWorker
+    {
+    public:
+        // Returns the singleton instance of the worker
+        static CReadAheadWorker* Get();
+
+        // Starts the threads, unless they're running already
+        void Start();
+
+        // Stops the threads. Readers which are still around read on the thread borrowing from them
+        void Stop();
+
+    private:
+        friend class CReadAheadReader;
+
+        // Queues a reader if it needs a block read, or reads the block right away without threads. The
+        // lock needs to hold the mutex
+        void Schedule(CReadAheadReader* reader, std::unique_lock<std::mutex>& lock);
+
+        // Takes a reader out of the queue and waits until no thread reads for it anymore
+        void Cancel(CReadAheadReader* reader);
+
+        // Opens the reader if that didn't happen yet, and reads its next block. The lock needs to hold the
+        // mutex, which is released while reading
+        void ReadNext(CReadAheadReader* reader, std::unique_lock<std::mutex>& lock);
+
+        // Runs on each thread, reads for the queued readers
+        void ThreadMain();
+
+    private:
+        // The threads, and the readers waiting for one of them
+        std::vector<std::thread> threads;
+        std::deque<CReadAheadReader*> queue;
+
+        // Locks the queue and the state of all readers and their blocks
+        std::mutex mutex;
+
+        // Signalled when a reader is queued, and when a thread is done reading for a reader
+        std::condition_variable queueCondition;
+        std::condition_variable readCondition;
+
+        // Tells the threads to exit
+        bool shouldStop = false;
+
+        // Singleton instance of the CReadAheadWorker
+        static CReadAheadWorker* singleton;
+    };
+
+    // Reads something in blocks, which are kept in a small ring. The CReadAheadWorker reads the blocks
+    // following the one currently being sent, so reading and sending over the network happen at the
+    // same time instead of taking turns. The network thread never waits for a read, blocks which aren't
+    // there yet are borrowed again once CContentWakeup says so
+    class CReadAheadReader
+    {
+    public:
+        virtual ~CReadAheadReader();
+
+        // Points outData at up to maxBytes bytes starting at offset, straight inside the block holding
+        // them, so nothing is copied. Never returns more than what's left of that block. The data stays
+        // valid until the next call. Returns HTTP_BORROW_PENDING if the block isn't read yet
+        // (CContentWakeup is signalled once it is), and 0 if reading it failed
+        u64 Borrow(u64 offset, u64 maxBytes, const char** outData);
+
+        // Moves the position the blocks are read ahead from. Borrow does this by itself, so this is
+        // only needed to get reading started before the data is actually needed
+        void Seek(u64 offset);
+
+        // Returns whether reading a block failed at some point. The block is read again when it's
+        // borrowed the next time, but a reader which failed once shouldn't be kept around for reuse
+        bool HasFailed();
+
+    protected:
+        // Takes the size of the blocks, which are read at offsets aligned to it
+        CReadAheadReader(u64 inBlockSize);
+
+        // Allocates the blocks and starts reading ahead from the start, once the size is known. What
+        // fits into one block only gets one block of its size, which is read in one go
+        void StartReadAhead(u64 inSize);
+
+        // Stops reading ahead. Subclasses need to call this in their destructor, before anything
+        // OpenBlocks or ReadBlock use goes away
+        void StopReadAhead();
+
+        // Opens what the blocks are read from, returns whether it worked. Runs on a read-ahead thread
+        // before the first block is read, every block fails if it didn't work
+        virtual bool OpenBlocks() { return true; }
+
+        // Reads up to maxBytes at offset into data, returns whether it worked. Runs on a read-ahead thread
+        virtual bool ReadBlock(u64 offset, unsigned char* data, u64 maxBytes, u64* outSize) = 0;
+
+    private:
+        friend class CReadAheadWorker;
+
+        // One block of the ring
+        struct SBlock
+        {
+            // The memory the block is read into
+            unsigned char* data = NULL;
+
+            // Which block this holds (its offset divided by the block size), -1 if none
+            s64 index = -1;
+
+            // How many bytes of the block are valid, once it's read
+            u64 size = 0;
+
+            // Whether the block is read and can be borrowed, or reading it failed
+            bool isReady = false;
+            bool hasFailed = false;
+        };
+
+        // Returns the first block from the current position on which doesn't hold what it should, and
+        // which block that is, or NULL if all of them do
+        SBlock* FindNextBlock(s64& outIndex);
+
+    private:
+        // Size of the blocks and of what's read, and how much memory each block has
+        u64 blockSize;
+        u64 size = 0;
+        u64 blockCapacity = 0;
+
+        // The ring of blocks, of which the first blockCount are used. The block with index i always goes
+        // into blocks[i % blockCount]
+        SBlock blocks[READ_AHEAD_BLOCK_COUNT];
+        u32 blockCount = 0;
+
+        // Index of the block which was borrowed last, the blocks from here on are read ahead
+        s64 currentIndex = 0;
+
+        // Whether a borrow found its block not read yet, so the network thread needs to be woken up
+        // once the next block is done
+        bool isBorrowPending = false;
+
+        // Whether a borrow found its block failed, see HasFailed
+        bool hasFailed = false;
+
+        // Whether reading ahead is started and not stopped yet, whether the reader waits in the worker's
+        // queue, and whether a thread reads for it right now
+        bool isStarted = false;
+        bool isQueued = false;
+        bool isReading = false;
+
+        // Whether OpenBlocks was called, and whether it worked
+        bool isOpened = false;
+        bool hasOpenFailed = false;
+    };
+
     // This class is responsible for reading videos as we access them
-    // in a stream-like format through capsa. 
+    // in a stream-like format through the album backend (capsa on the Switch).
     // Full credit goes to HookedBehemoth and his ShareNX project :)
-    class CVideoStreamReader
+    class CVideoStreamReader : public CReadAheadReader
     {
     public:
         // Constructor and destructor
         CVideoStreamReader(const CapsAlbumEntry& inAlbumEntry);
         ~CVideoStreamReader();
 
+        // Returns whether the movie stream could be opened
+        bool IsOpen();
+
+        // Returns the ID of the file this stream reads
+        const CapsAlbumFileId& GetFileId();
+
         // Returns the size of the whole video stream (= size of the video file)
         u64 GetStreamSize();
 
-        // Reads a number of bytes from the stream. Won't read more data than the internal
-        // workbuffer allows
-        u64 Read(char* outBuffer, u64 numBytes);
+    protected:
+        bool ReadBlock(u64 offset, unsigned char* data, u64 maxBytes, u64* outSize) override;
 
     private:
         // The album entry we're reading video data for
         CapsAlbumEntry albumEntry;
 
-        // Size of the work buffer
-        u64 workBufferSize = 0x40000;
+        // Handle for the movie stream, returned by the album backend
+        u64 streamHandle = 0;
+
+        // Whether the movie stream could be opened
+        bool isOpen = false;
+
+        // Size of the stream, returned by the album backend and cached at start
+        u64 streamSize = 0;
+    };
+
+    // Content source which reads a video through a CVideoStreamReader while it's being sent, so
+    // only the parts of the video a client asks for are read. The reader comes from the
+    // CVideoStreamPool and goes back there once the source is done
+    class CVideoStreamSource : public IContentSource
+    {
+    public:
+        CVideoStreamSource(const CapsAlbumEntry& albumEntry);
+        ~CVideoStreamSource();
+
+        u64 GetSize() override;
+        u64 Borrow(u64 offset, u64 maxBytes, const char** outData) override;
+
+    private:
+        // Reads the video, nullptr if the stream couldn't be opened
+        std::unique_ptr<CVideoStreamReader> reader;
+    };
+
+    // The orders gallery pages can be sorted in. Entries which are equal in what they're sorted by
+    // are shown newest first
+    enum class EGallerySort
+    {
+        // By when the entries were taken, which is the order of the IDs (or the other way round)
+        Newest,
+        Oldest,
+
+        // By file size
+        Largest,
+        Smallest,
+
+        // By the name of the game they were taken in, from A to Z
+        Game,
+
+        Count
+    };
+
+    // The album entries gallery pages are picked from: either the whole album, or the entries matching
+    // a filter, in some order. Positions within a selection count its entries in that order
+    struct SGallerySelection
+    {
+        // The filter and order as text, which tells selections apart (empty for the whole album, newest first)
+        std::string filter;
+
+        // The matching entries, nullptr for the whole album
+        std::shared_ptr<const CEntryBitmap> entries;
+
+        // The order the entries are in, and the IDs of the selected entries in that order (nullptr for newest
+        // first, as that's the order of the IDs themselves)
+        EGallerySort sort = EGallerySort::Newest;
+        std::shared_ptr<const std::vector<int>> order;
+    };
+
+    // Content source writing the JSON of a gallery page while it's sent, a few entries at a time, so
+    // big pages never need to be in memory as a whole. It doesn't know its size until it's written
+    // the last entry, so it's sent in chunks
+    class CGallerySource : public IContentSource
+    {
+    public:
+        // Takes the IDs of the entries to write, how many entries the selection has and how many entries
+        // pages have, and the cursor the next page is asked for with (empty if there's none)
+        CGallerySource(std::vector<int>&& inIds, int inTotal, int inPageSize, std::string&& inNextCursor);
+
+        u64 GetSize() override;
+        u64 Borrow(u64 offset, u64 maxBytes, const char** outData) override;
+
+    private:
+        // Writes the next part of the page into the buffer, replacing what was in there
+        void GenerateNext();
+
+    private:
+        // The entries to write, and which of them is written next
+        std::vector<int> ids;
+        size_t nextIndex = 0;
+
+        // How many entries the selection has and pages have, and where the next page continues
+        int total;
+        int pageSize;
+        std::string nextCursor;
+
+        // The part of the page written last, and where in the page it starts
+        std::string buffer;
+        u64 bufferOffset = 0;
 
-        // The work buffer
-        unsigned char* workBuffer;
+        // Writes into the buffer
+        CJsonWriter writer { buffer };
 
-        // Handle for the movie stream, returned by capsaOpenAlbumMovieStream
+        // The album generation the IDs belong to. Once the album is cached again they might refer to other
+        // files, so the page is cut short
+        u32 generation;
+
+        // Whether the start of the page is written, and when that was
+        bool hasStarted = false;
+        std::chrono::steady_clock::time_point startTime;
+
+        // Size of the whole page, once the end is written
+        u64 size = HTTP_SIZE_UNKNOWN;
+    };
+
+    // Content source reading an album file straight from the SD card or NAND. The file is read in
+    // large blocks at aligned offsets, which is what the storage is fastest with, ahead of where it's
+    // sent by the CReadAheadWorker. Finding and opening the file happens there as well, so the network
+    // thread never touches the storage. Files which can't be found there are read through capsa instead
+    class CAlbumFileSource : public IContentSource, private CReadAheadReader
+    {
+    public:
+        // Takes the album entry to read, whose size is the size of the content
+        CAlbumFileSource(const CapsAlbumEntry& inAlbumEntry);
+        ~CAlbumFileSource();
+
+        u64 GetSize() override;
+        u64 Borrow(u64 offset, u64 maxBytes, const char** outData) override;
+
+    protected:
+        bool OpenBlocks() override;
+        bool ReadBlock(u64 offset, unsigned char* data, u64 maxBytes, u64* outSize) override;
+
+    private:
+        // The album entry we're reading
+        CapsAlbumEntry albumEntry;
+
+        // The file to read from, -1 if it's read through capsa. Only touched by the read-ahead threads
+        int fileDescriptor = -1;
+
+        // What's read through capsa instead: the movie stream of a video, or the whole screenshot, as
+        // capsa only loads them as a whole
         u64 streamHandle = 0;
+        bool isStreamOpen = false;
+        std::string loadedContent;
+    };
 
-        // How many bytes have been read until now
+    // Where the album wrapper reads the content of album files from
+    enum class EContentBackend
+    {
+        // Through the capsa service, which works for every file but copies everything over IPC
+        Capsa,
+
+        // Straight from the album directories on the SD card and NAND. Files which can't be
+        // found there are still read through capsa
+        Filesystem
+    };
+
+    // Statistics about how fast a content backend reads
+    struct SContentBackendStats
+    {
+        // How many files were opened through the backend
+        u64 filesOpened = 0;
+
+        // How many bytes were read and how long that took in total
         u64 bytesRead = 0;
+        u64 readTimeNs = 0;
 
-        // Size of the stream, returned by capsaGetAlbumMovieStreamSize and cached at start
-        u64 streamSize = 0;
+        // How many files the backend couldn't find and left to capsa
+        u64 fallbacks = 0;
+    };
 
-        // Index of the last work buffer
-        u32 lastBufferIndex = -1;
+    // One day or month of the album's timeline
+    struct STimelineBucket
+    {
+        // The day (YYYYMMDD) or month (YYYYMM)
+        u32 date;
+
+        // How many entries were taken then
+        u32 count;
+
+        // The ID of the newest of them
+        int firstId;
+    };
+
+    // What the album has of one title
+    struct STitleStats
+    {
+        // How many screenshots and videos there are, and how many bytes they take
+        u32 screenshotCount = 0;
+        u32 videoCount = 0;
+        u64 totalBytes = 0;
+
+        // The IDs of the newest and the oldest entry
+        int newestId = -1;
+        int oldestId = -1;
+    };
+
+    // Everything the gallery shows about the album entries, worked out once when the album is cached.
+    // Every array has one element per entry, by ID, so building a gallery page only reads through a
+    // few contiguous arrays instead of asking the system about every entry again
+    struct SAlbumIndex
+    {
+        // When the entries were taken, as UNIX timestamps
+        std::vector<s64> timestamps;
+
+        // When the entries were taken, as YYYYMMDDhhmmssII decimal numbers (II counts up within the second)
+        // Unlike the timestamps, these also tell apart entries taken within the same second
+        std::vector<u64> captureTimes;
+
+        // Sizes of the files in bytes
+        std::vector<u64> fileSizes;
+
+        // What the entries are (CapsAlbumFileContents) and where they're stored (CapsAlbumStorage)
+        std::vector<u8> contents;
+        std::vector<u8> storages;
+
+        // Which of the titles below each entry was taken in
+        std::vector<u16> titles;
+
+        // Where the key and filename of each entry start in the strings. Each key ends where the
+        // filename of the same entry starts, each filename where the key of the next entry starts.
+        // keyOffsets has an extra element at the end for where the last filename ends
+        std::vector<u32> keyOffsets;
+        std::vector<u32> fileNameOffsets;
+
+        // The keys and filenames of all entries, one after another
+        std::string strings;
+
+        // The titles the album entries were taken in, their names (owned by the title cache) and what
+        // the album has of them
+        std::vector<u64> titleIds;
+        std::vector<const std::string*> titleNames;
+        std::vector<STitleStats> titleStats;
+
+        // Maps title IDs to where they are in the titles above
+        std::unordered_map<u64, u16> titleIndices;
+
+        // How many entries were taken on each day and in each month, newest first. Days and months
+        // without entries are left out
+        std::vector<STimelineBucket> timelineDays;
+        std::vector<STimelineBucket> timelineMonths;
+
+        // Which entries were taken in each of the titles above, have each kind of content
+        // (CapsAlbumFileContents) and are stored on each storage (CapsAlbumStorage)
+        std::vector<CEntryBitmap> titleEntries;
+        CEntryBitmap contentEntries[4];
+        CEntryBitmap storageEntries[2];
+
+        // Returns the key and the filename of an entry, which point into the strings
+        std::string_view GetKey(int id) const;
+        std::string_view GetFileName(int id) const;
+
+        // Returns how many bytes the index takes
+        u64 GetMemoryUsage() const;
+    };
+
+    // Everything cached about the album. It's built as a whole, on the album thread once the album
+    // changed, and then swapped in by the network thread, so requests never wait for it to be built
+    struct SAlbumCache
+    {
+        // The album entries, newest first. Their position is their ID
+        std::vector<CapsAlbumEntry> entries;
+
+        // What the gallery shows about the entries
+        SAlbumIndex index;
+
+        // Maps the keys of all entries (in the index) to their ID
+        std::unordered_map<std::string_view, int> keys;
+
+        // The JSON of the /games endpoint
+        std::shared_ptr<SCachedResponse> gamesContent;
+
+        // How many videos and photos there are
+        int screenshotCount = 0;
+        int videoCount = 0;
+
+        // How many files the NAND and the SD album held when they were listed, by CapsAlbumStorage
+        u64 fileCounts[2] = {};
     };
 
     // This class will help NXGallery with the Switch'es album.
@@ -87,57 +549,271 @@ namespace nxgallery::core
         // We use a singleton so the web server can access it
         static CAlbumWrapper* Get();
 
-        // Initializes the album wrapper
-        void Init();
+        // Initializes the album wrapper on top of the given backend, which it takes ownership of
+        void Init(std::unique_ptr<IAlbumBackend> inBackend);
 
         // Shuts down the album wrapper
         void Shutdown();
 
+        // Returns the backend the album is read through
+        IAlbumBackend* GetBackend();
+
         // Returns all paths where the Switch stores album content
         std::vector<const char*> GetAlbumContentPaths();
 
+        // Sets where file content is read from. Can be changed at any time, requests which are
+        // already being answered keep using the backend they started with
+        void SetContentBackend(EContentBackend backend);
+        EContentBackend GetContentBackend();
+
+        // Returns the statistics of the given backend
+        SContentBackendStats GetContentBackendStats(EContentBackend backend);
+
+        // Adds a read to the statistics of the given backend. Safe to call from any thread
+        void RecordContentRead(EContentBackend backend, u64 bytesRead, u64 readTimeNs);
+
+        // Adds a file opened through the given backend, or one the filesystem left to capsa, to the
+        // statistics. Safe to call from any thread
+        void RecordContentOpened(EContentBackend backend);
+        void RecordContentFallback();
+
+        // Finds the path of an album file in the album directories. Returns an empty string if there's no
+        // such file. Paths are remembered until the album is cached again. Safe to call from any thread
+        std::string FindAlbumFilePath(const CapsAlbumFileId& fileId);
+
+        // Selects the entries taken in a game (its title ID in hex), of a type ("screenshot", "video" or
+        // "extra") and stored on a storage ("sd" or "nand"), by intersecting the bitmaps of the album
+        // index. Filters which are empty don't narrow down the selection. The entries are sorted by
+        // sort ("newest", the default, "oldest", "largest", "smallest" or "game"). Returns false if one
+        // of them isn't valid
+        bool SelectGalleryEntries(std::string_view game, std::string_view type, std::string_view storage, std::string_view sort, SGallerySelection& outSelection);
+
+        // Returns how many entries a selection has
+        int GetSelectionSize(const SGallerySelection& selection);
+
         // Basically, the logic behind the /gallery endpoint as a backend API
-        // Contains a JSON-stringified array of gallery content
-        std::string GetGalleryContent(int page);
+        // Returns the JSON of the gallery page with pageSize entries of the selection, starting at the given
+        // position. It's cached until the album changes. Big pages aren't cached but written while they're
+        // sent, nullptr is returned for them (see GetGalleryContent). Meant to be called from the network
+        // thread only
+        std::shared_ptr<SCachedResponse> GetGalleryPage(const SGallerySelection& selection, int first, int pageSize);
+
+        // Returns the JSON of a gallery page, which is written while it's sent for big pages
+        std::shared_ptr<IContentSource> GetGalleryContent(const SGallerySelection& selection, int first, int pageSize);
+
+        // Returns the position of the first entry of the given page (counting from 1), clamped to the selection
+        int GetGalleryPageStart(const SGallerySelection& selection, int page, int pageSize);
+
+        // Returns the cursor of an entry, which is what a page following that entry is asked for with
+        // The cursor is made of the entry's capture time and key (and its size if sorted by size), so it
+        // keeps pointing at the same spot of the album when new captures are added, or the entry itself
+        // is deleted
+        std::string GetGalleryCursor(const SGallerySelection& selection, int id);
+
+        // Returns the position of the first entry of the selection after the one the cursor points at,
+        // which is found with a binary search over the selection's order. Returns -1 if the cursor isn't valid,
+        // or if the selection is sorted by game and the cursor's game has no entries in the album
+        int FindGalleryCursor(const SGallerySelection& selection, std::string_view cursor);
+
+        // Returns the position of the newest (oldest if sorted that way) entry of the selection taken in
+        // the given year, month or day (YYYY, YYYY-MM or YYYY-MM-DD), or the next one in the selection's
+        // order if there's none, found with a binary search. Returns -1 if the date isn't valid, or the
+        // selection isn't sorted by time
+        int FindGalleryDate(const SGallerySelection& selection, std::string_view date);
+
+        // The logic behind the /games endpoint, returns every game the album has entries of with how many
+        // screenshots and videos there are, how many bytes they take, when they were taken and which entry
+        // is the newest (to show as cover), most recently played first. The JSON is written whenever the
+        // album is cached, so this only hands it out
+        std::shared_ptr<SCachedResponse> GetGames();
+
+        // The logic behind the /search endpoint, returns the games of the album whose name contains the
+        // query (ignoring case) as JSON, with what the album has of them and where their entries are. Games
+        // whose name starts with the query come first, then the most recently played
+        std::string GetSearchContent(std::string_view query);
+
+        // The logic behind the /timeline endpoint, returns how many entries were taken on which days and
+        // in which months as JSON. It's cached until the album changes. Meant to be called from the network
+        // thread only
+        std::shared_ptr<SCachedResponse> GetTimeline();
+
+        // Write the parts of a gallery page: everything up to the entries, one entry, and the rest
+        // The page is picked from a selection with total entries. The next page is asked for with nextCursor,
+        // which is empty if there's no next page
+        void BeginGalleryContent(CJsonWriter& writer, int total, int pageSize);
+        void WriteGalleryEntry(CJsonWriter& writer, int id);
+        void EndGalleryContent(CJsonWriter& writer, const std::string& nextCursor, double indexTime);
 
         // Returns the readable name of the given title ID by looking at the nacp or at system titles
-        std::string GetTitleName(u64 titleId);
+        // Every title is only looked up once, see CTitleCache
+        const std::string& GetTitleName(u64 titleId);
+
+        // Returns how many entries the album has, valid IDs are 0 up to (excluding) this
+        int GetAlbumEntryCount();
+
+        // Returns a number which changes whenever the album cache is rebuilt, so anything derived
+        // from it (like gallery pages) can be told apart from older versions
+        u32 GetAlbumGeneration();
+
+        // Caches the album again if files were added to or removed from it since it was listed last, which
+        // is told by how many files each storage holds. The new cache is used once ApplyGalleryContent
+        // swaps it in. Returns whether the album was cached again. A file deleted and another one taken in
+        // between two calls isn't noticed. Can be called from any thread, the album thread calls it every
+        // ALBUM_CHECK_INTERVAL_MS
+        bool RefreshGalleryContent();
+
+        // Swaps in the cache RefreshGalleryContent built last, if it wasn't swapped in yet, and returns
+        // whether there was one. This only takes as long as swapping and adding new titles to the search.
+        // Meant to be called from the network thread only, which does so on every iteration
+        bool ApplyGalleryContent();
+
+        // Returns the stable key of an album entry. Unlike the ID, which is only an index into the
+        // current cache, the key is derived from the CapsAlbumFileId and never changes for a file
+        // The key stays valid until the album is cached again
+        std::string_view GetAlbumEntryKey(int id);
+
+        // Returns the ID of the album entry with the given key, or -1 if there is none
+        int FindAlbumEntryByKey(std::string_view key);
 
         // Returns the album entry for a given ID (useful for querying type)
         CapsAlbumFileContents GetAlbumEntryType(int id);
 
         // Returns the filename for an album entry so the frontend can download under that filename
-        std::string GetAlbumEntryFilename(int id);
+        // The filename stays valid until the album is cached again
+        std::string_view GetAlbumEntryFilename(int id);
 
         // Returns the raw file content of a file's thumbnail (JPEG)
         bool GetFileThumbnail(int id, void* outBuffer, u64 bufferSize, u64* outActualImageSize);
 
-        // Returns the raw file content of a file's main content file (JPEG/mp4)
-        bool GetFileContent(int id, void* outBuffer, u64 bufferSize, u64* outActualFileSize);
+        // Returns the content of a file's main content file (JPEG/mp4), or nullptr if it couldn't be loaded
+        // Videos are streamed while they're sent, so the memory this takes doesn't depend on the file's size
+        std::shared_ptr<IContentSource> GetFileContent(int id);
 
     private:
         // Cache all gallery images upon startup and store them so we won't have
         // to look up the gallery content everytime a request happens
         void CacheGalleryContent();
 
-        // Caches a specified album in a specified cache
-        void CacheAlbum(CapsAlbumStorage location, std::vector<CapsAlbumEntry>& outCache);
+        // Lists the album and works out everything the gallery shows about it. Only touches the cache
+        // it builds, so it can run on any thread
+        void BuildAlbumCache(SAlbumCache& outCache);
+
+        // Makes a cache the current one, and everything derived from the one before outdated
+        void SwapAlbumCache(std::unique_ptr<SAlbumCache> cache);
+
+        // Runs on the album thread, checks whether the album changed every ALBUM_CHECK_INTERVAL_MS
+        void AlbumThreadMain();
+
+        // Returns the IDs of the entries of a selection from position first up to (excluding) end
+        void GetSelectionIds(const SGallerySelection& selection, int first, int end, std::vector<int>& outIds);
+
+        // Returns the position within a selection sorted newest first of the first of its entries with the
+        // given ID or a higher one, so the first one which isn't newer
+        int GetSelectionPosition(const SGallerySelection& selection, int id);
+
+        // Writes the JSON of a gallery page with the given entries in one go
+        std::string WriteGalleryPage(const std::vector<int>& ids, int total, int pageSize, const std::string& nextCursor);
+
+        // Everything entries are sorted by
+        struct SSortValues
+        {
+            u64 captureTime;
+            u64 fileSize;
+            const std::string* titleName;
+            std::string_view key;
+        };
+
+        // Returns what an entry is sorted by
+        SSortValues GetSortValues(int id);
+
+        // Returns whether an entry with the values a comes before one with the values b in the given order
+        static bool IsSortedBefore(EGallerySort sort, const SSortValues& a, const SSortValues& b);
+
+        // Returns the IDs of the whole album in the given order, sorting them the first time the order is
+        // asked for in this album generation. Returns nullptr for newest first
+        std::shared_ptr<const std::vector<int>> GetSortOrder(EGallerySort sort);
+
+        // Returns the IDs of the given entries in the given order, which isn't newest first. They're picked
+        // out of the order of the whole album the first time the filter is asked for in this album generation
+        std::shared_ptr<const std::vector<int>> GetFilteredSortOrder(const std::string& filter, const CEntryBitmap& entries, EGallerySort sort);
+
+        // Lists the album of a storage into outEntries, newest first, and counts it into the cache
+        void CacheAlbum(CapsAlbumStorage location, SAlbumCache& cache, std::vector<CapsAlbumEntry>& outEntries);
+
+        // Builds the album index of a cache from its entries
+        void BuildAlbumIndex(SAlbumCache& cache);
+
+        // Writes the JSON of the /games endpoint from the album index of a cache
+        static void BuildGamesContent(SAlbumCache& cache);
+
+        // Returns the album directory of the given storage
+        const char* GetAlbumDir(CapsAlbumStorage storage);
 
-        // Returns the directory of the screenshot files based on the current installation type
-        std::string GetScreenshotDir();
 
     private:
-        // Holds the filesystem of the internal NAND storage
-        FsFileSystem nandFileSystem;
+        // What the album is read through
+        std::unique_ptr<IAlbumBackend> albumBackend;
+
+        // The names of all titles looked up so far
+        CTitleCache titleCache;
+
+        // Everything cached about the album, for the current album generation
+        std::unique_ptr<SAlbumCache> albumCache = std::make_unique<SAlbumCache>();
+
+        // The cache RefreshGalleryContent built last, until ApplyGalleryContent swaps it in. Locked by albumCacheMutex
+        std::unique_ptr<SAlbumCache> pendingAlbumCache;
+        std::mutex albumCacheMutex;
+
+        // Whether there's a pending cache, so the network thread doesn't need to lock to find out
+        std::atomic<bool> hasPendingAlbumCache { false };
+
+        // Only one cache is built at a time. Also locks how many files the album held when it was listed last
+        std::mutex refreshMutex;
+        u64 listedFileCounts[2] = {};
+
+        // The thread checking whether the album changed, and what tells it to stop
+        std::thread albumThread;
+        std::mutex albumThreadMutex;
+        std::condition_variable albumThreadCondition;
+        bool shouldStopAlbumThread = false;
+
+        // Incremented whenever the cache is rebuilt
+        u32 albumGeneration = 0;
 
-        // Holds all album content in cache
-        std::vector<CapsAlbumEntry> cachedAlbumContent;
+        // The gallery pages sent so far, for the current album generation
+        CGalleryPageCache galleryPageCache;
+
+        // The names of every title the album had entries of since launch, to search them. Titles are
+        // added whenever the album is cached and has new ones, so it's never built from scratch
+        CTitleSearchIndex titleSearch;
+
+        // The timeline sent last, and the album generation it belongs to
+        std::shared_ptr<SCachedResponse> cachedTimeline;
+        u32 cachedTimelineGeneration = 0;
+
+        // The IDs of the album in each order asked for so far, and the album generation they belong to
+        std::shared_ptr<const std::vector<int>> sortOrders[(int)EGallerySort::Count];
+        u32 sortOrderGenerations[(int)EGallerySort::Count] = {};
+
+        // The IDs of the filtered selections asked for last in their order, by filter (which has the sort
+        // in it), least recently used first. They belong to the album generation below
+        std::deque<std::pair<std::string, std::shared_ptr<const std::vector<int>>>> filteredSortOrders;
+        u32 filteredSortOrderGeneration = 0;
+
+        // The paths FindAlbumFilePath found so far, by the key of the file. Locked by filePathMutex, as
+        // files are opened on the read-ahead threads
+        std::unordered_map<std::string, std::string> cachedFilePaths;
+        std::mutex filePathMutex;
+
+        // Where file content is read from
+        std::atomic<EContentBackend> contentBackend { EContentBackend::Filesystem };
+
+        // Statistics of both backends, locked by statsMutex as reads are recorded from the read-ahead threads
+        SContentBackendStats capsaStats;
+        SContentBackendStats filesystemStats;
+        std::mutex statsMutex;
 
         // Singleton instance of the CAlbumWrapper
         static CAlbumWrapper* singleton;
-
-        // Holds counts for videos and photos
-        int screenshotCount = 0;
-        int videoCount = 0;
     };
 }
@@ -0,0 +1,67 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "assets.hpp"
+using namespace nxgallery::core;
+
+// CEmbeddedAssets::Find and CEmbeddedAssets::GetCount are generated by tools/embedwww.py
+
+const char* CEmbeddedAssets::GetMimeType(std::string_view path)
+{
+    // Content types by file extension, keep in sync with MIME_TYPES in tools/embedwww.py
+    static const struct { std::string_view extension; const char* mimeType; } mimeTypes[] = {
+        { ".html", "text/html; charset=utf-8" },
+        { ".js", "application/javascript; charset=utf-8" },
+        { ".css", "text/css; charset=utf-8" },
+        { ".json", "application/json" },
+        { ".map", "application/json" },
+        { ".txt", "text/plain; charset=utf-8" },
+        { ".png", "image/png" },
+        { ".jpg", "image/jpeg" },
+        { ".jpeg", "image/jpeg" },
+        { ".gif", "image/gif" },
+        { ".svg", "image/svg+xml" },
+        { ".ico", "image/x-icon" },
+        { ".woff", "font/woff" },
+        { ".woff2", "font/woff2" },
+        { ".ttf", "font/ttf" },
+    };
+
+    size_t dot = path.rfind('.');
+    if (dot != std::string_view::npos)
+    {
+        std::string_view extension = path.substr(dot);
+        for (const auto& entry : mimeTypes)
+        {
+            if (entry.extension == extension)
+                return entry.mimeType;
+        }
+    }
+
+    return "application/octet-stream";
+}
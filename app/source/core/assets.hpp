@@ -0,0 +1,95 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <string_view>
+#include "platform.hpp"
+
+namespace nxgallery::core
+{
+    // One encoding of an embedded asset
+    struct SEmbeddedAssetVariant
+    {
+        // The raw content in this encoding, nullptr if there is no such variant
+        const unsigned char* data;
+        u64 size;
+
+        // Value for the ETag header, derived from the content and unique per encoding
+        const char* etag;
+    };
+
+    // One static web asset which is compiled into the executable
+    struct SEmbeddedAsset
+    {
+        // The URL path this asset is served under, such as "/index.html"
+        std::string_view path;
+
+        // Value for the Content-Type header
+        const char* mimeType;
+
+        // The asset as it is, and precompressed with gzip and brotli. The compressed variants only
+        // exist if they turned out smaller, see tools/embedwww.py
+        SEmbeddedAssetVariant identity;
+        SEmbeddedAssetVariant gzip;
+        SEmbeddedAssetVariant brotli;
+
+        // Returns whether there are compressed variants of this asset
+        constexpr bool HasCompressedVariants() const { return gzip.data || brotli.data; }
+    };
+
+    // Hash function used for the perfect hash over the asset paths. tools/embedwww.py picks a
+    // seed for which no two assets collide, so a lookup is one hash and one string compare
+    constexpr u32 HashAssetPath(std::string_view path, u32 seed)
+    {
+        // FNV-1a with the seed mixed into the offset basis
+        u32 hash = 2166136261u ^ seed;
+        for (char c : path)
+        {
+            hash ^= (unsigned char)c;
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+
+    // This class gives access to the static web assets (romfs/www) which were turned into a
+    // generated C++ table at build time (see tools/embedwww.py), so they can be served from
+    // read-only memory without any filesystem calls
+    class CEmbeddedAssets
+    {
+    public:
+        // Returns the asset served under the given path, or nullptr if there is none
+        static const SEmbeddedAsset* Find(std::string_view path);
+
+        // Returns how many assets are embedded
+        static u32 GetCount();
+
+        // Returns the Content-Type for a file based on its extension, for files which aren't embedded
+        static const char* GetMimeType(std::string_view path);
+    };
+}
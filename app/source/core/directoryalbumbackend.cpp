@@ -0,0 +1,500 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "directoryalbumbackend.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#ifndef __SWITCH__
+using namespace nxgallery::core;
+
+// Size of the control data ns copies to look up a title's name (NsApplicationControlData)
+#define DIRECTORY_CONTROL_DATA_SIZE 0x24000
+
+// Length of an album filename: "YYYYMMDDHHMMSSII-", 32 hex digits and the extension
+#define ALBUM_FILENAME_LENGTH (16 + 1 + 32 + 4)
+
+// Returns whether the first count characters of a string are all decimal digits
+static bool IsDigits(const char* str, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (!isdigit((unsigned char)str[i]))
+            return false;
+    }
+
+    return true;
+}
+
+// Parses a decimal number out of the first count characters of a string
+static u32 ParseDigits(const char* str, int count)
+{
+    u32 number = 0;
+    for (int i = 0; i < count; i++)
+        number = number * 10 + (str[i] - '0');
+
+    return number;
+}
+
+// Parses an album filename into a file ID, returns false if it isn't one
+static bool ParseAlbumFilename(const char* name, CapsAlbumStorage storage, CapsAlbumFileId& outFileId)
+{
+    if (strlen(name) != ALBUM_FILENAME_LENGTH || !IsDigits(name, 16) || name[16] != '-')
+        return false;
+
+    for (int i = 17; i < 17 + 32; i++)
+    {
+        if (!isxdigit((unsigned char)name[i]))
+            return false;
+    }
+
+    const char* extension = name + 17 + 32;
+    if (strcmp(extension, ".jpg") == 0)
+        outFileId.content = CapsAlbumFileContents_ScreenShot;
+    else if (strcmp(extension, ".mp4") == 0)
+        outFileId.content = CapsAlbumFileContents_Movie;
+    else
+        return false;
+
+    // The first half of the hex digits is taken as the application ID
+    char applicationId[17];
+    memcpy(applicationId, name + 17, 16);
+    applicationId[16] = '\0';
+    outFileId.application_id = strtoull(applicationId, NULL, 16);
+
+    outFileId.datetime.year = ParseDigits(name, 4);
+    outFileId.datetime.month = ParseDigits(name + 4, 2);
+    outFileId.datetime.day = ParseDigits(name + 6, 2);
+    outFileId.datetime.hour = ParseDigits(name + 8, 2);
+    outFileId.datetime.minute = ParseDigits(name + 10, 2);
+    outFileId.datetime.second = ParseDigits(name + 12, 2);
+    outFileId.datetime.id = ParseDigits(name + 14, 2);
+    outFileId.storage = storage;
+    return true;
+}
+
+// Returns a string identifying the file with the given ID, to look up its path
+static std::string GetFileKey(const CapsAlbumFileId& fileId)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "%u%04u%02u%02u%02u%02u%02u%02u%u", fileId.storage,
+        fileId.datetime.year, fileId.datetime.month, fileId.datetime.day,
+        fileId.datetime.hour, fileId.datetime.minute, fileId.datetime.second, fileId.datetime.id, fileId.content);
+    return key;
+}
+
+// Returns the names of all entries of a directory whose name is made of the given number of digits, sorted
+static std::vector<std::string> ListNumberedDirectories(const std::string& path, int numDigits)
+{
+    std::vector<std::string> names;
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+        return names;
+
+    struct dirent* dirEntry;
+    while ((dirEntry = readdir(dir)) != NULL)
+    {
+        if (strlen(dirEntry->d_name) == numDigits && IsDigits(dirEntry->d_name, numDigits))
+            names.push_back(dirEntry->d_name);
+    }
+
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+CDirectoryAlbumBackend::CDirectoryAlbumBackend(const std::string& inSdAlbumDir, const std::string& inNandAlbumDir)
+    : sdAlbumDir(inSdAlbumDir), nandAlbumDir(inNandAlbumDir)
+{
+    // Make sure the directories end with a slash, so file names can simply be appended
+    if (!sdAlbumDir.empty() && sdAlbumDir.back() != '/')
+        sdAlbumDir += '/';
+    if (!nandAlbumDir.empty() && nandAlbumDir.back() != '/')
+        nandAlbumDir += '/';
+}
+
+void CDirectoryAlbumBackend::SetLatency(u64 inLatencyUs)
+{
+    latencyUs = inLatencyUs;
+}
+
+void CDirectoryAlbumBackend::SetBandwidth(u64 inBytesPerSecond)
+{
+    bytesPerSecond = inBytesPerSecond;
+}
+
+void CDirectoryAlbumBackend::FailMovieStreamReads(u32 count)
+{
+    failingMovieStreamReads = count;
+}
+
+bool CDirectoryAlbumBackend::LoadApplicationNames(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    // Every line is a title ID in hex, a space and the name
+    char line[512];
+    while (fgets(line, sizeof(line), file))
+    {
+        char* name = NULL;
+        u64 titleId = strtoull(line, &name, 16);
+        if (name == line || *name != ' ')
+            continue;
+
+        // Drop the line break
+        name++;
+        name[strcspn(name, "\r\n")] = '\0';
+        applicationNames[titleId] = name;
+    }
+
+    fclose(file);
+    return true;
+}
+
+void CDirectoryAlbumBackend::SetIsDarkTheme(bool inIsDarkTheme)
+{
+    isDarkTheme = inIsDarkTheme;
+}
+
+void CDirectoryAlbumBackend::SetCacheDir(const std::string& inCacheDir)
+{
+    cacheDir = inCacheDir;
+    if (!cacheDir.empty() && cacheDir.back() != '/')
+        cacheDir += '/';
+}
+
+void CDirectoryAlbumBackend::Init()
+{
+}
+
+void CDirectoryAlbumBackend::Shutdown()
+{
+    // Close all movie streams which are still open
+    std::lock_guard<std::mutex> lock(backendMutex);
+    for (auto& movieStream : movieStreams)
+        close(movieStream.second);
+
+    movieStreams.clear();
+}
+
+Result CDirectoryAlbumBackend::GetAlbumFileList(CapsAlbumStorage storage, std::vector<CapsAlbumEntry>& outEntries)
+{
+    outEntries.clear();
+    SimulateRead(0);
+
+    const std::string& albumDir = storage == CapsAlbumStorage_Sd ? sdAlbumDir : nandAlbumDir;
+    if (albumDir.empty())
+        return 0;
+
+    std::lock_guard<std::mutex> lock(backendMutex);
+
+    // Go through all YYYY/MM/DD directories. As they're sorted, so are the files
+    for (const std::string& year : ListNumberedDirectories(albumDir, 4))
+    {
+        for (const std::string& month : ListNumberedDirectories(albumDir + year, 2))
+        {
+            for (const std::string& day : ListNumberedDirectories(albumDir + year + "/" + month, 2))
+            {
+                std::string dayDir = albumDir + year + "/" + month + "/" + day + "/";
+                DIR* dir = opendir(dayDir.c_str());
+                if (!dir)
+                    continue;
+
+                size_t firstEntry = outEntries.size();
+                struct dirent* dirEntry;
+                while ((dirEntry = readdir(dir)) != NULL)
+                {
+                    CapsAlbumEntry entry = {};
+                    if (!ParseAlbumFilename(dirEntry->d_name, storage, entry.file_id))
+                        continue;
+
+                    std::string path = dayDir + dirEntry->d_name;
+                    struct stat fileStat;
+                    if (stat(path.c_str(), &fileStat) != 0)
+                        continue;
+
+                    entry.size = fileStat.st_size;
+                    outEntries.push_back(entry);
+                    filePaths[GetFileKey(entry.file_id)] = path;
+                }
+
+                closedir(dir);
+
+                // Files of the same day are sorted by their name, which starts with the time
+                std::sort(outEntries.begin() + firstEntry, outEntries.end(), [](const CapsAlbumEntry& a, const CapsAlbumEntry& b) {
+                    const CapsAlbumFileDateTime& x = a.file_id.datetime;
+                    const CapsAlbumFileDateTime& y = b.file_id.datetime;
+                    if (x.hour != y.hour) return x.hour < y.hour;
+                    if (x.minute != y.minute) return x.minute < y.minute;
+                    if (x.second != y.second) return x.second < y.second;
+                    return x.id < y.id;
+                });
+            }
+        }
+    }
+
+    return 0;
+}
+
+Result CDirectoryAlbumBackend::GetAlbumFileCount(CapsAlbumStorage storage, u64* outCount)
+{
+    *outCount = 0;
+    SimulateRead(0);
+
+    const std::string& albumDir = storage == CapsAlbumStorage_Sd ? sdAlbumDir : nandAlbumDir;
+    if (albumDir.empty())
+        return 0;
+
+    // Same walk as GetAlbumFileList, but without stat'ing, sorting or remembering the files
+    for (const std::string& year : ListNumberedDirectories(albumDir, 4))
+    {
+        for (const std::string& month : ListNumberedDirectories(albumDir + year, 2))
+        {
+            for (const std::string& day : ListNumberedDirectories(albumDir + year + "/" + month, 2))
+            {
+                std::string dayDir = albumDir + year + "/" + month + "/" + day + "/";
+                DIR* dir = opendir(dayDir.c_str());
+                if (!dir)
+                    continue;
+
+                struct dirent* dirEntry;
+                while ((dirEntry = readdir(dir)) != NULL)
+                {
+                    CapsAlbumFileId fileId = {};
+                    if (ParseAlbumFilename(dirEntry->d_name, storage, fileId))
+                        (*outCount)++;
+                }
+
+                closedir(dir);
+            }
+        }
+    }
+
+    return 0;
+}
+
+Result CDirectoryAlbumBackend::GetAlbumFileSize(const CapsAlbumFileId& fileId, u64* outSize)
+{
+    std::string path = GetAlbumFilePath(fileId);
+
+    struct stat fileStat;
+    if (path.empty() || stat(path.c_str(), &fileStat) != 0)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    *outSize = fileStat.st_size;
+    return 0;
+}
+
+Result CDirectoryAlbumBackend::LoadAlbumFile(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize)
+{
+    // Like capsa, only screenshots can be loaded as a whole
+    if (fileId.content != CapsAlbumFileContents_ScreenShot)
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    std::string path = GetAlbumFilePath(fileId);
+    if (path.empty())
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    return LoadFile(path, outBuffer, bufferSize, outSize);
+}
+
+Result CDirectoryAlbumBackend::LoadAlbumFileThumbnail(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize)
+{
+    std::string path = GetAlbumFilePath(fileId);
+    if (path.empty())
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    // Prefer a thumbnail next to the file, otherwise a screenshot is its own thumbnail
+    Result r = LoadFile(path + ".thumb", outBuffer, bufferSize, outSize);
+    if (R_FAILED(r) && fileId.content == CapsAlbumFileContents_ScreenShot)
+        r = LoadFile(path, outBuffer, bufferSize, outSize);
+
+    return r;
+}
+
+Result CDirectoryAlbumBackend::OpenMovieStream(const CapsAlbumFileId& fileId, u64* outStreamHandle)
+{
+    std::string path = GetAlbumFilePath(fileId);
+    if (path.empty() || fileId.content != CapsAlbumFileContents_Movie)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    SimulateRead(0);
+    int fileDescriptor = open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    std::lock_guard<std::mutex> lock(backendMutex);
+    *outStreamHandle = nextStreamHandle++;
+    movieStreams[*outStreamHandle] = fileDescriptor;
+    return 0;
+}
+
+void CDirectoryAlbumBackend::CloseMovieStream(u64 streamHandle)
+{
+    std::lock_guard<std::mutex> lock(backendMutex);
+    auto movieStream = movieStreams.find(streamHandle);
+    if (movieStream == movieStreams.end())
+        return;
+
+    close(movieStream->second);
+    movieStreams.erase(movieStream);
+}
+
+Result CDirectoryAlbumBackend::GetMovieStreamSize(u64 streamHandle, u64* outSize)
+{
+    std::unique_lock<std::mutex> lock(backendMutex);
+    auto movieStream = movieStreams.find(streamHandle);
+    if (movieStream == movieStreams.end())
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    struct stat fileStat;
+    if (fstat(movieStream->second, &fileStat) != 0)
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    *outSize = fileStat.st_size;
+    return 0;
+}
+
+Result CDirectoryAlbumBackend::ReadMovieStream(u64 streamHandle, u64 offset, void* outBuffer, u64 bufferSize, u64* outSize)
+{
+    int fileDescriptor = -1;
+    {
+        std::lock_guard<std::mutex> lock(backendMutex);
+        auto movieStream = movieStreams.find(streamHandle);
+        if (movieStream == movieStreams.end())
+            return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+        fileDescriptor = movieStream->second;
+    }
+
+    u32 failingReads = failingMovieStreamReads;
+    while (failingReads > 0 && !failingMovieStreamReads.compare_exchange_weak(failingReads, failingReads - 1));
+    if (failingReads > 0)
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    // pread doesn't move a shared file position, so several threads could read the same stream
+    ssize_t bytesRead = pread(fileDescriptor, outBuffer, bufferSize, offset);
+    if (bytesRead < 0)
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    SimulateRead(bytesRead);
+    *outSize = bytesRead;
+    return 0;
+}
+
+Result CDirectoryAlbumBackend::GetApplicationName(u64 titleId, std::string& outName)
+{
+    // On the Switch, this copies the whole control data of the title, icon included
+    SimulateRead(DIRECTORY_CONTROL_DATA_SIZE);
+
+    auto applicationName = applicationNames.find(titleId);
+    if (applicationName == applicationNames.end())
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    outName = applicationName->second;
+    return 0;
+}
+
+Result CDirectoryAlbumBackend::GetIsDarkTheme(bool* outIsDarkTheme)
+{
+    *outIsDarkTheme = isDarkTheme;
+    return 0;
+}
+
+const char* CDirectoryAlbumBackend::GetAlbumDir(CapsAlbumStorage storage)
+{
+    return storage == CapsAlbumStorage_Sd ? sdAlbumDir.c_str() : nandAlbumDir.c_str();
+}
+
+const char* CDirectoryAlbumBackend::GetCacheDir()
+{
+    return cacheDir.c_str();
+}
+
+void CDirectoryAlbumBackend::SimulateRead(u64 numBytes)
+{
+    u64 delayUs = latencyUs;
+    u64 currentBytesPerSecond = bytesPerSecond;
+    if (currentBytesPerSecond > 0)
+        delayUs += numBytes * 1000000 / currentBytesPerSecond;
+
+    if (delayUs > 0)
+        usleep(delayUs);
+}
+
+std::string CDirectoryAlbumBackend::GetAlbumFilePath(const CapsAlbumFileId& fileId)
+{
+    std::lock_guard<std::mutex> lock(backendMutex);
+    auto filePath = filePaths.find(GetFileKey(fileId));
+    return filePath != filePaths.end() ? filePath->second : std::string();
+}
+
+Result CDirectoryAlbumBackend::LoadFile(const std::string& path, void* outBuffer, u64 bufferSize, u64* outSize)
+{
+    int fileDescriptor = open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    // Like capsa, fail if the buffer is too small for the whole file
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) != 0 || (u64)fileStat.st_size > bufferSize)
+    {
+        close(fileDescriptor);
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    }
+
+    u64 totalRead = 0;
+    while (totalRead < (u64)fileStat.st_size)
+    {
+        ssize_t bytesRead = read(fileDescriptor, (char*)outBuffer + totalRead, fileStat.st_size - totalRead);
+        if (bytesRead <= 0)
+            break;
+
+        totalRead += bytesRead;
+    }
+
+    close(fileDescriptor);
+    if (totalRead != (u64)fileStat.st_size)
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    SimulateRead(totalRead);
+    *outSize = totalRead;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "albumbackend.hpp"
+
+#ifndef __SWITCH__
+
+namespace nxgallery::core
+{
+    // Album backend on top of directories laid out like the Switch's album directories, one for the
+    // SD card and one for the NAND. Files are in YYYY/MM/DD/ and named YYYYMMDDHHMMSSII-<32 hex digits>
+    // with .jpg or .mp4. On the Switch, the hex digits are the encrypted application ID, here the first
+    // 16 of them are taken as the plain application ID. Thumbnails are read from "<file>.thumb" if there
+    // is one, and screenshots serve as their own thumbnail otherwise.
+    // It's for running the server off the Switch, where there is no capsa to read the album through.
+    // Every read can be slowed down with a latency and a bandwidth limit to act like the Switch's storage
+    // and IPC, so the server can be profiled against something close to the real thing
+    class CDirectoryAlbumBackend : public IAlbumBackend
+    {
+    public:
+        // Takes the album directories of both storages, either may be empty
+        CDirectoryAlbumBackend(const std::string& inSdAlbumDir, const std::string& inNandAlbumDir);
+
+        // Adds a delay (in microseconds) to every call reading from the album
+        void SetLatency(u64 inLatencyUs);
+
+        // Limits how fast files are read, in bytes per second. 0 means unlimited
+        void SetBandwidth(u64 inBytesPerSecond);
+
+        // Makes the given number of movie stream reads from now on fail, like a capsa read can
+        void FailMovieStreamReads(u32 count);
+
+        // Reads the application names from a file with one "<16 hex digit title ID> <name>" per line
+        bool LoadApplicationNames(const char* path);
+
+        // Sets which theme is reported
+        void SetIsDarkTheme(bool inIsDarkTheme);
+
+        // Sets the directory files are kept in across launches, none if empty
+        void SetCacheDir(const std::string& inCacheDir);
+
+        void Init() override;
+        void Shutdown() override;
+
+        Result GetAlbumFileList(CapsAlbumStorage storage, std::vector<CapsAlbumEntry>& outEntries) override;
+        Result GetAlbumFileCount(CapsAlbumStorage storage, u64* outCount) override;
+        Result GetAlbumFileSize(const CapsAlbumFileId& fileId, u64* outSize) override;
+        Result LoadAlbumFile(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize) override;
+        Result LoadAlbumFileThumbnail(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize) override;
+
+        Result OpenMovieStream(const CapsAlbumFileId& fileId, u64* outStreamHandle) override;
+        void CloseMovieStream(u64 streamHandle) override;
+        Result GetMovieStreamSize(u64 streamHandle, u64* outSize) override;
+        Result ReadMovieStream(u64 streamHandle, u64 offset, void* outBuffer, u64 bufferSize, u64* outSize) override;
+
+        Result GetApplicationName(u64 titleId, std::string& outName) override;
+        Result GetIsDarkTheme(bool* outIsDarkTheme) override;
+        const char* GetAlbumDir(CapsAlbumStorage storage) override;
+        const char* GetCacheDir() override;
+
+    private:
+        // Sleeps as long as reading the given number of bytes should take with the configured latency and bandwidth
+        void SimulateRead(u64 numBytes);
+
+        // Returns the path of an album file, or an empty string if GetAlbumFileList didn't find it
+        std::string GetAlbumFilePath(const CapsAlbumFileId& fileId);
+
+        // Reads a whole file into the buffer
+        Result LoadFile(const std::string& path, void* outBuffer, u64 bufferSize, u64* outSize);
+
+    private:
+        // The album directories, ending with a slash
+        std::string sdAlbumDir;
+        std::string nandAlbumDir;
+
+        // Where files are kept across launches, ending with a slash or empty
+        std::string cacheDir;
+
+        // The simulated latency and bandwidth, which may be changed while files are read
+        std::atomic<u64> latencyUs = 0;
+        std::atomic<u64> bytesPerSecond = 0;
+
+        // How many movie stream reads are still to fail
+        std::atomic<u32> failingMovieStreamReads = 0;
+
+        // Names of the applications, by title ID
+        std::unordered_map<u64, std::string> applicationNames;
+
+        // The theme to report
+        bool isDarkTheme = true;
+
+        // The paths of all files GetAlbumFileList found, by the key of their file ID
+        std::unordered_map<std::string, std::string> filePaths;
+
+        // The file descriptors of the open movie streams, by handle
+        std::unordered_map<u64, int> movieStreams;
+        u64 nextStreamHandle = 1;
+
+        // Locks the file paths and movie streams, as the backend is used from several threads
+        std::mutex backendMutex;
+    };
+}
+
+#endif
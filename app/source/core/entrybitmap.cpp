@@ -0,0 +1,330 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "entrybitmap.hpp"
+#include <algorithm>
+#include <iterator>
+using namespace nxgallery::core;
+
+// How many 64 bit words the bits of a block take
+#define BLOCK_WORDS (ENTRY_BITMAP_BLOCK_SIZE / 64)
+
+void CEntryBitmap::SBlock::Compact()
+{
+    if (IsArray() && count > ENTRY_BITMAP_MAX_ARRAY_SIZE)
+    {
+        bits.assign(BLOCK_WORDS, 0);
+        for (u16 value : array)
+        {
+            bits[value / 64] |= 1ull << (value % 64);
+        }
+        array.clear();
+        array.shrink_to_fit();
+    }
+    else if (!IsArray() && count <= ENTRY_BITMAP_MAX_ARRAY_SIZE)
+    {
+        array.reserve(count);
+        for (u32 word = 0; word < BLOCK_WORDS; word++)
+        {
+            for (u64 wordBits = bits[word]; wordBits != 0; wordBits &= wordBits - 1)
+            {
+                array.push_back(word * 64 + __builtin_ctzll(wordBits));
+            }
+        }
+        bits.clear();
+        bits.shrink_to_fit();
+    }
+}
+
+void CEntryBitmap::Add(u32 id)
+{
+    u32 blockIndex = id / ENTRY_BITMAP_BLOCK_SIZE;
+    if (blocks.empty() || blocks.back().index != blockIndex)
+        blocks.push_back({ blockIndex, 0, {}, {} });
+
+    SBlock& block = blocks.back();
+    u16 value = id % ENTRY_BITMAP_BLOCK_SIZE;
+    if (block.IsArray())
+        block.array.push_back(value);
+    else
+        block.bits[value / 64] |= 1ull << (value % 64);
+
+    block.count++;
+    count++;
+    block.Compact();
+}
+
+u32 CEntryBitmap::GetCount() const
+{
+    return count;
+}
+
+bool CEntryBitmap::Contains(u32 id) const
+{
+    u32 blockIndex = id / ENTRY_BITMAP_BLOCK_SIZE;
+    auto block = std::lower_bound(blocks.begin(), blocks.end(), blockIndex, [](const SBlock& block, u32 index) { return block.index < index; });
+    if (block == blocks.end() || block->index != blockIndex)
+        return false;
+
+    u16 value = id % ENTRY_BITMAP_BLOCK_SIZE;
+    if (block->IsArray())
+        return std::binary_search(block->array.begin(), block->array.end(), value);
+
+    return (block->bits[value / 64] & (1ull << (value % 64))) != 0;
+}
+
+u32 CEntryBitmap::Rank(u32 id) const
+{
+    u32 blockIndex = id / ENTRY_BITMAP_BLOCK_SIZE;
+    u16 value = id % ENTRY_BITMAP_BLOCK_SIZE;
+
+    u32 rank = 0;
+    for (const SBlock& block : blocks)
+    {
+        // Whole blocks before the ID count completely
+        if (block.index < blockIndex)
+        {
+            rank += block.count;
+            continue;
+        }
+
+        // The block the ID is in only counts up to the ID
+        if (block.index == blockIndex)
+        {
+            if (block.IsArray())
+            {
+                rank += std::lower_bound(block.array.begin(), block.array.end(), value) - block.array.begin();
+            }
+            else
+            {
+                for (u32 word = 0; word < value / 64; word++)
+                {
+                    rank += __builtin_popcountll(block.bits[word]);
+                }
+                rank += __builtin_popcountll(block.bits[value / 64] & ((1ull << (value % 64)) - 1));
+            }
+        }
+
+        break;
+    }
+
+    return rank;
+}
+
+void CEntryBitmap::GetIds(u32 first, u32 maxIds, std::vector<int>& outIds) const
+{
+    for (const SBlock& block : blocks)
+    {
+        if (maxIds == 0)
+            break;
+
+        // Skip whole blocks before the first position
+        if (first >= block.count)
+        {
+            first -= block.count;
+            continue;
+        }
+
+        u32 blockStart = block.index * ENTRY_BITMAP_BLOCK_SIZE;
+        if (block.IsArray())
+        {
+            u32 taken = std::min(maxIds, block.count - first);
+            for (u32 i = first; i < first + taken; i++)
+            {
+                outIds.push_back(blockStart + block.array[i]);
+            }
+            maxIds -= taken;
+        }
+        else
+        {
+            // Skip whole words before the first position, then go through the set bits
+            for (u32 word = 0; word < BLOCK_WORDS && maxIds > 0; word++)
+            {
+                u64 wordBits = block.bits[word];
+                u32 wordCount = __builtin_popcountll(wordBits);
+                if (first >= wordCount)
+                {
+                    first -= wordCount;
+                    continue;
+                }
+
+                for (; wordBits != 0 && maxIds > 0; wordBits &= wordBits - 1)
+                {
+                    if (first > 0)
+                    {
+                        first--;
+                        continue;
+                    }
+
+                    outIds.push_back(blockStart + word * 64 + __builtin_ctzll(wordBits));
+                    maxIds--;
+                }
+            }
+        }
+
+        first = 0;
+    }
+}
+
+CEntryBitmap CEntryBitmap::Intersect(const CEntryBitmap& a, const CEntryBitmap& b)
+{
+    CEntryBitmap result;
+
+    // Only blocks which both have can have IDs in the result
+    auto blockA = a.blocks.begin();
+    auto blockB = b.blocks.begin();
+    while (blockA != a.blocks.end() && blockB != b.blocks.end())
+    {
+        if (blockA->index < blockB->index)
+        {
+            blockA++;
+            continue;
+        }
+        if (blockB->index < blockA->index)
+        {
+            blockB++;
+            continue;
+        }
+
+        SBlock block { blockA->index, 0, {}, {} };
+        if (!blockA->IsArray() && !blockB->IsArray())
+        {
+            // Both are bits, so just AND them
+            block.bits.resize(BLOCK_WORDS);
+            for (u32 word = 0; word < BLOCK_WORDS; word++)
+            {
+                block.bits[word] = blockA->bits[word] & blockB->bits[word];
+                block.count += __builtin_popcountll(block.bits[word]);
+            }
+        }
+        else if (blockA->IsArray() && blockB->IsArray())
+        {
+            std::set_intersection(blockA->array.begin(), blockA->array.end(), blockB->array.begin(), blockB->array.end(), std::back_inserter(block.array));
+            block.count = block.array.size();
+        }
+        else
+        {
+            // Look up every ID of the array in the bits
+            const SBlock& arrayBlock = blockA->IsArray() ? *blockA : *blockB;
+            const SBlock& bitsBlock = blockA->IsArray() ? *blockB : *blockA;
+            for (u16 value : arrayBlock.array)
+            {
+                if (bitsBlock.bits[value / 64] & (1ull << (value % 64)))
+                    block.array.push_back(value);
+            }
+            block.count = block.array.size();
+        }
+
+        if (block.count > 0)
+        {
+            block.Compact();
+            result.count += block.count;
+            result.blocks.push_back(std::move(block));
+        }
+
+        blockA++;
+        blockB++;
+    }
+
+    return result;
+}
+
+CEntryBitmap CEntryBitmap::Unite(const CEntryBitmap& a, const CEntryBitmap& b)
+{
+    CEntryBitmap result;
+
+    auto blockA = a.blocks.begin();
+    auto blockB = b.blocks.begin();
+    while (blockA != a.blocks.end() || blockB != b.blocks.end())
+    {
+        // Blocks only one of the sets has are taken over as they are
+        if (blockB == b.blocks.end() || (blockA != a.blocks.end() && blockA->index < blockB->index))
+        {
+            result.count += blockA->count;
+            result.blocks.push_back(*blockA++);
+            continue;
+        }
+        if (blockA == a.blocks.end() || blockB->index < blockA->index)
+        {
+            result.count += blockB->count;
+            result.blocks.push_back(*blockB++);
+            continue;
+        }
+
+        SBlock block { blockA->index, 0, {}, {} };
+        if (blockA->IsArray() && blockB->IsArray())
+        {
+            std::set_union(blockA->array.begin(), blockA->array.end(), blockB->array.begin(), blockB->array.end(), std::back_inserter(block.array));
+            block.count = block.array.size();
+        }
+        else
+        {
+            // Start with the bits of one of them and set the IDs of the other
+            const SBlock& bitsBlock = blockA->IsArray() ? *blockB : *blockA;
+            const SBlock& otherBlock = blockA->IsArray() ? *blockA : *blockB;
+            block.bits = bitsBlock.bits;
+            if (otherBlock.IsArray())
+            {
+                for (u16 value : otherBlock.array)
+                {
+                    block.bits[value / 64] |= 1ull << (value % 64);
+                }
+            }
+            else
+            {
+                for (u32 word = 0; word < BLOCK_WORDS; word++)
+                {
+                    block.bits[word] |= otherBlock.bits[word];
+                }
+            }
+
+            for (u64 word : block.bits)
+            {
+                block.count += __builtin_popcountll(word);
+            }
+        }
+
+        block.Compact();
+        result.count += block.count;
+        result.blocks.push_back(std::move(block));
+        blockA++;
+        blockB++;
+    }
+
+    return result;
+}
+
+u64 CEntryBitmap::GetMemoryUsage() const
+{
+    u64 usage = blocks.capacity() * sizeof(SBlock);
+    for (const SBlock& block : blocks)
+    {
+        usage += block.array.capacity() * sizeof(u16) + block.bits.capacity() * sizeof(u64);
+    }
+    return usage;
+}
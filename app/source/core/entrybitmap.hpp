@@ -0,0 +1,97 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <vector>
+#include "platform.hpp"
+
+// IDs are kept in blocks of this many, each one either as a sorted array or as bits
+#define ENTRY_BITMAP_BLOCK_SIZE 65536
+
+// Blocks with up to this many IDs keep them as a sorted array, fuller ones as bits (which always take 8kb)
+#define ENTRY_BITMAP_MAX_ARRAY_SIZE 4096
+
+namespace nxgallery::core
+{
+    // A compressed set of album entry IDs, used to find entries by what they are (such as all videos)
+    // without going through the whole album. The IDs are split into blocks, and every block keeps
+    // them in whatever takes less memory: a sorted array of the IDs for sparse blocks, or one bit
+    // per ID for dense ones. Empty blocks aren't stored at all
+    class CEntryBitmap
+    {
+    public:
+        // Adds an ID. IDs have to be added in ascending order
+        void Add(u32 id);
+
+        // Returns how many IDs are in the set
+        u32 GetCount() const;
+
+        // Returns whether the ID is in the set
+        bool Contains(u32 id) const;
+
+        // Returns how many IDs in the set are below the given one
+        u32 Rank(u32 id) const;
+
+        // Appends up to maxIds IDs to outIds, starting with the one at the given position (in ascending order)
+        void GetIds(u32 first, u32 maxIds, std::vector<int>& outIds) const;
+
+        // Returns the IDs which are in both sets, or in either of them
+        static CEntryBitmap Intersect(const CEntryBitmap& a, const CEntryBitmap& b);
+        static CEntryBitmap Unite(const CEntryBitmap& a, const CEntryBitmap& b);
+
+        // Returns how many bytes the set takes
+        u64 GetMemoryUsage() const;
+
+    private:
+        // A block of IDs, as an array or as bits
+        struct SBlock
+        {
+            // Which block this is (the ID divided by the block size)
+            u32 index;
+
+            // How many IDs are in this block
+            u32 count;
+
+            // The IDs (relative to the block) if there are few of them, or else one bit for each ID
+            std::vector<u16> array;
+            std::vector<u64> bits;
+
+            bool IsArray() const { return bits.empty(); }
+
+            // Switches to bits or to an array, whatever fits the count
+            void Compact();
+        };
+
+    private:
+        // The blocks which have IDs, sorted by their index
+        std::vector<SBlock> blocks;
+
+        // How many IDs are in the set
+        u32 count = 0;
+    };
+}
@@ -0,0 +1,107 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "gallerycache.hpp"
+#include <stdio.h>
+
+using namespace nxgallery::core;
+
+bool SGalleryPageKey::operator==(const SGalleryPageKey& other) const
+{
+    return firstId == other.firstId && pageSize == other.pageSize && filter == other.filter;
+}
+
+size_t SGalleryPageKeyHash::operator()(const SGalleryPageKey& key) const
+{
+    size_t hash = std::hash<std::string>()(key.filter);
+    hash = hash * 31 + (size_t)key.firstId;
+    hash = hash * 31 + (size_t)key.pageSize;
+    return hash;
+}
+
+std::shared_ptr<SCachedResponse> CGalleryPageCache::Find(const SGalleryPageKey& key, u32 inGeneration)
+{
+    // Pages of an older album are of no use anymore
+    if (inGeneration != generation)
+    {
+        Clear();
+        generation = inGeneration;
+        return nullptr;
+    }
+
+    auto it = pages.find(key);
+    return it != pages.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<SCachedResponse> CGalleryPageCache::Insert(const SGalleryPageKey& key, u32 inGeneration, std::string&& json)
+{
+    if (inGeneration != generation)
+    {
+        Clear();
+        generation = inGeneration;
+    }
+
+    std::shared_ptr<SCachedResponse> cached = std::make_shared<SCachedResponse>(std::move(json));
+
+    // Replace the page if it's cached already
+    auto it = pages.find(key);
+    if (it != pages.end())
+    {
+        cachedBytes -= it->second->body->size();
+        it->second = cached;
+    }
+    else
+    {
+        pages.emplace(key, cached);
+        insertionOrder.push_back(key);
+    }
+    cachedBytes += cached->body->size();
+
+    // Make room by dropping the pages which were cached first, but always keep the new one. Responses
+    // which are being sent keep their body alive on their own
+    while (cachedBytes > GALLERY_PAGE_CACHE_MAX_BYTES && insertionOrder.size() > 1)
+    {
+        auto oldest = pages.find(insertionOrder.front());
+        cachedBytes -= oldest->second->body->size();
+        pages.erase(oldest);
+        insertionOrder.pop_front();
+    }
+
+    return cached;
+}
+
+void CGalleryPageCache::Clear()
+{
+    pages.clear();
+    insertionOrder.clear();
+    cachedBytes = 0;
+
+#ifdef __DEBUG__
+    printf("CGalleryPageCache::Clear: dropped all cached gallery pages\n");
+#endif
+}
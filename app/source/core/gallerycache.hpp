@@ -0,0 +1,87 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <string>
+#include <memory>
+#include <deque>
+#include <unordered_map>
+#include "platform.hpp"
+#include "http.hpp"
+
+// How many bytes of gallery JSON are kept at most. Once there's more, the pages cached first are dropped
+// The gzip compressed pages come on top, they're a fraction of that
+#define GALLERY_PAGE_CACHE_MAX_BYTES (1024 * 1024)
+
+namespace nxgallery::core
+{
+    // Identifies a gallery page within one album generation: which entry it starts at, how many entries
+    // a page has, and what the entries were filtered by (empty if nothing)
+    struct SGalleryPageKey
+    {
+        int firstId;
+        int pageSize;
+        std::string filter;
+
+        bool operator==(const SGalleryPageKey& other) const;
+    };
+
+    struct SGalleryPageKeyHash
+    {
+        size_t operator()(const SGalleryPageKey& key) const;
+    };
+
+    // Keeps serialized gallery pages around, so going back to a page (or reloading it) only needs a
+    // lookup instead of writing its JSON again. Pages are filled in as they're asked for, and all of
+    // them are dropped at once when the album generation changes, as they're all outdated then
+    // Only used by the network thread, so it's not locked
+    class CGalleryPageCache
+    {
+    public:
+        // Returns the cached page for the given key, or nullptr if it's not cached. Passing a
+        // different generation than before drops all cached pages
+        std::shared_ptr<SCachedResponse> Find(const SGalleryPageKey& key, u32 generation);
+
+        // Caches the JSON of a page and returns the cached page
+        std::shared_ptr<SCachedResponse> Insert(const SGalleryPageKey& key, u32 generation, std::string&& json);
+
+        // Drops all cached pages
+        void Clear();
+
+    private:
+        // The cached pages, and their keys in the order they were cached
+        std::unordered_map<SGalleryPageKey, std::shared_ptr<SCachedResponse>, SGalleryPageKeyHash> pages;
+        std::deque<SGalleryPageKey> insertionOrder;
+
+        // The album generation the cached pages belong to
+        u32 generation = 0;
+
+        // How many bytes of JSON are cached
+        u64 cachedBytes = 0;
+    };
+}
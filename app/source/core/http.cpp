@@ -0,0 +1,1013 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "http.hpp"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <charconv>
+#include <ctype.h>
+#include <string.h>
+#include <zlib.h>
+using namespace nxgallery::core;
+
+// Needed for compiler
+CContentWakeup* CContentWakeup::singleton = NULL;
+
+CContentWakeup* CContentWakeup::Get()
+{
+    // If no singleton is existing, create a new instance
+    if (!singleton)
+    {
+        singleton = new CContentWakeup();
+    }
+
+    // Return the instance
+    return singleton;
+}
+
+bool CContentWakeup::Open()
+{
+    if (wakeupSocket >= 0)
+        return true;
+
+    int newSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (newSocket < 0)
+    {
+        printf("Failed to create the wakeup socket: %d\n", errno);
+        return false;
+    }
+
+    // Bind to any free port on the loopback interface and connect to that same address, so whatever is
+    // sent comes right back in
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t addressLength = sizeof(address);
+    if (bind(newSocket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        getsockname(newSocket, (struct sockaddr*)&address, &addressLength) < 0 ||
+        connect(newSocket, (struct sockaddr*)&address, sizeof(address)) < 0)
+    {
+        printf("Failed to set up the wakeup socket: %d\n", errno);
+        close(newSocket);
+        return false;
+    }
+
+    // Signalling must never block, a full socket buffer means the network thread is woken up anyway
+    fcntl(newSocket, F_SETFL, fcntl(newSocket, F_GETFL, 0) | O_NONBLOCK);
+
+    wakeupSocket = newSocket;
+    return true;
+}
+
+void CContentWakeup::Close()
+{
+    int oldSocket = wakeupSocket.exchange(-1);
+    if (oldSocket >= 0)
+        close(oldSocket);
+}
+
+int CContentWakeup::GetSocket()
+{
+    return wakeupSocket;
+}
+
+void CContentWakeup::Signal()
+{
+    int currentSocket = wakeupSocket;
+    if (currentSocket >= 0)
+        send(currentSocket, "", 1, 0);
+}
+
+void CContentWakeup::Drain()
+{
+    int currentSocket = wakeupSocket;
+    if (currentSocket < 0)
+        return;
+
+    char buffer[64];
+    while (recv(currentSocket, buffer, sizeof(buffer), 0) > 0)
+    {
+    }
+}
+
+CMemorySource::CMemorySource(std::string&& inData)
+    : data(std::make_shared<const std::string>(std::move(inData)))
+{
+}
+
+CMemorySource::CMemorySource(std::shared_ptr<const std::string> inData)
+    : data(std::move(inData))
+{
+}
+
+u64 CMemorySource::GetSize()
+{
+    return data->size();
+}
+
+u64 CMemorySource::Borrow(u64 offset, u64 maxBytes, const char** outData)
+{
+    // Nothing left to borrow past the end
+    if (offset >= data->size())
+        return 0;
+
+    // The data is in memory already, so just point at it
+    *outData = data->data() + offset;
+    return std::min(maxBytes, (u64)data->size() - offset);
+}
+
+CStaticSource::CStaticSource(const void* inData, u64 inSize)
+    : data((const char*)inData), size(inSize)
+{
+}
+
+u64 CStaticSource::GetSize()
+{
+    return size;
+}
+
+u64 CStaticSource::Borrow(u64 offset, u64 maxBytes, const char** outData)
+{
+    // Nothing left to borrow past the end
+    if (offset >= size)
+        return 0;
+
+    *outData = data + offset;
+    return std::min(maxBytes, size - offset);
+}
+
+CFileSource::CFileSource(int inFileDescriptor)
+    : fileDescriptor(inFileDescriptor)
+{
+    // Figure out how big the file is
+    struct stat fileStat;
+    if (fstat(fileDescriptor, &fileStat) == 0)
+        fileSize = fileStat.st_size;
+}
+
+CFileSource::~CFileSource()
+{
+    // We own the file descriptor, so close it
+    close(fileDescriptor);
+}
+
+u64 CFileSource::GetSize()
+{
+    return fileSize;
+}
+
+u64 CFileSource::Borrow(u64 offset, u64 maxBytes, const char** outData)
+{
+    // Only seek if someone asks for a different part than the one following the last read
+    if (offset != filePosition)
+    {
+        if (lseek(fileDescriptor, offset, SEEK_SET) < 0)
+            return 0;
+
+        filePosition = offset;
+    }
+
+    // Read the next part of the file into our buffer
+    ssize_t bytesRead = read(fileDescriptor, readBuffer, std::min(maxBytes, (u64)sizeof(readBuffer)));
+    if (bytesRead <= 0)
+        return 0;
+
+    filePosition += bytesRead;
+    *outData = readBuffer;
+    return bytesRead;
+}
+
+CSliceSource::CSliceSource(std::shared_ptr<IContentSource> inSource, u64 inOffset, u64 inSize)
+    : source(std::move(inSource)), sliceOffset(inOffset), sliceSize(inSize)
+{
+}
+
+u64 CSliceSource::GetSize()
+{
+    return sliceSize;
+}
+
+u64 CSliceSource::Borrow(u64 offset, u64 maxBytes, const char** outData)
+{
+    // Nothing left to borrow past the end of the slice
+    if (offset >= sliceSize)
+        return 0;
+
+    return source->Borrow(sliceOffset + offset, std::min(maxBytes, sliceSize - offset), outData);
+}
+
+CMultipartSource::CMultipartSource(std::shared_ptr<IContentSource> inSource, const std::vector<SByteRange>& ranges, const char* contentType)
+    : source(std::move(inSource))
+{
+    u64 sourceSize = source->GetSize();
+
+    // Every range is preceded by a boundary and a small header saying which range it is
+    for (const SByteRange& range : ranges)
+    {
+        char partHead[256];
+        snprintf(partHead, sizeof(partHead), "\r\n--" HTTP_MULTIPART_BOUNDARY "\r\nContent-Type: %s\r\nContent-Range: bytes %lu-%lu/%lu\r\n\r\n",
+            contentType, range.first, range.last, sourceSize);
+
+        SSegment head = { size, strlen(partHead), 0, partHead };
+        size += head.length;
+        segments.push_back(std::move(head));
+
+        SSegment data = { size, range.last - range.first + 1, range.first, std::string() };
+        size += data.length;
+        segments.push_back(std::move(data));
+    }
+
+    // The body ends with the closing boundary
+    SSegment tail = { size, 0, 0, "\r\n--" HTTP_MULTIPART_BOUNDARY "--\r\n" };
+    tail.length = tail.text.size();
+    size += tail.length;
+    segments.push_back(std::move(tail));
+}
+
+u64 CMultipartSource::GetSize()
+{
+    return size;
+}
+
+u64 CMultipartSource::Borrow(u64 offset, u64 maxBytes, const char** outData)
+{
+    // Nothing left to borrow past the end
+    if (offset >= size)
+        return 0;
+
+    // Find the segment the offset is in, which is the last one starting at or before it
+    auto it = std::upper_bound(segments.begin(), segments.end(), offset, [](u64 value, const SSegment& segment) {
+        return value < segment.start;
+    });
+    const SSegment& segment = *(it - 1);
+
+    // Never hand out more than what's left of this segment, the next call will continue with the next one
+    u64 offsetInSegment = offset - segment.start;
+    u64 available = std::min(maxBytes, segment.length - offsetInSegment);
+    if (segment.text.empty())
+        return source->Borrow(segment.sourceOffset + offsetInSegment, available, outData);
+
+    *outData = segment.text.data() + offsetInSegment;
+    return available;
+}
+
+// Compares two strings ignoring the case of ASCII letters
+static bool EqualsIgnoreCase(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+            return false;
+    }
+
+    return true;
+}
+
+// Strips spaces and tabs from both ends of a string
+static std::string_view TrimWhitespace(std::string_view str)
+{
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+        str.remove_prefix(1);
+
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+        str.remove_suffix(1);
+
+    return str;
+}
+
+std::string_view SHttpRequest::GetHeader(std::string_view name) const
+{
+    for (int i = 0; i < numHeaders; i++)
+    {
+        if (EqualsIgnoreCase(headers[i].name, name))
+            return headers[i].value;
+    }
+
+    return std::string_view();
+}
+
+bool SHttpRequest::HeaderHasToken(std::string_view name, std::string_view token) const
+{
+    std::string_view value = GetHeader(name);
+
+    // Go through the comma-separated list and compare every element
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        if (EqualsIgnoreCase(TrimWhitespace(value.substr(0, comma)), token))
+            return true;
+
+        if (comma == std::string_view::npos)
+            break;
+
+        value.remove_prefix(comma + 1);
+    }
+
+    return false;
+}
+
+bool SHttpRequest::HasCachedETag(std::string_view etag) const
+{
+    std::string_view value = GetHeader("If-None-Match");
+
+    // Weak comparison: an ETag matches no matter whether either side is marked weak ("W/")
+    if (etag.substr(0, 2) == "W/")
+        etag.remove_prefix(2);
+
+    // The header is either "*" or a comma-separated list of ETags
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        std::string_view element = TrimWhitespace(value.substr(0, comma));
+        value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+
+        if (element.substr(0, 2) == "W/")
+            element.remove_prefix(2);
+
+        if (element == "*" || element == etag)
+            return true;
+    }
+
+    return false;
+}
+
+bool SHttpRequest::AcceptsEncoding(std::string_view coding) const
+{
+    std::string_view value = GetHeader("Accept-Encoding");
+
+    // Whether the coding was listed explicitly or through "*", and with which quality
+    bool isListed = false;
+    bool isAccepted = false;
+    bool wildcardAccepted = false;
+
+    // The header is a comma-separated list like "gzip, deflate, br;q=0.8, *;q=0"
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        std::string_view element = value.substr(0, comma);
+        value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+
+        // Split off the parameters, we only care about the quality. A quality of 0 means "not acceptable"
+        size_t semicolon = element.find(';');
+        std::string_view name = TrimWhitespace(element.substr(0, semicolon));
+        bool hasNonZeroQuality = true;
+        if (semicolon != std::string_view::npos)
+        {
+            std::string_view parameter = TrimWhitespace(element.substr(semicolon + 1));
+            if (parameter.size() > 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=')
+            {
+                // Any digit other than 0 makes the quality non-zero ("0", "0.0" and "0.000" are all zero)
+                std::string_view quality = parameter.substr(2);
+                hasNonZeroQuality = quality.find_first_of("123456789") != std::string_view::npos;
+            }
+        }
+
+        if (EqualsIgnoreCase(name, coding))
+        {
+            isListed = true;
+            isAccepted = hasNonZeroQuality;
+        }
+        else if (name == "*")
+        {
+            wildcardAccepted = hasNonZeroQuality;
+        }
+    }
+
+    return isListed ? isAccepted : wildcardAccepted;
+}
+
+// Parses a whole string as a decimal number, returns false if it isn't one
+static bool ParseNumber(std::string_view str, u64& outNumber)
+{
+    if (str.empty())
+        return false;
+
+    auto result = std::from_chars(str.data(), str.data() + str.size(), outNumber);
+    return result.ec == std::errc() && result.ptr == str.data() + str.size();
+}
+
+ERangeResult SHttpRequest::GetByteRanges(u64 contentSize, std::vector<SByteRange>& outRanges) const
+{
+    outRanges.clear();
+
+    // We only know about byte ranges
+    std::string_view value = TrimWhitespace(GetHeader("Range"));
+    if (value.size() < 6 || !EqualsIgnoreCase(value.substr(0, 6), "bytes="))
+        return ERangeResult::None;
+    value.remove_prefix(6);
+
+    // Go through the comma-separated range specs, which are "first-last", "first-" or "-suffixLength"
+    int numSpecs = 0;
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        std::string_view spec = TrimWhitespace(value.substr(0, comma));
+        value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+
+        // Empty elements in the list are allowed
+        if (spec.empty())
+            continue;
+
+        // Don't let a client make us split the content into countless little parts
+        if (++numSpecs > HTTP_MAX_RANGES)
+            return ERangeResult::None;
+
+        size_t dash = spec.find('-');
+        if (dash == std::string_view::npos)
+            return ERangeResult::None;
+
+        SByteRange range;
+        if (dash == 0)
+        {
+            // The last suffixLength bytes
+            u64 suffixLength = 0;
+            if (!ParseNumber(spec.substr(1), suffixLength))
+                return ERangeResult::None;
+
+            // A suffix of zero bytes can't be satisfied
+            if (suffixLength == 0 || contentSize == 0)
+                continue;
+
+            range.first = contentSize - std::min(suffixLength, contentSize);
+            range.last = contentSize - 1;
+        }
+        else
+        {
+            // From first up to last, or up to the end if there's no last
+            if (!ParseNumber(spec.substr(0, dash), range.first))
+                return ERangeResult::None;
+
+            range.last = contentSize - 1;
+            if (dash + 1 < spec.size())
+            {
+                if (!ParseNumber(spec.substr(dash + 1), range.last) || range.last < range.first)
+                    return ERangeResult::None;
+            }
+
+            // Ranges starting past the end can't be satisfied, ones ending past it are cut short
+            if (range.first >= contentSize)
+                continue;
+            range.last = std::min(range.last, contentSize - 1);
+        }
+
+        outRanges.push_back(range);
+    }
+
+    // A header without a single range spec is malformed
+    if (numSpecs == 0)
+        return ERangeResult::None;
+
+    if (outRanges.empty())
+        return ERangeResult::Unsatisfiable;
+
+    // Sort the ranges and merge the ones which overlap or touch, so no byte is sent twice
+    std::sort(outRanges.begin(), outRanges.end(), [](const SByteRange& a, const SByteRange& b) {
+        return a.first < b.first;
+    });
+
+    size_t numMerged = 0;
+    for (size_t i = 1; i < outRanges.size(); i++)
+    {
+        if (outRanges[i].first <= outRanges[numMerged].last + 1)
+            outRanges[numMerged].last = std::max(outRanges[numMerged].last, outRanges[i].last);
+        else
+            outRanges[++numMerged] = outRanges[i];
+    }
+    outRanges.resize(numMerged + 1);
+
+    return ERangeResult::Satisfiable;
+}
+
+std::string_view SHttpRequest::GetQueryParam(std::string_view name) const
+{
+    std::string_view remaining = query;
+
+    // Go through the "name=value" pairs separated by "&"
+    while (!remaining.empty())
+    {
+        size_t ampersand = remaining.find('&');
+        std::string_view pair = remaining.substr(0, ampersand);
+
+        size_t equals = pair.find('=');
+        if (pair.substr(0, equals) == name)
+            return equals == std::string_view::npos ? std::string_view() : pair.substr(equals + 1);
+
+        if (ampersand == std::string_view::npos)
+            break;
+
+        remaining.remove_prefix(ampersand + 1);
+    }
+
+    return std::string_view();
+}
+
+bool SHttpRequest::HasQueryParam(std::string_view name) const
+{
+    std::string_view remaining = query;
+
+    while (!remaining.empty())
+    {
+        size_t ampersand = remaining.find('&');
+        std::string_view pair = remaining.substr(0, ampersand);
+
+        if (pair.substr(0, pair.find('=')) == name)
+            return true;
+
+        if (ampersand == std::string_view::npos)
+            break;
+
+        remaining.remove_prefix(ampersand + 1);
+    }
+
+    return false;
+}
+
+EHttpParseResult CHttpParser::Parse(std::string_view buffer, SHttpRequest& outRequest)
+{
+    // Clients may send empty lines in front of a request, which we skip over
+    size_t headStart = 0;
+    while (headStart < buffer.size() && (buffer[headStart] == '\r' || buffer[headStart] == '\n'))
+        headStart++;
+
+    // Look for the empty line ending the request head ("\n\r\n" or "\n\n"), starting where we stopped last time
+    for (size_t i = std::max((size_t)scanOffset, headStart); i < buffer.size(); i++)
+    {
+        if (buffer[i] != '\n')
+            continue;
+
+        size_t headEnd = 0;
+        if (i + 1 < buffer.size() && buffer[i + 1] == '\n')
+            headEnd = i + 2;
+        else if (i + 2 < buffer.size() && buffer[i + 1] == '\r' && buffer[i + 2] == '\n')
+            headEnd = i + 3;
+        else if (i + 2 >= buffer.size())
+            break; // The terminator might be cut off, look at this line break again once more data arrived
+        else
+            continue;
+
+        // We found the end, so parse the whole head in one go
+        outRequest.length = headEnd;
+        return ParseHead(buffer.substr(headStart, i + 1 - headStart), outRequest);
+    }
+
+    // Not complete yet. Remember how far we got, minus the last two bytes which may be the start of the terminator
+    scanOffset = buffer.size() >= 2 ? buffer.size() - 2 : 0;
+    return EHttpParseResult::Incomplete;
+}
+
+void CHttpParser::Reset()
+{
+    scanOffset = 0;
+}
+
+EHttpParseResult CHttpParser::ParseHead(std::string_view head, SHttpRequest& outRequest)
+{
+    outRequest.numHeaders = 0;
+    bool isRequestLine = true;
+
+    // Go through the head line by line
+    while (!head.empty())
+    {
+        size_t lineEnd = head.find('\n');
+        std::string_view line = head.substr(0, lineEnd);
+        head.remove_prefix(lineEnd == std::string_view::npos ? head.size() : lineEnd + 1);
+
+        // Lines are terminated by "\r\n", but we also take a plain "\n"
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+
+        if (isRequestLine)
+        {
+            // The request line looks like "GET /index.html HTTP/1.1"
+            isRequestLine = false;
+
+            size_t methodEnd = line.find(' ');
+            if (methodEnd == std::string_view::npos || methodEnd == 0)
+                return EHttpParseResult::Error;
+
+            size_t targetEnd = line.find(' ', methodEnd + 1);
+            if (targetEnd == std::string_view::npos || targetEnd == methodEnd + 1)
+                return EHttpParseResult::Error;
+
+            std::string_view version = line.substr(targetEnd + 1);
+            if (version.size() != 8 || version.substr(0, 7) != "HTTP/1." || version[7] < '0' || version[7] > '9')
+                return EHttpParseResult::Error;
+
+            outRequest.method = line.substr(0, methodEnd);
+            outRequest.target = line.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+            outRequest.minorVersion = version[7] - '0';
+
+            // We only serve origin-form targets, such as "/gallery?page=1"
+            if (outRequest.target.front() != '/')
+                return EHttpParseResult::Error;
+
+            size_t queryStart = outRequest.target.find('?');
+            outRequest.path = outRequest.target.substr(0, queryStart);
+            outRequest.query = queryStart == std::string_view::npos ? std::string_view() : outRequest.target.substr(queryStart + 1);
+            continue;
+        }
+
+        // Header lines look like "Name: value"
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0)
+            return EHttpParseResult::Error;
+
+        // Headers we have no room for are ignored, we only ever look at a handful anyway
+        if (outRequest.numHeaders < HTTP_MAX_HEADERS)
+        {
+            SHttpHeader& header = outRequest.headers[outRequest.numHeaders++];
+            header.name = line.substr(0, colon);
+            header.value = TrimWhitespace(line.substr(colon + 1));
+        }
+    }
+
+    return EHttpParseResult::Complete;
+}
+
+void SHttpResponse::SetStatus(int code, const char* text)
+{
+    statusCode = code;
+    statusText = text;
+}
+
+void SHttpResponse::AddHeader(const char* name, const std::string& value)
+{
+    headers.append(name);
+    headers.append(": ");
+    headers.append(value);
+    headers.append("\r\n");
+}
+
+bool nxgallery::core::CompressGzip(std::string_view data, std::string& outCompressed)
+{
+    // 16 on top of the window bits makes zlib write a gzip header and trailer instead of its own
+    z_stream stream = {};
+    if (deflateInit2(&stream, HTTP_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    // deflateBound tells how big the output can get at worst, so it's compressed in one go
+    outCompressed.resize(deflateBound(&stream, data.size()));
+    stream.next_in = (Bytef*)data.data();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef*)&outCompressed[0];
+    stream.avail_out = outCompressed.size();
+
+    int result = deflate(&stream, Z_FINISH);
+    outCompressed.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return result == Z_STREAM_END;
+}
+
+SCachedResponse::SCachedResponse(std::string&& inBody)
+    : body(std::make_shared<const std::string>(std::move(inBody)))
+{
+    // FNV-1a over the body. The same body always gets the same ETag, even across launches, and clients
+    // which have an older body can't mistake it for the current one
+    u64 hash = 0xcbf29ce484222325;
+    for (unsigned char c : *body)
+    {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+
+    char hashETag[24];
+    snprintf(hashETag, sizeof(hashETag), "\"%016lx\"", hash);
+    etag = hashETag;
+}
+
+std::shared_ptr<const std::string> SCachedResponse::GetGzipBody()
+{
+    if (!isGzipTried)
+    {
+        isGzipTried = true;
+
+        // Only keep the compressed body if it's worth it. It's a different representation than the
+        // plain one, so it needs its own ETag
+        std::string compressed;
+        if (CompressGzip(*body, compressed) && compressed.size() < body->size())
+        {
+            gzipBody = std::make_shared<const std::string>(std::move(compressed));
+            gzipETag = etag;
+            gzipETag.insert(gzipETag.size() - 1, "-gz");
+        }
+    }
+
+    return gzipBody;
+}
+
+u64 SCachedResponse::GetMemoryUsage() const
+{
+    return body->size() + (gzipBody ? gzipBody->size() : 0);
+}
+
+bool SHttpResponse::SetETag(const SHttpRequest& request, const std::string& inETag)
+{
+    etag = inETag;
+    AddHeader("ETag", etag);
+
+    if (!request.HasCachedETag(etag))
+        return false;
+
+    SetStatus(304, "Not Modified");
+    body.reset();
+    return true;
+}
+
+void SHttpResponse::SetRangedBody(const SHttpRequest& request, std::shared_ptr<IContentSource> content, const char* contentType)
+{
+    // Let clients know they can ask for parts of this content
+    AddHeader("Accept-Ranges", "bytes");
+
+    // If-Range makes the Range header only count if the client's copy is still the current one. We don't
+    // send Last-Modified, so only a matching (strong) ETag counts, a date never does
+    std::string_view ifRange = TrimWhitespace(request.GetHeader("If-Range"));
+    bool rangesAllowed = ifRange.empty() || (!etag.empty() && etag.compare(0, 2, "W/") != 0 && ifRange == etag);
+
+    // Content which doesn't know its size can't be split into ranges
+    rangesAllowed = rangesAllowed && content->GetSize() != HTTP_SIZE_UNKNOWN;
+
+    std::vector<SByteRange> ranges;
+    ERangeResult rangeResult = rangesAllowed ? request.GetByteRanges(content->GetSize(), ranges) : ERangeResult::None;
+
+    char contentRange[96];
+    if (rangeResult == ERangeResult::Unsatisfiable)
+    {
+        // Tell the client how big the content actually is
+        SetStatus(416, "Range Not Satisfiable");
+        snprintf(contentRange, sizeof(contentRange), "bytes */%lu", content->GetSize());
+        AddHeader("Content-Range", contentRange);
+        body.reset();
+    }
+    else if (rangeResult == ERangeResult::Satisfiable && ranges.size() == 1)
+    {
+        // A single range is sent as it is, with the Content-Range saying where it belongs
+        SetStatus(206, "Partial Content");
+        snprintf(contentRange, sizeof(contentRange), "bytes %lu-%lu/%lu", ranges[0].first, ranges[0].last, content->GetSize());
+        AddHeader("Content-Range", contentRange);
+        AddHeader("Content-Type", contentType);
+        body = std::make_shared<CSliceSource>(std::move(content), ranges[0].first, ranges[0].last - ranges[0].first + 1);
+    }
+    else if (rangeResult == ERangeResult::Satisfiable)
+    {
+        // Several ranges are packed into a multipart body, where each part has its own Content-Range
+        SetStatus(206, "Partial Content");
+        AddHeader("Content-Type", "multipart/byteranges; boundary=" HTTP_MULTIPART_BOUNDARY);
+        body = std::make_shared<CMultipartSource>(std::move(content), ranges, contentType);
+    }
+    else
+    {
+        // No ranges, send everything
+        AddHeader("Content-Type", contentType);
+        body = std::move(content);
+    }
+}
+
+void SHttpConnection::CheckForRequest()
+{
+    EHttpParseResult result = parser.Parse(inBuffer, request);
+    if (result == EHttpParseResult::Complete)
+    {
+        state = EConnectionState::Dispatching;
+    }
+    else if (result == EHttpParseResult::Error)
+    {
+        // We can't tell where the next request would start, so answer with a 400 and close
+        SHttpResponse response;
+        response.SetStatus(400, "Bad Request");
+        keepAlive = false;
+        BeginResponse(response);
+    }
+}
+
+void SHttpConnection::BeginResponse(const SHttpResponse& response, bool sendBody)
+{
+    // Close the connection after this response if the client asked for it or it already sent enough requests
+    requestsServed++;
+    if (requestsServed >= HTTP_MAX_KEEPALIVE_REQUESTS)
+        keepAlive = false;
+
+    // Build the status line and headers
+    char statusLine[64];
+    snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %d %s\r\n", response.statusCode, response.statusText);
+    outHead = statusLine;
+    outHead.append(response.headers);
+
+    // Every response carries its length, so the client knows where it ends without us closing the connection
+    // The exception is 304 Not Modified, which never has a body and whose length would refer to the cached one
+    // Bodies which don't know their length yet are sent in chunks, each carrying its own length. HTTP/1.0
+    // doesn't know chunks, so there the connection is closed after the body
+    char lengthHeaders[128];
+    u64 bodySize = response.body ? response.body->GetSize() : 0;
+    isBodyChunked = false;
+    if (response.statusCode != 304)
+    {
+        if (bodySize != HTTP_SIZE_UNKNOWN)
+        {
+            snprintf(lengthHeaders, sizeof(lengthHeaders), "Content-Length: %lu\r\n", bodySize);
+            outHead.append(lengthHeaders);
+        }
+        else if (request.minorVersion >= 1)
+        {
+            outHead.append("Transfer-Encoding: chunked\r\n");
+            isBodyChunked = true;
+        }
+        else
+        {
+            keepAlive = false;
+        }
+    }
+
+    if (keepAlive)
+        snprintf(lengthHeaders, sizeof(lengthHeaders), "Connection: keep-alive\r\nKeep-Alive: timeout=%d, max=%d\r\n\r\n", HTTP_KEEPALIVE_TIMEOUT, HTTP_MAX_KEEPALIVE_REQUESTS - requestsServed);
+    else
+        snprintf(lengthHeaders, sizeof(lengthHeaders), "Connection: close\r\n\r\n");
+    outHead.append(lengthHeaders);
+    outHeadSent = 0;
+
+    // Set up the body, if there is one and it's meant to be sent
+    outBody = sendBody ? response.body : nullptr;
+    outBodyOffset = 0;
+    outBodyRemaining = sendBody ? bodySize : 0;
+    isBodyChunked = isBodyChunked && sendBody;
+    outChunkHead.clear();
+    outChunkHeadSent = 0;
+    outChunkRemaining = 0;
+    isWaitingForBody = false;
+
+    // Small bodies (like most JSON) go right behind the head, so the whole response leaves with one send()
+    // instead of two. If the source fails or is still reading here, the rest fails or waits the same way later on
+    if (outBody && !isBodyChunked && outBodyRemaining > 0 && outBodyRemaining <= HTTP_COALESCE_MAX_SIZE)
+    {
+        const char* data = nullptr;
+        u64 borrowed = 0;
+        while (outBodyRemaining > 0 && (borrowed = outBody->Borrow(outBodyOffset, outBodyRemaining, &data)) > 0 && borrowed != HTTP_BORROW_PENDING)
+        {
+            outHead.append(data, borrowed);
+            outBodyOffset += borrowed;
+            outBodyRemaining -= borrowed;
+        }
+    }
+
+    // Start writing
+    state = EConnectionState::WritingBody;
+}
+
+void SHttpConnection::BeginBodyChunk(u64 maxBytes)
+{
+    // The body might know where it ends by now
+    u64 bodySize = outBody->GetSize();
+    bool isLastChunk = bodySize != HTTP_SIZE_UNKNOWN && outBodyOffset >= bodySize;
+
+    // Find out how big the chunk is. The data is borrowed again once it's sent
+    u64 chunkSize = 0;
+    if (!isLastChunk)
+    {
+        const char* data = nullptr;
+        chunkSize = outBody->Borrow(outBodyOffset, maxBytes, &data);
+        if (chunkSize == 0)
+        {
+            // The source failed, the client will notice the response is cut short
+            state = EConnectionState::Closing;
+            return;
+        }
+        else if (chunkSize == HTTP_BORROW_PENDING)
+        {
+            // Try again once the data is there
+            isWaitingForBody = true;
+            return;
+        }
+    }
+
+    // Every chunk but the first starts by ending the previous one. The last chunk is empty and ends the body
+    char chunkHead[32];
+    snprintf(chunkHead, sizeof(chunkHead), "%s%lX\r\n%s", outBodyOffset > 0 ? "\r\n" : "", chunkSize, isLastChunk ? "\r\n" : "");
+    outChunkHead = chunkHead;
+    outChunkHeadSent = 0;
+    outChunkRemaining = chunkSize;
+
+    if (isLastChunk)
+        outBodyRemaining = 0;
+}
+
+void SHttpConnection::FinishResponse()
+{
+    // Let go of the body, it might hold a lot of memory
+    outBody.reset();
+    isWaitingForBody = false;
+    outHead.clear();
+
+    if (!keepAlive)
+    {
+        state = EConnectionState::Closing;
+        return;
+    }
+
+    // Drop the request we just answered and wait for the next one. It might even be there already
+    inBuffer.erase(0, request.length);
+    request.length = 0;
+    parser.Reset();
+    state = EConnectionState::ReadingHeaders;
+    CheckForRequest();
+}
+
+void SHttpResponse::SetDownloadFilename(std::string_view filename)
+{
+    // The fallback replaces every character which isn't printable ASCII, and the ones which would end
+    // or escape the quoted string
+    std::string fallback;
+    fallback.reserve(filename.size());
+    for (size_t i = 0; i < filename.size(); i++)
+    {
+        unsigned char c = filename[i];
+        if (c >= 0x80)
+        {
+            // One replacement per UTF-8 sequence, so skip its continuation bytes
+            while (i + 1 < filename.size() && ((unsigned char)filename[i + 1] & 0xC0) == 0x80)
+                i++;
+            fallback += '_';
+        }
+        else if (c < 0x20 || c == 0x7F || c == '"' || c == '\\')
+        {
+            fallback += '_';
+        }
+        else
+        {
+            fallback += c;
+        }
+    }
+
+    std::string value = "inline; filename=\"" + fallback + "\"";
+
+    // Only names which needed replacements are sent as UTF-8, percent-encoding everything which isn't an attr-char
+    if (fallback != filename)
+    {
+        static const char hexDigits[] = "0123456789ABCDEF";
+        value += "; filename*=UTF-8''";
+        for (unsigned char c : filename)
+        {
+            if (c < 0x80 && (isalnum(c) || (c != '\0' && strchr("!#$&+-.^_`|~", c) != NULL)))
+            {
+                value += c;
+            }
+            else
+            {
+                value += '%';
+                value += hexDigits[c >> 4];
+                value += hexDigits[c & 0xF];
+            }
+        }
+    }
+
+    AddHeader("Content-Disposition", value);
+}
+
+void SHttpResponse::SetCachedBody(const SHttpRequest& request, SCachedResponse& cached, const char* contentType)
+{
+    // The body depends on what the client accepts, so caches along the way must keep both variants apart
+    AddHeader("Vary", "Accept-Encoding");
+
+    std::shared_ptr<const std::string> gzipBody = request.AcceptsEncoding("gzip") ? cached.GetGzipBody() : nullptr;
+    if (SetETag(request, gzipBody ? cached.gzipETag : cached.etag))
+        return;
+
+    AddHeader("Content-Type", contentType);
+    if (gzipBody)
+        AddHeader("Content-Encoding", "gzip");
+
+    body = std::make_shared<CMemorySource>(gzipBody ? gzipBody : cached.body);
+}
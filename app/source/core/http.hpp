@@ -0,0 +1,502 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include "platform.hpp"
+
+// How many header lines a request may have, further ones are ignored
+#define HTTP_MAX_HEADERS 32
+
+// How many requests one connection may send before we close it
+#define HTTP_MAX_KEEPALIVE_REQUESTS 100
+
+// How long (in seconds) a kept-alive connection may sit idle between two requests
+#define HTTP_KEEPALIVE_TIMEOUT 5
+
+// How many ranges one Range header may ask for, if there are more the whole content is sent instead
+#define HTTP_MAX_RANGES 16
+
+// Returned by IContentSource::GetSize for content which doesn't know its size yet
+#define HTTP_SIZE_UNKNOWN ((u64)-1)
+
+// Returned by IContentSource::Borrow for data which is still being read on another thread
+#define HTTP_BORROW_PENDING ((u64)-2)
+
+// Separates the parts of a multipart/byteranges response
+#define HTTP_MULTIPART_BOUNDARY "NXGALLERY_BYTERANGES"
+
+// Bodies up to this size are copied behind the response head, so both go out with a single send()
+#define HTTP_COALESCE_MAX_SIZE (16 * 1024)
+
+// How hard gzip compresses, from 1 (fastest) to 9 (smallest)
+#define HTTP_GZIP_LEVEL 6
+
+namespace nxgallery::core
+{
+    // Everything a response body can be read from. The network thread pulls data out of
+    // this bit by bit as the client's socket accepts it, so a source never has to hand
+    // out more than fits into one send() call.
+    class IContentSource
+    {
+    public:
+        virtual ~IContentSource() {}
+
+        // Returns the total size of the content in bytes. Content which is generated while it's sent
+        // may return HTTP_SIZE_UNKNOWN until it has generated its end, and is sent in chunks then
+        // (chunked transfer encoding). Such content is only ever read front to back
+        virtual u64 GetSize() = 0;
+
+        // Makes up to maxBytes bytes starting at offset available and points outData at them.
+        // The data stays valid until the next call on this source. Returns how many bytes are
+        // available, 0 means the source failed to read. Sources which read on another thread never
+        // make the network thread wait: they return HTTP_BORROW_PENDING if the data isn't there yet,
+        // and signal CContentWakeup once it is
+        virtual u64 Borrow(u64 offset, u64 maxBytes, const char** outData) = 0;
+    };
+
+    // Wakes the network thread up from poll() once data a connection waits for was read on another
+    // thread. It's a UDP socket on the loopback interface sending to itself, which goes into the poll()
+    // set along with the clients, as poll() on the Switch only works with sockets (so there is no pipe
+    // or eventfd). Signal can be called from any thread, everything else is for the network thread
+    class CContentWakeup
+    {
+    public:
+        // Returns the singleton instance of the wakeup
+        static CContentWakeup* Get();
+
+        // Opens the socket, returns whether it worked
+        bool Open();
+
+        // Closes the socket
+        void Close();
+
+        // Returns the socket to poll() for POLLIN, -1 if it isn't open
+        int GetSocket();
+
+        // Wakes the network thread up, or makes it not sleep the next time it polls
+        void Signal();
+
+        // Reads all signals which came in, so poll() blocks again
+        void Drain();
+
+    private:
+        // The socket, which is connected to itself
+        std::atomic<int> wakeupSocket { -1 };
+
+        // Singleton instance of the CContentWakeup
+        static CContentWakeup* singleton;
+    };
+
+    // Content source for data which is already in memory, such as generated JSON
+    class CMemorySource : public IContentSource
+    {
+    public:
+        // Takes ownership of the given data
+        CMemorySource(std::string&& inData);
+
+        // Shares data which is kept around elsewhere as well, such as a cached response
+        CMemorySource(std::shared_ptr<const std::string> inData);
+
+        u64 GetSize() override;
+        u64 Borrow(u64 offset, u64 maxBytes, const char** outData) override;
+
+    private:
+        // The data to serve
+        std::shared_ptr<const std::string> data;
+    };
+
+    // Content source for data which lives for the whole runtime, such as the embedded web assets
+    // Nothing is copied or freed, the source only points at the data
+    class CStaticSource : public IContentSource
+    {
+    public:
+        CStaticSource(const void* inData, u64 inSize);
+
+        u64 GetSize() override;
+        u64 Borrow(u64 offset, u64 maxBytes, const char** outData) override;
+
+    private:
+        // The data to serve
+        const char* data;
+        u64 size;
+    };
+
+    // Content source reading from an already opened file descriptor
+    class CFileSource : public IContentSource
+    {
+    public:
+        // Takes ownership of the file descriptor, which will be closed once the source is destroyed
+        CFileSource(int inFileDescriptor);
+        ~CFileSource();
+
+        u64 GetSize() override;
+        u64 Borrow(u64 offset, u64 maxBytes, const char** outData) override;
+
+    private:
+        // The file to read from
+        int fileDescriptor;
+
+        // Size of the file, determined when opening
+        u64 fileSize = 0;
+
+        // The offset the file is currently positioned at, so we only seek when we need to
+        u64 filePosition = 0;
+
+        // Buffer the file is read into
+        char readBuffer[8192];
+    };
+
+    // A range of bytes within some content, as asked for with a Range header. Both ends are inclusive
+    struct SByteRange
+    {
+        u64 first;
+        u64 last;
+    };
+
+    // Content source serving one part of another source, used for single range responses
+    class CSliceSource : public IContentSource
+    {
+    public:
+        CSliceSource(std::shared_ptr<IContentSource> inSource, u64 inOffset, u64 inSize);
+
+        u64 GetSize() override;
+        u64 Borrow(u64 offset, u64 maxBytes, const char** outData) override;
+
+    private:
+        // The source to slice and where the slice is
+        std::shared_ptr<IContentSource> source;
+        u64 sliceOffset;
+        u64 sliceSize;
+    };
+
+    // Content source serving several ranges of another source as a multipart/byteranges body
+    // Only the small part headers are kept in memory, the ranges themselves are borrowed from the
+    // source as they're sent
+    class CMultipartSource : public IContentSource
+    {
+    public:
+        CMultipartSource(std::shared_ptr<IContentSource> inSource, const std::vector<SByteRange>& ranges, const char* contentType);
+
+        u64 GetSize() override;
+        u64 Borrow(u64 offset, u64 maxBytes, const char** outData) override;
+
+    private:
+        // The body is made of segments, which are either text (part headers and the final boundary)
+        // or a range of the source if the text is empty
+        struct SSegment
+        {
+            // Where the segment starts within the body, and how long it is
+            u64 start;
+            u64 length;
+
+            // Where the segment starts within the source, if it's a range
+            u64 sourceOffset;
+
+            // The text of the segment, if it's not a range
+            std::string text;
+        };
+
+        // The source the ranges come from
+        std::shared_ptr<IContentSource> source;
+
+        // The segments, sorted by where they start
+        std::vector<SSegment> segments;
+
+        // Size of the whole body
+        u64 size = 0;
+    };
+
+    // Results of looking at the Range header of a request
+    enum class ERangeResult
+    {
+        // There's no (usable) Range header, the whole content should be sent
+        None,
+
+        // At least one of the ranges is within the content
+        Satisfiable,
+
+        // None of the ranges are within the content, which calls for a 416
+        Unsatisfiable
+    };
+
+    // Compresses the data into a gzip stream (as sent with "Content-Encoding: gzip"). Returns false if zlib failed
+    bool CompressGzip(std::string_view data, std::string& outCompressed);
+
+    // A response body which is kept around to be sent again, together with its ETag and a gzip compressed
+    // version. The compressed version is only made once a client asks for it, and is shared from then on
+    // Not thread safe, a cached response is meant to be used by the network thread only
+    struct SCachedResponse
+    {
+        // Takes ownership of the body and works out its ETag
+        SCachedResponse(std::string&& inBody);
+
+        // The body and its strong ETag, which is a hash of the body
+        std::shared_ptr<const std::string> body;
+        std::string etag;
+
+        // The gzip compressed body and its ETag, once they were made
+        std::shared_ptr<const std::string> gzipBody;
+        std::string gzipETag;
+
+        // Whether compressing was tried already, so a body which doesn't get smaller isn't compressed again
+        bool isGzipTried = false;
+
+        // Returns the gzip compressed body, compressing it the first time. Returns nullptr if compressing
+        // failed or didn't make the body smaller, the plain body should be sent then
+        std::shared_ptr<const std::string> GetGzipBody();
+
+        // Returns how many bytes the bodies take
+        u64 GetMemoryUsage() const;
+    };
+
+    // One header line of a request
+    struct SHttpHeader
+    {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    // A parsed request. Nothing is copied out of the connection's receive buffer, so all
+    // the views here are only valid until the request was answered
+    struct SHttpRequest
+    {
+        // The method, such as "GET"
+        std::string_view method;
+
+        // The full request target, such as "/gallery?page=1"
+        std::string_view target;
+
+        // The target split up into path ("/gallery") and query ("page=1", without the "?")
+        std::string_view path;
+        std::string_view query;
+
+        // The minor HTTP version, 0 for HTTP/1.0 and 1 for HTTP/1.1
+        int minorVersion = 0;
+
+        // The header lines, in the order they were sent
+        SHttpHeader headers[HTTP_MAX_HEADERS];
+        int numHeaders = 0;
+
+        // How many bytes of the receive buffer this request takes up
+        u64 length = 0;
+
+        // Returns the value of the given header (case-insensitive), or an empty view if it wasn't sent
+        std::string_view GetHeader(std::string_view name) const;
+
+        // Returns whether the given comma-separated header (such as "Connection") contains the token (case-insensitive)
+        bool HeaderHasToken(std::string_view name, std::string_view token) const;
+
+        // Returns whether the client already has the representation with the given ETag, according
+        // to its If-None-Match header. If so, a 304 Not Modified is all it needs
+        bool HasCachedETag(std::string_view etag) const;
+
+        // Returns whether the client accepts responses in the given content coding (such as "gzip"),
+        // according to the Accept-Encoding header and its quality values
+        bool AcceptsEncoding(std::string_view coding) const;
+
+        // Parses the byte ranges the Range header asks for out of content with the given size. The ranges
+        // are sorted and overlapping ones merged. Malformed headers are ignored, as the standard says
+        ERangeResult GetByteRanges(u64 contentSize, std::vector<SByteRange>& outRanges) const;
+
+        // Returns the raw value of the given query parameter, or an empty view if it wasn't sent
+        // Use HasQueryParam to tell a missing parameter apart from an empty one
+        std::string_view GetQueryParam(std::string_view name) const;
+        bool HasQueryParam(std::string_view name) const;
+    };
+
+    // Results of feeding data into the request parser
+    enum class EHttpParseResult
+    {
+        // The request isn't complete yet, call again once more data arrived
+        Incomplete,
+
+        // A full request was parsed
+        Complete,
+
+        // The data isn't a valid request
+        Error
+    };
+
+    // Incremental request parser. It remembers how far it already looked, so each byte of the
+    // receive buffer is only scanned once no matter how many pieces the request arrives in. As
+    // it only hands out views, pipelined requests can be parsed one after another from the same
+    // buffer without copying
+    class CHttpParser
+    {
+    public:
+        // Tries to parse one request from the start of the buffer
+        EHttpParseResult Parse(std::string_view buffer, SHttpRequest& outRequest);
+
+        // Resets the parser so it starts with a fresh request
+        void Reset();
+
+    private:
+        // Parses a complete request head, from the request line up to (excluding) the empty line
+        static EHttpParseResult ParseHead(std::string_view head, SHttpRequest& outRequest);
+
+    private:
+        // Up to where the buffer was already scanned for the end of the request head
+        u64 scanOffset = 0;
+    };
+
+    // A response the server will send back to a client
+    struct SHttpResponse
+    {
+        // Status code and text, such as 200 and "OK"
+        int statusCode = 200;
+        const char* statusText = "OK";
+
+        // Additional header lines, each one terminated with "\r\n"
+        std::string headers;
+
+        // The body to send, may be empty
+        std::shared_ptr<IContentSource> body;
+
+        // The ETag given to SetETag, needed to check If-Range
+        std::string etag;
+
+        // Sets the status of this response
+        void SetStatus(int code, const char* text);
+
+        // Appends a header line to this response
+        void AddHeader(const char* name, const std::string& value);
+
+        // Adds the ETag header and, if the client already has that version cached, turns this
+        // response into a 304 Not Modified. Returns true in that case, so the caller can skip
+        // producing the body
+        bool SetETag(const SHttpRequest& request, const std::string& inETag);
+
+        // Sets the body of this response, honoring the Range header of the request: either the whole
+        // content is sent, only the requested part(s) with a 206 Partial Content, or a 416 if none of the
+        // ranges exist. Call SetETag before, so If-Range can be checked
+        void SetRangedBody(const SHttpRequest& request, std::shared_ptr<IContentSource> content, const char* contentType);
+
+        // Adds the Content-Disposition header suggesting the filename the body is saved under. Names
+        // which aren't plain ASCII are sent UTF-8 encoded as well (RFC 5987), with an ASCII fallback
+        // for clients which don't understand that
+        void SetDownloadFilename(std::string_view filename);
+
+        // Sets a cached response as the body, gzip compressed if the client accepts that. Adds the ETag of
+        // the variant which is sent, and turns this response into a 304 Not Modified if the client has it
+        void SetCachedBody(const SHttpRequest& request, SCachedResponse& cached, const char* contentType);
+    };
+
+    // The states one client connection will cycle through
+    enum class EConnectionState
+    {
+        // Waiting for the request headers to arrive
+        ReadingHeaders,
+
+        // A full request is there, waiting to be answered
+        Dispatching,
+
+        // Sending out the response head and body
+        WritingBody,
+
+        // The connection is done and about to be closed
+        Closing
+    };
+
+    // One client connection the server is handling
+    struct SHttpConnection
+    {
+        // The client's socket
+        int socket = -1;
+
+        // Where this connection is at
+        EConnectionState state = EConnectionState::ReadingHeaders;
+
+        // Holds the received request data
+        std::string inBuffer;
+
+        // Parses requests out of inBuffer
+        CHttpParser parser;
+
+        // The request at the start of inBuffer, once it's complete
+        SHttpRequest request;
+
+        // Whether the connection stays open once the current response is sent (HTTP keep-alive)
+        bool keepAlive = false;
+
+        // How many requests have been answered on this connection
+        u32 requestsServed = 0;
+
+        // The serialized status line and headers of the response being sent
+        std::string outHead;
+
+        // How much of the outHead has been sent out already
+        u64 outHeadSent = 0;
+
+        // The body of the response being sent and how far we are with it. For a body which doesn't
+        // know its size yet, outBodyRemaining is HTTP_SIZE_UNKNOWN until it does
+        std::shared_ptr<IContentSource> outBody;
+        u64 outBodyOffset = 0;
+        u64 outBodyRemaining = 0;
+
+        // Whether the body is sent with chunked transfer encoding, the head of the current chunk
+        // (which also ends the previous one), how much of it is sent, and how much of the chunk's
+        // data is still to be sent
+        bool isBodyChunked = false;
+        std::string outChunkHead;
+        u64 outChunkHeadSent = 0;
+        u64 outChunkRemaining = 0;
+
+        // Whether the body's source is still reading the data which is sent next. The connection
+        // isn't polled for writing until CContentWakeup tells the network thread the data is there
+        bool isWaitingForBody = false;
+
+        // When something last happened on this connection, used to drop idle connections
+        std::chrono::steady_clock::time_point lastActivity;
+
+        // Checks whether inBuffer holds a complete request, and if so switches into dispatching state
+        // Switches into closing state if the data isn't a valid request
+        void CheckForRequest();
+
+        // Serializes the given response into this connection and switches it into writing state
+        // Without sendBody, only the head is sent (for HEAD requests), but it still announces the body's length
+        void BeginResponse(const SHttpResponse& response, bool sendBody = true);
+
+        // Starts the next chunk of a chunked body, which is at most maxBytes big, or the last (empty)
+        // chunk if the body is at its end. Switches into closing state if the body failed, and leaves
+        // the chunk unstarted (waiting for the body) if its data isn't there yet
+        void BeginBodyChunk(u64 maxBytes);
+
+        // Called once a response is sent. Drops the answered request and either waits for the
+        // next one (keep-alive) or switches into closing state
+        void FinishResponse();
+    };
+}
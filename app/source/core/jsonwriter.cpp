@@ -0,0 +1,179 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "jsonwriter.hpp"
+#include <charconv>
+using namespace nxgallery::core;
+
+CJsonWriter::CJsonWriter(std::string& inOutput)
+    : output(inOutput)
+{
+}
+
+void CJsonWriter::BeginObject()
+{
+    BeginValue();
+    output += '{';
+    isEmpty[++depth] = true;
+}
+
+void CJsonWriter::EndObject()
+{
+    output += '}';
+    depth--;
+}
+
+void CJsonWriter::BeginArray()
+{
+    BeginValue();
+    output += '[';
+    isEmpty[++depth] = true;
+}
+
+void CJsonWriter::EndArray()
+{
+    output += ']';
+    depth--;
+}
+
+void CJsonWriter::Key(std::string_view key)
+{
+    BeginValue();
+    AppendQuoted(key);
+    output += ':';
+    isAfterKey = true;
+}
+
+void CJsonWriter::String(std::string_view value)
+{
+    BeginValue();
+    AppendQuoted(value);
+}
+
+void CJsonWriter::Int(s64 value)
+{
+    BeginValue();
+    char buffer[24];
+    char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+    output.append(buffer, end - buffer);
+}
+
+void CJsonWriter::UInt(u64 value)
+{
+    BeginValue();
+    char buffer[24];
+    char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+    output.append(buffer, end - buffer);
+}
+
+void CJsonWriter::Double(double value)
+{
+    BeginValue();
+
+    // JSON has no infinity or NaN
+    if (value != value || value - value != 0)
+    {
+        output += "null";
+        return;
+    }
+
+    // The shortest representation which reads back as the same number
+    char buffer[32];
+    char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+    output.append(buffer, end - buffer);
+}
+
+void CJsonWriter::Bool(bool value)
+{
+    BeginValue();
+    output += value ? "true" : "false";
+}
+
+void CJsonWriter::Null()
+{
+    BeginValue();
+    output += "null";
+}
+
+std::string& CJsonWriter::GetOutput()
+{
+    return output;
+}
+
+void CJsonWriter::BeginValue()
+{
+    // A value after a key belongs to it, and the key already took care of the comma
+    if (isAfterKey)
+    {
+        isAfterKey = false;
+        return;
+    }
+
+    if (!isEmpty[depth])
+        output += ',';
+
+    isEmpty[depth] = false;
+}
+
+void CJsonWriter::AppendQuoted(std::string_view value)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    output += '"';
+
+    // Append everything which needs no escaping in one go, up to the next character which does
+    size_t runStart = 0;
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        unsigned char c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        output.append(value.data() + runStart, i - runStart);
+        runStart = i + 1;
+
+        switch (c)
+        {
+            case '"': output += "\\\""; break;
+            case '\\': output += "\\\\"; break;
+            case '\b': output += "\\b"; break;
+            case '\f': output += "\\f"; break;
+            case '\n': output += "\\n"; break;
+            case '\r': output += "\\r"; break;
+            case '\t': output += "\\t"; break;
+            default:
+                output += "\\u00";
+                output += hexDigits[c >> 4];
+                output += hexDigits[c & 0xF];
+                break;
+        }
+    }
+
+    output.append(value.data() + runStart, value.size() - runStart);
+    output += '"';
+}
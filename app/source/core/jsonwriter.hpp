@@ -0,0 +1,90 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <string>
+#include <string_view>
+#include "platform.hpp"
+
+// How deep arrays and objects may be nested
+#define JSON_WRITER_MAX_DEPTH 16
+
+namespace nxgallery::core
+{
+    // Writes JSON by appending it straight to a string, one value at a time. Nothing is built up
+    // in between, so writing doesn't allocate anything but what the string itself grows by. Reusing
+    // (clearing) the string keeps its memory around for the next time.
+    // The writer takes care of commas and escaping, it's up to the caller to open and close
+    // arrays and objects in the right order and to give every value in an object a key
+    class CJsonWriter
+    {
+    public:
+        // Takes the string to append to, which has to outlive the writer
+        CJsonWriter(std::string& inOutput);
+
+        // Opens and closes arrays and objects
+        void BeginObject();
+        void EndObject();
+        void BeginArray();
+        void EndArray();
+
+        // Writes the key of the next value in an object
+        void Key(std::string_view key);
+
+        // Writes values
+        void String(std::string_view value);
+        void Int(s64 value);
+        void UInt(u64 value);
+        void Double(double value);
+        void Bool(bool value);
+        void Null();
+
+        // Returns the string written to
+        std::string& GetOutput();
+
+    private:
+        // Writes what needs to go before a value, which is a comma unless it's the first one
+        void BeginValue();
+
+        // Appends a string in quotes, escaping what needs to be
+        void AppendQuoted(std::string_view value);
+
+    private:
+        // The string everything is appended to
+        std::string& output;
+
+        // How deep arrays and objects are nested right now
+        int depth = 0;
+
+        // Whether the array or object at each depth has no values yet, so the next one needs no comma
+        bool isEmpty[JSON_WRITER_MAX_DEPTH + 1] = { true };
+
+        // Whether a key was just written, so the value goes right after it
+        bool isAfterKey = false;
+    };
+}
@@ -0,0 +1,164 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "libnxalbumbackend.hpp"
+#include <stdio.h>
+#include <memory>
+
+#ifdef __SWITCH__
+using namespace nxgallery::core;
+
+void CLibnxAlbumBackend::Init()
+{
+    // SD card storage will already be mounted thanks to romfsInitialize()
+
+    // Mount the USER partition of the NAND storage by first opening the BIS USER parition
+    Result r = fsOpenBisFileSystem(&nandFileSystem, FsBisPartitionId_User, "");
+    if (R_FAILED(r))
+    {
+        printf("Error opening BIS USER partition: %d\n", R_DESCRIPTION(r));
+        return;
+    }
+
+    // Now mount the opened partition to "nand:/"
+    int rc = fsdevMountDevice("nand", nandFileSystem);
+    if (rc < 0)
+    {
+        printf("Error mounting NAND storage!\n");
+    }
+}
+
+void CLibnxAlbumBackend::Shutdown()
+{
+    // Unmount the NAND storage
+    int r = fsdevUnmountDevice("nand");
+    if (r < 0)
+    {
+        printf("Error unmounting NAND storage!\n");
+    }
+}
+
+Result CLibnxAlbumBackend::GetAlbumFileList(CapsAlbumStorage storage, std::vector<CapsAlbumEntry>& outEntries)
+{
+    // Get the total amount of files in the album
+    u64 totalAlbumFileCount = 0;
+    Result r = capsaGetAlbumFileCount(storage, &totalAlbumFileCount);
+    if (R_FAILED(r))
+        return r;
+
+    // Get all album files from the album
+    u64 albumFileCount = 0;
+    outEntries.resize(totalAlbumFileCount);
+    r = capsaGetAlbumFileList(storage, &albumFileCount, outEntries.data(), outEntries.size());
+    outEntries.resize(R_SUCCEEDED(r) ? albumFileCount : 0);
+    return r;
+}
+
+Result CLibnxAlbumBackend::GetAlbumFileCount(CapsAlbumStorage storage, u64* outCount)
+{
+    return capsaGetAlbumFileCount(storage, outCount);
+}
+
+Result CLibnxAlbumBackend::GetAlbumFileSize(const CapsAlbumFileId& fileId, u64* outSize)
+{
+    return capsaGetAlbumFileSize(&fileId, outSize);
+}
+
+Result CLibnxAlbumBackend::LoadAlbumFile(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize)
+{
+    return capsaLoadAlbumFile(&fileId, outSize, outBuffer, bufferSize);
+}
+
+Result CLibnxAlbumBackend::LoadAlbumFileThumbnail(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize)
+{
+    return capsaLoadAlbumFileThumbnail(&fileId, outSize, outBuffer, bufferSize);
+}
+
+Result CLibnxAlbumBackend::OpenMovieStream(const CapsAlbumFileId& fileId, u64* outStreamHandle)
+{
+    return capsaOpenAlbumMovieStream(outStreamHandle, &fileId);
+}
+
+void CLibnxAlbumBackend::CloseMovieStream(u64 streamHandle)
+{
+    capsaCloseAlbumMovieStream(streamHandle);
+}
+
+Result CLibnxAlbumBackend::GetMovieStreamSize(u64 streamHandle, u64* outSize)
+{
+    return capsaGetAlbumMovieStreamSize(streamHandle, outSize);
+}
+
+Result CLibnxAlbumBackend::ReadMovieStream(u64 streamHandle, u64 offset, void* outBuffer, u64 bufferSize, u64* outSize)
+{
+    return capsaReadMovieDataFromAlbumMovieReadStream(streamHandle, offset, outBuffer, bufferSize, outSize);
+}
+
+Result CLibnxAlbumBackend::GetApplicationName(u64 titleId, std::string& outName)
+{
+    // Retrieve the control.nacp data for the game where the current album entry was taken
+    // It's too big for the stack, so it goes onto the heap
+    std::unique_ptr<NsApplicationControlData> nacpData = std::make_unique<NsApplicationControlData>();
+    u64 nacpDataSize;
+    Result r = nsGetApplicationControlData(NsApplicationControlSource_Storage, titleId, nacpData.get(), sizeof(NsApplicationControlData), &nacpDataSize);
+    if (R_FAILED(r))
+        return r;
+
+    // Retrieve the language string for the Switch'es desired language
+    NacpLanguageEntry* nacpLangEntry;
+    r = nsGetApplicationDesiredLanguage(&nacpData->nacp, &nacpLangEntry);
+
+    // If it worked, we can grab the nacpLangEntry->name which will hold the name of the title
+    if (R_SUCCEEDED(r))
+        outName = nacpLangEntry->name;
+
+    return r;
+}
+
+Result CLibnxAlbumBackend::GetIsDarkTheme(bool* outIsDarkTheme)
+{
+    // Get the console's color theme
+    ColorSetId colorTheme;
+    Result r = setsysGetColorSetId(&colorTheme);
+    if (R_SUCCEEDED(r))
+        *outIsDarkTheme = colorTheme == ColorSetId_Dark;
+
+    return r;
+}
+
+const char* CLibnxAlbumBackend::GetAlbumDir(CapsAlbumStorage storage)
+{
+    return storage == CapsAlbumStorage_Sd ? ALBUM_DIR_SD : ALBUM_DIR_NAND;
+}
+
+const char* CLibnxAlbumBackend::GetCacheDir()
+{
+    return CACHE_DIR_SD;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include "albumbackend.hpp"
+
+#ifdef __SWITCH__
+
+// Where the album directories are on the SD card and the NAND's USER partition
+#define ALBUM_DIR_SD "sdmc:/Nintendo/Album/"
+#define ALBUM_DIR_NAND "nand:/Album/"
+
+// Where NXGallery keeps files across launches, next to where homebrew apps are usually put
+#define CACHE_DIR_SD "sdmc:/switch/NXGallery/"
+
+namespace nxgallery::core
+{
+    // The album backend of the Switch, which goes through capsa for the album, ns for title names
+    // and setsys for the theme. It also mounts the NAND's USER partition, so album files stored
+    // there can be read directly
+    class CLibnxAlbumBackend : public IAlbumBackend
+    {
+    public:
+        void Init() override;
+        void Shutdown() override;
+
+        Result GetAlbumFileList(CapsAlbumStorage storage, std::vector<CapsAlbumEntry>& outEntries) override;
+        Result GetAlbumFileCount(CapsAlbumStorage storage, u64* outCount) override;
+        Result GetAlbumFileSize(const CapsAlbumFileId& fileId, u64* outSize) override;
+        Result LoadAlbumFile(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize) override;
+        Result LoadAlbumFileThumbnail(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize) override;
+
+        Result OpenMovieStream(const CapsAlbumFileId& fileId, u64* outStreamHandle) override;
+        void CloseMovieStream(u64 streamHandle) override;
+        Result GetMovieStreamSize(u64 streamHandle, u64* outSize) override;
+        Result ReadMovieStream(u64 streamHandle, u64 offset, void* outBuffer, u64 bufferSize, u64* outSize) override;
+
+        Result GetApplicationName(u64 titleId, std::string& outName) override;
+        Result GetIsDarkTheme(bool* outIsDarkTheme) override;
+        const char* GetAlbumDir(CapsAlbumStorage storage) override;
+        const char* GetCacheDir() override;
+
+    private:
+        // Holds the filesystem of the internal NAND storage
+        FsFileSystem nandFileSystem;
+    };
+}
+
+#endif
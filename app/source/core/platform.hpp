@@ -0,0 +1,133 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+// Everything the core needs from libnx. On the Switch, that's libnx itself. Elsewhere (such as when
+// building for Linux to run and profile the server off-console), the types and macros the core uses
+// are defined here the way libnx defines them, so the core compiles unchanged
+#ifdef __SWITCH__
+#include <switch.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/sysinfo.h>
+
+// Integer types
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+// Result codes, made of a module and a description
+typedef u32 Result;
+#define R_SUCCEEDED(res) ((res) == 0)
+#define R_FAILED(res) ((res) != 0)
+#define R_MODULE(res) ((res) & 0x1FF)
+#define R_DESCRIPTION(res) (((res) >> 9) & 0x1FFF)
+#define MAKERESULT(module, description) ((((module) & 0x1FF)) | ((description) & 0x1FFF) << 9)
+
+// The libnx error codes used outside of the Switch
+enum { Module_Libnx = 345 };
+enum
+{
+    LibnxError_BadInput = 3,
+    LibnxError_IoError = 5,
+    LibnxError_NotFound = 6,
+};
+
+// Album types, as defined by libnx's caps services
+typedef enum
+{
+    CapsAlbumStorage_Nand = 0,
+    CapsAlbumStorage_Sd = 1,
+} CapsAlbumStorage;
+
+typedef enum
+{
+    CapsAlbumFileContents_ScreenShot = 0,
+    CapsAlbumFileContents_Movie = 1,
+    CapsAlbumFileContents_ExtraScreenShot = 2,
+    CapsAlbumFileContents_ExtraMovie = 3,
+} CapsAlbumFileContents;
+
+typedef struct
+{
+    u16 year;
+    u8 month;
+    u8 day;
+    u8 hour;
+    u8 minute;
+    u8 second;
+    u8 id;
+} CapsAlbumFileDateTime;
+
+typedef struct
+{
+    u64 application_id;
+    CapsAlbumFileDateTime datetime;
+    u8 storage;
+    u8 content;
+    u8 pad_x12[0x6];
+} CapsAlbumFileId;
+
+typedef struct
+{
+    u64 size;
+    CapsAlbumFileId file_id;
+} CapsAlbumEntry;
+#endif
+
+namespace nxgallery::core
+{
+    // Returns how much memory this process may still allocate
+    inline u64 GetAvailableMemory()
+    {
+#ifdef __SWITCH__
+        // Ask the kernel how much memory this process may use and how much of it is used already
+        u64 totalMemory = 0;
+        u64 usedMemory = 0;
+        if (R_FAILED(svcGetInfo(&totalMemory, InfoType_TotalMemorySize, CUR_PROCESS_HANDLE, 0)) ||
+            R_FAILED(svcGetInfo(&usedMemory, InfoType_UsedMemorySize, CUR_PROCESS_HANDLE, 0)))
+            return (u64)-1;
+
+        return totalMemory > usedMemory ? totalMemory - usedMemory : 0;
+#else
+        // There's no limit per process here, so go by what the system has left
+        struct sysinfo info;
+        if (sysinfo(&info) != 0)
+            return (u64)-1;
+
+        return (u64)info.freeram * info.mem_unit;
+#endif
+    }
+}
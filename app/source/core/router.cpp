@@ -0,0 +1,313 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "router.hpp"
+#include "albumwrapper.hpp"
+#include <algorithm>
+using namespace nxgallery::core;
+
+// Finds the album entry a request for /thumbnail or /file is about. Entries can either be requested
+// by their ID (?id=), which is only valid until the album changes, or by their key (?key=), which
+// always refers to the same file. Returns the ID of the entry, or -1 after setting up a 404
+static int FindRequestedEntry(const SHttpRequest& request, SHttpResponse& response)
+{
+    int fileId = -1;
+    std::string_view key;
+    if (CRouter::GetQueryParam(request, "key", key))
+    {
+        fileId = CAlbumWrapper::Get()->FindAlbumEntryByKey(key);
+
+        // Files in the album never change, so whatever is served under a key can be cached forever
+        if (fileId >= 0)
+            response.AddHeader("Cache-Control", "public, max-age=31536000, immutable");
+    }
+    else if (CRouter::GetQueryParam(request, "id", fileId))
+    {
+        // The same ID might point to another file once the album changed, so caches need to ask every time
+        response.AddHeader("Cache-Control", "no-cache");
+    }
+
+    // Make sure we got a valid ID
+    if (fileId < 0 || fileId >= CAlbumWrapper::Get()->GetAlbumEntryCount())
+    {
+        response.SetStatus(404, "Invalid content ID");
+        return -1;
+    }
+
+    return fileId;
+}
+
+// Logic behind the /gallery?page= (or ?cursor=, ?date=) endpoint, returns one page of the album as JSON
+// How many entries a page has can be asked for with &limit=, which entries it has with &game=, &type=
+// and &storage=, and their order with &sort=
+static void HandleGallery(const SHttpRequest& request, SHttpResponse& response)
+{
+    int pageSize = CONTENT_PER_PAGE;
+    if (request.HasQueryParam("limit") && (!CRouter::GetQueryParam(request, "limit", pageSize) || pageSize < 1 || pageSize > GALLERY_MAX_PAGE_SIZE))
+    {
+        response.SetStatus(400, "Bad Request");
+        return;
+    }
+
+    // Only show entries of a game, type and storage, if asked for, in the order asked for
+    SGallerySelection selection;
+    if (!CAlbumWrapper::Get()->SelectGalleryEntries(request.GetQueryParam("game"), request.GetQueryParam("type"), request.GetQueryParam("storage"), request.GetQueryParam("sort"), selection))
+    {
+        response.SetStatus(400, "Bad Request");
+        return;
+    }
+
+    // A page either continues after the entry a cursor points at, starts at the newest entry of a date,
+    // or is picked by its number. Cursors keep pointing at the same spot when new captures come in, page
+    // numbers don't. Only one of them may be sent
+    if (request.HasQueryParam("page") + request.HasQueryParam("cursor") + request.HasQueryParam("date") > 1)
+    {
+        response.SetStatus(400, "Bad Request");
+        return;
+    }
+
+    int first = 0;
+    if (request.HasQueryParam("cursor") || request.HasQueryParam("date"))
+    {
+        if (request.HasQueryParam("cursor"))
+            first = CAlbumWrapper::Get()->FindGalleryCursor(selection, request.GetQueryParam("cursor"));
+        else
+            first = CAlbumWrapper::Get()->FindGalleryDate(selection, request.GetQueryParam("date"));
+
+        if (first < 0)
+        {
+            response.SetStatus(400, "Bad Request");
+            return;
+        }
+    }
+    else
+    {
+        // The first page is the default
+        int page = 1;
+        if (request.HasQueryParam("page") && !CRouter::GetQueryParam(request, "page", page))
+        {
+            response.SetStatus(400, "Bad Request");
+            return;
+        }
+
+        first = CAlbumWrapper::Get()->GetGalleryPageStart(selection, page, pageSize);
+    }
+
+    response.AddHeader("Access-Control-Allow-Origin", "*");
+    response.AddHeader("Cache-Control", "no-cache");
+
+    // Pages are cached with their ETag and a gzip compressed version, so sending one again is just a lookup
+    std::shared_ptr<SCachedResponse> galleryPage = CAlbumWrapper::Get()->GetGalleryPage(selection, first, pageSize);
+    if (galleryPage)
+    {
+        response.SetCachedBody(request, *galleryPage, "application/json");
+        return;
+    }
+
+    // Big pages are written while they're sent. We don't know their bytes up front, so there's no ETag
+    response.AddHeader("Content-Type", "application/json");
+    response.body = CAlbumWrapper::Get()->GetGalleryContent(selection, first, pageSize);
+}
+
+// Logic behind the /timeline endpoint, returns how many entries were taken on which days and in which months
+static void HandleTimeline(const SHttpRequest& request, SHttpResponse& response)
+{
+    response.AddHeader("Access-Control-Allow-Origin", "*");
+    response.AddHeader("Cache-Control", "no-cache");
+    response.SetCachedBody(request, *CAlbumWrapper::Get()->GetTimeline(), "application/json");
+}
+
+// Logic behind the /games endpoint, returns every game the album has entries of
+static void HandleGames(const SHttpRequest& request, SHttpResponse& response)
+{
+    response.AddHeader("Access-Control-Allow-Origin", "*");
+    response.AddHeader("Cache-Control", "no-cache");
+    response.SetCachedBody(request, *CAlbumWrapper::Get()->GetGames(), "application/json");
+}
+
+// Logic behind the /search?q= endpoint, returns the games whose name contains the query
+static void HandleSearch(const SHttpRequest& request, SHttpResponse& response)
+{
+    // The query is URL encoded, as names have spaces and other characters in them
+    std::string query;
+    if (!CRouter::GetQueryParam(request, "q", query))
+    {
+        response.SetStatus(400, "Bad Request");
+        return;
+    }
+
+    response.AddHeader("Access-Control-Allow-Origin", "*");
+    response.AddHeader("Cache-Control", "no-cache");
+    response.AddHeader("Content-Type", "application/json");
+    response.body = std::make_shared<CMemorySource>(CAlbumWrapper::Get()->GetSearchContent(query));
+}
+
+// Logic behind the /thumbnail?id= (or ?key=) endpoint, returns the thumbnail of a picture or video
+static void HandleThumbnail(const SHttpRequest& request, SHttpResponse& response)
+{
+    response.AddHeader("Access-Control-Allow-Origin", "*");
+
+    int fileId = FindRequestedEntry(request, response);
+    if (fileId < 0)
+        return;
+
+    // The key identifies the thumbnail, so it makes a strong ETag. Nothing to load if the client has it already
+    if (response.SetETag(request, "\"" + std::string(CAlbumWrapper::Get()->GetAlbumEntryKey(fileId)) + "-t\""))
+        return;
+
+    // Allocate the buffer for the thumbnail
+    // 64kb is enough for a thumbnail
+    std::string imageBuffer;
+    imageBuffer.resize(64 * 1024);
+
+    // The actual size is smaller than the workbuffer we allocated, so only send what we actually use
+    u64 actualImageBufferSize = 0;
+    if (!CAlbumWrapper::Get()->GetFileThumbnail(fileId, &imageBuffer[0], imageBuffer.size(), &actualImageBufferSize))
+    {
+        // Send a server error back
+        response.SetStatus(500, "Failed to load thumbnail");
+        return;
+    }
+
+    // Send a 200 OK back with the raw JPEG data
+    imageBuffer.resize(actualImageBufferSize);
+    response.AddHeader("Content-Type", "image/jpeg");
+    response.body = std::make_shared<CMemorySource>(std::move(imageBuffer));
+}
+
+// Logic behind the /file?id= (or ?key=) endpoint, returns the full content of a picture or video
+static void HandleFile(const SHttpRequest& request, SHttpResponse& response)
+{
+    response.AddHeader("Access-Control-Allow-Origin", "*");
+
+    int fileId = FindRequestedEntry(request, response);
+    if (fileId < 0)
+        return;
+
+    // The key identifies the file, so it makes a strong ETag. Nothing to load if the client has it already
+    if (response.SetETag(request, "\"" + std::string(CAlbumWrapper::Get()->GetAlbumEntryKey(fileId)) + "\""))
+        return;
+
+    // Get the media first to check what type it is
+    CapsAlbumFileContents fileType = CAlbumWrapper::Get()->GetAlbumEntryType(fileId);
+    bool isVideo = (fileType == CapsAlbumFileContents_Movie || fileType == CapsAlbumFileContents_ExtraMovie);
+
+    // Videos are read from their movie stream while they're sent, so a range request only reads the
+    // parts of the video it covers, and no download needs more than a few small buffers
+    std::shared_ptr<IContentSource> content = CAlbumWrapper::Get()->GetFileContent(fileId);
+    if (!content)
+    {
+        // Send a server error back
+        response.SetStatus(500, "Failed to load file");
+        return;
+    }
+
+    // Send the file (or the parts of it which were asked for) back with the correct content type
+    response.SetDownloadFilename(CAlbumWrapper::Get()->GetAlbumEntryFilename(fileId));
+    response.SetRangedBody(request, std::move(content), isVideo ? "video/mp4" : "image/jpeg");
+}
+
+// The routing table. It has to stay sorted by path, which is checked at compile time below
+static constexpr SRoute routes[] = {
+    { "/file", HandleFile },
+    { "/gallery", HandleGallery },
+    { "/games", HandleGames },
+    { "/search", HandleSearch },
+    { "/thumbnail", HandleThumbnail },
+    { "/timeline", HandleTimeline },
+};
+
+// Returns whether the routing table is sorted by path and has no duplicates
+static constexpr bool IsRoutingTableSorted()
+{
+    for (size_t i = 1; i < sizeof(routes) / sizeof(routes[0]); i++)
+    {
+        if (!(routes[i - 1].path < routes[i].path))
+            return false;
+    }
+
+    return true;
+}
+
+// Binary search over the routing table, returns the index of the route or -1
+static constexpr int FindRouteIndex(std::string_view path)
+{
+    int low = 0;
+    int high = sizeof(routes) / sizeof(routes[0]) - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        int comparison = path.compare(routes[middle].path);
+        if (comparison == 0)
+            return middle;
+        else if (comparison < 0)
+            high = middle - 1;
+        else
+            low = middle + 1;
+    }
+
+    return -1;
+}
+
+static_assert(IsRoutingTableSorted(), "The routing table needs to be sorted by path");
+static_assert(FindRouteIndex("/gallery") >= 0 && FindRouteIndex("/index.html") < 0, "Route lookup is broken");
+
+RouteHandler CRouter::FindRoute(std::string_view path)
+{
+    int index = FindRouteIndex(path);
+    return index >= 0 ? routes[index].handler : nullptr;
+}
+
+bool CRouter::DecodeQueryValue(std::string_view value, std::string& outDecoded)
+{
+    outDecoded.clear();
+    outDecoded.reserve(value.size());
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        if (value[i] == '+')
+        {
+            outDecoded += ' ';
+        }
+        else if (value[i] == '%')
+        {
+            u8 byte = 0;
+            auto [end, error] = std::from_chars(value.data() + i + 1, value.data() + std::min(i + 3, value.size()), byte, 16);
+            if (error != std::errc() || end != value.data() + i + 3)
+                return false;
+
+            outDecoded += (char)byte;
+            i += 2;
+        }
+        else
+        {
+            outDecoded += value[i];
+        }
+    }
+
+    return true;
+}
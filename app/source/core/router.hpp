@@ -0,0 +1,100 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <type_traits>
+#include "http.hpp"
+
+namespace nxgallery::core
+{
+    // Signature every API endpoint implements
+    typedef void (*RouteHandler)(const SHttpRequest& request, SHttpResponse& response);
+
+    // One entry of the routing table, mapping an exact path to its handler
+    struct SRoute
+    {
+        std::string_view path;
+        RouteHandler handler;
+    };
+
+    // This class routes API requests to their handlers. The routing table is checked and
+    // sorted at compile time, so dispatching a request is one binary search over exact paths
+    // and never touches the filesystem. Everything that isn't an API route is a static asset
+    class CRouter
+    {
+    public:
+        // Returns the handler for the given path, or nullptr if it's not an API route
+        static RouteHandler FindRoute(std::string_view path);
+
+        // Decodes a query parameter value, turning "+" into spaces and "%XX" into the byte it stands for
+        // Returns false if there's a "%" which isn't followed by two hex digits
+        static bool DecodeQueryValue(std::string_view value, std::string& outDecoded);
+
+        // Parses a query parameter into outValue. Returns false if it wasn't sent or isn't a valid
+        // value of that type, in which case outValue stays untouched
+        template<typename T>
+        static bool GetQueryParam(const SHttpRequest& request, std::string_view name, T& outValue)
+        {
+            if constexpr (std::is_integral_v<T>)
+            {
+                // Numbers need to be numbers as a whole, "12abc" is no valid ID
+                std::string_view value = request.GetQueryParam(name);
+                T parsedValue;
+                auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), parsedValue);
+                if (value.empty() || error != std::errc() || end != value.data() + value.size())
+                    return false;
+
+                outValue = parsedValue;
+                return true;
+            }
+            else if constexpr (std::is_same_v<T, std::string>)
+            {
+                // Strings are decoded, while views point at the raw value
+                std::string decodedValue;
+                if (!request.HasQueryParam(name) || !DecodeQueryValue(request.GetQueryParam(name), decodedValue))
+                    return false;
+
+                outValue = std::move(decodedValue);
+                return true;
+            }
+            else
+            {
+                static_assert(std::is_same_v<T, std::string_view>, "Unsupported query parameter type");
+
+                if (!request.HasQueryParam(name))
+                    return false;
+
+                outValue = request.GetQueryParam(name);
+                return true;
+            }
+        }
+    };
+}
@@ -27,6 +27,9 @@
 
 #include "server.hpp"
 #include "albumwrapper.hpp"
+#include "router.hpp"
+#include "assets.hpp"
+#include "videostreampool.hpp"
 
 using namespace nxgallery::core;
 
@@ -37,6 +40,7 @@ CWebServer::CWebServer(int port)
 
     // We're not running yet
     isRunning = false;
+    shouldStop = false;
 
     // We won't initialize the web server here just now, 
     // the caller can do that by calling CWebServer::Start
@@ -48,6 +52,24 @@ void CWebServer::Start()
     if (isRunning)
         return;
 
+    // Open the server socket on the calling thread, so the caller knows right away whether it worked
+    if (!OpenSocket())
+        return;
+
+    // Content read on other threads wakes the network thread up through this. Without it, connections
+    // waiting for their body are checked on a short timeout instead
+    CContentWakeup::Get()->Open();
+
+    // Now we're running
+    isRunning = true;
+    shouldStop = false;
+
+    // Spawn the network thread which will do all the accepting and serving from now on
+    networkThread = std::thread(&CWebServer::NetworkThreadMain, this);
+}
+
+bool CWebServer::OpenSocket()
+{
     // Construct a socket address where we want to listen for requests
     static struct sockaddr_in serv_addr;
     serv_addr.sin_addr.s_addr = INADDR_ANY; // The Switch'es IP address
@@ -59,14 +81,11 @@ void CWebServer::Start()
     if (serverSocket < 0)
     {
         printf("Failed to create a web server socket: %d\n", errno);
-        return;
+        return false;
     }
 
-    // Set a relatively short timeout for recv() calls, see CWebServer::ServeRequest for more info why
-    struct timeval recvTimeout;
-    recvTimeout.tv_sec = 1;
-    recvTimeout.tv_usec = 0;
-    setsockopt(serverSocket, SOL_SOCKET, SO_RCVTIMEO, (char*)&recvTimeout, sizeof(recvTimeout));
+    // Make the socket non-blocking, so accept() returns right away once the backlog is drained
+    fcntl(serverSocket, F_SETFL, fcntl(serverSocket, F_GETFL, 0) | O_NONBLOCK);
 
     // Enable address and port reusing
     int yes = 1;
@@ -77,18 +96,40 @@ void CWebServer::Start()
     if (bind(serverSocket, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0)
     {
         printf("Failed to bind web server socket: %d\n", errno);
-        return;
+        CloseSocket();
+        return false;
     }
 
-    // Start listening to the socket with 5 maximum parallel connections
-    if (listen(serverSocket, 10) < 0)
+    // Start listening to the socket, with room for as many pending connections as we serve at once, so
+    // a crowd of clients connecting together isn't turned away before we get to accept them
+    if (listen(serverSocket, SERVER_MAX_CONNECTIONS) < 0)
     {
         printf("Failed to listen to the web server socket: %d\n", errno);
-        return;
+        CloseSocket();
+        return false;
     }
 
-    // Now we're running
-    isRunning = true;
+    // Let everyone know we're listening
+    std::lock_guard<std::mutex> lock(statusMutex);
+    status.isListening = true;
+
+    return true;
+}
+
+void CWebServer::CloseSocket()
+{
+    // Nothing to close if the socket never opened
+    if (serverSocket < 0)
+        return;
+
+    // Shutdown the server socket, then close it
+    shutdown(serverSocket, SHUT_RDWR);
+    close(serverSocket);
+    serverSocket = -1;
+
+    // We're not listening anymore
+    std::lock_guard<std::mutex> lock(statusMutex);
+    status.isListening = false;
 }
 
 void CWebServer::GetAddress(char* buffer)
@@ -104,330 +145,555 @@ void CWebServer::AddMountPoint(const char* path)
     mountPoints.push_back(path);
 }
 
-void CWebServer::ServeLoop()
+SServerStatus CWebServer::GetStatus()
+{
+    // Hand out a copy, so the caller never sees values the network thread is about to change
+    std::lock_guard<std::mutex> lock(statusMutex);
+    return status;
+}
+
+void CWebServer::NetworkThreadMain()
+{
+#ifdef __DEBUG__
+    printf("Network thread started\n");
+#endif
+
+    // Keep serving until we're asked to stop. As ServeLoop blocks in poll() for at most
+    // SERVER_POLL_TIMEOUT_MS, Stop() will never have to wait longer than that for us
+    while (!shouldStop)
+    {
+        // The socket might have been closed because it failed (e.g. after the console woke up from sleep),
+        // so try to open it again before serving anything
+        if (serverSocket < 0 && !OpenSocket())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_RESTART_DELAY_MS));
+            continue;
+        }
+
+        ServeLoop(SERVER_POLL_TIMEOUT_MS);
+    }
+
+    // Drop everyone still connected
+    CloseAllConnections();
+
+#ifdef __DEBUG__
+    printf("Network thread exited\n");
+#endif
+}
+
+void CWebServer::ServeLoop(int timeoutMs)
 {
     // Asynchronous / event-driven loop using poll
     // More here: http://man7.org/linux/man-pages/man2/poll.2.html
+    // The server socket and all client sockets go into one poll() set, so one slow client
+    // never holds up the others
+
+    // The first entry is always the server socket. Only listen for new clients if we have room for them
+    pollInfos.clear();
+    struct pollfd serverPollInfo;
+    serverPollInfo.fd = serverSocket;
+    serverPollInfo.events = connections.size() < SERVER_MAX_CONNECTIONS ? POLLIN : 0;
+    serverPollInfo.revents = 0;
+    pollInfos.push_back(serverPollInfo);
+
+    // The second one is the wakeup socket, if it's open, which tells us when a body was read on another thread
+    int wakeupSocket = CContentWakeup::Get()->GetSocket();
+    if (wakeupSocket >= 0)
+    {
+        struct pollfd wakeupPollInfo;
+        wakeupPollInfo.fd = wakeupSocket;
+        wakeupPollInfo.events = POLLIN;
+        wakeupPollInfo.revents = 0;
+        pollInfos.push_back(wakeupPollInfo);
+    }
+    size_t firstConnectionPollInfo = pollInfos.size();
 
-    // Do not try to serve anything when the server isn't running
-    if (!isRunning)
+    // Then one entry for every connection, waiting for the event its state needs to continue
+    for (SHttpConnection& connection : connections)
+    {
+        // A connection might already hold the next request (e.g. a pipelined one), so don't block then
+        if (connection.state == EConnectionState::Dispatching)
+            timeoutMs = 0;
+
+        // Without a wakeup socket, nobody tells us when a body was read, so check back soon
+        if (connection.isWaitingForBody && wakeupSocket < 0)
+            timeoutMs = std::min(timeoutMs, SERVER_WAKEUP_FALLBACK_MS);
+
+        // A connection waiting for its body to be read can't send anything, even if its socket could
+        struct pollfd connectionPollInfo;
+        connectionPollInfo.fd = connection.socket;
+        connectionPollInfo.events = connection.state == EConnectionState::WritingBody ? (connection.isWaitingForBody ? 0 : POLLOUT) : POLLIN;
+        connectionPollInfo.revents = 0;
+        pollInfos.push_back(connectionPollInfo);
+    }
+
+    // Poll for new events, blocking until there is one or the timeout passed
+    int numEvents = poll(pollInfos.data(), pollInfos.size(), timeoutMs);
+    if (numEvents < 0)
+    {
+#ifdef __DEBUG__
+        if (errno != EINTR)
+            printf("Error polling sockets: %d %s\n", errno, strerror(errno));
+#endif
         return;
+    }
 
-    // Will hold the data returned from poll()
-    struct pollfd pollInfo;
-    pollInfo.fd = serverSocket; // Listen to events from the server socket we opened
-    pollInfo.events = POLLIN; // Only react on incoming events
-    pollInfo.revents = 0; // Gets filled with events later
+    // Some body was read, so every connection waiting for one gets to try again. Reading the signals
+    // first means none of the ones coming in from now on get lost
+    bool isBodyReady = wakeupSocket < 0 || (pollInfos[1].revents & POLLIN);
+    if (wakeupSocket >= 0 && isBodyReady)
+        CContentWakeup::Get()->Drain();
 
-    // Poll for new events
-    if (poll(&pollInfo, 1, 0) > 0)
+    // Work through the connections which have something to do. Every connection gets at most
+    // one read and one chunk written per iteration, so they all take turns fairly
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < connections.size(); i++)
     {
-        // There was an incoming event on the server socket
-        if (pollInfo.revents & POLLIN)
+        SHttpConnection& connection = connections[i];
+        short revents = pollInfos[firstConnectionPollInfo + i].revents;
+
+        if (connection.isWaitingForBody && isBodyReady)
         {
-            // Will hold data about the new connection
-            struct sockaddr_in clientAddress;
-            socklen_t addrLen = sizeof(clientAddress);
+            connection.isWaitingForBody = false;
+            revents |= POLLOUT;
+        }
 
-            // Accept the incoming connection
-            int acceptedConnection = accept(serverSocket, (struct sockaddr*)&clientAddress, &addrLen);
-            if (acceptedConnection > 0)
-            {
-#ifdef __DEBUG__
-                printf("Accepted connection from %s:%u\n", inet_ntoa(clientAddress.sin_addr), ntohs(clientAddress.sin_port));
-#endif
+        if (revents & POLLIN)
+            ReadFromConnection(connection);
+        else if (revents & (POLLERR | POLLHUP | POLLNVAL))
+            connection.state = EConnectionState::Closing;
 
-                // Serve ("answer") the request which is waiting at the file descriptor accept() returned
-                ServeRequest(acceptedConnection, acceptedConnection, mountPoints);
+        // A full request arrived, answer it and try sending the start of the response right away
+        if (connection.state == EConnectionState::Dispatching)
+        {
+            DispatchRequest(connection);
+            revents |= POLLOUT;
+        }
 
-                // After we served the request, close the connection
-                if (close(acceptedConnection) < 0)
-                {
+        if (connection.state == EConnectionState::WritingBody && (revents & POLLOUT))
+            WriteToConnection(connection);
+
+        // Drop kept-alive connections which didn't send another request in time, and all
+        // other connections which haven't made any progress for too long
+        bool isIdle = connection.state == EConnectionState::ReadingHeaders && connection.requestsServed > 0 && connection.inBuffer.empty();
+        auto timeout = isIdle ? std::chrono::milliseconds(HTTP_KEEPALIVE_TIMEOUT * 1000) : std::chrono::milliseconds(SERVER_CONNECTION_TIMEOUT_MS);
+        if (now - connection.lastActivity > timeout)
+            connection.state = EConnectionState::Closing;
+    }
+
+    // Close and remove all connections which are done
+    for (auto it = connections.begin(); it != connections.end();)
+    {
+        if (it->state == EConnectionState::Closing)
+        {
+            if (close(it->socket) < 0)
+            {
 #ifdef __DEBUG__
-                    printf("Error closing connection %d: %d %s\n", acceptedConnection, errno, strerror(errno));
+                printf("Error closing connection %d: %d %s\n", it->socket, errno, strerror(errno));
 #endif
-                }
             }
-            else if (errno == ECONNABORTED && isRunning)
-            {
-                // Make sure this only happens once
-                isRunning = false;
-
-                // Shutdown and close a socket if still open
-                shutdown(serverSocket, SHUT_RDWR);
-                close(serverSocket);
 
-                // Start the sever again
-                Start();
-            }
-            
+            it = connections.erase(it);
         }
+        else
+        {
+            ++it;
+        }
+    }
+
+    // There was an incoming event on the server socket
+    if (pollInfos[0].revents & POLLIN)
+    {
+        AcceptConnections();
+    }
+    else if (pollInfos[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+    {
+        // The server socket broke, close it so the network thread will open it again
+        CloseSocket();
     }
-    
+
+    // Close the movie streams nobody came back for. Checking asks the system how much memory is left,
+    // so it's only done every now and then rather than on every iteration
+    if (now - lastStreamEviction >= std::chrono::milliseconds(SERVER_STREAM_EVICTION_INTERVAL_MS))
+    {
+        CVideoStreamPool::Get()->EvictIdle();
+        lastStreamEviction = now;
+    }
+
+    // Pick up screenshots and videos taken (or deleted) while the server runs. The album thread caches
+    // the album again when it changed, it's only swapped in here as the indices are used on the network thread
+    CAlbumWrapper::Get()->ApplyGalleryContent();
+
+    // Update the status for everyone watching
+    std::lock_guard<std::mutex> lock(statusMutex);
+    status.activeConnections = connections.size();
 }
 
-void CWebServer::ServeRequest(int in, int out, std::vector<const char*> mountPoints)
+void CWebServer::AcceptConnections()
 {
-    // A lot of the code here is taken from the german page here: https://www.kompf.de/cplus/artikel/httpserv.html
-    
-    // Will hold the raw data to send out
-    char buffer[8192];
-
-    // Various pointers for the header reading
-    char *b = buffer;
-    char *l = buffer;
-    char *le;
-
-    // Counts the bytes received from a request
-    int bytesReceived = 0;
-    int bytesTotal = 0;
-
-    // URL which was requested
-    char url[256];
-    *url = 0;
-
-    // Will hold the requested URL mapped to the server filesystem
-    char path[256];
-
-    // Will hold the file descriptor of the file which was requested (e.g. a .html file)
-    int fileToServe = 0;
-
-    // For the /gallery endpoint, this holds the page argument
-    int galleryPage = 0;
-
-    // For the file endpoint, this holds the requested file ID
-    int fileId = 0;
-
-    // While there is data to receive, receive it
-    // NOTE: recv() is a blocking call, see here: http://man7.org/linux/man-pages/man2/recv.2.html
-    //       Therefore, the code may halt here to wait for incoming data. Some browsers, such as
-    //       Google Chrome like to open a second socket (but not send anything) as a backup socket
-    //       for optimization. Therefore, we would wait forever for data to arrive on that socket.
-    //       That's why I set a timeout for recv calls() before, see CWebServer::Start()
-    bool breakReceive = false;
-    while ((bytesReceived = recv(in, b, sizeof(buffer) - bytesTotal, 0)) > 0) 
+    // Drain the whole backlog, so a burst of clients (like a browser opening a page) gets in at once
+    while (connections.size() < SERVER_MAX_CONNECTIONS)
     {
-        // Count the bytes received
-        bytesTotal += bytesReceived;
-        b += bytesReceived;
+        // Will hold data about the new connection
+        struct sockaddr_in clientAddress;
+        socklen_t addrLen = sizeof(clientAddress);
 
-        // Go through all bytes we received until now
-        while (l < b) 
+        // Accept the incoming connection
+        int acceptedConnection = accept(serverSocket, (struct sockaddr*)&clientAddress, &addrLen);
+        if (acceptedConnection < 0)
         {
-            // Check if we reached the end of the request by looking at terminators
-            le = l;
-            while (le < b && *le != '\n' && *le != '\r')
-            { 
-                ++le;
-            }
+            // The console went to sleep or similar, close the broken socket. The network thread
+            // will open it again on the next iteration
+            if (errno == ECONNABORTED)
+                CloseSocket();
 
-            if ('\n' == *le || '\r' == *le) 
-            {
-                // Right now we reached the end and therefore we have a full request header
-                *le = 0;
-                // printf("Header \"%s\"\n", l);
+            // Otherwise, this is EAGAIN and the backlog is empty
+            return;
+        }
+
+#ifdef __DEBUG__
+        printf("Accepted connection from %s:%u\n", inet_ntoa(clientAddress.sin_addr), ntohs(clientAddress.sin_port));
+#endif
 
-                // Scan the request header to see if this was the last request header
-                // The last request header will always contain the operation requested, such as "GET /index.html HTTP/1.0"
-                // The requested URL will be stored in url
-                sscanf(l, "GET %255s HTTP/", url);
+        // Client sockets are non-blocking too, we only ever touch them once poll() says so
+        fcntl(acceptedConnection, F_SETFL, fcntl(acceptedConnection, F_GETFL, 0) | O_NONBLOCK);
 
-                // Was the last header we received an operation? If so, we reached the end
-                // of all request headers and we can break this while loop
-                if (strlen(l))
-                    breakReceive = true;
+        // Responses go out in as few send()s as we can, so there's nothing to gain from Nagle's algorithm.
+        // It would hold back the last bit of a body until the client acknowledged the rest, which the
+        // client delays, in the hope of more data coming. That cost every download 40 ms
+        int noDelay = 1;
+        setsockopt(acceptedConnection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
 
-                l = le + 1;
-            }
-        }
+        // Add it to the table, waiting for the request to come in
+        SHttpConnection connection;
+        connection.socket = acceptedConnection;
+        connection.lastActivity = std::chrono::steady_clock::now();
+        connections.push_back(std::move(connection));
 
-        // Should we break? Then break
-        if (breakReceive) 
-            break;
+        std::lock_guard<std::mutex> lock(statusMutex);
+        status.connectionsAccepted++;
     }
+}
+
+void CWebServer::ReadFromConnection(SHttpConnection& connection)
+{
+    // Only read while we are waiting for a request
+    if (connection.state != EConnectionState::ReadingHeaders)
+        return;
+
+    // Receive whatever is there
+    char buffer[4096];
+    ssize_t bytesReceived = recv(connection.socket, buffer, sizeof(buffer), 0);
+    if (bytesReceived == 0)
+    {
+        // The client closed the connection
+        connection.state = EConnectionState::Closing;
+        return;
+    }
+    else if (bytesReceived < 0)
+    {
+        // Spurious wakeups are fine, everything else means the connection broke
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            connection.state = EConnectionState::Closing;
+
+        return;
+    }
+
+    connection.inBuffer.append(buffer, bytesReceived);
+    connection.lastActivity = std::chrono::steady_clock::now();
 
-    // Did the request contain a URL for us to serve?
-    if (strlen(url) > 0) 
+    // See if we got a complete request now
+    connection.CheckForRequest();
+    if (connection.state != EConnectionState::Dispatching && connection.inBuffer.size() > SERVER_MAX_HEADER_SIZE)
     {
+        // Nobody needs headers this big
+        connection.state = EConnectionState::Closing;
+    }
+}
+
+void CWebServer::DispatchRequest(SHttpConnection& connection)
+{
+    const SHttpRequest& request = connection.request;
+
+    // HTTP/1.1 clients keep the connection open unless they say otherwise, HTTP/1.0 clients only if they ask for it
+    if (request.minorVersion >= 1)
+        connection.keepAlive = !request.HeaderHasToken("Connection", "close");
+    else
+        connection.keepAlive = request.HeaderHasToken("Connection", "keep-alive");
+
+    // We never read request bodies, so if one was sent we can't tell where the next request starts
+    if (!request.GetHeader("Content-Length").empty() || !request.GetHeader("Transfer-Encoding").empty())
+        connection.keepAlive = false;
+
 #ifdef __DEBUG__
-        printf("Received request: GET %s\n", url);
+    printf("Received request: %.*s %.*s\n", (int)request.method.size(), request.method.data(), (int)request.target.size(), request.target.data());
 #endif
-        // Map the requested URL to the path where we serve web assets
-        // If the request didn't specify a file but only a "/", we route
-        // to index.html aswell.
-        if (strcmp(url, "/") == 0)
-        {
-            strcpy(url, "/index.html");
-        }
 
-        // Find the file in one of the mounted folders
-        for (const char* mountPoint : mountPoints)
+    SHttpResponse response;
+
+    // We only serve content, so all we need is GET, and HEAD which is answered the same way minus the body
+    bool isHead = request.method == "HEAD";
+    if (request.method == "GET" || isHead)
+    {
+        BuildResponse(request, mountPoints, response);
+    }
+    else
+    {
+        response.SetStatus(501, "Not Implemented");
+        response.AddHeader("Allow", "GET, HEAD");
+    }
+
+    // The request is handled, start sending out the response
+    connection.BeginResponse(response, !isHead);
+}
+
+void CWebServer::WriteToConnection(SHttpConnection& connection)
+{
+    u64 bytesSentNow = 0;
+
+    // Send the status line and headers first
+    if (connection.outHeadSent < connection.outHead.size())
+    {
+        ssize_t bytesSent = send(connection.socket, connection.outHead.data() + connection.outHeadSent, connection.outHead.size() - connection.outHeadSent, 0);
+        if (bytesSent < 0)
         {
-            // Map the path of the requested file to this mount point
-            sprintf(path, "%s%s", mountPoint, url);
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                connection.state = EConnectionState::Closing;
 
-            // Stat to see if the file exists at that mountpoint
-            struct stat fileStat;
-            if (stat(path, &fileStat) == 0)
-            {
-                // If so, break the loop as we have found our file path for the requested file
-                break;
-            }
+            return;
         }
 
-        // Open the requested file
-        fileToServe = open(path, O_RDONLY);
-
-        // Check if we file we tried to open existed
-        if (fileToServe > 0) {
-            // The file exists, so lets send an 200 OK to notify the client
-            // that we will continue to send HTML data now
-            sprintf(buffer, "HTTP/1.0 200 OK\n\n"); // \nContent-Type: text/html
-            send(out, buffer, strlen(buffer), 0);
+        connection.outHeadSent += bytesSent;
+        bytesSentNow += bytesSent;
+    }
 
-            // Read the data from the file requested until there is no data left to read
-            do {
-                bytesReceived = read(fileToServe, buffer, sizeof(buffer));
+    // A chunked body needs a new chunk once the data of the current one is out
+    if (connection.outHeadSent == connection.outHead.size() && connection.isBodyChunked && connection.outBodyRemaining > 0 &&
+        connection.outChunkRemaining == 0 && connection.outChunkHeadSent == connection.outChunkHead.size())
+    {
+        connection.BeginBodyChunk(SERVER_SEND_CHUNK_SIZE);
+        if (connection.state == EConnectionState::Closing)
+            return;
+    }
 
-                // Send it out to the client
-                send(out, buffer, bytesReceived, 0);
-            } while (bytesReceived > 0);
+    // Then the head of the current chunk, if there is one
+    if (connection.outHeadSent == connection.outHead.size() && connection.outChunkHeadSent < connection.outChunkHead.size())
+    {
+        ssize_t bytesSent = send(connection.socket, connection.outChunkHead.data() + connection.outChunkHeadSent, connection.outChunkHead.size() - connection.outChunkHeadSent, 0);
+        if (bytesSent < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                connection.state = EConnectionState::Closing;
 
-            // We successfully read the file to serve, so close it
-            close(fileToServe);
+            return;
         }
-        // No file to serve, check for the /gallery endpoint (and also parse out the arguments directly)
-        else if (sscanf(url, "/gallery?page=%d", &galleryPage))
-        {
-            // First, send a 200 OK back with JSON content data
-            sprintf(buffer, "HTTP/1.0 200 OK\nContent-Type: application/json\nAccess-Control-Allow-Origin: *\n\n");
-            send(out, buffer, strlen(buffer), 0);
 
-            // Ask the album wrapper to process the request
-            std::string jsonData = nxgallery::core::CAlbumWrapper::Get()->GetGalleryContent(galleryPage);
+        connection.outChunkHeadSent += bytesSent;
+        bytesSentNow += bytesSent;
+    }
 
-            // Send out the data to the socket
-            const char* dataPtr = jsonData.data();
-            std::size_t dataSize = jsonData.size();
-            int bytesSent = 0;
+    // Then one part of the body, once all headers are out
+    if (connection.outHeadSent == connection.outHead.size() && connection.outChunkHeadSent == connection.outChunkHead.size() &&
+        connection.outBodyRemaining > 0 && (!connection.isBodyChunked || connection.outChunkRemaining > 0))
+    {
+        // Get the next part of the body from its source, without going past the current chunk
+        u64 maxBytes = std::min(connection.outBodyRemaining, (u64)SERVER_SEND_CHUNK_SIZE);
+        if (connection.isBodyChunked)
+            maxBytes = std::min(maxBytes, connection.outChunkRemaining);
+
+        const char* data = nullptr;
+        u64 bytesAvailable = connection.outBody->Borrow(connection.outBodyOffset, maxBytes, &data);
+        if (bytesAvailable == 0)
+        {
+            // The source failed, the client will notice the response is cut short
+            connection.state = EConnectionState::Closing;
+            return;
+        }
 
-            while (dataSize > 0)
-            {
-                bytesSent = send(out, dataPtr, dataSize, 0);
-                if (bytesSent < 0)
-                    break;
+        // The source is still reading, park the connection until it's done instead of waiting for it
+        ssize_t bytesSent = 0;
+        if (bytesAvailable == HTTP_BORROW_PENDING)
+            connection.isWaitingForBody = true;
+        else
+            bytesSent = send(connection.socket, data, bytesAvailable, 0);
 
-                dataPtr += bytesSent;
-                dataSize -= bytesSent;
-            }
+        if (bytesSent < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                connection.state = EConnectionState::Closing;
         }
-        // Endpoint to retrieve the thumbnail of a picture
-        else if (sscanf(url, "/thumbnail?id=%d", &fileId))
+        else
         {
-            // First, send a 200 OK back with the right content type
-            sprintf(buffer, "HTTP/1.0 200 OK\nContent-Type: image/jpeg\nAccess-Control-Allow-Origin: *\n\n");
-            send(out, buffer, strlen(buffer), 0);
-
-            // Allocate the buffer for the thumbnail
-            // 64kb is enough for a thumbnail
-            int imageBufferSize = 64 * 1024;
-            char* imageBuffer = (char*)malloc(imageBufferSize);
-
-            // The actual size is smaller than the workbuffer we allocated, so only send what we actually use
-            u64 actualImageBufferSize = 0;
-            if (nxgallery::core::CAlbumWrapper::Get()->GetFileThumbnail(fileId, imageBuffer, imageBufferSize, &actualImageBufferSize))
-            {
-                // Send raw JPEG data
-                int bytesSent = 0;
-
-                // Note we only send the actual size GetFileContent returned, not the whole buffer which might contain useless data
-                while (actualImageBufferSize > 0)
-                {
-                    bytesSent = send(out, imageBuffer, actualImageBufferSize, 0);
-                    if (bytesSent < 0)
-                        break;
+            connection.outBodyOffset += bytesSent;
+            bytesSentNow += bytesSent;
 
-                    imageBuffer += bytesSent;
-                    actualImageBufferSize -= bytesSent;
-                }
-            }
-            else
+            if (connection.isBodyChunked)
             {
-                // Send a server error back
-                sprintf(buffer, "HTTP/1.0 500 Invalid content ID\nAccess-Control-Allow-Origin: *\n\n");
-                send(out, buffer, strlen(buffer), 0);
+                // The body's end is announced by the last chunk
+                connection.outChunkRemaining -= bytesSent;
             }
-        }
-        // Endpoint to retrieve the full content of a image/video
-        else if (sscanf(url, "/file?id=%d", &fileId))
-        {
-            // Get the media first to check what type it is
-            CapsAlbumFileContents fileType = nxgallery::core::CAlbumWrapper::Get()->GetAlbumEntryType(fileId);
-            bool isVideo = (fileType == CapsAlbumFileContents_Movie || fileType == CapsAlbumFileContents_ExtraMovie);
-
-            // Send a 200 OK back with the correct content type
-            std::string contentType = isVideo ? "video/mp4" : "image/jpeg";
-            std::string downloadFileName = nxgallery::core::CAlbumWrapper::Get()->GetAlbumEntryFilename(fileId);
-            sprintf(buffer, "HTTP/1.0 200 OK\nContent-Type: %s\nAccess-Control-Allow-Origin: *\nContent-Disposition: filename=\"%s\"\n\n", contentType.c_str(), downloadFileName.c_str());
-            send(out, buffer, strlen(buffer), 0);
-
-            // Allocate a buffer for the file content
-            // For screenshots, a 512kb buffer is okay, for videos, a 32mb buffer is used
-            int fileBufferSize = isVideo ? (32 * 1024 * 1024) : (512 * 1024);
-            char* fileBuffer = (char*)malloc(fileBufferSize);
-
-            // The actual size is smaller than the workbuffer we allocated, so only send what we actually use
-            u64 actualFileBufferSize = 0; 
-            if (nxgallery::core::CAlbumWrapper::Get()->GetFileContent(fileId, fileBuffer, fileBufferSize, &actualFileBufferSize))
+            else if (connection.outBodyRemaining != HTTP_SIZE_UNKNOWN)
             {
-                // Send raw file data
-                int bytesSent = 0;
-
-                // Note we only send the actual size GetFileContent returned, not the whole buffer which might contain useless data
-                while (actualFileBufferSize > 0)
-                {
-                    bytesSent = send(out, fileBuffer, actualFileBufferSize, 0);
-                    if (bytesSent < 0)
-                        break;
-
-                    fileBuffer += bytesSent;
-                    actualFileBufferSize -= bytesSent;
-                }
+                connection.outBodyRemaining -= bytesSent;
             }
             else
             {
-                // Send a server error back
-                sprintf(buffer, "HTTP/1.0 500 Invalid content ID\nAccess-Control-Allow-Origin: *\n\n");
-                send(out, buffer, strlen(buffer), 0);
+                // Sent without chunks (HTTP/1.0), it ends once the body knows its size and all of it is out
+                u64 bodySize = connection.outBody->GetSize();
+                if (bodySize != HTTP_SIZE_UNKNOWN)
+                    connection.outBodyRemaining = bodySize - connection.outBodyOffset;
             }
         }
-        // No file, and no endpoint will result in a 404
-        else
+    }
+
+    if (bytesSentNow > 0)
+        connection.lastActivity = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(statusMutex);
+    status.bytesSent += bytesSentNow;
+
+    // Once everything went out, the response is done
+    if (connection.state == EConnectionState::WritingBody && connection.outHeadSent == connection.outHead.size() &&
+        connection.outChunkHeadSent == connection.outChunkHead.size() && connection.outBodyRemaining == 0)
+    {
+        connection.FinishResponse();
+        status.requestsServed++;
+    }
+}
+
+void CWebServer::CloseAllConnections()
+{
+    for (SHttpConnection& connection : connections)
+    {
+        close(connection.socket);
+    }
+
+    connections.clear();
+
+    std::lock_guard<std::mutex> lock(statusMutex);
+    status.activeConnections = 0;
+}
+
+void CWebServer::BuildResponse(const SHttpRequest& request, const std::vector<const char*>& mountPoints, SHttpResponse& response)
+{
+    // API routes are answered by their handler right away
+    RouteHandler handler = CRouter::FindRoute(request.path);
+    if (handler)
+    {
+        handler(request, response);
+        return;
+    }
+
+    // Everything else is a static web asset
+    ServeStaticFile(request, mountPoints, response);
+}
+
+void CWebServer::ServeStaticFile(const SHttpRequest& request, const std::vector<const char*>& mountPoints, SHttpResponse& response)
+{
+    // Map the requested URL to the path where we serve web assets
+    // If the request didn't specify a file but only a "/", we route
+    // to index.html aswell.
+    std::string_view url = request.path == "/" ? "/index.html" : request.path;
+
+    // Most requests are for the web page itself, which is compiled into the executable
+    const SEmbeddedAsset* asset = CEmbeddedAssets::Find(url);
+    if (asset)
+    {
+        // Pick the smallest variant the client can handle
+        const SEmbeddedAssetVariant* variant = &asset->identity;
+        const char* contentEncoding = nullptr;
+        if (asset->brotli.data && asset->brotli.size < variant->size && request.AcceptsEncoding("br"))
+        {
+            variant = &asset->brotli;
+            contentEncoding = "br";
+        }
+        if (asset->gzip.data && asset->gzip.size < variant->size && request.AcceptsEncoding("gzip"))
         {
-            // The requested file did not exist, send out a 404
-            sprintf(buffer, "HTTP/1.0 404 Not Found\n\n");
-            send(out, buffer, strlen(buffer), 0);
+            variant = &asset->gzip;
+            contentEncoding = "gzip";
         }
+
+        // Caches need to know the response depends on Accept-Encoding, even if we sent the uncompressed variant
+        if (asset->HasCompressedVariants())
+            response.AddHeader("Vary", "Accept-Encoding");
+
+        // Nothing to send if the client has this asset already
+        if (response.SetETag(request, variant->etag))
+            return;
+
+        response.AddHeader("Content-Type", asset->mimeType);
+        if (contentEncoding)
+            response.AddHeader("Content-Encoding", contentEncoding);
+
+        response.body = std::make_shared<CStaticSource>(variant->data, variant->size);
+        return;
     }
-    // For the reason mentioned above, it might happen that we receive data which is
-    // 0 bytes long. Make sure to ignore that and NOT return a 501 then
-    else if (bytesTotal > 0)
+
+    // Don't let anyone escape the mount points
+    if (url.find("..") != std::string::npos)
     {
-        // There was no URL given, likely that another request was issued.
-        // Return a 501
-        sprintf(buffer, "HTTP/1.0 501 Method Not Implemented\n\n");
-        send(out, buffer, strlen(buffer), 0);
+        response.SetStatus(404, "Not Found");
+        return;
+    }
+
+    // Precompressed siblings (such as "main.js.br" and "main.js.gz") are preferred if the client accepts them
+    struct { const char* extension; const char* contentEncoding; } variants[] = {
+        { ".br", "br" },
+        { ".gz", "gzip" },
+        { "", nullptr },
+    };
+
+    // Find the file in one of the mounted folders
+    for (const char* mountPoint : mountPoints)
+    {
+        for (const auto& variant : variants)
+        {
+            if (variant.contentEncoding && !request.AcceptsEncoding(variant.contentEncoding))
+                continue;
+
+            // Map the path of the requested file to this mount point and try to open it
+            std::string path = mountPoint + std::string(url) + variant.extension;
+            int fileToServe = open(path.c_str(), O_RDONLY);
+
+            // Check if we file we tried to open existed
+            if (fileToServe >= 0)
+            {
+                // The file exists, so it becomes the body of a 200 OK. The network thread will
+                // read it bit by bit as the client takes it
+                response.AddHeader("Content-Type", CEmbeddedAssets::GetMimeType(url));
+                if (variant.contentEncoding)
+                {
+                    response.AddHeader("Content-Encoding", variant.contentEncoding);
+                    response.AddHeader("Vary", "Accept-Encoding");
+                }
+
+                response.body = std::make_shared<CFileSource>(fileToServe);
+                return;
+            }
+        }
     }
+
+    // The requested file did not exist, send out a 404
+    response.SetStatus(404, "Not Found");
 }
 
 void CWebServer::Stop()
 {
+    // Nothing to stop if we never started
+    if (!isRunning)
+        return;
+
+    // Ask the network thread to exit and wait for it. It will notice within SERVER_POLL_TIMEOUT_MS
+    shouldStop = true;
+    if (networkThread.joinable())
+        networkThread.join();
+
     // Not running anymore
     isRunning = false;
 
-    // Shutdown the server socket, then close it
-    shutdown(serverSocket, SHUT_RDWR);
-    close(serverSocket);
+    // Now that no one else is using it, shutdown the server socket and close it
+    CloseSocket();
+    CContentWakeup::Get()->Close();
 
 #ifdef __DEBUG__
     printf("Stopped WebServer\n");
@@ -25,6 +25,7 @@
     SOFTWARE.
 */
 
+
 #pragma once
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,14 +35,66 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <poll.h>
 #include <sys/time.h>
 #include <vector>
-#include <switch.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "platform.hpp"
+#include "http.hpp"
+
+// How long (in milliseconds) the network thread blocks in poll() before it checks whether it should stop
+#define SERVER_POLL_TIMEOUT_MS 250
+
+// How long (in milliseconds) the network thread blocks in poll() while a connection waits for its body
+// to be read, if there's no wakeup socket to tell it when that's done
+#define SERVER_WAKEUP_FALLBACK_MS 5
+
+// How long (in milliseconds) the network thread waits before trying to re-open a failed server socket
+#define SERVER_RESTART_DELAY_MS 1000
+
+// How often (in milliseconds) the network thread closes the movie streams nobody came back for
+#define SERVER_STREAM_EVICTION_INTERVAL_MS 1000
+
+// How many clients can be connected at the same time. Further clients wait in the listen backlog
+#define SERVER_MAX_CONNECTIONS 64
+
+// How many bytes one connection may send per loop iteration, before it's the next connection's turn
+#define SERVER_SEND_CHUNK_SIZE (64 * 1024)
+
+// How big the request headers may get before we drop the connection
+#define SERVER_MAX_HEADER_SIZE 8192
+
+// How long (in milliseconds) a connection may go without any progress before we drop it
+// Some browsers, such as Google Chrome, like to open a backup socket which never sends anything
+#define SERVER_CONNECTION_TIMEOUT_MS 10000
 
 namespace nxgallery::core
 {
+    // A snapshot of the web server's state. The network thread owns the live values, 
+    // everyone else (like the UI) only ever gets a copy of this through CWebServer::GetStatus
+    struct SServerStatus
+    {
+        // Whether the server socket is open and listening
+        bool isListening = false;
+
+        // How many clients are connected right now
+        u32 activeConnections = 0;
+
+        // How many connections have been accepted since the server was started
+        u64 connectionsAccepted = 0;
+
+        // How many requests have been answered since the server was started
+        u64 requestsServed = 0;
+
+        // How many bytes have been sent out since the server was started
+        u64 bytesSent = 0;
+    };
+
     // This class will handle the web server running.
     // Therefore it's a very important part for this app
     // Huge shoutout to https://www.kompf.de/cplus/artikel/httpserv.html
@@ -52,36 +105,87 @@ namespace nxgallery::core
         // Constructor taking in the port for this server to run on
         CWebServer(int port);
         
-        // Starts the web server
+        // Starts the web server by spawning the network thread which will accept and handle requests
         void Start();
 
-        // Stops the web server
+        // Stops the web server and waits for the network thread to exit
         void Stop();
 
         // Adds a new mount point for where the server will look for files to serve
+        // Mount points need to be added before the server is started
         void AddMountPoint(const char* path);
 
-        // The loop for the server to accept and handle requests
-        void ServeLoop();
-
         // Returns the address and port string this server is running on
         void GetAddress(char* buffer);
 
+        // Returns a thread-safe copy of the server's current status
+        SServerStatus GetStatus();
+
     private:
-        // Serves a incoming request to the speicified out socket
-        static void ServeRequest(int in, int out, std::vector<const char*> mountPoints);
+        // Opens, binds and listens to the server socket. Returns whether it worked
+        bool OpenSocket();
+
+        // Shuts down and closes the server socket
+        void CloseSocket();
+
+        // Entrypoint of the network thread, runs until CWebServer::Stop is called
+        void NetworkThreadMain();
+
+        // One iteration of the network thread, blocks in poll() for at most timeoutMs
+        void ServeLoop(int timeoutMs);
+
+        // Accepts all connections waiting in the listen backlog
+        void AcceptConnections();
+
+        // Receives whatever data is waiting on the connection's socket
+        void ReadFromConnection(SHttpConnection& connection);
+
+        // Answers the request the connection holds
+        void DispatchRequest(SHttpConnection& connection);
+
+        // Sends the next chunk of the connection's response
+        void WriteToConnection(SHttpConnection& connection);
+
+        // Closes all connections, used when the server stops
+        void CloseAllConnections();
+
+        // Builds the response for a request
+        static void BuildResponse(const SHttpRequest& request, const std::vector<const char*>& mountPoints, SHttpResponse& response);
+
+        // Serves a static web asset, either from the embedded assets or one of the mount points
+        static void ServeStaticFile(const SHttpRequest& request, const std::vector<const char*>& mountPoints, SHttpResponse& response);
 
     public:
         // The port the server is running on
         int port;
 
         // Holds whether the server is fully initialized or not
-        bool isRunning;
+        std::atomic<bool> isRunning;
 
         // The socket which was opened for the HTTP server
-        int serverSocket;
+        int serverSocket = -1;
 
         // The mounted folders the web server can serve from
         std::vector<const char*> mountPoints;
+
+    private:
+        // The thread all networking happens on, so the UI never waits for a client (and vice versa)
+        std::thread networkThread;
+
+        // Set by CWebServer::Stop to ask the network thread to exit
+        std::atomic<bool> shouldStop;
+
+        // All clients currently connected, only touched by the network thread
+        std::vector<SHttpConnection> connections;
+
+        // Reused for every poll() call so we don't allocate each iteration
+        std::vector<struct pollfd> pollInfos;
+
+        // When the unused movie streams were last checked for eviction
+        std::chrono::steady_clock::time_point lastStreamEviction;
+
+        // The live status, only to be accessed while holding statusMutex
+        SServerStatus status;
+        std::mutex statusMutex;
     };
 }
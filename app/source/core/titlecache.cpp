@@ -0,0 +1,203 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "titlecache.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+using namespace nxgallery::core;
+
+// A system applet and its name
+struct SSystemTitle
+{
+    u64 titleId;
+    const char* name;
+};
+
+// All system applets which can take screenshots, sorted by title ID so they can be binary searched
+// https://switchbrew.org/wiki/Title_list#System_Applets
+static constexpr SSystemTitle systemTitles[] =
+{
+    { 0x0100000000001000, "Home Menu" }, // qlaunch
+    { 0x0100000000001001, "Auth" }, // auth
+    { 0x0100000000001002, "Cabinet" }, // cabinet
+    { 0x0100000000001003, "Controller" }, // controller
+    { 0x0100000000001004, "DataErase" }, // dataErase
+    { 0x0100000000001005, "Error" }, // error
+    { 0x0100000000001006, "Net Connect" }, // netConnect
+    { 0x0100000000001007, "Player Select" }, // playerSelect
+    { 0x0100000000001008, "Keyboard" }, // swkbd
+    { 0x0100000000001009, "Mii Editor" }, // miiEdit
+    { 0x010000000000100A, "Web Browser" }, // web
+    { 0x010000000000100B, "eShop" }, // shop
+    { 0x010000000000100C, "Overlay" }, // overlayDisp
+    { 0x010000000000100D, "Album" }, // photoViewer
+    { 0x010000000000100F, "Offline Web Browser" }, // offlineWeb
+    { 0x0100000000001010, "Share" }, // loginShare
+    { 0x0100000000001011, "WiFi Web Auth" }, // wifiWebAuth
+    { 0x0100000000001012, "Starter" }, // starter
+    { 0x0100000000001013, "My Page" }, // myPage
+};
+
+// Returns whether the system titles are sorted, checked at compile time
+static constexpr bool AreSystemTitlesSorted()
+{
+    for (size_t i = 1; i < sizeof(systemTitles) / sizeof(systemTitles[0]); i++)
+    {
+        if (systemTitles[i - 1].titleId >= systemTitles[i].titleId)
+            return false;
+    }
+
+    return true;
+}
+static_assert(AreSystemTitlesSorted(), "System titles need to be sorted by title ID");
+
+void CTitleCache::Load(const std::string& inCachePath)
+{
+    std::lock_guard<std::mutex> lock(titleMutex);
+    cachePath = inCachePath;
+    if (cachePath.empty())
+        return;
+
+    FILE* file = fopen(cachePath.c_str(), "r");
+    if (!file)
+        return;
+
+    // Files of another format are ignored, and overwritten by the next Save
+    char line[512];
+    if (!fgets(line, sizeof(line), file) || strncmp(line, TITLE_CACHE_HEADER "\n", sizeof(line)) != 0)
+    {
+        fclose(file);
+        isDirty = true;
+        return;
+    }
+
+    // Every other line is a title ID in hex, a space and the name
+    while (fgets(line, sizeof(line), file))
+    {
+        char* name = NULL;
+        u64 titleId = strtoull(line, &name, 16);
+        if (name == line || *name != ' ')
+            continue;
+
+        // Drop the line break
+        name++;
+        name[strcspn(name, "\r\n")] = '\0';
+        titleNames[titleId] = { name, true };
+    }
+
+    fclose(file);
+
+#ifdef __DEBUG__
+    printf("Loaded %zu title names from %s\n", titleNames.size(), cachePath.c_str());
+#endif
+}
+
+void CTitleCache::Save()
+{
+    std::lock_guard<std::mutex> lock(titleMutex);
+    if (!isDirty || cachePath.empty())
+        return;
+
+    // Make sure the directory exists
+    std::string directory = cachePath.substr(0, cachePath.find_last_of('/'));
+    mkdir(directory.c_str(), 0777);
+
+    // Write to a temporary file first, so a crash halfway doesn't leave a broken cache behind
+    std::string tempPath = cachePath + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "w");
+    if (!file)
+    {
+        printf("Failed to write title cache to %s\n", tempPath.c_str());
+        return;
+    }
+
+    fprintf(file, "%s\n", TITLE_CACHE_HEADER);
+    for (const auto& titleName : titleNames)
+    {
+        if (titleName.second.isInstalled)
+            fprintf(file, "%016lX %s\n", titleName.first, titleName.second.name.c_str());
+    }
+
+    bool hasFailed = ferror(file) != 0;
+    hasFailed |= fclose(file) != 0;
+
+    // Replace the old cache. Not every filesystem replaces files when renaming, so remove it first
+    remove(cachePath.c_str());
+    if (hasFailed || rename(tempPath.c_str(), cachePath.c_str()) != 0)
+    {
+        printf("Failed to write title cache to %s\n", cachePath.c_str());
+        remove(tempPath.c_str());
+        return;
+    }
+
+    isDirty = false;
+}
+
+const std::string& CTitleCache::GetTitleName(u64 titleId, IAlbumBackend* backend)
+{
+    std::lock_guard<std::mutex> lock(titleMutex);
+
+    // Most of the time, we already know it
+    auto titleName = titleNames.find(titleId);
+    if (titleName != titleNames.end())
+        return titleName->second.name;
+
+    // System applets aren't installed titles, so there's no need to ask for them
+    STitleName newTitleName;
+    if (const char* systemTitleName = FindSystemTitleName(titleId))
+    {
+        newTitleName.name = systemTitleName;
+    }
+    else if (R_SUCCEEDED(backend->GetApplicationName(titleId, newTitleName.name)))
+    {
+        // Names containing line breaks couldn't be read back from the file
+        newTitleName.isInstalled = newTitleName.name.find_first_of("\r\n") == std::string::npos;
+        isDirty |= newTitleName.isInstalled;
+    }
+    else
+    {
+        // Remember it's unknown as well, so we don't ask again this launch
+        newTitleName.name = TITLE_NAME_UNKNOWN;
+    }
+
+    // Map elements don't move, so the reference stays valid
+    return titleNames.emplace(titleId, std::move(newTitleName)).first->second.name;
+}
+
+const char* CTitleCache::FindSystemTitleName(u64 titleId)
+{
+    const SSystemTitle* end = systemTitles + sizeof(systemTitles) / sizeof(systemTitles[0]);
+    const SSystemTitle* systemTitle = std::lower_bound(systemTitles, end, titleId, [](const SSystemTitle& title, u64 id) {
+        return title.titleId < id;
+    });
+
+    return systemTitle != end && systemTitle->titleId == titleId ? systemTitle->name : NULL;
+}
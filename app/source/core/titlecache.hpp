@@ -0,0 +1,93 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <string>
+#include <mutex>
+#include <unordered_map>
+#include "albumbackend.hpp"
+
+// Name of the file the title cache is kept in, inside the backend's cache directory
+#define TITLE_CACHE_FILE_NAME "titles.cache"
+
+// First line of the title cache file. Bump the number whenever the format changes, older files are ignored then
+#define TITLE_CACHE_HEADER "NXGallery title cache 1"
+
+// Name of titles which couldn't be resolved
+#define TITLE_NAME_UNKNOWN "Unknown"
+
+namespace nxgallery::core
+{
+    // Resolves title IDs to readable names, and every title ID only once. Asking ns for a name copies
+    // the whole control data of the title (over 128 KB, including the icon), which is way too slow to
+    // do for every album entry on every request.
+    // System applets are looked up in a fixed table. Installed titles are asked for through the
+    // backend once and kept in a hash map, which is also stored in a small file, so following
+    // launches don't need to ask at all. Deleting the file makes all names be asked for again
+    class CTitleCache
+    {
+    public:
+        // Loads the names stored by an earlier launch from the given file, and remembers to store
+        // them there again. Without a path, nothing is stored
+        void Load(const std::string& inCachePath);
+
+        // Stores the names of the installed titles, if any were added since they were loaded
+        void Save();
+
+        // Returns the name of a title, asking the backend for it if it's not known yet. The returned
+        // reference stays valid as long as the cache lives
+        const std::string& GetTitleName(u64 titleId, IAlbumBackend* backend);
+
+        // Returns the name of a system applet, or NULL if the title isn't one
+        static const char* FindSystemTitleName(u64 titleId);
+
+    private:
+        // A resolved title
+        struct STitleName
+        {
+            // The readable name
+            std::string name;
+
+            // Whether the name is from the backend and should be stored. Names of system applets
+            // and unknown titles aren't, the latter might be installed by the next launch
+            bool isInstalled = false;
+        };
+
+        // All titles resolved so far, by title ID
+        std::unordered_map<u64, STitleName> titleNames;
+
+        // Where the names are stored, empty if they aren't
+        std::string cachePath;
+
+        // Whether names were added since loading, so they need to be stored again
+        bool isDirty = false;
+
+        // Locks the above, as titles can be resolved from any thread
+        std::mutex titleMutex;
+    };
+}
@@ -0,0 +1,138 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "titlesearch.hpp"
+#include <algorithm>
+#include <iterator>
+using namespace nxgallery::core;
+
+void CTitleSearchIndex::AddTitle(u64 titleId, std::string_view name)
+{
+    // Names are looked up once per launch (see CTitleCache), so a title which is known already keeps its name
+    if (titleSlots.find(titleId) != titleSlots.end())
+        return;
+
+    u32 newSlot = titleIds.size();
+    titleIds.push_back(titleId);
+    names.push_back(Normalize(name));
+    titleSlots.emplace(titleId, newSlot);
+    AddGrams(newSlot);
+}
+
+void CTitleSearchIndex::Search(std::string_view query, std::vector<u64>& outTitleIds) const
+{
+    std::string normalizedQuery = Normalize(query);
+    if (normalizedQuery.empty())
+        return;
+
+    // Only titles which have all trigrams of the query can contain it. Start with the trigram the fewest
+    // titles have, and keep the slots which also have the others. Shorter queries are a gram of their own
+    size_t gramLength = std::min(normalizedQuery.size(), (size_t)TITLE_SEARCH_GRAM_LENGTH);
+    std::vector<const std::vector<u32>*> slotLists;
+    for (size_t i = 0; i + gramLength <= normalizedQuery.size(); i++)
+    {
+        auto slots = gramSlots.find(GetGram(&normalizedQuery[i], gramLength));
+        if (slots == gramSlots.end())
+            return;
+
+        slotLists.push_back(&slots->second);
+    }
+
+    std::sort(slotLists.begin(), slotLists.end(), [](const std::vector<u32>* a, const std::vector<u32>* b) { return a->size() < b->size(); });
+    slotLists.erase(std::unique(slotLists.begin(), slotLists.end()), slotLists.end());
+
+    // A query which is a single gram is in every title which has it
+    if (slotLists.size() == 1 && normalizedQuery.size() == gramLength)
+    {
+        for (u32 slot : *slotLists[0])
+        {
+            outTitleIds.push_back(titleIds[slot]);
+        }
+        return;
+    }
+
+    std::vector<u32> candidates = *slotLists[0];
+    std::vector<u32> narrowed;
+    for (size_t i = 1; i < slotLists.size() && !candidates.empty(); i++)
+    {
+        narrowed.clear();
+        std::set_intersection(candidates.begin(), candidates.end(), slotLists[i]->begin(), slotLists[i]->end(), std::back_inserter(narrowed));
+        candidates.swap(narrowed);
+    }
+
+    // Check whether the names really contain the query, the trigrams could be spread over the name
+    for (u32 slot : candidates)
+    {
+        if (names[slot].find(normalizedQuery) != std::string::npos)
+            outTitleIds.push_back(titleIds[slot]);
+    }
+}
+
+u32 CTitleSearchIndex::GetTitleCount() const
+{
+    return titleIds.size();
+}
+
+std::string CTitleSearchIndex::Normalize(std::string_view name)
+{
+    // Only ASCII letters are folded, other bytes (such as UTF-8 sequences) stay as they are
+    std::string normalizedName(name);
+    for (char& c : normalizedName)
+    {
+        if (c >= 'A' && c <= 'Z')
+            c = c - 'A' + 'a';
+    }
+    return normalizedName;
+}
+
+u32 CTitleSearchIndex::GetGram(const char* characters, size_t length)
+{
+    // The characters take the lower three bytes, the length the upper one, so "ab" and "\0ab" differ
+    u32 gram = (u32)length << 24;
+    for (size_t i = 0; i < length; i++)
+    {
+        gram |= (u32)(u8)characters[i] << (8 * (length - 1 - i));
+    }
+    return gram;
+}
+
+void CTitleSearchIndex::AddGrams(u32 slot)
+{
+    const std::string& name = names[slot];
+    for (size_t length = 1; length <= TITLE_SEARCH_GRAM_LENGTH; length++)
+    {
+        for (size_t i = 0; i + length <= name.size(); i++)
+        {
+            // New titles get the highest slot, so appending keeps the slots sorted. A gram which is in the
+            // name more than once is only added once
+            std::vector<u32>& slots = gramSlots[GetGram(&name[i], length)];
+            if (slots.empty() || slots.back() != slot)
+                slots.push_back(slot);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include "platform.hpp"
+
+// How many characters the longest pieces names are split into for searching are long
+#define TITLE_SEARCH_GRAM_LENGTH 3
+
+namespace nxgallery::core
+{
+    // Finds titles by a part of their name. Every name is split into all its (overlapping) trigrams,
+    // and the index remembers which titles have each trigram. A search only needs to look at the
+    // titles which have all the trigrams of the query, and then check whether they really contain it,
+    // so it takes microseconds no matter how many titles there are. Searches ignore the case of ASCII
+    // letters. The single characters and pairs of characters of the names are indexed as well, so
+    // queries shorter than a trigram (like typing the first letter) don't have to check every name
+    class CTitleSearchIndex
+    {
+    public:
+        // Adds a title, unless it was added before. Only the trigrams of that title are touched, so titles
+        // can be added as they show up without building the index again
+        void AddTitle(u64 titleId, std::string_view name);
+
+        // Appends the IDs of the titles whose name contains the query to outTitleIds, in the order the
+        // titles were added
+        void Search(std::string_view query, std::vector<u64>& outTitleIds) const;
+
+        // Returns how many titles were added
+        u32 GetTitleCount() const;
+
+    private:
+        // Returns the name with all ASCII letters in lowercase
+        static std::string Normalize(std::string_view name);
+
+        // Returns the gram of the given length (up to TITLE_SEARCH_GRAM_LENGTH) starting at the given character
+        static u32 GetGram(const char* characters, size_t length);
+
+        // Adds the title in the given slot to the titles of every gram of its name
+        void AddGrams(u32 slot);
+
+    private:
+        // The IDs and normalized names of the titles, by the slot they were added in
+        std::vector<u64> titleIds;
+        std::vector<std::string> names;
+
+        // Maps title IDs to their slot
+        std::unordered_map<u64, u32> titleSlots;
+
+        // The slots of the titles with each gram in their name, sorted. Grams of different lengths have
+        // different keys
+        std::unordered_map<u32, std::vector<u32>> gramSlots;
+    };
+}
@@ -0,0 +1,183 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "videostreampool.hpp"
+using namespace nxgallery::core;
+
+// Needed for compiler
+CVideoStreamPool* CVideoStreamPool::singleton = NULL;
+
+// Returns whether two file IDs refer to the same album file
+static bool IsSameFile(const CapsAlbumFileId& lhs, const CapsAlbumFileId& rhs)
+{
+    return lhs.application_id == rhs.application_id
+        && lhs.storage == rhs.storage
+        && lhs.content == rhs.content
+        && lhs.datetime.year == rhs.datetime.year
+        && lhs.datetime.month == rhs.datetime.month
+        && lhs.datetime.day == rhs.datetime.day
+        && lhs.datetime.hour == rhs.datetime.hour
+        && lhs.datetime.minute == rhs.datetime.minute
+        && lhs.datetime.second == rhs.datetime.second
+        && lhs.datetime.id == rhs.datetime.id;
+}
+
+CVideoStreamPool* CVideoStreamPool::Get()
+{
+    // If no singleton is existing, create a new instance
+    if (!singleton)
+    {
+        singleton = new CVideoStreamPool();
+    }
+
+    // Return the instance
+    return singleton;
+}
+
+std::unique_ptr<CVideoStreamReader> CVideoStreamPool::Acquire(const CapsAlbumEntry& albumEntry)
+{
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+
+        // Reuse an unused stream of the same file, the most recently used one first as it most likely
+        // holds the blocks which are needed now
+        for (auto it = idleStreams.rbegin(); it != idleStreams.rend(); ++it)
+        {
+            if (IsSameFile(it->reader->GetFileId(), albumEntry.file_id))
+            {
+                std::unique_ptr<CVideoStreamReader> reader = std::move(it->reader);
+                idleStreams.erase(std::next(it).base());
+
+                stats.hits++;
+                stats.activeStreams++;
+                stats.idleStreams = idleStreams.size();
+                return reader;
+            }
+        }
+
+        stats.misses++;
+    }
+
+    // Make room if memory runs low, a new stream needs memory for its blocks
+    if (GetAvailableMemory() < VIDEO_STREAM_POOL_MIN_FREE_MEMORY)
+        Clear();
+
+    // Open a new stream. capsa only allows a few streams to be open at once, so if that fails, close
+    // the unused ones and try again
+    std::unique_ptr<CVideoStreamReader> reader = std::make_unique<CVideoStreamReader>(albumEntry);
+    if (!reader->IsOpen())
+    {
+        reader.reset();
+        Clear();
+        reader = std::make_unique<CVideoStreamReader>(albumEntry);
+    }
+
+    if (!reader->IsOpen())
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(poolMutex);
+    stats.activeStreams++;
+    return reader;
+}
+
+void CVideoStreamPool::Release(std::unique_ptr<CVideoStreamReader> reader)
+{
+    // Closing a stream waits until no read-ahead thread reads for it, so do that outside of the lock
+    std::unique_ptr<CVideoStreamReader> evictedReader;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stats.activeStreams--;
+
+        // A stream which failed once (capsa might have closed it on its end) would fail whoever gets it
+        // next, and reusing it would keep it from timing out
+        if (reader->HasFailed())
+        {
+            evictedReader = std::move(reader);
+            stats.evictions++;
+            return;
+        }
+
+        idleStreams.push_back({ std::move(reader), std::chrono::steady_clock::now() });
+
+        // Too many unused streams, close the one unused for the longest time
+        if (idleStreams.size() > VIDEO_STREAM_POOL_SIZE)
+        {
+            evictedReader = std::move(idleStreams.front().reader);
+            idleStreams.erase(idleStreams.begin());
+            stats.evictions++;
+        }
+
+        stats.idleStreams = idleStreams.size();
+    }
+}
+
+void CVideoStreamPool::EvictIdle()
+{
+    // Low on memory, nothing unused should hold any now
+    if (GetAvailableMemory() < VIDEO_STREAM_POOL_MIN_FREE_MEMORY)
+    {
+        Clear();
+        return;
+    }
+
+    std::vector<SIdleStream> evictedStreams;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+
+        // The streams are sorted by age, so only the first ones can be too old
+        auto now = std::chrono::steady_clock::now();
+        auto timeout = std::chrono::milliseconds(VIDEO_STREAM_POOL_IDLE_TIMEOUT_MS);
+        auto firstToKeep = idleStreams.begin();
+        while (firstToKeep != idleStreams.end() && now - firstToKeep->releaseTime > timeout)
+            ++firstToKeep;
+
+        evictedStreams.assign(std::make_move_iterator(idleStreams.begin()), std::make_move_iterator(firstToKeep));
+        idleStreams.erase(idleStreams.begin(), firstToKeep);
+
+        stats.evictions += evictedStreams.size();
+        stats.idleStreams = idleStreams.size();
+    }
+}
+
+void CVideoStreamPool::Clear()
+{
+    std::vector<SIdleStream> evictedStreams;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        evictedStreams.swap(idleStreams);
+
+        stats.evictions += evictedStreams.size();
+        stats.idleStreams = 0;
+    }
+}
+
+SVideoStreamPoolStats CVideoStreamPool::GetStats()
+{
+    std::lock_guard<std::mutex> lock(poolMutex);
+    return stats;
+}
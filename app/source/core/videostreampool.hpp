@@ -0,0 +1,111 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include "platform.hpp"
+#include "albumwrapper.hpp"
+
+// How many unused movie streams are kept open for when the same video is asked for again
+#define VIDEO_STREAM_POOL_SIZE 2
+
+// How long (in milliseconds) an unused movie stream is kept open
+#define VIDEO_STREAM_POOL_IDLE_TIMEOUT_MS 30000
+
+// If less memory than this is left, unused movie streams are closed right away
+#define VIDEO_STREAM_POOL_MIN_FREE_MEMORY (16 * 1024 * 1024)
+
+namespace nxgallery::core
+{
+    // Statistics about the video stream pool
+    struct SVideoStreamPoolStats
+    {
+        // How often a stream could be reused, and how often a new one had to be opened
+        u64 hits = 0;
+        u64 misses = 0;
+
+        // How many unused streams were closed, because of their age, the pool size, low memory or a failed read
+        u64 evictions = 0;
+
+        // How many streams are currently in use and how many are waiting to be reused
+        u32 activeStreams = 0;
+        u32 idleStreams = 0;
+    };
+
+    // Keeps movie streams open after a video was sent, so they can be reused. Browsers send lots of
+    // range requests against the same video while the user skips through it, and opening a stream
+    // through capsa and setting up its blocks for every one of them adds up. A reused stream also
+    // still holds the blocks it read last
+    class CVideoStreamPool
+    {
+    public:
+        // Returns the singleton instance of the pool
+        static CVideoStreamPool* Get();
+
+        // Hands out a reader for the given album entry, reusing an unused one for the same file if
+        // there is one. Returns nullptr if no stream could be opened. Every reader has to be given
+        // back through Release once it's not needed anymore
+        std::unique_ptr<CVideoStreamReader> Acquire(const CapsAlbumEntry& albumEntry);
+
+        // Gives a reader back, so it can be reused. Readers which failed to read are closed instead
+        void Release(std::unique_ptr<CVideoStreamReader> reader);
+
+        // Closes unused streams which weren't reused in time, or all of them if memory runs low
+        // Should be called regularly
+        void EvictIdle();
+
+        // Closes all unused streams
+        void Clear();
+
+        // Returns the current statistics
+        SVideoStreamPoolStats GetStats();
+
+    private:
+        // A stream which is waiting to be reused
+        struct SIdleStream
+        {
+            std::unique_ptr<CVideoStreamReader> reader;
+            std::chrono::steady_clock::time_point releaseTime;
+        };
+
+        // The unused streams, the ones unused for the longest time come first
+        std::vector<SIdleStream> idleStreams;
+
+        // Statistics, see GetStats
+        SVideoStreamPoolStats stats;
+
+        // Locks the idle streams and statistics, as streams are released from wherever their last user goes away
+        std::mutex poolMutex;
+
+        // Singleton instance of the CVideoStreamPool
+        static CVideoStreamPool* singleton;
+    };
+}
@@ -0,0 +1,164 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Include the most common headers from the C standard library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+
+// Include NXGallery core
+#include "core/server.hpp"
+#include "core/albumwrapper.hpp"
+#include "core/directoryalbumbackend.hpp"
+#include "core/videostreampool.hpp"
+
+// Port the server should run on by default, same as on the Switch
+#define SERVER_PORT 1234
+
+// Set by the signal handler once the server should stop
+static volatile sig_atomic_t shouldExit = 0;
+
+// Stops the server on Ctrl+C
+static void handleSignal(int signal)
+{
+    shouldExit = 1;
+}
+
+// Prints how to use this
+static void printUsage(const char* executable)
+{
+    printf("Runs the NXGallery web server outside of the Switch, on top of album directories\n\n");
+    printf("Usage: %s [options]\n", executable);
+    printf("  -p <port>       Port to listen on (default: %d)\n", SERVER_PORT);
+    printf("  -s <directory>  Album directory of the SD card\n");
+    printf("  -n <directory>  Album directory of the NAND\n");
+    printf("  -w <directory>  Directory of the web interface (default: romfs/www)\n");
+    printf("  -t <file>       Title names, one \"<title ID in hex> <name>\" per line\n");
+    printf("  -d <directory>  Directory to keep caches in across launches (default: none)\n");
+    printf("  -l <us>         Latency added to every album read, in microseconds\n");
+    printf("  -b <bytes/s>    Bandwidth album files are read with (default: unlimited)\n");
+    printf("  -c              Read album files through the backend only, like capsa on the Switch\n");
+    printf("  -L              Report the light theme instead of the dark one\n");
+}
+
+int main(int argc, char* argv[])
+{
+    int port = SERVER_PORT;
+    const char* sdAlbumDir = "";
+    const char* nandAlbumDir = "";
+    const char* webDir = "romfs/www";
+    const char* titlesPath = NULL;
+    const char* cacheDir = "";
+    u64 latencyUs = 0;
+    u64 bytesPerSecond = 0;
+    bool useCapsaOnly = false;
+    bool isLightTheme = false;
+
+    // Parse the options
+    int option;
+    while ((option = getopt(argc, argv, "p:s:n:w:t:d:l:b:cLh")) != -1)
+    {
+        switch (option)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 's': sdAlbumDir = optarg; break;
+            case 'n': nandAlbumDir = optarg; break;
+            case 'w': webDir = optarg; break;
+            case 't': titlesPath = optarg; break;
+            case 'd': cacheDir = optarg; break;
+            case 'l': latencyUs = strtoull(optarg, NULL, 10); break;
+            case 'b': bytesPerSecond = strtoull(optarg, NULL, 10); break;
+            case 'c': useCapsaOnly = true; break;
+            case 'L': isLightTheme = true; break;
+            default:
+                printUsage(argv[0]);
+                return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (!*sdAlbumDir && !*nandAlbumDir)
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Stop on Ctrl+C, and don't die when a client goes away while we're sending to it
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Set up the backend standing in for capsa
+    std::unique_ptr<nxgallery::core::CDirectoryAlbumBackend> backend = std::make_unique<nxgallery::core::CDirectoryAlbumBackend>(sdAlbumDir, nandAlbumDir);
+    backend->SetLatency(latencyUs);
+    backend->SetBandwidth(bytesPerSecond);
+    backend->SetIsDarkTheme(!isLightTheme);
+    backend->SetCacheDir(cacheDir);
+    if (titlesPath && !backend->LoadApplicationNames(titlesPath))
+        printf("Failed to load title names from %s\n", titlesPath);
+
+    // Initialize the album wrapper
+    nxgallery::core::CAlbumWrapper* albumWrapper = nxgallery::core::CAlbumWrapper::Get();
+    albumWrapper->Init(std::move(backend));
+    if (useCapsaOnly)
+        albumWrapper->SetContentBackend(nxgallery::core::EContentBackend::Capsa);
+
+    // Create the web server and start it
+    nxgallery::core::CWebServer* webServer = new nxgallery::core::CWebServer(port);
+    webServer->AddMountPoint(webDir);
+    webServer->Start();
+
+    // The server's own address is the Switch's, so just point at localhost
+    printf("Serving %d album files on http://localhost:%d/\n", albumWrapper->GetAlbumEntryCount(), port);
+
+    // The web server runs on its own thread, just wait until we should exit
+    while (!shouldExit)
+        usleep(100000);
+
+    // Report how it went
+    webServer->Stop();
+    nxgallery::core::SServerStatus status = webServer->GetStatus();
+    nxgallery::core::SVideoStreamPoolStats poolStats = nxgallery::core::CVideoStreamPool::Get()->GetStats();
+    printf("Served %lu requests on %lu connections, %lu bytes sent\n", status.requestsServed, status.connectionsAccepted, status.bytesSent);
+    printf("Video stream pool: %lu hits, %lu misses, %lu evictions\n", poolStats.hits, poolStats.misses, poolStats.evictions);
+
+    for (nxgallery::core::EContentBackend contentBackend : { nxgallery::core::EContentBackend::Capsa, nxgallery::core::EContentBackend::Filesystem })
+    {
+        nxgallery::core::SContentBackendStats stats = albumWrapper->GetContentBackendStats(contentBackend);
+        printf("%s: %lu files opened, %lu bytes read in %.3f s, %lu fallbacks\n",
+            contentBackend == nxgallery::core::EContentBackend::Capsa ? "Backend" : "Filesystem",
+            stats.filesOpened, stats.bytesRead, stats.readTimeNs / 1e9, stats.fallbacks);
+    }
+
+    // Clean up
+    delete webServer;
+    albumWrapper->Shutdown();
+    return EXIT_SUCCESS;
+}
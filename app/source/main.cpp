@@ -37,6 +37,8 @@
 // Include NXGallery core
 #include "core/server.hpp"
 #include "core/albumwrapper.hpp"
+#include "core/libnxalbumbackend.hpp"
+#include "core/videostreampool.hpp"
 
 // Include NXGallery UI
 #include "ui/mainframe.hpp"
@@ -154,10 +156,10 @@ int main(int argc, char* argv[])
     }
 
     // Initialize the album wrapper
-    nxgallery::core::CAlbumWrapper::Get()->Init();
+    nxgallery::core::CAlbumWrapper::Get()->Init(std::make_unique<nxgallery::core::CLibnxAlbumBackend>());
 
     // Create the web server for hosting the web interface, add romfs:/www as a mount point for
-    // static web assets and start it
+    // static web assets and start it. The server runs on its own network thread from now on
     nxgallery::core::CWebServer* webServer = new nxgallery::core::CWebServer(SERVER_PORT);
     webServer->AddMountPoint("romfs:/www");
     webServer->Start();
@@ -170,14 +172,54 @@ int main(int argc, char* argv[])
     mainActivity->qrCode->setText(std::string(serverAddress));
     mainActivity->address->setText(std::string(serverAddress));
 
-    // Run the Borealis loop
+    // Let the user switch between reading album files through capsa and straight from the filesystem
+    mainActivity->registerAction("nxgallery/hints/switch_backend"_i18n, brls::ControllerButton::BUTTON_X, [](brls::View* view) {
+        nxgallery::core::CAlbumWrapper* albumWrapper = nxgallery::core::CAlbumWrapper::Get();
+        bool useFilesystem = albumWrapper->GetContentBackend() == nxgallery::core::EContentBackend::Capsa;
+        albumWrapper->SetContentBackend(useFilesystem ? nxgallery::core::EContentBackend::Filesystem : nxgallery::core::EContentBackend::Capsa);
+        brls::Application::notify(useFilesystem ? "nxgallery/backend/filesystem"_i18n : "nxgallery/backend/capsa"_i18n);
+        return true;
+    });
+
+    // Run the Borealis loop. The web server doesn't need any time from it, as it's served by its own thread
     while (brls::Application::mainLoop())
     {
-        // Run the web server loop
-        webServer->ServeLoop();
+#ifdef __DEBUG__
+        // Log whenever the server socket goes up or down (e.g. when the console goes to sleep)
+        static bool wasListening = true;
+        nxgallery::core::SServerStatus serverStatus = webServer->GetStatus();
+        if (serverStatus.isListening != wasListening)
+        {
+            printf("Web server is %s (%lu requests served)\n", serverStatus.isListening ? "listening" : "not listening", serverStatus.requestsServed);
+            wasListening = serverStatus.isListening;
+        }
+
+        // Log how well movie streams are reused whenever another video request came in
+        static u64 lastPoolRequests = 0;
+        nxgallery::core::SVideoStreamPoolStats poolStats = nxgallery::core::CVideoStreamPool::Get()->GetStats();
+        if (poolStats.hits + poolStats.misses != lastPoolRequests)
+        {
+            lastPoolRequests = poolStats.hits + poolStats.misses;
+            printf("Video stream pool: %lu hits, %lu misses (%.1f%% hit rate), %lu evictions, %u active, %u idle\n",
+                poolStats.hits, poolStats.misses, 100.0 * poolStats.hits / lastPoolRequests, poolStats.evictions, poolStats.activeStreams, poolStats.idleStreams);
+        }
+
+        // Log how fast both content backends read whenever one of them opened another file
+        static u64 lastFilesOpened = 0;
+        nxgallery::core::SContentBackendStats capsaStats = nxgallery::core::CAlbumWrapper::Get()->GetContentBackendStats(nxgallery::core::EContentBackend::Capsa);
+        nxgallery::core::SContentBackendStats filesystemStats = nxgallery::core::CAlbumWrapper::Get()->GetContentBackendStats(nxgallery::core::EContentBackend::Filesystem);
+        if (capsaStats.filesOpened + filesystemStats.filesOpened != lastFilesOpened)
+        {
+            lastFilesOpened = capsaStats.filesOpened + filesystemStats.filesOpened;
+            printf("Capsa backend: %lu files, %lu bytes at %.2f MB/s\n", capsaStats.filesOpened, capsaStats.bytesRead,
+                capsaStats.readTimeNs ? (capsaStats.bytesRead / 1048576.0) / (capsaStats.readTimeNs / 1e9) : 0.0);
+            printf("Filesystem backend: %lu files (%lu left to capsa), %lu bytes at %.2f MB/s\n", filesystemStats.filesOpened, filesystemStats.fallbacks, filesystemStats.bytesRead,
+                filesystemStats.readTimeNs ? (filesystemStats.bytesRead / 1048576.0) / (filesystemStats.readTimeNs / 1e9) : 0.0);
+        }
+#endif
     }
 
-    // Stop the web server
+    // Stop the web server and wait for its network thread to exit
     webServer->Stop();
 
     // Stop the album wrapper
@@ -0,0 +1,165 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Adds screenshots and videos to the album after it was cached, and checks that they show up: once by
+// refreshing the album directly and once by waiting for the album thread and the web server to notice.
+// A refreshed album is only swapped in once the network thread applies it. Everything counted
+// while caching needs to be counted from scratch rather than on top of the earlier counts, and big
+// gallery pages which were being written when the album changed are cut short
+
+#include "testutils.hpp"
+#include "core/server.hpp"
+#include "json.hpp"
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+using json = nlohmann::json;
+
+// The games the entries are taken in
+#define REFRESH_TITLE_ID 0x0100000000010000
+#define REFRESH_NEW_TITLE_ID 0x0100000000020000
+
+// The album when it's first cached, with more screenshots than a gallery page written in one go has
+#define REFRESH_SCREENSHOT_COUNT (GALLERY_STREAM_MIN_ENTRIES + 44)
+#define REFRESH_VIDEO_COUNT 2
+#define REFRESH_FILE_SIZE 1024
+
+// How long the web server may take to notice a change, in milliseconds
+#define REFRESH_SERVER_TIMEOUT_MS (ALBUM_CHECK_INTERVAL_MS * 3)
+
+// Reads the stats and the total of the whole gallery
+static json GetGallery()
+{
+    SGallerySelection selection;
+    CAlbumWrapper::Get()->SelectGalleryEntries("", "", "", "", selection);
+    std::shared_ptr<IContentSource> content = CAlbumWrapper::Get()->GetGalleryContent(selection, 0, 1);
+    const char* data = nullptr;
+    u64 size = content->Borrow(0, content->GetSize(), &data);
+    return json::parse(std::string(data, size));
+}
+
+// Checks what the gallery and /games tell about the album
+static void CheckCounts(const json& gallery, const json& games, int screenshotCount, int videoCount, int newScreenshotCount, const char* step)
+{
+    int total = screenshotCount + videoCount + newScreenshotCount;
+    TEST_CHECK(gallery["total"] == total, "%s: the gallery has %d entries, not %d", step, gallery["total"].get<int>(), total);
+    TEST_CHECK(gallery["stats"]["numScreenshots"] == screenshotCount + newScreenshotCount, "%s: %d screenshots were counted, not %d", step,
+        gallery["stats"]["numScreenshots"].get<int>(), screenshotCount + newScreenshotCount);
+    TEST_CHECK(gallery["stats"]["numVideos"] == videoCount, "%s: %d videos were counted, not %d", step, gallery["stats"]["numVideos"].get<int>(), videoCount);
+
+    // The game taken in last comes first
+    size_t gameCount = newScreenshotCount > 0 ? 2 : 1;
+    if (!TEST_CHECK(games["games"].size() == gameCount, "%s: /games has %zu games, not %zu", step, games["games"].size(), gameCount))
+        return;
+
+    const json& game = games["games"].back();
+    TEST_CHECK(game["screenshots"] == screenshotCount && game["videos"] == videoCount, "%s: /games has %d screenshots and %d videos, not %d and %d",
+        step, game["screenshots"].get<int>(), game["videos"].get<int>(), screenshotCount, videoCount);
+    if (newScreenshotCount > 0)
+        TEST_CHECK(games["games"][0]["screenshots"] == newScreenshotCount, "%s: /games has %d screenshots of the new game, not %d", step,
+            games["games"][0]["screenshots"].get<int>(), newScreenshotCount);
+}
+
+int main(int argc, char* argv[])
+{
+    CTestAlbum album;
+    for (int i = 0; i < REFRESH_VIDEO_COUNT; i++)
+        album.AddFile(CapsAlbumFileContents_Movie, REFRESH_TITLE_ID, REFRESH_FILE_SIZE);
+    for (int i = 0; i < REFRESH_SCREENSHOT_COUNT; i++)
+        album.AddFile(CapsAlbumFileContents_ScreenShot, REFRESH_TITLE_ID, REFRESH_FILE_SIZE);
+
+    InitAlbumWrapper(album, 0);
+    CAlbumWrapper* albumWrapper = CAlbumWrapper::Get();
+    CheckCounts(GetGallery(), json::parse(*albumWrapper->GetGames()->body), REFRESH_SCREENSHOT_COUNT, REFRESH_VIDEO_COUNT, 0, "cached");
+
+    // Nothing changed, so nothing is cached again
+    u32 generation = albumWrapper->GetAlbumGeneration();
+    TEST_CHECK(!albumWrapper->RefreshGalleryContent(), "the album was cached again without having changed");
+    TEST_CHECK(albumWrapper->GetAlbumGeneration() == generation, "the album generation changed without the album changing");
+
+    // Start writing a page which is too big to be written in one go
+    SGallerySelection selection;
+    albumWrapper->SelectGalleryEntries("", "", "", "", selection);
+    std::shared_ptr<IContentSource> bigPage = albumWrapper->GetGalleryContent(selection, 0, REFRESH_SCREENSHOT_COUNT);
+    const char* data = nullptr;
+    u64 firstChunkSize = bigPage->Borrow(0, UINT64_MAX, &data);
+    TEST_CHECK(firstChunkSize > 0 && bigPage->GetSize() == HTTP_SIZE_UNKNOWN, "the big page was written in one go");
+
+    // A screenshot and a video of the same game, and screenshots of a new one
+    album.AddFile(CapsAlbumFileContents_ScreenShot, REFRESH_TITLE_ID, REFRESH_FILE_SIZE);
+    album.AddFile(CapsAlbumFileContents_Movie, REFRESH_TITLE_ID, REFRESH_FILE_SIZE);
+    for (int i = 0; i < 3; i++)
+        album.AddFile(CapsAlbumFileContents_ScreenShot, REFRESH_NEW_TITLE_ID, REFRESH_FILE_SIZE);
+
+    // The album thread might have noticed first, then there's nothing left to refresh
+    albumWrapper->RefreshGalleryContent();
+    TEST_CHECK(albumWrapper->GetAlbumGeneration() == generation, "the album was swapped in before the network thread applied it");
+    TEST_CHECK(albumWrapper->ApplyGalleryContent(), "the album wasn't cached again after files were added");
+    TEST_CHECK(albumWrapper->GetAlbumGeneration() != generation, "the album generation didn't change along with the album");
+    TEST_CHECK(!albumWrapper->ApplyGalleryContent(), "the same album was applied twice");
+    CheckCounts(GetGallery(), json::parse(*albumWrapper->GetGames()->body), REFRESH_SCREENSHOT_COUNT + 1, REFRESH_VIDEO_COUNT + 1, 3, "refreshed");
+
+    // Both games are searchable once, the one known before wasn't added again
+    json search = json::parse(albumWrapper->GetSearchContent(TITLE_NAME_UNKNOWN));
+    TEST_CHECK(search["games"].size() == 2, "searching found %zu games, not 2", search["games"].size());
+
+    // The rest of the page would list entries of the new album under the old total
+    TEST_CHECK(bigPage->Borrow(firstChunkSize, UINT64_MAX, &data) == 0, "the big page went on after the album changed");
+
+    // The web server checks for changes on its own
+    int port = FindFreePort();
+    CWebServer server(port);
+    server.Start();
+    if (!TEST_CHECK(server.isRunning, "the server didn't start on port %d", port))
+        return GetTestResult("albumrefreshtest");
+
+    album.AddFile(CapsAlbumFileContents_ScreenShot, REFRESH_NEW_TITLE_ID, REFRESH_FILE_SIZE);
+
+    CTestClient client(port);
+    std::string body;
+    json gallery;
+    u64 startTime = GetTimeNs();
+    do
+    {
+        usleep(50 * 1000);
+        if (client.Get("/gallery?limit=1", &body) != 200)
+            break;
+
+        gallery = json::parse(body);
+    } while (gallery["total"] != REFRESH_SCREENSHOT_COUNT + REFRESH_VIDEO_COUNT + 6 && GetTimeNs() - startTime < REFRESH_SERVER_TIMEOUT_MS * 1000000ull);
+
+    json games;
+    if (TEST_CHECK(client.Get("/games", &body) == 200, "/games failed"))
+        games = json::parse(body);
+
+    if (!gallery.is_null() && !games.is_null())
+        CheckCounts(gallery, games, REFRESH_SCREENSHOT_COUNT + 1, REFRESH_VIDEO_COUNT + 1, 4, "served");
+
+    server.Stop();
+    CAlbumWrapper::Get()->Shutdown();
+    return GetTestResult("albumrefreshtest");
+}
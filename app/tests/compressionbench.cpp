@@ -0,0 +1,139 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Compares what the first load of the web page costs with and without compression: index.html and the
+// scripts, styles and icons it links to, read at the rate of a slow link to the Switch. The embedded
+// assets come with precompressed variants (see tools/embedwww.py), which are sent to clients that accept
+// them. Every load reads all assets again, as a browser without anything cached does
+
+#include "testutils.hpp"
+#include "core/server.hpp"
+#include <string.h>
+#include <algorithm>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// How fast (in bytes per second) the client reads, about what a busy Wi-Fi gives the Switch
+#define COMPRESSION_BENCH_LINK_RATE (2 * 1024 * 1024)
+
+// One Accept-Encoding to measure
+struct SEncodingCase
+{
+    const char* name;
+    const char* acceptEncoding;
+};
+
+// Returns the local assets index.html links to, each once and in the order they are linked
+static std::vector<std::string> FindLinkedAssets(const std::string& indexHtml)
+{
+    std::vector<std::string> assets;
+    for (const char* attribute : { " href=\"", " src=\"" })
+    {
+        size_t position = 0;
+        while ((position = indexHtml.find(attribute, position)) != std::string::npos)
+        {
+            position += strlen(attribute);
+            std::string url = indexHtml.substr(position, indexHtml.find('"', position) - position);
+
+            // Fonts and icons from other servers don't go through the Switch
+            if (url.find("://") != std::string::npos)
+                continue;
+
+            if (url[0] != '/')
+                url = "/" + url;
+
+            if (std::find(assets.begin(), assets.end(), url) == assets.end())
+                assets.push_back(url);
+        }
+    }
+    return assets;
+}
+
+int main(int argc, char* argv[])
+{
+    CTestAlbum album;
+    InitAlbumWrapper(album, 0);
+
+    int port = FindFreePort();
+    CWebServer server(port);
+    server.Start();
+    if (!TEST_CHECK(server.isRunning, "the server didn't start on port %d", port))
+        return GetTestResult("compressionbench");
+
+    std::string indexHtml;
+    CTestClient indexClient(port);
+    if (!TEST_CHECK(indexClient.Get("/", &indexHtml) == 200, "index.html wasn't served"))
+        return GetTestResult("compressionbench");
+
+    std::vector<std::string> assets = FindLinkedAssets(indexHtml);
+    assets.insert(assets.begin(), "/");
+
+    SEncodingCase cases[] = {
+        { "uncompressed", "identity" },
+        { "gzip", "gzip" },
+        { "browser (gzip, deflate, br)", "gzip, deflate, br" },
+    };
+
+    printf("First load of %zu assets at %.1f MB/s\n", assets.size(), COMPRESSION_BENCH_LINK_RATE / (1024.0 * 1024.0));
+    printf("%-28s %12s %14s %14s\n", "accepted", "KB per load", "ms per load", "compressed");
+    u64 uncompressedBytes = 0;
+    for (const SEncodingCase& encodingCase : cases)
+    {
+        CTestClient client(port);
+        client.SetAcceptEncoding(encodingCase.acceptEncoding);
+        client.SetReceiveRate(COMPRESSION_BENCH_LINK_RATE);
+
+        u64 bytesPerLoad = 0;
+        u32 compressedAssets = 0;
+        bool hasFailed = false;
+        double loadRate = MeasureRate([&]() {
+            bytesPerLoad = 0;
+            compressedAssets = 0;
+            for (const std::string& asset : assets)
+            {
+                hasFailed |= client.Get(asset) != 200;
+                bytesPerLoad += client.GetBodySize();
+                compressedAssets += !client.GetContentEncoding().empty();
+            }
+            return (u64)1;
+        });
+
+        TEST_CHECK(!hasFailed, "%s: assets failed to load", encodingCase.name);
+        printf("%-28s %12.1f %14.1f %9u of %zu\n", encodingCase.name, bytesPerLoad / 1024.0, 1000.0 / loadRate, compressedAssets, assets.size());
+
+        // Compressed variants are only embedded if they are smaller
+        if (uncompressedBytes == 0)
+            uncompressedBytes = bytesPerLoad;
+        else
+            TEST_CHECK(compressedAssets > 0 && bytesPerLoad < uncompressedBytes, "%s: %lu bytes were sent compressed, %lu uncompressed", encodingCase.name, bytesPerLoad, uncompressedBytes);
+    }
+
+    server.Stop();
+    CAlbumWrapper::Get()->Shutdown();
+    return GetTestResult("compressionbench");
+}
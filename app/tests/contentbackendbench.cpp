@@ -0,0 +1,146 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Compares how fast the content backends serve album files: through capsa, where every read is a call
+// to the service, and straight from the filesystem. Videos are downloaded by one client and by several
+// at once, screenshots by one client. The host build stands in for capsa with the album directory, so
+// capsa is measured once as fast as the disk and once with the time a call to the service takes added
+
+#include "testutils.hpp"
+#include "core/server.hpp"
+#include <thread>
+#include <vector>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// The album: a few large videos and screenshots as big as the Switch saves them
+#define BACKEND_BENCH_VIDEO_COUNT 2
+#define BACKEND_BENCH_VIDEO_SIZE (16 * 1024 * 1024)
+#define BACKEND_BENCH_SCREENSHOT_COUNT 8
+#define BACKEND_BENCH_SCREENSHOT_SIZE (512 * 1024)
+
+// How many clients download videos at the same time in the concurrent case
+#define BACKEND_BENCH_CLIENT_COUNT 4
+
+// How long (in microseconds) a call to capsa takes, when its latency is simulated
+#define BACKEND_BENCH_CAPSA_LATENCY_US 1000
+
+// One backend configuration to measure
+struct SBackendCase
+{
+    const char* name;
+    EContentBackend backend;
+    u64 latencyUs;
+};
+
+// Downloads the file with the given ID and returns its size, or 0 if that failed
+static u64 Download(CTestClient& client, int id, u64 expectedSize)
+{
+    if (client.Get("/file?id=" + std::to_string(id)) != 200 || client.GetBodySize() != expectedSize)
+        return 0;
+
+    return expectedSize;
+}
+
+int main(int argc, char* argv[])
+{
+    // The screenshots are added last, which makes them the newest entries with the first IDs
+    CTestAlbum album;
+    for (int i = 0; i < BACKEND_BENCH_VIDEO_COUNT; i++)
+        album.AddFile(CapsAlbumFileContents_Movie, 0x0100000000010000, BACKEND_BENCH_VIDEO_SIZE);
+    for (int i = 0; i < BACKEND_BENCH_SCREENSHOT_COUNT; i++)
+        album.AddFile(CapsAlbumFileContents_ScreenShot, 0x0100000000010000, BACKEND_BENCH_SCREENSHOT_SIZE);
+
+    CDirectoryAlbumBackend* backend = InitAlbumWrapper(album, 0);
+
+    int port = FindFreePort();
+    CWebServer server(port);
+    server.Start();
+    if (!TEST_CHECK(server.isRunning, "the server didn't start on port %d", port))
+        return GetTestResult("contentbackendbench");
+
+    SBackendCase cases[] = {
+        { "capsa", EContentBackend::Capsa, 0 },
+        { "capsa, 1 ms per call", EContentBackend::Capsa, BACKEND_BENCH_CAPSA_LATENCY_US },
+        { "filesystem", EContentBackend::Filesystem, 0 },
+    };
+
+    printf("%-24s %14s %14s %16s\n", "backend", "video MB/s", "4 clients MB/s", "screenshots/s");
+    for (const SBackendCase& backendCase : cases)
+    {
+        CAlbumWrapper::Get()->SetContentBackend(backendCase.backend);
+        backend->SetLatency(backendCase.latencyUs);
+
+        // One client downloading the videos one after the other
+        CTestClient client(port);
+        int videoIndex = 0;
+        double videoRate = MeasureRate([&]() {
+            int id = BACKEND_BENCH_SCREENSHOT_COUNT + videoIndex++ % BACKEND_BENCH_VIDEO_COUNT;
+            return Download(client, id, BACKEND_BENCH_VIDEO_SIZE);
+        });
+
+        // Several clients downloading videos at the same time
+        std::vector<CTestClient> clients;
+        for (int i = 0; i < BACKEND_BENCH_CLIENT_COUNT; i++)
+            clients.emplace_back(port);
+
+        double concurrentRate = MeasureRate([&]() {
+            std::vector<u64> bytes(BACKEND_BENCH_CLIENT_COUNT);
+            std::vector<std::thread> threads;
+            for (int i = 0; i < BACKEND_BENCH_CLIENT_COUNT; i++)
+            {
+                int id = BACKEND_BENCH_SCREENSHOT_COUNT + i % BACKEND_BENCH_VIDEO_COUNT;
+                threads.emplace_back([&, i, id]() { bytes[i] = Download(clients[i], id, BACKEND_BENCH_VIDEO_SIZE); });
+            }
+
+            u64 totalBytes = 0;
+            for (int i = 0; i < BACKEND_BENCH_CLIENT_COUNT; i++)
+            {
+                threads[i].join();
+                totalBytes += bytes[i];
+            }
+
+            return totalBytes;
+        });
+
+        // One client downloading the screenshots one after the other
+        int screenshotIndex = 0;
+        u64 failedScreenshots = 0;
+        double screenshotRate = MeasureRate([&]() {
+            if (Download(client, screenshotIndex++ % BACKEND_BENCH_SCREENSHOT_COUNT, BACKEND_BENCH_SCREENSHOT_SIZE) == 0)
+                failedScreenshots++;
+            return (u64)1;
+        });
+
+        TEST_CHECK(videoRate > 0 && concurrentRate > 0 && failedScreenshots == 0, "%s: downloads failed", backendCase.name);
+        printf("%-24s %14.1f %14.1f %16.0f\n", backendCase.name, videoRate / (1024 * 1024), concurrentRate / (1024 * 1024), screenshotRate);
+    }
+
+    server.Stop();
+    CAlbumWrapper::Get()->Shutdown();
+    return GetTestResult("contentbackendbench");
+}
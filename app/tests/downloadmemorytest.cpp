@@ -0,0 +1,120 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Downloads files from the web server a thousand times and checks that its memory doesn't grow. Files
+// are streamed in fixed-size blocks, so a download needs the same memory however big the file is: a
+// video larger than the 32 MB the server used to load files into needs to come through whole, and
+// without the server taking up memory of its size
+
+#include "testutils.hpp"
+#include "core/server.hpp"
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// How many files are downloaded, and how many before that to warm up the allocator and the stream pool
+#define MEMORY_DOWNLOAD_COUNT 1000
+#define MEMORY_WARMUP_COUNT 50
+
+// The album: a video larger than the old 32 MB buffer, smaller videos and screenshots
+#define MEMORY_LARGE_VIDEO_SIZE (40 * 1024 * 1024)
+#define MEMORY_VIDEO_COUNT 4
+#define MEMORY_VIDEO_SIZE (1024 * 1024)
+#define MEMORY_SCREENSHOT_COUNT 4
+#define MEMORY_SCREENSHOT_SIZE (300 * 1024)
+
+// How much the resident memory may grow over all downloads, in bytes. A buffer leaked per download,
+// or one the size of the large video, would be a lot more
+#define MEMORY_MAX_GROWTH (2 * 1024 * 1024)
+
+// Downloads the given number of files, going through all entries, and checks they came through whole
+static void Download(CTestClient& client, int count, const char* backendName)
+{
+    int failures = 0;
+    int entryCount = 1 + MEMORY_VIDEO_COUNT + MEMORY_SCREENSHOT_COUNT;
+    for (int i = 0; i < count; i++)
+    {
+        // The large video has the last ID, as it was added first
+        int id = i % (entryCount - 1);
+        u64 expectedSize = id < MEMORY_SCREENSHOT_COUNT ? MEMORY_SCREENSHOT_SIZE : MEMORY_VIDEO_SIZE;
+        if (client.Get("/file?id=" + std::to_string(id)) != 200 || client.GetBodySize() != expectedSize)
+            failures++;
+    }
+
+    TEST_CHECK(failures == 0, "%s: %d of %d downloads failed", backendName, failures, count);
+}
+
+// Downloads the large video, then lots of other files, and checks how the memory changed
+static void RunDownloads(int port, const char* backendName)
+{
+    CTestClient client(port);
+    Download(client, MEMORY_WARMUP_COUNT, backendName);
+    u64 memoryBefore = GetResidentMemory();
+
+    // The whole video needs to come through, while the server only holds a few blocks of it at a time
+    std::string target = "/file?id=" + std::to_string(MEMORY_VIDEO_COUNT + MEMORY_SCREENSHOT_COUNT);
+    TEST_CHECK(client.Get(target) == 200 && client.GetBodySize() == MEMORY_LARGE_VIDEO_SIZE, "%s: the large video was sent with %lu of %d bytes",
+        backendName, client.GetBodySize(), MEMORY_LARGE_VIDEO_SIZE);
+    u64 memoryLargeVideo = GetResidentMemory();
+
+    Download(client, MEMORY_DOWNLOAD_COUNT, backendName);
+    u64 memoryAfter = GetResidentMemory();
+
+    printf("%s: %.1f MB resident before, %.1f MB after the large video, %.1f MB after %d downloads\n", backendName, memoryBefore / 1048576.0,
+        memoryLargeVideo / 1048576.0, memoryAfter / 1048576.0, MEMORY_DOWNLOAD_COUNT);
+
+    TEST_CHECK(memoryLargeVideo <= memoryBefore + MEMORY_MAX_GROWTH, "%s: the large video took up %lu bytes", backendName, memoryLargeVideo - memoryBefore);
+    TEST_CHECK(memoryAfter <= memoryBefore + MEMORY_MAX_GROWTH, "%s: %d downloads took up %lu bytes", backendName, MEMORY_DOWNLOAD_COUNT, memoryAfter - memoryBefore);
+}
+
+int main(int argc, char* argv[])
+{
+    // The screenshots are added last, which makes them the newest entries with the first IDs
+    CTestAlbum album;
+    album.AddFile(CapsAlbumFileContents_Movie, 0x0100000000010000, MEMORY_LARGE_VIDEO_SIZE);
+    for (int i = 0; i < MEMORY_VIDEO_COUNT; i++)
+        album.AddFile(CapsAlbumFileContents_Movie, 0x0100000000010000, MEMORY_VIDEO_SIZE);
+    for (int i = 0; i < MEMORY_SCREENSHOT_COUNT; i++)
+        album.AddFile(CapsAlbumFileContents_ScreenShot, 0x0100000000010000, MEMORY_SCREENSHOT_SIZE);
+
+    InitAlbumWrapper(album, 0);
+
+    int port = FindFreePort();
+    CWebServer server(port);
+    server.Start();
+    if (!TEST_CHECK(server.isRunning, "the server didn't start on port %d", port))
+        return GetTestResult("downloadmemorytest");
+
+    CAlbumWrapper::Get()->SetContentBackend(EContentBackend::Capsa);
+    RunDownloads(port, "capsa");
+
+    CAlbumWrapper::Get()->SetContentBackend(EContentBackend::Filesystem);
+    RunDownloads(port, "filesystem");
+
+    server.Stop();
+    CAlbumWrapper::Get()->Shutdown();
+    return GetTestResult("downloadmemorytest");
+}
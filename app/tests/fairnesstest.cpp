@@ -0,0 +1,207 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Opens lots of keep-alive clients against the web server at the same time. A few of them download
+// videos the whole time, read through a backend as slow as capsa, the others browse the gallery like
+// a phone would. No client may be starved: all of them need to be answered, the browsing ones about
+// equally often, and none of them may wait long for the downloads. This runs once for each content
+// backend, as they read on threads of their own
+
+#include "testutils.hpp"
+#include "core/server.hpp"
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// How many clients connect, and how many of them download videos
+#define FAIRNESS_CLIENT_COUNT 50
+#define FAIRNESS_DOWNLOAD_CLIENT_COUNT 10
+
+// How long (in milliseconds) the clients keep sending requests, per content backend
+#define FAIRNESS_DURATION_MS 2000
+
+// How many screenshots and videos the album has, and how big they are
+#define FAIRNESS_SCREENSHOT_COUNT 60
+#define FAIRNESS_SCREENSHOT_SIZE (4 * 1024)
+#define FAIRNESS_VIDEO_COUNT 4
+#define FAIRNESS_VIDEO_SIZE (2 * 1024 * 1024)
+
+// How fast the backend reads, in bytes per second. A video block takes 64 ms like this
+#define FAIRNESS_BACKEND_BANDWIDTH (4 * 1024 * 1024)
+
+// The longest a browsing request may take, in milliseconds
+#define FAIRNESS_MAX_LATENCY_MS 250
+
+// How many requests each browsing client needs to get answered at least, compared to the average
+#define FAIRNESS_MIN_SHARE 0.5
+
+// How fair the requests need to be shared between the browsing clients, by Jain's fairness index
+// (1 means perfectly equal, 1/n means one client got everything)
+#define FAIRNESS_MIN_INDEX 0.9
+
+// What one client went through
+struct SClientResult
+{
+    u32 requests = 0;
+    u32 failures = 0;
+    u32 connections = 0;
+    double maxLatencyMs = 0;
+};
+
+// Browses the gallery until the deadline: pages, thumbnails, screenshots and the web page
+static void RunBrowsingClient(int port, int clientIndex, std::chrono::steady_clock::time_point deadline, SClientResult& outResult)
+{
+    CTestClient client(port);
+    for (u32 i = clientIndex; std::chrono::steady_clock::now() < deadline; i++)
+    {
+        int screenshotId = FAIRNESS_VIDEO_COUNT + i % FAIRNESS_SCREENSHOT_COUNT;
+        std::string target;
+        switch (i % 4)
+        {
+            case 0: target = "/gallery?page=" + std::to_string(1 + i % 3); break;
+            case 1: target = "/thumbnail?id=" + std::to_string(screenshotId); break;
+            case 2: target = "/file?id=" + std::to_string(screenshotId); break;
+            case 3: target = "/index.html"; break;
+        }
+
+        auto startTime = std::chrono::steady_clock::now();
+        int statusCode = client.Get(target);
+        double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+        if (statusCode == 200)
+            outResult.requests++;
+        else
+            outResult.failures++;
+
+        outResult.maxLatencyMs = std::max(outResult.maxLatencyMs, latencyMs);
+    }
+
+    outResult.connections = client.GetConnectionCount();
+}
+
+// Downloads whole videos until the deadline
+static void RunDownloadingClient(int port, int clientIndex, std::chrono::steady_clock::time_point deadline, SClientResult& outResult)
+{
+    CTestClient client(port);
+    for (u32 i = clientIndex; std::chrono::steady_clock::now() < deadline; i++)
+    {
+        int statusCode = client.Get("/file?id=" + std::to_string(i % FAIRNESS_VIDEO_COUNT));
+        if (statusCode == 200 && client.GetBodySize() == FAIRNESS_VIDEO_SIZE)
+            outResult.requests++;
+        else
+            outResult.failures++;
+    }
+
+    outResult.connections = client.GetConnectionCount();
+}
+
+// Lets all clients loose on the server at once and checks how they were served
+static void RunClients(int port, const char* backendName)
+{
+    std::vector<SClientResult> results(FAIRNESS_CLIENT_COUNT);
+    std::vector<std::thread> clients;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(FAIRNESS_DURATION_MS);
+    for (int i = 0; i < FAIRNESS_CLIENT_COUNT; i++)
+    {
+        if (i < FAIRNESS_DOWNLOAD_CLIENT_COUNT)
+            clients.emplace_back(RunDownloadingClient, port, i, deadline, std::ref(results[i]));
+        else
+            clients.emplace_back(RunBrowsingClient, port, i, deadline, std::ref(results[i]));
+    }
+
+    for (std::thread& client : clients)
+        client.join();
+
+    // Sum up the browsing clients
+    double sum = 0;
+    double sumOfSquares = 0;
+    u32 minRequests = (u32)-1;
+    double maxLatencyMs = 0;
+    u32 downloads = 0;
+    for (int i = 0; i < FAIRNESS_CLIENT_COUNT; i++)
+    {
+        const SClientResult& result = results[i];
+        TEST_CHECK(result.failures == 0, "%s: client %d had %u failed requests", backendName, i, result.failures);
+        TEST_CHECK(result.requests > 0, "%s: client %d was never answered", backendName, i);
+
+        if (i < FAIRNESS_DOWNLOAD_CLIENT_COUNT)
+        {
+            downloads += result.requests;
+            continue;
+        }
+
+        sum += result.requests;
+        sumOfSquares += (double)result.requests * result.requests;
+        minRequests = std::min(minRequests, result.requests);
+        maxLatencyMs = std::max(maxLatencyMs, result.maxLatencyMs);
+    }
+
+    int numBrowsingClients = FAIRNESS_CLIENT_COUNT - FAIRNESS_DOWNLOAD_CLIENT_COUNT;
+    double average = sum / numBrowsingClients;
+    double fairnessIndex = sumOfSquares > 0 ? sum * sum / (numBrowsingClients * sumOfSquares) : 0;
+    printf("%s: %u videos downloaded, %.0f browsing requests (%.1f per client, at least %u), fairness index %.3f, longest request %.1f ms\n",
+        backendName, downloads, sum, average, minRequests, fairnessIndex, maxLatencyMs);
+
+    TEST_CHECK(minRequests >= average * FAIRNESS_MIN_SHARE, "%s: a browsing client only got %u requests answered, the average is %.1f", backendName, minRequests, average);
+    TEST_CHECK(fairnessIndex >= FAIRNESS_MIN_INDEX, "%s: fairness index %.3f is below %.3f", backendName, fairnessIndex, FAIRNESS_MIN_INDEX);
+    TEST_CHECK(maxLatencyMs <= FAIRNESS_MAX_LATENCY_MS, "%s: a browsing request took %.1f ms, more than %d ms", backendName, maxLatencyMs, FAIRNESS_MAX_LATENCY_MS);
+}
+
+int main(int argc, char* argv[])
+{
+    // The videos are added last, which makes them the newest entries with the first IDs
+    CTestAlbum album;
+    for (int i = 0; i < FAIRNESS_SCREENSHOT_COUNT; i++)
+        album.AddFile(CapsAlbumFileContents_ScreenShot, 0x0100000000010000 + i % 3, FAIRNESS_SCREENSHOT_SIZE);
+    for (int i = 0; i < FAIRNESS_VIDEO_COUNT; i++)
+        album.AddFile(CapsAlbumFileContents_Movie, 0x0100000000010000, FAIRNESS_VIDEO_SIZE);
+
+    InitAlbumWrapper(album, FAIRNESS_BACKEND_BANDWIDTH);
+
+    int port = FindFreePort();
+    CWebServer server(port);
+    server.Start();
+    if (!TEST_CHECK(server.isRunning, "the server didn't start on port %d", port))
+        return GetTestResult("fairnesstest");
+
+    CAlbumWrapper::Get()->SetContentBackend(EContentBackend::Capsa);
+    RunClients(port, "capsa");
+
+    CAlbumWrapper::Get()->SetContentBackend(EContentBackend::Filesystem);
+    RunClients(port, "filesystem");
+
+    server.Stop();
+    SServerStatus status = server.GetStatus();
+    printf("Served %lu requests on %lu connections\n", status.requestsServed, status.connectionsAccepted);
+
+    CAlbumWrapper::Get()->Shutdown();
+    return GetTestResult("fairnesstest");
+}
@@ -0,0 +1,156 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Measures filtering /gallery by game, type and storage on made up albums of 10,000 and 100,000 entries:
+// selecting the entries and counting them, and writing a page from the middle of the selection. For
+// comparison, it also counts the same entries by going through the whole album, which is what answering
+// a filter would take without the entry bitmaps. Each album is measured in a process of its own
+
+#include "testutils.hpp"
+#include "core/albumwrapper.hpp"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// The album sizes to measure, and how many games their entries are spread over
+static const u32 albumSizes[] = { 10000, 100000 };
+#define FILTER_BENCH_TITLE_COUNT 200
+
+// One filter to measure, as /gallery gets it
+struct SFilterCase
+{
+    const char* name;
+    bool hasGame;
+    const char* type;
+    const char* storage;
+    const char* sort;
+};
+
+static const SFilterCase filterCases[] = {
+    { "type=video", false, "video", "", "" },
+    { "storage=nand", false, "", "nand", "" },
+    { "game", true, "", "", "" },
+    { "game&type=screenshot&storage=sd", true, "screenshot", "sd", "" },
+    { "type=video&sort=largest", false, "video", "", "largest" },
+};
+
+// Returns whether an entry matches the filter, which is what going through the whole album checks
+static bool MatchesFilter(const CapsAlbumEntry& entry, const SFilterCase& filterCase, u64 titleId)
+{
+    const CapsAlbumFileId& fileId = entry.file_id;
+    bool isVideo = fileId.content == CapsAlbumFileContents_Movie || fileId.content == CapsAlbumFileContents_ExtraMovie;
+    if (filterCase.hasGame && fileId.application_id != titleId)
+        return false;
+    if (filterCase.type[0] && isVideo != (strcmp(filterCase.type, "video") == 0))
+        return false;
+    if (filterCase.storage[0] && (fileId.storage == CapsAlbumStorage_Sd) != (strcmp(filterCase.storage, "sd") == 0))
+        return false;
+
+    return true;
+}
+
+// Indexes a made up album of the given size and measures every filter on it
+static void RunAlbum(u32 entryCount)
+{
+    std::unique_ptr<CSyntheticAlbumBackend> backend = std::make_unique<CSyntheticAlbumBackend>(entryCount, FILTER_BENCH_TITLE_COUNT);
+    const std::vector<CapsAlbumEntry>& entries = backend->GetEntries();
+
+    auto startTime = std::chrono::steady_clock::now();
+    CAlbumWrapper::Get()->Init(std::move(backend));
+    double indexTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    TEST_CHECK(CAlbumWrapper::Get()->GetAlbumEntryCount() == (int)entryCount, "%u entries: the album has %d entries", entryCount, CAlbumWrapper::Get()->GetAlbumEntryCount());
+    printf("%u entries, indexed in %.1f ms\n", entryCount, indexTimeMs);
+
+    // The game asked for has an index in the middle
+    u64 titleId = CSyntheticAlbumBackend::GetTitleId(FILTER_BENCH_TITLE_COUNT / 2);
+    char game[32];
+    snprintf(game, sizeof(game), "%016lX", titleId);
+
+    printf("  %-32s %8s %14s %14s %14s\n", "filter", "entries", "select us", "+ page us", "full scan us");
+    for (const SFilterCase& filterCase : filterCases)
+    {
+        // The bitmaps need to select just what going through the album finds
+        u32 expectedCount = 0;
+        for (const CapsAlbumEntry& entry : entries)
+            expectedCount += MatchesFilter(entry, filterCase, titleId);
+
+        SGallerySelection selection;
+        bool isValid = CAlbumWrapper::Get()->SelectGalleryEntries(filterCase.hasGame ? game : "", filterCase.type, filterCase.storage, filterCase.sort, selection);
+        int count = CAlbumWrapper::Get()->GetSelectionSize(selection);
+        TEST_CHECK(isValid && count == (int)expectedCount, "%u entries, %s: selected %d entries instead of %u", entryCount, filterCase.name, count, expectedCount);
+
+        double selectRate = MeasureRate([&]() {
+            SGallerySelection selection;
+            CAlbumWrapper::Get()->SelectGalleryEntries(filterCase.hasGame ? game : "", filterCase.type, filterCase.storage, filterCase.sort, selection);
+            KeepResult(CAlbumWrapper::Get()->GetSelectionSize(selection));
+            return (u64)1;
+        });
+
+        double pageRate = MeasureRate([&]() {
+            SGallerySelection selection;
+            CAlbumWrapper::Get()->SelectGalleryEntries(filterCase.hasGame ? game : "", filterCase.type, filterCase.storage, filterCase.sort, selection);
+            int first = CAlbumWrapper::Get()->GetSelectionSize(selection) / 2;
+            KeepResult(CAlbumWrapper::Get()->GetGalleryContent(selection, first, CONTENT_PER_PAGE)->GetSize());
+            return (u64)1;
+        });
+
+        double scanRate = MeasureRate([&]() {
+            u32 matching = 0;
+            for (const CapsAlbumEntry& entry : entries)
+                matching += MatchesFilter(entry, filterCase, titleId);
+            KeepResult(matching);
+            return (u64)1;
+        });
+
+        printf("  %-32s %8d %14.1f %14.1f %14.1f\n", filterCase.name, count, 1e6 / selectRate, 1e6 / pageRate, 1e6 / scanRate);
+    }
+
+    CAlbumWrapper::Get()->Shutdown();
+}
+
+int main(int argc, char* argv[])
+{
+    // The album wrapper is indexed once per process, so every album gets a process of its own
+    bool hasPassed = true;
+    for (u32 entryCount : albumSizes)
+    {
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            RunAlbum(entryCount);
+            exit(GetTestResult("galleryfilterbench") == EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+        int status = 0;
+        hasPassed &= child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    }
+
+    return hasPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
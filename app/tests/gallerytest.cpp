@@ -0,0 +1,221 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Checks paging through /gallery selections on a made up album: every filter and order needs to have
+// the entries going through the whole album finds, in the order of the whole album, and cursors and
+// dates need to point at the right entries. Cursors of games which aren't in the album are rejected
+
+#include "testutils.hpp"
+#include "core/server.hpp"
+#include "json.hpp"
+#include <algorithm>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+using json = nlohmann::json;
+
+// The album, and how many games its entries are spread over
+#define GALLERY_TEST_ENTRY_COUNT 2000
+#define GALLERY_TEST_TITLE_COUNT 7
+
+// How many entries are read per page, few enough for the page to be written in one go
+#define GALLERY_TEST_PAGE_SIZE 250
+
+// The filters (as game index, type and storage) and the orders every filter is checked with
+struct SFilterCase
+{
+    int titleIndex;
+    const char* type;
+    const char* storage;
+};
+
+static const SFilterCase filterCases[] = {
+    { -1, "", "" },
+    { -1, "video", "" },
+    { 3, "", "sd" },
+    { 5, "screenshot", "nand" },
+};
+
+static const char* sorts[] = { "newest", "oldest", "largest", "smallest", "game" };
+
+// Returns the IDs of a selection, read page by page from the gallery JSON
+static std::vector<int> GetSelectionIds(const SGallerySelection& selection)
+{
+    std::vector<int> ids;
+    int total = CAlbumWrapper::Get()->GetSelectionSize(selection);
+    for (int first = 0; first < total; first += GALLERY_TEST_PAGE_SIZE)
+    {
+        std::shared_ptr<IContentSource> content = CAlbumWrapper::Get()->GetGalleryContent(selection, first, GALLERY_TEST_PAGE_SIZE);
+        const char* data = nullptr;
+        u64 size = content->Borrow(0, content->GetSize(), &data);
+
+        json page = json::parse(std::string(data, size));
+        for (const json& entry : page["gallery"])
+            ids.push_back(entry["id"].get<int>());
+    }
+
+    return ids;
+}
+
+// Returns whether the entry with the given ID matches the filter. IDs count from the newest entry,
+// while the backend lists the oldest first
+static bool MatchesFilter(CSyntheticAlbumBackend& backend, int id, const SFilterCase& filterCase)
+{
+    const CapsAlbumFileId& fileId = backend.GetEntries()[GALLERY_TEST_ENTRY_COUNT - 1 - id].file_id;
+    bool isVideo = fileId.content == CapsAlbumFileContents_Movie;
+    if (filterCase.titleIndex >= 0 && fileId.application_id != CSyntheticAlbumBackend::GetTitleId(filterCase.titleIndex))
+        return false;
+    if (filterCase.type[0] && isVideo != (strcmp(filterCase.type, "video") == 0))
+        return false;
+    if (filterCase.storage[0] && (fileId.storage == CapsAlbumStorage_Sd) != (strcmp(filterCase.storage, "sd") == 0))
+        return false;
+
+    return true;
+}
+
+// Selects the entries of a filter in an order
+static bool Select(const SFilterCase& filterCase, const char* sort, SGallerySelection& outSelection)
+{
+    char game[32] = "";
+    if (filterCase.titleIndex >= 0)
+        snprintf(game, sizeof(game), "%016lX", CSyntheticAlbumBackend::GetTitleId(filterCase.titleIndex));
+
+    return CAlbumWrapper::Get()->SelectGalleryEntries(game, filterCase.type, filterCase.storage, sort, outSelection);
+}
+
+// Checks every filter in every order
+static void CheckSelections(CSyntheticAlbumBackend& backend)
+{
+    for (const char* sort : sorts)
+    {
+        // The whole album in that order, which every filter needs to keep
+        SGallerySelection albumSelection;
+        TEST_CHECK(Select(filterCases[0], sort, albumSelection), "sort=%s: not a valid order", sort);
+        std::vector<int> albumIds = GetSelectionIds(albumSelection);
+        TEST_CHECK(albumIds.size() == GALLERY_TEST_ENTRY_COUNT, "sort=%s: the album has %zu entries", sort, albumIds.size());
+
+        for (const SFilterCase& filterCase : filterCases)
+        {
+            std::vector<int> expectedIds;
+            std::copy_if(albumIds.begin(), albumIds.end(), std::back_inserter(expectedIds), [&](int id) { return MatchesFilter(backend, id, filterCase); });
+
+            // Twice, as the order of the filter is cached the first time
+            for (int pass = 0; pass < 2; pass++)
+            {
+                SGallerySelection selection;
+                TEST_CHECK(Select(filterCase, sort, selection), "sort=%s: not a valid filter", sort);
+                std::vector<int> ids = GetSelectionIds(selection);
+                TEST_CHECK(ids == expectedIds, "sort=%s, game %d, type=%s, storage=%s: %zu entries, %zu expected (pass %d)", sort,
+                    filterCase.titleIndex, filterCase.type, filterCase.storage, ids.size(), expectedIds.size(), pass);
+
+                // The cursor of an entry continues right after it
+                for (size_t position = 0; position < ids.size(); position += 37)
+                {
+                    std::string cursor = CAlbumWrapper::Get()->GetGalleryCursor(selection, ids[position]);
+                    int next = CAlbumWrapper::Get()->FindGalleryCursor(selection, cursor);
+                    TEST_CHECK(next == (int)position + 1, "sort=%s, game %d: cursor %s continues at %d instead of %zu", sort,
+                        filterCase.titleIndex, cursor.c_str(), next, position + 1);
+                }
+            }
+        }
+    }
+}
+
+// Checks that dates point at the first entry of the selection taken that day (or the next one in its order)
+static void CheckDates()
+{
+    // The album starts on the first of January 2020, with an entry every minute
+    const char* dates[] = { "2020-01-01", "2020-01-02", "2020-01", "2020", "2019-12-31", "2021" };
+    for (const char* sort : { "newest", "oldest" })
+    {
+        for (const SFilterCase& filterCase : filterCases)
+        {
+            SGallerySelection selection;
+            Select(filterCase, sort, selection);
+            std::vector<int> ids = GetSelectionIds(selection);
+            bool isNewestFirst = strcmp(sort, "newest") == 0;
+
+            for (const char* date : dates)
+            {
+                // Entries count up from the newest, the entry with ID i was taken (count - 1 - i) minutes in
+                int dayLength = strlen(date) == 10 ? 1 : strlen(date) == 7 ? 31 : 366;
+                int startDay = strcmp(date, "2019-12-31") == 0 ? -1 : strcmp(date, "2021") == 0 ? 366 : strcmp(date, "2020-01-02") == 0 ? 1 : 0;
+                auto isTakenBefore = [&](int id, int day) { return (GALLERY_TEST_ENTRY_COUNT - 1 - id) < day * 1440; };
+
+                // Newest first, the first entry taken before the end of the period, oldest first the first taken since its start
+                auto expected = std::find_if(ids.begin(), ids.end(), [&](int id) {
+                    return isNewestFirst ? isTakenBefore(id, startDay + dayLength) : !isTakenBefore(id, startDay);
+                });
+
+                int position = CAlbumWrapper::Get()->FindGalleryDate(selection, date);
+                TEST_CHECK(position == expected - ids.begin(), "sort=%s, game %d, date=%s: starts at %d instead of %zd", sort,
+                    filterCase.titleIndex, date, position, expected - ids.begin());
+            }
+        }
+    }
+}
+
+// Checks that the server only takes cursors of games the album has, sorted by game
+static void CheckGameCursors()
+{
+    SGallerySelection selection;
+    Select(filterCases[0], "game", selection);
+    std::string cursor = CAlbumWrapper::Get()->GetGalleryCursor(selection, 100);
+
+    // The key after the capture time starts with the title ID
+    std::string unknownCursor = cursor;
+    size_t keyStart = unknownCursor.find('-') + 1;
+    unknownCursor.replace(keyStart, 16, "0100000000FF0000");
+    TEST_CHECK(CAlbumWrapper::Get()->FindGalleryCursor(selection, unknownCursor) == -1, "the cursor of a game which isn't in the album was taken");
+
+    int port = FindFreePort();
+    CWebServer server(port);
+    server.Start();
+    if (!TEST_CHECK(server.isRunning, "the server didn't start on port %d", port))
+        return;
+
+    CTestClient client(port);
+    int status = client.Get("/gallery?sort=game&cursor=" + cursor);
+    TEST_CHECK(status == 200, "a cursor of the album sorted by game got %d", status);
+    status = client.Get("/gallery?sort=game&cursor=" + unknownCursor);
+    TEST_CHECK(status == 400, "a cursor of a game which isn't in the album got %d", status);
+
+    server.Stop();
+}
+
+int main(int argc, char* argv[])
+{
+    std::unique_ptr<CSyntheticAlbumBackend> backend = std::make_unique<CSyntheticAlbumBackend>(GALLERY_TEST_ENTRY_COUNT, GALLERY_TEST_TITLE_COUNT);
+    CSyntheticAlbumBackend* backendPointer = backend.get();
+    CAlbumWrapper::Get()->Init(std::move(backend));
+
+    CheckSelections(*backendPointer);
+    CheckDates();
+    CheckGameCursors();
+
+    CAlbumWrapper::Get()->Shutdown();
+    return GetTestResult("gallerytest");
+}
@@ -0,0 +1,220 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Compares how fast a /gallery page is written with CJsonWriter against building it as a nlohmann::json
+// tree and dumping that, like the server did before. Pages have 21 entries (the default page size),
+// 500 and 10,000 entries. The writer writes the whole page into one string, or, like the server does
+// for large pages, into a buffer which is sent (here: emptied) every GALLERY_STREAM_CHUNK_SIZE bytes
+
+#include "testutils.hpp"
+#include "core/jsonwriter.hpp"
+#include "core/albumwrapper.hpp"
+#include "json.hpp"
+#include <string>
+#include <vector>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+using json = nlohmann::json;
+
+// The page sizes to measure
+static const int pageSizes[] = { CONTENT_PER_PAGE, 500, 10000 };
+
+// What a gallery entry has, like the album index keeps it
+struct SBenchEntry
+{
+    int id;
+    std::string key;
+    bool isSd;
+    std::string game;
+    u64 fileSize;
+    s64 takenAt;
+    bool isVideo;
+    std::string fileName;
+};
+
+// Makes up the entries of a page, with names which need escaping here and there
+static std::vector<SBenchEntry> MakeEntries(int count)
+{
+    static const char* games[] = { "Super Mario Odyssey", "The Legend of Zelda: Breath of the Wild", "Pok\xC3\xA9mon Sword", "\"Quoted\" \\ Game" };
+
+    std::vector<SBenchEntry> entries(count);
+    for (int i = 0; i < count; i++)
+    {
+        SBenchEntry& entry = entries[i];
+        char key[64];
+        snprintf(key, sizeof(key), "%016lX%014ld%02d", 0x0100000000010000 + i % 4, 20200504101907 - i, i % 100);
+
+        entry.id = i;
+        entry.key = key;
+        entry.isSd = i % 3 != 0;
+        entry.game = games[i % 4];
+        entry.fileSize = 300000 + i * 17;
+        entry.takenAt = 1589444763 - i * 60;
+        entry.isVideo = i % 7 == 0;
+        entry.fileName = std::string("Game_") + key + (entry.isVideo ? ".mp4" : ".jpg");
+    }
+
+    return entries;
+}
+
+// Writes one entry like CAlbumWrapper::WriteGalleryEntry does
+static void WriteEntry(CJsonWriter& writer, const SBenchEntry& entry)
+{
+    writer.BeginObject();
+    writer.Key("id");
+    writer.Int(entry.id);
+    writer.Key("key");
+    writer.String(entry.key);
+    writer.Key("storedAt");
+    writer.String(entry.isSd ? "sd" : "nand");
+    writer.Key("game");
+    writer.String(entry.game);
+    writer.Key("fileSize");
+    writer.UInt(entry.fileSize);
+    writer.Key("takenAt");
+    writer.Int(entry.takenAt);
+    writer.Key("type");
+    writer.String(entry.isVideo ? "video" : "screenshot");
+    writer.Key("fileName");
+    writer.String(entry.fileName);
+    writer.EndObject();
+}
+
+// Writes the page with the writer. If chunked, the output is emptied whenever a chunk is full, and the
+// number of bytes written returned, otherwise the whole page is left in the output
+static u64 WritePage(const std::vector<SBenchEntry>& entries, std::string& output, bool isChunked)
+{
+    output.clear();
+    output.reserve(isChunked ? GALLERY_STREAM_CHUNK_SIZE + GALLERY_JSON_ENTRY_SIZE : GALLERY_JSON_BASE_SIZE + entries.size() * GALLERY_JSON_ENTRY_SIZE);
+    u64 bytesSent = 0;
+
+    CJsonWriter writer(output);
+    writer.BeginObject();
+    writer.Key("pages");
+    writer.Int(1);
+    writer.Key("total");
+    writer.Int(entries.size());
+    writer.Key("theme");
+    writer.String("dark");
+    writer.Key("gallery");
+    writer.BeginArray();
+    for (const SBenchEntry& entry : entries)
+    {
+        WriteEntry(writer, entry);
+        if (isChunked && output.size() >= GALLERY_STREAM_CHUNK_SIZE)
+        {
+            bytesSent += output.size();
+            output.clear();
+        }
+    }
+    writer.EndArray();
+
+    writer.Key("nextCursor");
+    writer.Null();
+    writer.Key("stats");
+    writer.BeginObject();
+    writer.Key("indexTime");
+    writer.Double(0.001);
+    writer.Key("numScreenshots");
+    writer.Int(50);
+    writer.Key("numVideos");
+    writer.Int(13);
+    writer.EndObject();
+    writer.EndObject();
+
+    return bytesSent + output.size();
+}
+
+// Builds the page as a tree and dumps it, like GetGalleryContent did before CJsonWriter
+static std::string DumpPage(const std::vector<SBenchEntry>& entries)
+{
+    json finalObject;
+    finalObject["pages"] = 1;
+    finalObject["total"] = (int)entries.size();
+    finalObject["theme"] = "dark";
+
+    json jsonArray = json::array();
+    for (const SBenchEntry& entry : entries)
+    {
+        json jsonObj;
+        jsonObj["id"] = entry.id;
+        jsonObj["key"] = entry.key;
+        jsonObj["storedAt"] = entry.isSd ? "sd" : "nand";
+        jsonObj["game"] = entry.game;
+        jsonObj["fileSize"] = entry.fileSize;
+        jsonObj["takenAt"] = entry.takenAt;
+        jsonObj["type"] = entry.isVideo ? "video" : "screenshot";
+        jsonObj["fileName"] = entry.fileName;
+        jsonArray.push_back(jsonObj);
+    }
+    finalObject["gallery"] = jsonArray;
+    finalObject["nextCursor"] = nullptr;
+
+    json statObject;
+    statObject["indexTime"] = 0.001;
+    statObject["numScreenshots"] = 50;
+    statObject["numVideos"] = 13;
+    finalObject["stats"] = statObject;
+
+    return finalObject.dump();
+}
+
+int main(int argc, char* argv[])
+{
+    printf("%-8s %14s %14s %14s %10s\n", "entries", "nlohmann us", "writer us", "chunked us", "speedup");
+    for (int pageSize : pageSizes)
+    {
+        std::vector<SBenchEntry> entries = MakeEntries(pageSize);
+
+        // Both need to describe the same page, the order of the keys aside
+        std::string written;
+        WritePage(entries, written, false);
+        std::string dumped = DumpPage(entries);
+        TEST_CHECK(json::parse(written) == json::parse(dumped), "%d entries: the writer and nlohmann wrote different pages", pageSize);
+        TEST_CHECK(written.size() == dumped.size(), "%d entries: the writer wrote %zu bytes, nlohmann %zu", pageSize, written.size(), dumped.size());
+
+        double dumpRate = MeasureRate([&]() {
+            KeepResult(DumpPage(entries).size());
+            return (u64)1;
+        });
+
+        std::string output;
+        double writeRate = MeasureRate([&]() {
+            KeepResult(WritePage(entries, output, false));
+            return (u64)1;
+        });
+
+        double chunkedRate = MeasureRate([&]() {
+            KeepResult(WritePage(entries, output, true));
+            return (u64)1;
+        });
+
+        printf("%-8d %14.1f %14.1f %14.1f %9.1fx\n", pageSize, 1e6 / dumpRate, 1e6 / writeRate, 1e6 / chunkedRate, writeRate / dumpRate);
+    }
+
+    return GetTestResult("jsonwriterbench");
+}
@@ -0,0 +1,113 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Measures what a browser does when it opens the gallery: one /gallery page, then the thumbnails of all
+// its entries. The page is loaded once with a new connection for every request, as a server without
+// keep-alive makes clients do, and once over a single connection which stays open between requests (up
+// to HTTP_MAX_KEEPALIVE_REQUESTS of them)
+
+#include "testutils.hpp"
+#include "core/server.hpp"
+#include <memory>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// The album, screenshots small enough to be their own thumbnails
+#define PAGE_LOAD_BENCH_SCREENSHOT_COUNT (CONTENT_PER_PAGE * 4)
+#define PAGE_LOAD_BENCH_SCREENSHOT_SIZE (24 * 1024)
+
+// Loads the first gallery page and the thumbnails of its entries, getting the client for every request
+// from the given function. Returns the number of requests which went through
+static u64 LoadPage(const std::function<CTestClient&()>& getClient)
+{
+    u64 requestCount = 0;
+    if (getClient().Get("/gallery") == 200)
+        requestCount++;
+
+    for (int id = 0; id < CONTENT_PER_PAGE; id++)
+    {
+        CTestClient& client = getClient();
+        if (client.Get("/thumbnail?id=" + std::to_string(id)) == 200 && client.GetBodySize() == PAGE_LOAD_BENCH_SCREENSHOT_SIZE)
+            requestCount++;
+    }
+
+    return requestCount;
+}
+
+int main(int argc, char* argv[])
+{
+    CTestAlbum album;
+    for (int i = 0; i < PAGE_LOAD_BENCH_SCREENSHOT_COUNT; i++)
+        album.AddFile(CapsAlbumFileContents_ScreenShot, 0x0100000000010000, PAGE_LOAD_BENCH_SCREENSHOT_SIZE);
+
+    InitAlbumWrapper(album, 0);
+
+    int port = FindFreePort();
+    CWebServer server(port);
+    server.Start();
+    if (!TEST_CHECK(server.isRunning, "the server didn't start on port %d", port))
+        return GetTestResult("pageloadbench");
+
+    const u64 requestsPerLoad = CONTENT_PER_PAGE + 1;
+    printf("%-28s %14s %14s %14s\n", "page load", "ms per load", "requests/s", "connections");
+
+    // A new connection for every request, the client closes it once the response is read
+    std::unique_ptr<CTestClient> oneShotClient;
+    u32 oneShotConnections = 0;
+    u64 failedRequests = 0;
+    double oneShotRate = MeasureRate([&]() {
+        u64 requestCount = LoadPage([&]() -> CTestClient& {
+            oneShotClient = std::make_unique<CTestClient>(port);
+            oneShotConnections++;
+            return *oneShotClient;
+        });
+        failedRequests += requestsPerLoad - requestCount;
+        return (u64)1;
+    });
+    oneShotClient.reset();
+    printf("%-28s %14.2f %14.0f %14u\n", "connection per request", 1000.0 / oneShotRate, oneShotRate * requestsPerLoad, oneShotConnections);
+
+    // One connection which is kept open, until the server closes it after HTTP_MAX_KEEPALIVE_REQUESTS
+    CTestClient keepAliveClient(port);
+    u64 keepAliveRequests = 0;
+    double keepAliveRate = MeasureRate([&]() {
+        u64 requestCount = LoadPage([&]() -> CTestClient& { return keepAliveClient; });
+        failedRequests += requestsPerLoad - requestCount;
+        keepAliveRequests += requestsPerLoad;
+        return (u64)1;
+    });
+    printf("%-28s %14.2f %14.0f %14u\n", "keep-alive connection", 1000.0 / keepAliveRate, keepAliveRate * requestsPerLoad, keepAliveClient.GetConnectionCount());
+
+    TEST_CHECK(failedRequests == 0, "%lu requests failed", failedRequests);
+    TEST_CHECK(keepAliveClient.GetConnectionCount() <= keepAliveRequests / HTTP_MAX_KEEPALIVE_REQUESTS + 1, "the keep-alive client connected %u times for %lu requests",
+        keepAliveClient.GetConnectionCount(), keepAliveRequests);
+
+    server.Stop();
+    CAlbumWrapper::Get()->Shutdown();
+    return GetTestResult("pageloadbench");
+}
@@ -0,0 +1,138 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Measures how many requests per second CHttpParser gets through, on the kind of requests the web
+// page and browsers send: whole requests, requests which arrive in pieces, and pipelined requests.
+// The last case also looks up the headers and query parameters the server reads for every request
+
+#include "testutils.hpp"
+#include "core/http.hpp"
+#include <string>
+#include <string_view>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// How many requests the pipelined case puts into one receive buffer
+#define PARSER_BENCH_PIPELINE_DEPTH 16
+
+// What a browser sends when the web page asks for the next page of the gallery
+static const std::string_view browserRequest =
+    "GET /gallery?page=3&type=screenshot&sort=newest HTTP/1.1\r\n"
+    "Host: 192.168.178.46:1234\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (Linux; Android 13; Pixel 7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Mobile Safari/537.36\r\n"
+    "Accept: application/json, text/plain, */*\r\n"
+    "Referer: http://192.168.178.46:1234/\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: de-DE,de;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+    "If-None-Match: \"a81f3c5e-3\"\r\n"
+    "\r\n";
+
+// The smallest request a client can send
+static const std::string_view minimalRequest = "GET / HTTP/1.1\r\nHost: switch\r\n\r\n";
+
+// Parses the request from one buffer, as it arrives in one read most of the time
+static u64 ParseWhole(std::string_view request)
+{
+    CHttpParser parser;
+    SHttpRequest parsed;
+    EHttpParseResult result = parser.Parse(request, parsed);
+    KeepResult(parsed.numHeaders);
+    return result == EHttpParseResult::Complete ? 1 : 0;
+}
+
+// Parses the request as it arrives in three reads, cut in the middle of the headers and the terminator
+static u64 ParseInPieces(std::string_view request)
+{
+    CHttpParser parser;
+    SHttpRequest parsed;
+    size_t cuts[] = { request.size() / 3, request.size() - 2, request.size() };
+
+    EHttpParseResult result = EHttpParseResult::Incomplete;
+    for (size_t cut : cuts)
+        result = parser.Parse(request.substr(0, cut), parsed);
+
+    KeepResult(parsed.numHeaders);
+    return result == EHttpParseResult::Complete ? 1 : 0;
+}
+
+// Parses all requests of a pipelined buffer one after the other, like the connection does after each response
+static u64 ParsePipelined(std::string_view buffer)
+{
+    CHttpParser parser;
+    SHttpRequest parsed;
+    u64 requests = 0;
+    while (!buffer.empty() && parser.Parse(buffer, parsed) == EHttpParseResult::Complete)
+    {
+        buffer.remove_prefix(parsed.length);
+        parser.Reset();
+        requests++;
+    }
+
+    return requests;
+}
+
+// Parses the request and reads what the server reads of every request: whether to keep the connection
+// open, whether the client has the response cached already, whether it takes gzip and the query
+static u64 ParseAndRead(std::string_view request)
+{
+    CHttpParser parser;
+    SHttpRequest parsed;
+    if (parser.Parse(request, parsed) != EHttpParseResult::Complete)
+        return 0;
+
+    u64 seen = parsed.HeaderHasToken("Connection", "close") ? 1 : 0;
+    seen += parsed.HasCachedETag("\"a81f3c5e-3\"") ? 1 : 0;
+    seen += parsed.AcceptsEncoding("gzip") ? 1 : 0;
+    seen += parsed.GetQueryParam("page").size() + parsed.GetQueryParam("sort").size();
+    KeepResult(seen);
+    return 1;
+}
+
+// Measures one case and prints its requests and megabytes per second
+static void RunCase(const char* name, u64 bytesPerRequest, u64 (*parse)(std::string_view), std::string_view input, u64 expectedRequests)
+{
+    TEST_CHECK(parse(input) == expectedRequests, "%s: the parser didn't get through all requests", name);
+
+    double requestsPerSecond = MeasureRate([&]() { return parse(input); });
+    printf("%-24s %12.0f requests/s %8.1f MB/s\n", name, requestsPerSecond, requestsPerSecond * bytesPerRequest / (1024 * 1024));
+}
+
+int main(int argc, char* argv[])
+{
+    std::string pipelined;
+    for (int i = 0; i < PARSER_BENCH_PIPELINE_DEPTH; i++)
+        pipelined.append(browserRequest);
+
+    RunCase("minimal", minimalRequest.size(), ParseWhole, minimalRequest, 1);
+    RunCase("browser", browserRequest.size(), ParseWhole, browserRequest, 1);
+    RunCase("browser in 3 reads", browserRequest.size(), ParseInPieces, browserRequest, 1);
+    RunCase("browser pipelined", browserRequest.size(), ParsePipelined, pipelined, PARSER_BENCH_PIPELINE_DEPTH);
+    RunCase("browser with lookups", browserRequest.size(), ParseAndRead, browserRequest, 1);
+
+    return GetTestResult("parserbench");
+}
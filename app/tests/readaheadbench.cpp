@@ -0,0 +1,140 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Measures how fast a video downloads when reading it from capsa and sending it over the network take
+// turns, and when the blocks following the one being sent are read ahead. Capsa is simulated by the
+// album directory read at a fixed rate. The network thread is played by borrowing from the video's
+// content source and handing what it got to a link, which takes as much as its send buffer holds and
+// sends it on at a fixed rate. With read-ahead the download should come close to the slower of the
+// two rates, without it the time of both adds up whenever the send buffer runs dry
+
+#include "testutils.hpp"
+#include <unistd.h>
+#include <algorithm>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// The video, big enough for many blocks
+#define READ_AHEAD_BENCH_VIDEO_SIZE (4 * 1024 * 1024)
+
+// How much the link buffers before send() has to wait, as much as the Switch's sockets start out with
+#define READ_AHEAD_BENCH_SEND_BUFFER_SIZE 0x8000
+
+#define MB (1024 * 1024)
+
+// One pair of rates to measure, in bytes per second
+struct SRateCase
+{
+    u64 capsaRate;
+    u64 linkRate;
+};
+
+// Downloads the video over a link of the given rate, and returns how many bytes went through
+static u64 Download(u64 linkRate)
+{
+    // When all bytes handed to the link so far will have left it
+    u64 linkBusyUntil = GetTimeNs();
+
+    std::shared_ptr<IContentSource> source = CAlbumWrapper::Get()->GetFileContent(0);
+    if (!source || source->GetSize() != READ_AHEAD_BENCH_VIDEO_SIZE)
+        return 0;
+
+    u64 offset = 0;
+    while (offset < READ_AHEAD_BENCH_VIDEO_SIZE)
+    {
+        const char* data = nullptr;
+        u64 borrowed = source->Borrow(offset, READ_AHEAD_BENCH_SEND_BUFFER_SIZE, &data);
+        if (borrowed == HTTP_BORROW_PENDING)
+        {
+            // The network thread would serve other connections until the block is read
+            usleep(100);
+            continue;
+        }
+
+        if (borrowed == 0)
+            return 0;
+
+        // Wait until the send buffer has room for what was borrowed, then it leaves at the link's rate
+        u64 bufferedTime = (READ_AHEAD_BENCH_SEND_BUFFER_SIZE - borrowed) * 1000000000ull / linkRate;
+        u64 now = GetTimeNs();
+        if (linkBusyUntil > now + bufferedTime)
+            usleep((linkBusyUntil - now - bufferedTime) / 1000);
+
+        linkBusyUntil = std::max(linkBusyUntil, GetTimeNs()) + borrowed * 1000000000ull / linkRate;
+        offset += borrowed;
+    }
+
+    // The download is done once the last bytes left the link
+    u64 now = GetTimeNs();
+    if (linkBusyUntil > now)
+        usleep((linkBusyUntil - now) / 1000);
+
+    return offset;
+}
+
+int main(int argc, char* argv[])
+{
+    CTestAlbum album;
+    album.AddFile(CapsAlbumFileContents_Movie, 0x0100000000010000, READ_AHEAD_BENCH_VIDEO_SIZE);
+
+    CDirectoryAlbumBackend* backend = InitAlbumWrapper(album, 0);
+    CAlbumWrapper::Get()->SetContentBackend(EContentBackend::Capsa);
+
+    SRateCase cases[] = {
+        { 8 * MB, 8 * MB },
+        { 16 * MB, 8 * MB },
+        { 8 * MB, 16 * MB },
+        { 32 * MB, 4 * MB },
+    };
+
+    printf("%12s %12s %14s %16s %14s\n", "capsa MB/s", "link MB/s", "serial MB/s", "read-ahead MB/s", "slower MB/s");
+    for (const SRateCase& rateCase : cases)
+    {
+        backend->SetBandwidth(rateCase.capsaRate);
+        bool hasFailed = false;
+        auto download = [&]() {
+            u64 bytes = Download(rateCase.linkRate);
+            hasFailed |= bytes != READ_AHEAD_BENCH_VIDEO_SIZE;
+            return bytes;
+        };
+
+        // Without the read-ahead threads, the blocks are read when the network thread borrows them
+        CReadAheadWorker::Get()->Stop();
+        double serialRate = MeasureRate(download);
+
+        CReadAheadWorker::Get()->Start();
+        double readAheadRate = MeasureRate(download);
+
+        TEST_CHECK(!hasFailed, "downloads failed at %lu MB/s from capsa and %lu MB/s over the link", rateCase.capsaRate / MB, rateCase.linkRate / MB);
+        printf("%12lu %12lu %14.1f %16.1f %14lu\n", rateCase.capsaRate / MB, rateCase.linkRate / MB, serialRate / MB, readAheadRate / MB,
+            std::min(rateCase.capsaRate, rateCase.linkRate) / MB);
+    }
+
+    CAlbumWrapper::Get()->Shutdown();
+    return GetTestResult("readaheadbench");
+}
@@ -0,0 +1,174 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Checks the read-ahead of album files read straight from the filesystem: all files are read by the
+// same few threads however many are open, files are found and opened on those threads rather than on
+// the thread asking for them, and files which aren't where the filesystem backend looks for them are
+// read through capsa instead
+
+#include "testutils.hpp"
+#include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// The album: screenshots which fit into one block, and videos which take a few
+#define READ_AHEAD_SCREENSHOT_COUNT 32
+#define READ_AHEAD_SCREENSHOT_SIZE (ALBUM_FILE_BLOCK_SIZE / 2 + 100)
+#define READ_AHEAD_VIDEO_COUNT 32
+#define READ_AHEAD_VIDEO_SIZE (ALBUM_FILE_BLOCK_SIZE * 3 + 100)
+
+// How long every call through the backend takes in the fallback check, in milliseconds
+#define READ_AHEAD_LATENCY_MS 100
+
+// How long to wait for a block to be read, in milliseconds
+#define READ_AHEAD_TIMEOUT_MS 5000
+
+// A directory backend whose album directories the filesystem backend doesn't find, so everything
+// is left to capsa
+class CHiddenDirectoryAlbumBackend : public CDirectoryAlbumBackend
+{
+public:
+    using CDirectoryAlbumBackend::CDirectoryAlbumBackend;
+
+    const char* GetAlbumDir(CapsAlbumStorage storage) override
+    {
+        return "/nonexistent/";
+    }
+};
+
+// Returns how many threads the process has
+static int GetThreadCount()
+{
+    int threadCount = 0;
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir)
+        return -1;
+
+    struct dirent* dirEntry;
+    while ((dirEntry = readdir(dir)) != NULL)
+    {
+        if (dirEntry->d_name[0] != '.')
+            threadCount++;
+    }
+
+    closedir(dir);
+    return threadCount;
+}
+
+// Reads a whole source, returns whether it has the expected content
+static bool ReadWhole(IContentSource& source, const std::string& expectedContent)
+{
+    std::string content;
+    u64 startTime = GetTimeNs();
+    while (content.size() < expectedContent.size() && GetTimeNs() - startTime < READ_AHEAD_TIMEOUT_MS * 1000000ull)
+    {
+        const char* data = nullptr;
+        u64 borrowed = source.Borrow(content.size(), expectedContent.size(), &data);
+        if (borrowed == HTTP_BORROW_PENDING)
+            usleep(1000);
+        else if (borrowed == 0)
+            return false;
+        else
+            content.append(data, borrowed);
+    }
+
+    return content == expectedContent;
+}
+
+// Opens every entry at once and reads them all, checking that the number of threads doesn't change
+static void CheckThreads(const std::vector<std::string>& contents)
+{
+    int threadCount = GetThreadCount();
+
+    std::vector<std::shared_ptr<IContentSource>> sources;
+    for (int id = 0; id < contents.size(); id++)
+        sources.push_back(CAlbumWrapper::Get()->GetFileContent(id));
+
+    int failures = 0;
+    for (int id = 0; id < contents.size(); id++)
+    {
+        if (!sources[id] || sources[id]->GetSize() != contents[id].size() || !ReadWhole(*sources[id], contents[id]))
+            failures++;
+    }
+
+    TEST_CHECK(failures == 0, "%d of %zu files weren't read right", failures, contents.size());
+    TEST_CHECK(GetThreadCount() == threadCount, "%zu open files took %d threads", contents.size(), GetThreadCount() - threadCount);
+}
+
+// Reads every entry through a backend the filesystem backend can't find the files of, so they're
+// read through capsa after all. Looking for them goes through the slow backend, which mustn't hold
+// up asking for the content
+static void CheckFallback(CTestAlbum& album, const std::vector<std::string>& contents)
+{
+    std::unique_ptr<CHiddenDirectoryAlbumBackend> backend = std::make_unique<CHiddenDirectoryAlbumBackend>(album.GetSdAlbumDir(), "");
+    CHiddenDirectoryAlbumBackend* backendPointer = backend.get();
+    CAlbumWrapper::Get()->Init(std::move(backend));
+    backendPointer->SetLatency(READ_AHEAD_LATENCY_MS * 1000);
+
+    SContentBackendStats statsBefore = CAlbumWrapper::Get()->GetContentBackendStats(EContentBackend::Filesystem);
+    int failures = 0;
+    for (int id = 0; id < contents.size(); id += contents.size() / 4)
+    {
+        u64 startTime = GetTimeNs();
+        std::shared_ptr<IContentSource> source = CAlbumWrapper::Get()->GetFileContent(id);
+        u64 openTimeMs = (GetTimeNs() - startTime) / 1000000;
+        TEST_CHECK(openTimeMs < READ_AHEAD_LATENCY_MS, "asking for file %d took %lu ms", id, openTimeMs);
+
+        if (!source || !ReadWhole(*source, contents[id]))
+            failures++;
+    }
+
+    TEST_CHECK(failures == 0, "%d files weren't read right through capsa", failures);
+    SContentBackendStats stats = CAlbumWrapper::Get()->GetContentBackendStats(EContentBackend::Filesystem);
+    TEST_CHECK(stats.fallbacks == statsBefore.fallbacks + 4 && stats.filesOpened == statsBefore.filesOpened, "%lu files were left to capsa and %lu opened, not 4 and 0",
+        stats.fallbacks - statsBefore.fallbacks, stats.filesOpened - statsBefore.filesOpened);
+
+    CAlbumWrapper::Get()->Shutdown();
+}
+
+int main(int argc, char* argv[])
+{
+    // The screenshots are added last, which gives them the first IDs
+    CTestAlbum album;
+    std::vector<std::string> contents;
+    for (int i = 0; i < READ_AHEAD_VIDEO_COUNT; i++)
+        contents.push_back(CTestAlbum::GetFileContent(album.AddFile(CapsAlbumFileContents_Movie, 0x0100000000010000, READ_AHEAD_VIDEO_SIZE), READ_AHEAD_VIDEO_SIZE));
+    for (int i = 0; i < READ_AHEAD_SCREENSHOT_COUNT; i++)
+        contents.push_back(CTestAlbum::GetFileContent(album.AddFile(CapsAlbumFileContents_ScreenShot, 0x0100000000010000, READ_AHEAD_SCREENSHOT_SIZE), READ_AHEAD_SCREENSHOT_SIZE));
+    std::reverse(contents.begin(), contents.end());
+
+    InitAlbumWrapper(album, 0);
+    CAlbumWrapper::Get()->SetContentBackend(EContentBackend::Filesystem);
+    CheckThreads(contents);
+    CAlbumWrapper::Get()->Shutdown();
+
+    CheckFallback(album, contents);
+    return GetTestResult("readaheadtest");
+}
@@ -0,0 +1,161 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Measures how long it takes to find out what answers a request: looking up API routes, falling through
+// to the static web assets and reading typed query parameters. For comparison, it also measures the
+// dispatch the server did before the routing table, which probed each mount point with stat() and open()
+// and tried one sscanf() per endpoint
+
+#include "testutils.hpp"
+#include "core/router.hpp"
+#include "core/assets.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// Requests for every API route, as the web page sends them
+static const char* apiRequests[] = {
+    "GET /file?id=12 HTTP/1.1\r\nHost: switch\r\n\r\n",
+    "GET /gallery?page=3&type=screenshot&sort=newest HTTP/1.1\r\nHost: switch\r\n\r\n",
+    "GET /games HTTP/1.1\r\nHost: switch\r\n\r\n",
+    "GET /search?q=super%20mario HTTP/1.1\r\nHost: switch\r\n\r\n",
+    "GET /thumbnail?id=12 HTTP/1.1\r\nHost: switch\r\n\r\n",
+    "GET /timeline HTTP/1.1\r\nHost: switch\r\n\r\n",
+};
+
+// Requests for static web assets, which no route answers
+static const char* assetRequests[] = {
+    "GET / HTTP/1.1\r\nHost: switch\r\n\r\n",
+    "GET /assets/css/main.css HTTP/1.1\r\nHost: switch\r\n\r\n",
+    "GET /assets/favicon.png HTTP/1.1\r\nHost: switch\r\n\r\n",
+    "GET /static/js/main.b80ee19d.chunk.js HTTP/1.1\r\nHost: switch\r\n\r\n",
+};
+
+// Parses each of the requests, they point into the strings so those need to stay around
+static std::vector<SHttpRequest> ParseRequests(const char* const* requests, size_t count)
+{
+    std::vector<SHttpRequest> parsed(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        CHttpParser parser;
+        TEST_CHECK(parser.Parse(requests[i], parsed[i]) == EHttpParseResult::Complete, "couldn't parse %s", requests[i]);
+    }
+
+    return parsed;
+}
+
+// Dispatches the request like the server did before the routing table: the first mount point which has
+// the file serves it, if none has, one endpoint after the other is tried with sscanf
+static u64 DispatchWithProbes(const SHttpRequest& request, const std::vector<std::string>& mountPoints)
+{
+    std::string url = request.target == "/" ? "/index.html" : std::string(request.target);
+    std::string path;
+    for (const std::string& mountPoint : mountPoints)
+    {
+        path = mountPoint + url;
+        struct stat fileStat;
+        if (stat(path.c_str(), &fileStat) == 0)
+            break;
+    }
+
+    int file = open(path.c_str(), O_RDONLY);
+    if (file >= 0)
+    {
+        close(file);
+        return 1;
+    }
+
+    int value = 0;
+    if (sscanf(url.c_str(), "/gallery?page=%d", &value))
+        return 2 + value;
+    if (sscanf(url.c_str(), "/thumbnail?id=%d", &value))
+        return 3 + value;
+    if (sscanf(url.c_str(), "/file?id=%d", &value))
+        return 4 + value;
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<SHttpRequest> api = ParseRequests(apiRequests, sizeof(apiRequests) / sizeof(apiRequests[0]));
+    std::vector<SHttpRequest> assets = ParseRequests(assetRequests, sizeof(assetRequests) / sizeof(assetRequests[0]));
+
+    for (const SHttpRequest& request : api)
+        TEST_CHECK(CRouter::FindRoute(request.path) != nullptr, "no route for %.*s", (int)request.path.size(), request.path.data());
+    for (const SHttpRequest& request : assets)
+        TEST_CHECK(CRouter::FindRoute(request.path) == nullptr, "a route for the asset %.*s", (int)request.path.size(), request.path.data());
+
+    // Finding the handler of an API request
+    double rate = MeasureRate([&]() {
+        for (const SHttpRequest& request : api)
+            KeepResult((u64)CRouter::FindRoute(request.path));
+        return (u64)api.size();
+    });
+    printf("%-28s %12.0f requests/s %8.1f ns/request\n", "api route", rate, 1e9 / rate);
+
+    // Finding out a request isn't an API route, and finding its embedded asset instead
+    rate = MeasureRate([&]() {
+        for (const SHttpRequest& request : assets)
+        {
+            KeepResult((u64)CRouter::FindRoute(request.path));
+            KeepResult((u64)CEmbeddedAssets::Find(request.path == "/" ? "/index.html" : request.path));
+        }
+        return (u64)assets.size();
+    });
+    printf("%-28s %12.0f requests/s %8.1f ns/request\n", "static asset", rate, 1e9 / rate);
+
+    // Reading the typed query parameters the handlers read
+    rate = MeasureRate([&]() {
+        int id = 0;
+        int page = 0;
+        std::string query;
+        CRouter::GetQueryParam(api[0], "id", id);
+        CRouter::GetQueryParam(api[1], "page", page);
+        CRouter::GetQueryParam(api[3], "q", query);
+        KeepResult(id + page + query.size());
+        return (u64)3;
+    });
+    printf("%-28s %12.0f params/s   %8.1f ns/param\n", "typed query parameter", rate, 1e9 / rate);
+
+    // The same requests dispatched like before the routing table, against two mount points which
+    // don't have them (on the Switch, romfs and the SD card, where each probe is a lot slower still)
+    CTestAlbum album;
+    std::vector<std::string> mountPoints = { album.GetSdAlbumDir() + "romfs", album.GetSdAlbumDir() + "www" };
+    rate = MeasureRate([&]() {
+        for (const SHttpRequest& request : api)
+            KeepResult(DispatchWithProbes(request, mountPoints));
+        return (u64)api.size();
+    });
+    printf("%-28s %12.0f requests/s %8.1f ns/request\n", "api, stat + sscanf (old)", rate, 1e9 / rate);
+
+    return GetTestResult("routerbench");
+}
@@ -0,0 +1,550 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "testutils.hpp"
+#include <stdarg.h>
+#include <malloc.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+using namespace nxgallery::tests;
+
+// How many checks failed so far
+static int numFailedChecks = 0;
+
+// Where KeepResult puts its values, which the compiler can't see through
+static volatile u64 keptResult = 0;
+
+bool nxgallery::tests::Check(bool condition, const char* file, int line, const char* format, ...)
+{
+    if (condition)
+        return true;
+
+    printf("FAILED %s:%d: ", file, line);
+    va_list arguments;
+    va_start(arguments, format);
+    vprintf(format, arguments);
+    va_end(arguments);
+    printf("\n");
+
+    numFailedChecks++;
+    return false;
+}
+
+int nxgallery::tests::GetTestResult(const char* testName)
+{
+    if (numFailedChecks > 0)
+    {
+        printf("%s: %d checks FAILED\n", testName, numFailedChecks);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: passed\n", testName);
+    return EXIT_SUCCESS;
+}
+
+u64 nxgallery::tests::GetTimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double nxgallery::tests::MeasureRate(const std::function<u64()>& run)
+{
+    // Warm up the caches and the allocator once, so the first call doesn't count
+    run();
+
+    u64 operations = 0;
+    u64 start = GetTimeNs();
+    u64 elapsed = 0;
+    do
+    {
+        operations += run();
+        elapsed = GetTimeNs() - start;
+    }
+    while (elapsed < (u64)BENCH_DURATION_MS * 1000000ULL);
+
+    return operations * 1e9 / elapsed;
+}
+
+void nxgallery::tests::KeepResult(u64 value)
+{
+    keptResult = keptResult + value;
+}
+
+u64 nxgallery::tests::GetResidentMemory()
+{
+    // Each thread may allocate from an arena of its own, which keeps what was freed around for later
+    malloc_trim(0);
+
+    // The kernel reports it as "VmRSS:     4400 kB"
+    FILE* status = fopen("/proc/self/status", "r");
+    char line[256];
+    u64 residentKb = 0;
+    while (status && fgets(line, sizeof(line), status))
+    {
+        if (sscanf(line, "VmRSS: %lu kB", &residentKb) == 1)
+            break;
+    }
+
+    if (status)
+        fclose(status);
+
+    return residentKb * 1024;
+}
+
+CTestAlbum::CTestAlbum()
+{
+    char rootTemplate[] = "/tmp/nxgallery-test-XXXXXX";
+    if (!mkdtemp(rootTemplate))
+    {
+        printf("Failed to create the test album: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    rootDir = rootTemplate;
+    sdAlbumDir = rootDir + "/sd/";
+}
+
+CTestAlbum::~CTestAlbum()
+{
+    std::error_code error;
+    std::filesystem::remove_all(rootDir, error);
+}
+
+std::string CTestAlbum::AddFile(CapsAlbumFileContents content, u64 titleId, u64 size)
+{
+    // Every file is taken a second after the previous one, starting on the first of January 2022
+    u32 second = fileCount++;
+    char directory[32];
+    snprintf(directory, sizeof(directory), "2022/01/%02u/", 1 + second / 86400);
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "202201%02u%02u%02u%02u00-%016lX0000000000000000.%s", 1 + second / 86400, second / 3600 % 24,
+        second / 60 % 60, second % 60, titleId, content == CapsAlbumFileContents_Movie ? "mp4" : "jpg");
+
+    std::filesystem::create_directories(sdAlbumDir + directory);
+    std::string path = sdAlbumDir + directory + filename;
+
+    FILE* file = fopen(path.c_str(), "wb");
+    std::string fileContent = GetFileContent(path, size);
+    if (!file || fwrite(fileContent.data(), 1, fileContent.size(), file) != fileContent.size())
+    {
+        printf("Failed to write %s\n", path.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    fclose(file);
+    return path;
+}
+
+const std::string& CTestAlbum::GetSdAlbumDir()
+{
+    return sdAlbumDir;
+}
+
+std::string CTestAlbum::GetFileContent(const std::string& path, u64 size)
+{
+    // Made up from the filename, so every file has different content which can be checked later on
+    u64 state = 0xCBF29CE484222325;
+    for (char c : path.substr(path.find_last_of('/') + 1))
+        state = (state ^ (u8)c) * 0x100000001B3;
+
+    std::string content(size, '\0');
+    for (u64 i = 0; i < size; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        content[i] = (char)state;
+    }
+
+    return content;
+}
+
+nxgallery::core::CDirectoryAlbumBackend* nxgallery::tests::InitAlbumWrapper(CTestAlbum& album, u64 bytesPerSecond)
+{
+    std::unique_ptr<core::CDirectoryAlbumBackend> backend = std::make_unique<core::CDirectoryAlbumBackend>(album.GetSdAlbumDir(), "");
+    backend->SetBandwidth(bytesPerSecond);
+
+    core::CDirectoryAlbumBackend* backendPointer = backend.get();
+    core::CAlbumWrapper::Get()->Init(std::move(backend));
+    return backendPointer;
+}
+
+CSyntheticAlbumBackend::CSyntheticAlbumBackend(u32 entryCount, u32 titleCount)
+{
+    // The first entry is taken on the first of January 2020
+    time_t firstTime = 1577836800;
+    entries.resize(entryCount);
+    for (u32 i = 0; i < entryCount; i++)
+    {
+        time_t takenAt = firstTime + (time_t)i * 60;
+        struct tm date;
+        gmtime_r(&takenAt, &date);
+
+        CapsAlbumEntry& entry = entries[i];
+        entry.size = i % 8 == 7 ? 20000000 + i : 300000 + i;
+        entry.file_id.application_id = GetTitleId(i % titleCount);
+        entry.file_id.datetime.year = date.tm_year + 1900;
+        entry.file_id.datetime.month = date.tm_mon + 1;
+        entry.file_id.datetime.day = date.tm_mday;
+        entry.file_id.datetime.hour = date.tm_hour;
+        entry.file_id.datetime.minute = date.tm_min;
+        entry.file_id.datetime.second = date.tm_sec;
+        entry.file_id.datetime.id = 0;
+        entry.file_id.storage = i % 3 == 2 ? CapsAlbumStorage_Nand : CapsAlbumStorage_Sd;
+        entry.file_id.content = i % 8 == 7 ? CapsAlbumFileContents_Movie : CapsAlbumFileContents_ScreenShot;
+    }
+}
+
+const std::vector<CapsAlbumEntry>& CSyntheticAlbumBackend::GetEntries()
+{
+    return entries;
+}
+
+u64 CSyntheticAlbumBackend::GetTitleId(u32 titleIndex)
+{
+    return 0x0100000000010000 + ((u64)titleIndex << 16);
+}
+
+void CSyntheticAlbumBackend::SetApplicationNameLatency(u64 inLatencyUs)
+{
+    nameLatencyUs = inLatencyUs;
+}
+
+u32 CSyntheticAlbumBackend::GetApplicationNameCount()
+{
+    return nameCount;
+}
+
+void CSyntheticAlbumBackend::SetCacheDir(const std::string& inCacheDir)
+{
+    cacheDir = inCacheDir;
+    if (!cacheDir.empty() && cacheDir.back() != '/')
+        cacheDir += '/';
+}
+
+Result CSyntheticAlbumBackend::GetAlbumFileList(CapsAlbumStorage storage, std::vector<CapsAlbumEntry>& outEntries)
+{
+    outEntries.clear();
+    for (const CapsAlbumEntry& entry : entries)
+    {
+        if (entry.file_id.storage == storage)
+            outEntries.push_back(entry);
+    }
+
+    return 0;
+}
+
+Result CSyntheticAlbumBackend::GetAlbumFileCount(CapsAlbumStorage storage, u64* outCount)
+{
+    *outCount = std::count_if(entries.begin(), entries.end(), [storage](const CapsAlbumEntry& entry) {
+        return entry.file_id.storage == storage;
+    });
+
+    return 0;
+}
+
+Result CSyntheticAlbumBackend::GetAlbumFileSize(const CapsAlbumFileId& fileId, u64* outSize)
+{
+    // Entries are only ever asked for by what the list said, so that's enough to find them again
+    for (const CapsAlbumEntry& entry : entries)
+    {
+        if (memcmp(&entry.file_id, &fileId, sizeof(fileId)) == 0)
+        {
+            *outSize = entry.size;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+Result CSyntheticAlbumBackend::GetApplicationName(u64 titleId, std::string& outName)
+{
+    nameCount++;
+    if (nameLatencyUs > 0)
+        usleep(nameLatencyUs);
+
+    char name[32];
+    snprintf(name, sizeof(name), "Game %lu", (titleId - GetTitleId(0)) >> 16);
+    outName = name;
+    return 0;
+}
+
+Result CSyntheticAlbumBackend::GetIsDarkTheme(bool* outIsDarkTheme)
+{
+    *outIsDarkTheme = true;
+    return 0;
+}
+
+int nxgallery::tests::FindFreePort()
+{
+    // Let the system pick a port, then give it back
+    int portSocket = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+    if (portSocket < 0 || bind(portSocket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        getsockname(portSocket, (struct sockaddr*)&address, &addressLength) < 0)
+    {
+        printf("Failed to find a free port: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    close(portSocket);
+    return ntohs(address.sin_port);
+}
+
+CTestClient::CTestClient(int inPort)
+    : port(inPort)
+{
+}
+
+CTestClient::~CTestClient()
+{
+    Disconnect();
+}
+
+int CTestClient::Get(std::string_view target, std::string* outBody)
+{
+    bodySize = 0;
+    contentEncoding.clear();
+    if (outBody)
+        outBody->clear();
+
+    // A kept-alive connection might have been closed by the server in the meantime, so a request which
+    // fails right away on an old connection is sent again on a new one
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        bool isNewConnection = clientSocket < 0;
+        if (isNewConnection && !Connect())
+            return -1;
+
+        std::string request = "GET " + std::string(target) + " HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: " + acceptEncoding + "\r\n\r\n";
+        std::string statusLine;
+        if (send(clientSocket, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size() || !ReadLine(statusLine))
+        {
+            Disconnect();
+            if (isNewConnection)
+                return -1;
+
+            continue;
+        }
+
+        int statusCode = -1;
+        if (sscanf(statusLine.c_str(), "HTTP/1.%*d %d", &statusCode) != 1)
+        {
+            Disconnect();
+            return -1;
+        }
+
+        // Only the headers telling where the body ends and how it's encoded matter here
+        u64 contentLength = 0;
+        bool isChunked = false;
+        bool isClosing = false;
+        std::string header;
+        while (ReadLine(header) && !header.empty())
+        {
+            std::transform(header.begin(), header.end(), header.begin(), ::tolower);
+            if (header.compare(0, 15, "content-length:") == 0)
+                contentLength = strtoull(header.c_str() + 15, NULL, 10);
+            else if (header == "transfer-encoding: chunked")
+                isChunked = true;
+            else if (header == "connection: close")
+                isClosing = true;
+            else if (header.compare(0, 17, "content-encoding:") == 0)
+                contentEncoding = header.substr(header.find_first_not_of(' ', 17));
+        }
+
+        bool hasBody = true;
+        if (isChunked)
+        {
+            // Chunks until the empty one, each followed by a CRLF
+            std::string chunkHead;
+            u64 chunkSize = 0;
+            while ((hasBody = ReadLine(chunkHead)) && (chunkSize = strtoull(chunkHead.c_str(), NULL, 16)) > 0)
+            {
+                std::string chunkEnd;
+                if (!(hasBody = ReadBody(chunkSize, outBody) && ReadLine(chunkEnd)))
+                    break;
+            }
+
+            std::string lastLine;
+            hasBody = hasBody && ReadLine(lastLine);
+        }
+        else if (statusCode != 304)
+        {
+            hasBody = ReadBody(contentLength, outBody);
+        }
+
+        if (!hasBody)
+        {
+            Disconnect();
+            return -1;
+        }
+
+        if (isClosing)
+            Disconnect();
+
+        return statusCode;
+    }
+
+    return -1;
+}
+
+u64 CTestClient::GetBodySize()
+{
+    return bodySize;
+}
+
+u32 CTestClient::GetConnectionCount()
+{
+    return connectionCount;
+}
+
+void CTestClient::SetAcceptEncoding(std::string_view encodings)
+{
+    acceptEncoding = encodings;
+}
+
+const std::string& CTestClient::GetContentEncoding()
+{
+    return contentEncoding;
+}
+
+void CTestClient::SetReceiveRate(u64 bytesPerSecond)
+{
+    receiveRate = bytesPerSecond;
+    nextReceiveTime = 0;
+}
+
+bool CTestClient::Connect()
+{
+    clientSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (clientSocket < 0)
+        return false;
+
+    // Never hang forever if the server doesn't answer
+    struct timeval timeout;
+    timeout.tv_sec = TEST_CLIENT_TIMEOUT_MS / 1000;
+    timeout.tv_usec = TEST_CLIENT_TIMEOUT_MS % 1000 * 1000;
+    setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(clientSocket, (struct sockaddr*)&address, sizeof(address)) < 0)
+    {
+        Disconnect();
+        return false;
+    }
+
+    connectionCount++;
+    return true;
+}
+
+void CTestClient::Disconnect()
+{
+    if (clientSocket >= 0)
+        close(clientSocket);
+
+    clientSocket = -1;
+    buffer.clear();
+}
+
+bool CTestClient::Receive()
+{
+    char receiveBuffer[64 * 1024];
+    size_t receiveSize = sizeof(receiveBuffer);
+    if (receiveRate > 0)
+    {
+        // Wait until the link would have delivered what was read before, and read at most a hundredth of a
+        // second's worth at once, so the rate is kept even for small responses
+        u64 now = GetTimeNs();
+        if (nextReceiveTime > now)
+            usleep((nextReceiveTime - now) / 1000);
+
+        receiveSize = std::clamp<size_t>(receiveRate / 100, 1, sizeof(receiveBuffer));
+    }
+
+    ssize_t bytesReceived = recv(clientSocket, receiveBuffer, receiveSize, 0);
+    if (bytesReceived <= 0)
+        return false;
+
+    if (receiveRate > 0)
+        nextReceiveTime = std::max(nextReceiveTime, GetTimeNs()) + bytesReceived * 1000000000ull / receiveRate;
+
+    buffer.append(receiveBuffer, bytesReceived);
+    return true;
+}
+
+bool CTestClient::ReadBody(u64 length, std::string* outBody)
+{
+    while (length > 0)
+    {
+        if (buffer.empty() && !Receive())
+            return false;
+
+        // Bodies which aren't kept are only counted, so downloads don't need any memory here
+        u64 available = std::min((u64)buffer.size(), length);
+        if (outBody)
+            outBody->append(buffer, 0, available);
+
+        buffer.erase(0, available);
+        bodySize += available;
+        length -= available;
+    }
+
+    return true;
+}
+
+bool CTestClient::ReadLine(std::string& outLine)
+{
+    size_t lineEnd;
+    while ((lineEnd = buffer.find("\r\n")) == std::string::npos)
+    {
+        if (!Receive())
+            return false;
+    }
+
+    outLine.assign(buffer, 0, lineEnd);
+    buffer.erase(0, lineEnd + 2);
+    return true;
+}
@@ -0,0 +1,226 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <vector>
+#include <atomic>
+#include "core/platform.hpp"
+#include "core/albumwrapper.hpp"
+#include "core/directoryalbumbackend.hpp"
+
+// How long (in milliseconds) a test client waits for the server before it gives up
+#define TEST_CLIENT_TIMEOUT_MS 10000
+
+// How long (in milliseconds) a benchmark measures each of its cases
+#define BENCH_DURATION_MS 1000
+
+// Checks a condition, and prints the message and marks the test as failed if it doesn't hold
+#define TEST_CHECK(condition, ...) nxgallery::tests::Check((condition), __FILE__, __LINE__, __VA_ARGS__)
+
+// What the host tests (*test.cpp, run with "make -f Makefile.host test") have in common. Each test is
+// an executable of its own, so it gets a fresh album wrapper and server
+namespace nxgallery::tests
+{
+    // Prints the message and marks the test as failed if the condition doesn't hold. Returns the condition
+    bool Check(bool condition, const char* file, int line, const char* format, ...);
+
+    // Prints whether the test passed, and returns what the test's main function should return
+    int GetTestResult(const char* testName);
+
+    // Returns a monotonic timestamp in nanoseconds
+    u64 GetTimeNs();
+
+    // Calls the function over and over for BENCH_DURATION_MS, and returns how many operations it did per
+    // second. The function returns how many operations one call did (such as requests parsed)
+    double MeasureRate(const std::function<u64()>& run);
+
+    // Keeps the compiler from optimizing away the work which led to the value
+    void KeepResult(u64 value);
+
+    // Returns how much memory (in bytes) the process has resident right now. Memory which was freed but is
+    // still held by the allocator is given back first, so only what's in use counts
+    u64 GetResidentMemory();
+
+    // An album directory laid out like the Switch's (see CDirectoryAlbumBackend), filled with files of
+    // made up content in a temporary directory, which is deleted again once this is destroyed
+    class CTestAlbum
+    {
+    public:
+        CTestAlbum();
+        ~CTestAlbum();
+
+        // Adds a file of the given size and kind taken in the given title, and returns its path. Every file
+        // is taken one second after the one added before, so the file added last has ID 0 in the gallery
+        std::string AddFile(CapsAlbumFileContents content, u64 titleId, u64 size);
+
+        // Returns the album directory of the SD card, which all files are added to
+        const std::string& GetSdAlbumDir();
+
+        // Returns the content a file of the given size added through AddFile has
+        static std::string GetFileContent(const std::string& path, u64 size);
+
+    private:
+        // The temporary directory and the album directory inside of it
+        std::string rootDir;
+        std::string sdAlbumDir;
+
+        // How many files were added so far
+        u32 fileCount = 0;
+    };
+
+    // Initializes the album wrapper on top of the test album. Every read through the backend (which
+    // stands in for capsa) is slowed down to the given bandwidth in bytes per second, 0 for unlimited.
+    // Returns the backend, which the album wrapper owns, to change how slow it is later on
+    core::CDirectoryAlbumBackend* InitAlbumWrapper(CTestAlbum& album, u64 bytesPerSecond);
+
+    // An album made up in memory, for albums too big to lay out on disk. Its entries are taken one minute
+    // after the other in titleCount games, taking turns. Every eighth entry is a video, and every third is
+    // stored on the NAND. Only listing the album and naming the games works, reading files fails. Naming
+    // a game can be made as slow as reading its control data is on the Switch
+    class CSyntheticAlbumBackend : public core::IAlbumBackend
+    {
+    public:
+        CSyntheticAlbumBackend(u32 entryCount, u32 titleCount);
+
+        // Returns the entries of both storages, oldest first
+        const std::vector<CapsAlbumEntry>& GetEntries();
+
+        // Returns the title ID of the game with the given index
+        static u64 GetTitleId(u32 titleIndex);
+
+        // Adds a delay (in microseconds) to every name asked for
+        void SetApplicationNameLatency(u64 inLatencyUs);
+
+        // Returns how many names were asked for so far
+        u32 GetApplicationNameCount();
+
+        // Sets the directory files are kept in across launches, none if empty
+        void SetCacheDir(const std::string& inCacheDir);
+
+        // IAlbumBackend
+        void Init() override {}
+        void Shutdown() override {}
+        Result GetAlbumFileList(CapsAlbumStorage storage, std::vector<CapsAlbumEntry>& outEntries) override;
+        Result GetAlbumFileCount(CapsAlbumStorage storage, u64* outCount) override;
+        Result GetAlbumFileSize(const CapsAlbumFileId& fileId, u64* outSize) override;
+        Result LoadAlbumFile(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize) override { return 1; }
+        Result LoadAlbumFileThumbnail(const CapsAlbumFileId& fileId, void* outBuffer, u64 bufferSize, u64* outSize) override { return 1; }
+        Result OpenMovieStream(const CapsAlbumFileId& fileId, u64* outStreamHandle) override { return 1; }
+        void CloseMovieStream(u64 streamHandle) override {}
+        Result GetMovieStreamSize(u64 streamHandle, u64* outSize) override { return 1; }
+        Result ReadMovieStream(u64 streamHandle, u64 offset, void* outBuffer, u64 bufferSize, u64* outSize) override { return 1; }
+        Result GetApplicationName(u64 titleId, std::string& outName) override;
+        Result GetIsDarkTheme(bool* outIsDarkTheme) override;
+        const char* GetAlbumDir(CapsAlbumStorage storage) override { return ""; }
+        const char* GetCacheDir() override { return cacheDir.c_str(); }
+
+    private:
+        // The entries of both storages, oldest first
+        std::vector<CapsAlbumEntry> entries;
+
+        // How long asking for a name takes, and how many were asked for
+        u64 nameLatencyUs = 0;
+        std::atomic<u32> nameCount { 0 };
+
+        // Where files are kept across launches, ending in a slash
+        std::string cacheDir;
+    };
+
+    // Returns a port on the loopback interface nothing listens on right now
+    int FindFreePort();
+
+    // A minimal HTTP/1.1 client over a blocking socket, which keeps its connection open between requests
+    // like a browser does. It connects again whenever the server closed the connection. It can read
+    // responses as slow as a link to the Switch would be, and ask for compressed ones
+    class CTestClient
+    {
+    public:
+        CTestClient(int inPort);
+        ~CTestClient();
+
+        // Sends a GET request for the target and reads the whole response. The body is stored in
+        // outBody if given, and only counted otherwise. Returns the status code, or -1 if the request failed
+        int Get(std::string_view target, std::string* outBody = nullptr);
+
+        // Returns the size of the body of the last response
+        u64 GetBodySize();
+
+        // Returns how many connections the client opened so far
+        u32 GetConnectionCount();
+
+        // Sets the Accept-Encoding header sent with every request, "identity" unless set
+        void SetAcceptEncoding(std::string_view encodings);
+
+        // Returns the Content-Encoding of the last response, empty if it had none
+        const std::string& GetContentEncoding();
+
+        // Slows down reading responses to the given rate in bytes per second, 0 for unlimited
+        void SetReceiveRate(u64 bytesPerSecond);
+
+    private:
+        // Connects to the server, returns whether it worked
+        bool Connect();
+
+        // Closes the connection
+        void Disconnect();
+
+        // Receives more data into the buffer, returns false if the connection is gone
+        bool Receive();
+
+        // Reads the given number of body bytes, returns false if the connection is gone
+        bool ReadBody(u64 length, std::string* outBody);
+
+        // Reads a CRLF terminated line, returns false if the connection is gone
+        bool ReadLine(std::string& outLine);
+
+    private:
+        // Where the server listens, and the connection to it
+        int port;
+        int clientSocket = -1;
+
+        // What was received but not read yet
+        std::string buffer;
+
+        // The size of the last body and how many connections were opened
+        u64 bodySize = 0;
+        u32 connectionCount = 0;
+
+        // What the client accepts, and how the last response was encoded
+        std::string acceptEncoding = "identity";
+        std::string contentEncoding;
+
+        // How fast responses are read, and when the next bytes may be read (see GetTimeNs)
+        u64 receiveRate = 0;
+        u64 nextReceiveTime = 0;
+    };
+}
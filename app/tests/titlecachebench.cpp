@@ -0,0 +1,124 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Measures launching with a made up album of many games: once with nothing stored yet, when the name of
+// every game has to be asked for (which reads its control data on the Switch), and once more with the
+// names stored by the first launch in titles.cache. For each launch it reports how long caching the
+// album took and how long the first gallery page and /games took after that. Every launch runs in a
+// process of its own, as the names would be remembered in memory otherwise
+
+#include "testutils.hpp"
+#include "core/albumwrapper.hpp"
+#include "core/titlecache.hpp"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <filesystem>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// The album, and how many games its entries are spread over
+#define TITLE_CACHE_BENCH_ENTRY_COUNT 10000
+#define TITLE_CACHE_BENCH_TITLE_COUNT 200
+
+// How long (in microseconds) asking for one name takes
+#define TITLE_CACHE_BENCH_NAME_LATENCY_US 2000
+
+// Returns the milliseconds since the given time
+static double GetElapsedMs(std::chrono::steady_clock::time_point startTime)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Launches on the album with names stored in the cache directory or not, and checks how many names were
+// asked for
+static void RunLaunch(const char* name, const std::string& cacheDir, u32 expectedNameCount)
+{
+    std::unique_ptr<CSyntheticAlbumBackend> backend = std::make_unique<CSyntheticAlbumBackend>(TITLE_CACHE_BENCH_ENTRY_COUNT, TITLE_CACHE_BENCH_TITLE_COUNT);
+    backend->SetApplicationNameLatency(TITLE_CACHE_BENCH_NAME_LATENCY_US);
+    backend->SetCacheDir(cacheDir);
+    CSyntheticAlbumBackend* backendPointer = backend.get();
+
+    auto startTime = std::chrono::steady_clock::now();
+    CAlbumWrapper::Get()->Init(std::move(backend));
+    double cacheTimeMs = GetElapsedMs(startTime);
+
+    startTime = std::chrono::steady_clock::now();
+    SGallerySelection selection;
+    CAlbumWrapper::Get()->SelectGalleryEntries("", "", "", "", selection);
+    std::shared_ptr<IContentSource> page = CAlbumWrapper::Get()->GetGalleryContent(selection, 0, CONTENT_PER_PAGE);
+    const char* data = nullptr;
+    u64 pageSize = page->Borrow(0, page->GetSize(), &data);
+    u64 gamesSize = CAlbumWrapper::Get()->GetGames()->body->size();
+    double pageTimeMs = GetElapsedMs(startTime);
+
+    u32 nameCount = backendPointer->GetApplicationNameCount();
+    TEST_CHECK(pageSize > 0 && gamesSize > 0, "%s: the first page or /games is empty", name);
+    TEST_CHECK(nameCount == expectedNameCount, "%s: %u names were asked for, not %u", name, nameCount, expectedNameCount);
+    printf("%-8s %14u %14.1f %16.2f\n", name, nameCount, cacheTimeMs, pageTimeMs);
+
+    CAlbumWrapper::Get()->Shutdown();
+}
+
+int main(int argc, char* argv[])
+{
+    char cacheDirTemplate[] = "/tmp/nxgallery-bench-XXXXXX";
+    if (!TEST_CHECK(mkdtemp(cacheDirTemplate) != nullptr, "failed to create the cache directory"))
+        return GetTestResult("titlecachebench");
+
+    std::string cacheDir = cacheDirTemplate;
+    printf("%u entries of %u games, %u us per name\n", TITLE_CACHE_BENCH_ENTRY_COUNT, TITLE_CACHE_BENCH_TITLE_COUNT, TITLE_CACHE_BENCH_NAME_LATENCY_US);
+    printf("%-8s %14s %14s %16s\n", "launch", "names asked", "cache ms", "first page ms");
+
+    // The first launch stores all names, the second one finds them in titles.cache
+    struct { const char* name; u32 expectedNameCount; } launches[] = {
+        { "cold", TITLE_CACHE_BENCH_TITLE_COUNT },
+        { "warm", 0 },
+    };
+
+    bool hasPassed = true;
+    for (const auto& launch : launches)
+    {
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            RunLaunch(launch.name, cacheDir, launch.expectedNameCount);
+            exit(GetTestResult("titlecachebench") == EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+        int status = 0;
+        hasPassed &= child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    }
+
+    hasPassed &= TEST_CHECK(std::filesystem::exists(cacheDir + "/" TITLE_CACHE_FILE_NAME), "%s wasn't stored", TITLE_CACHE_FILE_NAME);
+
+    std::error_code error;
+    std::filesystem::remove_all(cacheDir, error);
+    return hasPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
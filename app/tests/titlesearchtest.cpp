@@ -0,0 +1,128 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Searches made up game names for every piece of them, with one to four characters and in different
+// cases, and checks that the index finds the same games as checking every name does. Short queries are
+// looked up in the index as well, so they need to find the same games as long ones
+
+#include "testutils.hpp"
+#include "core/titlesearch.hpp"
+#include <algorithm>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// The longest query checked, one longer than a trigram so queries are narrowed down by several
+#define TITLE_SEARCH_TEST_QUERY_LENGTH (TITLE_SEARCH_GRAM_LENGTH + 1)
+
+static const char* titleNames[] = {
+    "Super Mario Odyssey",
+    "Mario Kart 8 Deluxe",
+    "The Legend of Zelda: Breath of the Wild",
+    "Animal Crossing: New Horizons",
+    "Splatoon 2",
+    "Xenoblade Chronicles 2",
+    "ARMS",
+    "A",
+    "Pokémon Sword",
+    "aaaa",
+};
+
+// Returns the IDs of the titles whose name contains the query, ignoring the case of ASCII letters
+static std::vector<u64> FindTitles(std::string_view query)
+{
+    auto lower = [](std::string_view text)
+    {
+        std::string lowerText(text);
+        for (char& c : lowerText)
+        {
+            if (c >= 'A' && c <= 'Z')
+                c = c - 'A' + 'a';
+        }
+        return lowerText;
+    };
+
+    std::vector<u64> titleIds;
+    for (size_t i = 0; i < std::size(titleNames); i++)
+    {
+        if (lower(titleNames[i]).find(lower(query)) != std::string::npos)
+            titleIds.push_back(CSyntheticAlbumBackend::GetTitleId(i));
+    }
+    return titleIds;
+}
+
+static void CheckQuery(const CTitleSearchIndex& search, const std::string& query)
+{
+    std::vector<u64> titleIds;
+    search.Search(query, titleIds);
+    std::vector<u64> expectedTitleIds = FindTitles(query);
+    TEST_CHECK(titleIds == expectedTitleIds, "searching \"%s\" found %zu games, not %zu", query.c_str(), titleIds.size(), expectedTitleIds.size());
+}
+
+int main(int argc, char* argv[])
+{
+    CTitleSearchIndex search;
+    for (size_t i = 0; i < std::size(titleNames); i++)
+    {
+        search.AddTitle(CSyntheticAlbumBackend::GetTitleId(i), titleNames[i]);
+    }
+
+    // Adding a title again keeps the name it was added with
+    search.AddTitle(CSyntheticAlbumBackend::GetTitleId(0), "Renamed");
+    TEST_CHECK(search.GetTitleCount() == std::size(titleNames), "%u titles were added, not %zu", search.GetTitleCount(), std::size(titleNames));
+    CheckQuery(search, "Renamed");
+
+    // Every piece of every name, as it is and in uppercase
+    for (const char* name : titleNames)
+    {
+        std::string_view nameView(name);
+        for (size_t length = 1; length <= TITLE_SEARCH_TEST_QUERY_LENGTH; length++)
+        {
+            for (size_t i = 0; i + length <= nameView.size(); i++)
+            {
+                std::string query(nameView.substr(i, length));
+                CheckQuery(search, query);
+
+                std::transform(query.begin(), query.end(), query.begin(), [](char c) { return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c; });
+                CheckQuery(search, query);
+            }
+        }
+    }
+
+    // Pieces which aren't in any name, also ones whose characters are all in the index
+    for (const char* query : { "q", "zz", "aaaaa", "oa", "marios", "\xc3" })
+    {
+        CheckQuery(search, query);
+    }
+
+    // An empty query finds nothing rather than everything
+    std::vector<u64> titleIds;
+    search.Search("", titleIds);
+    TEST_CHECK(titleIds.empty(), "searching nothing found %zu games", titleIds.size());
+
+    return GetTestResult("titlesearchtest");
+}
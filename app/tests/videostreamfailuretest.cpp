@@ -0,0 +1,111 @@
+/*
+    NXGallery for Nintendo Switch
+    Made with love by Jonathan Verbeek (jverbeek.de)
+
+    MIT License
+
+    Copyright (c) 2020-2022 Jonathan Verbeek
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+// Makes a movie stream read fail and checks that the video can be read again afterwards: the same
+// source reads the failed block again when it's borrowed the next time, and the stream isn't kept in
+// the pool for reuse, so later requests for the video get a fresh one
+
+#include "testutils.hpp"
+#include "core/videostreampool.hpp"
+#include <unistd.h>
+using namespace nxgallery::core;
+using namespace nxgallery::tests;
+
+// The video, which takes a few blocks
+#define FAILURE_VIDEO_SIZE (VIDEO_STREAM_BLOCK_SIZE * 3 + 1000)
+
+// How long to wait for a block to be read, in milliseconds
+#define FAILURE_READ_TIMEOUT_MS 5000
+
+// Borrows from the source until the block is read, returns what Borrow returned in the end
+static u64 BorrowRead(IContentSource& source, u64 offset, const char** outData)
+{
+    u64 startTime = GetTimeNs();
+    u64 borrowed;
+    while ((borrowed = source.Borrow(offset, FAILURE_VIDEO_SIZE, outData)) == HTTP_BORROW_PENDING && GetTimeNs() - startTime < FAILURE_READ_TIMEOUT_MS * 1000000ull)
+        usleep(1000);
+
+    return borrowed;
+}
+
+// Reads the whole source, returns whether it has the expected content
+static bool ReadWhole(IContentSource& source, const std::string& expectedContent)
+{
+    std::string content;
+    while (content.size() < expectedContent.size())
+    {
+        const char* data = nullptr;
+        u64 borrowed = BorrowRead(source, content.size(), &data);
+        if (borrowed == 0 || borrowed == HTTP_BORROW_PENDING)
+            return false;
+
+        content.append(data, borrowed);
+    }
+
+    return content == expectedContent;
+}
+
+int main(int argc, char* argv[])
+{
+    CTestAlbum album;
+    std::string path = album.AddFile(CapsAlbumFileContents_Movie, 0x0100000000010000, FAILURE_VIDEO_SIZE);
+    std::string expectedContent = CTestAlbum::GetFileContent(path, FAILURE_VIDEO_SIZE);
+
+    CDirectoryAlbumBackend* backend = InitAlbumWrapper(album, 0);
+    CAlbumWrapper::Get()->SetContentBackend(EContentBackend::Capsa);
+
+    // The first block is read right when the stream is opened, and fails
+    backend->FailMovieStreamReads(1);
+    std::shared_ptr<IContentSource> source = CAlbumWrapper::Get()->GetFileContent(0);
+    if (!TEST_CHECK(source != nullptr, "the video couldn't be opened"))
+        return GetTestResult("videostreamfailuretest");
+
+    const char* data = nullptr;
+    TEST_CHECK(BorrowRead(*source, 0, &data) == 0, "the failed block could be borrowed");
+
+    // The next borrow reads it again, so a client retrying gets the video
+    TEST_CHECK(ReadWhole(*source, expectedContent), "the video couldn't be read after a failed block");
+
+    // The stream which failed isn't pooled
+    SVideoStreamPoolStats statsBefore = CVideoStreamPool::Get()->GetStats();
+    source.reset();
+    SVideoStreamPoolStats stats = CVideoStreamPool::Get()->GetStats();
+    TEST_CHECK(stats.idleStreams == 0 && stats.evictions == statsBefore.evictions + 1, "the failed stream was kept for reuse (%u idle, %lu evicted)",
+        stats.idleStreams, stats.evictions - statsBefore.evictions);
+
+    // So the next request opens a new one, which is pooled once it's done
+    source = CAlbumWrapper::Get()->GetFileContent(0);
+    TEST_CHECK(source && ReadWhole(*source, expectedContent), "the video couldn't be read with a new stream");
+    TEST_CHECK(CVideoStreamPool::Get()->GetStats().misses == statsBefore.misses + 1, "no new stream was opened after the failed one");
+
+    source.reset();
+    TEST_CHECK(CVideoStreamPool::Get()->GetStats().idleStreams == 1, "the healthy stream wasn't kept for reuse");
+
+    CAlbumWrapper::Get()->Shutdown();
+    return GetTestResult("videostreamfailuretest");
+}
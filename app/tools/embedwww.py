@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+#    NXGallery for Nintendo Switch
+#    Made with love by Jonathan Verbeek (jverbeek.de)
+
+#    Turns the static web assets (app/romfs/www) into a C++ source file, so the web server
+#    can serve them straight from memory without touching the filesystem.
+#    Lookups go through a perfect hash, see CEmbeddedAssets in source/core/assets.hpp.
+#
+#    Usage: embedwww.py <www directory> <output .cpp file>
+
+import gzip
+import hashlib
+import os
+import sys
+
+# Brotli is optional, without it only gzip variants are generated
+try:
+    import brotli
+except ImportError:
+    brotli = None
+
+# Content types by file extension, everything else is served as application/octet-stream
+MIME_TYPES = {
+    ".html": "text/html; charset=utf-8",
+    ".js": "application/javascript; charset=utf-8",
+    ".css": "text/css; charset=utf-8",
+    ".json": "application/json",
+    ".map": "application/json",
+    ".txt": "text/plain; charset=utf-8",
+    ".png": "image/png",
+    ".jpg": "image/jpeg",
+    ".jpeg": "image/jpeg",
+    ".gif": "image/gif",
+    ".svg": "image/svg+xml",
+    ".ico": "image/x-icon",
+    ".woff": "font/woff",
+    ".woff2": "font/woff2",
+    ".ttf": "font/ttf",
+}
+
+# Files which are in the www folder but aren't part of the web page
+IGNORED_FILES = {"REACT_BUILD_GOES_HERE"}
+
+# Extensions of files which are compressed already, so there's no point in precompressing them
+PRECOMPRESSED_EXTENSIONS = {".png", ".jpg", ".jpeg", ".gif", ".woff", ".woff2"}
+
+# A compressed variant is only kept if it's at most this big compared to the original
+MIN_COMPRESSION_RATIO = 0.9
+
+
+def hash_path(path, seed):
+    # Needs to match HashAssetPath in source/core/assets.hpp (FNV-1a with a seeded offset basis)
+    h = (2166136261 ^ seed) & 0xFFFFFFFF
+    for byte in path.encode("utf-8"):
+        h ^= byte
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def find_perfect_hash(paths):
+    # Use a table with at least twice as many slots as assets, then try seeds until no two paths collide
+    table_size = 1
+    while table_size < len(paths) * 2:
+        table_size *= 2
+
+    for seed in range(1 << 20):
+        slots = [-1] * table_size
+        for index, path in enumerate(paths):
+            slot = hash_path(path, seed) & (table_size - 1)
+            if slots[slot] != -1:
+                break
+            slots[slot] = index
+        else:
+            return seed, slots
+
+    raise RuntimeError("No perfect hash found for %d assets" % len(paths))
+
+
+def collect_assets(www_dir):
+    assets = []
+    for root, dirs, files in os.walk(www_dir):
+        dirs.sort()
+        for name in sorted(files):
+            if name in IGNORED_FILES:
+                continue
+            full_path = os.path.join(root, name)
+            url_path = "/" + os.path.relpath(full_path, www_dir).replace(os.sep, "/")
+            with open(full_path, "rb") as f:
+                assets.append((url_path, f.read()))
+    return assets
+
+
+def compress_variants(path, data):
+    # Returns the compressed variants worth keeping as a dict of encoding -> bytes
+    variants = {}
+    if os.path.splitext(path)[1].lower() in PRECOMPRESSED_EXTENSIONS:
+        return variants
+
+    # mtime=0 keeps the output the same between builds
+    variants["gzip"] = gzip.compress(data, compresslevel=9, mtime=0)
+    if brotli is not None:
+        variants["br"] = brotli.compress(data, quality=11)
+
+    return {encoding: compressed for encoding, compressed in variants.items() if len(compressed) <= len(data) * MIN_COMPRESSION_RATIO}
+
+
+def format_variant(name, data, etag):
+    if data is None:
+        return "{ nullptr, 0, nullptr }"
+    return "{ %s, %d, \"\\\"%s\\\"\" }" % (name, len(data), etag)
+
+
+def format_bytes(data):
+    lines = []
+    for i in range(0, len(data), 24):
+        lines.append("    " + ",".join("0x%02x" % b for b in data[i:i + 24]) + ",")
+    return "\n".join(lines)
+
+
+def generate(www_dir, out_file):
+    assets = collect_assets(www_dir)
+    paths = [path for path, _ in assets]
+    seed, slots = find_perfect_hash(paths) if assets else (0, [-1])
+
+    out = []
+    out.append("// Generated by tools/embedwww.py from %s, do not edit" % www_dir)
+    out.append("#include \"core/assets.hpp\"")
+    out.append("using namespace nxgallery::core;")
+    out.append("")
+
+    entries = []
+    for index, (path, data) in enumerate(assets):
+        variants = compress_variants(path, data)
+        entries.append(variants)
+
+        out.append("// %s" % path)
+        out.append("static const unsigned char assetData%d[] = {" % index)
+        out.append(format_bytes(data) if data else "    0")
+        out.append("};")
+        for encoding, compressed in variants.items():
+            out.append("static const unsigned char assetData%d_%s[] = {" % (index, encoding))
+            out.append(format_bytes(compressed))
+            out.append("};")
+        out.append("")
+
+    out.append("static constexpr SEmbeddedAsset assets[] = {")
+    for index, (path, data) in enumerate(assets):
+        extension = os.path.splitext(path)[1].lower()
+        mime_type = MIME_TYPES.get(extension, "application/octet-stream")
+        etag = hashlib.sha1(data).hexdigest()[:16]
+        variants = entries[index]
+
+        # Every variant gets its own ETag, as caches must not mix them up
+        identity = format_variant("assetData%d" % index, data, etag)
+        gzip_variant = format_variant("assetData%d_gzip" % index, variants.get("gzip"), etag + "-gz")
+        brotli_variant = format_variant("assetData%d_br" % index, variants.get("br"), etag + "-br")
+        out.append("    { \"%s\", \"%s\", %s, %s, %s }," % (path, mime_type, identity, gzip_variant, brotli_variant))
+    if not assets:
+        out.append("    { \"\", \"\", { nullptr, 0, nullptr }, { nullptr, 0, nullptr }, { nullptr, 0, nullptr } },")
+    out.append("};")
+    out.append("")
+
+    out.append("static constexpr u32 assetHashSeed = %d;" % seed)
+    out.append("static constexpr s16 assetSlots[%d] = { %s };" % (len(slots), ", ".join(str(s) for s in slots)))
+    out.append("")
+
+    # Let the compiler double-check that HashAssetPath agrees with hash_path for every asset
+    out.append("static constexpr u32 assetSlotMask = sizeof(assetSlots) / sizeof(assetSlots[0]) - 1;")
+    for index, path in enumerate(paths):
+        out.append("static_assert(assetSlots[HashAssetPath(\"%s\", assetHashSeed) & assetSlotMask] == %d, \"Asset hash mismatch\");" % (path, index))
+    out.append("")
+    out.append("const SEmbeddedAsset* CEmbeddedAssets::Find(std::string_view path)")
+    out.append("{")
+    out.append("    s16 index = assetSlots[HashAssetPath(path, assetHashSeed) & assetSlotMask];")
+    out.append("    if (index < 0 || assets[index].path != path)")
+    out.append("        return nullptr;")
+    out.append("")
+    out.append("    return &assets[index];")
+    out.append("}")
+    out.append("")
+    out.append("u32 CEmbeddedAssets::GetCount()")
+    out.append("{")
+    out.append("    return %d;" % len(assets))
+    out.append("}")
+    out.append("")
+
+    with open(out_file, "w") as f:
+        f.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("Usage: %s <www directory> <output .cpp file>" % sys.argv[0])
+        sys.exit(1)
+
+    generate(sys.argv[1], sys.argv[2])
@@ -120,8 +120,8 @@ class GalleryItem extends React.Component {
         // Decide whether to show a video or an image element
         let viewElement;
         let viewElementBig;
-        const previewURL = getBackendURL() + "/thumbnail?id=" + this.state.item.id;
-        const fullURL = getBackendURL() + "/file?id=" + this.state.item.id;
+        const previewURL = getBackendURL() + "/thumbnail?key=" + this.state.item.key;
+        const fullURL = getBackendURL() + "/file?key=" + this.state.item.key;
         if (this.state.isVideo) {
             viewElement = <video src={fullURL} controls preload={"none"} poster={previewURL}></video>
             viewElementBig = <video src={fullURL} controls preload={"none"} className={"gallery-content-big"} poster={previewURL}></video>;